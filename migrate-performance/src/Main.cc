@@ -1,106 +1,136 @@
-#include "Buffer.h"
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * \file
+ * Measures how fast a tablet migrates between two masters.
+ *
+ * The benchmark fills a fresh table (which the coordinator places on a
+ * single master) with objects, migrates it to another master with a single
+ * MIGRATE_TABLET, and reports the transfer rate along with the average
+ * time each migration segment spent in flight, as seen by the source
+ * master's metrics.
+ */
+
+#include <boost/program_options.hpp>
+#include <iostream>
+
 #include "Common.h"
-#include "RamCloud.h"
-#include "KeyUtil.h"
 #include "Context.h"
+#include "Cycles.h"
 #include "MasterClient.h"
-#include "BindTransport.h"
-#include "Transport.h"
-#include "RejectRules.h"
-#include "Timer.h"
-#include "ObjectFinder.h"
-
-#include <sys/time.h>
-#include <unistd.h>
-#include <cassert>
-#include <cmath>
-#include <cstdarg>
-#include <cstdio>
-#include <stdint.h>
-#include <string>
-#include <iostream>
-
-#if 1
-#define debug(...) fprintf(stderr, __VA_ARGS__)
-#else
-#define debug(...) {}
-#endif
+#include "RamCloud.h"
+#include "ServerMetrics.h"
+#include "ShortMacros.h"
 
 using namespace RAMCloud;
-using namespace std;
-const char * kTableName = "test10";
-size_t kNumValues = 100;
-Timer myTimer;
-static int intLength(int integer){
-	int end = 0;
-	while(integer > 0) {
-		integer = integer/10;
-		end++;
-	}
-	return end;
-}
-
-static char* itoa (int value){
-
-	int length = intLength(value);
-	char* key = new char[length];
-	sprintf(key,"%d",value);
-
-	return key;
+namespace po = boost::program_options;
+
+int
+main(int argc, char* argv[])
+try
+{
+    Context context(true);
+    Context::Guard _(context);
+
+    string coordinatorLocator;
+    string tableName;
+    uint32_t numObjects;
+    uint32_t objectSize;
+    uint64_t newOwner;
+    uint64_t bytesPerSecond;
+    po::options_description desc(
+            "Usage: migrate-performance [options]\n\n"
+            "Fills a table and migrates it to another master, reporting\n"
+            "the transfer rate and per-segment latency.\n\n"
+            "Allowed options:");
+    desc.add_options()
+        ("coordinator,C", po::value<string>(&coordinatorLocator),
+                "Service locator for the cluster coordinator (required)")
+        ("table,t",
+                po::value<string>(&tableName)->default_value("migrate"),
+                "Name of the table to create and migrate")
+        ("objects,n",
+                po::value<uint32_t>(&numObjects)->default_value(100000),
+                "Number of objects to write before migrating")
+        ("size,s", po::value<uint32_t>(&objectSize)->default_value(1000),
+                "Size of each object in bytes")
+        ("to", po::value<uint64_t>(&newOwner),
+                "ServerId of the master to migrate the table to (required)")
+        ("rate", po::value<uint64_t>(&bytesPerSecond)->default_value(0),
+                "Limit on the migration's transfer rate in bytes per second "
+                "(0 for the source master's default)")
+        ("help,h", "Print this help message");
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+        std::cout << desc << '\n';
+        return 0;
+    }
+    if (coordinatorLocator.empty() || !vm.count("to")) {
+        std::cerr << "missing required option --coordinator or --to\n";
+        return 1;
+    }
+
+    RamCloud cluster(context, coordinatorLocator.c_str());
+    cluster.createTable(tableName.c_str());
+    uint64_t table = cluster.getTableId(tableName.c_str());
+
+    string value(objectSize, 'x');
+    for (uint32_t i = 0; i < numObjects; i++) {
+        string key = format("%u", i);
+        cluster.write(table, key.c_str(), downCast<uint16_t>(key.length()),
+                      value.data(), objectSize);
+    }
+    std::cout << format("Wrote %u objects of %u bytes\n",
+                        numObjects, objectSize);
+
+    // After the migration the table is found on the new owner, so talk to
+    // the source master by its locator from here on.
+    Transport::SessionRef session = cluster.objectFinder.lookup(table, "0", 1);
+    string sourceLocator = session->getServiceLocator();
+    ServerMetrics before = cluster.getMetrics(sourceLocator.c_str());
+
+    MasterClient source(session);
+    uint64_t start = Cycles::rdtsc();
+    source.migrateTablet(table, 0, ~0UL, ServerId(newOwner), bytesPerSecond);
+    double seconds = Cycles::toSeconds(Cycles::rdtsc() - start);
+
+    ServerMetrics after = cluster.getMetrics(sourceLocator.c_str());
+    ServerMetrics delta = after.difference(before);
+    uint64_t bytes = delta["master.migrationByteCount"];
+    uint64_t segments = delta["master.migrationSegmentCount"];
+    double segmentSeconds =
+        static_cast<double>(delta["master.migrationSegmentTicks"]) /
+        static_cast<double>(after["clockFrequency"]);
+
+    std::cout << format("Migrated %lu bytes in %lu segments from %s in "
+                        "%.3f s: %.3f GB/s\n",
+                        bytes, segments, sourceLocator.c_str(), seconds,
+                        static_cast<double>(bytes) / seconds / 1e09);
+    if (segments > 0) {
+        std::cout << format("Average segment latency: %.1f us\n",
+                            segmentSeconds / static_cast<double>(segments) *
+                            1e06);
+    }
+    return 0;
+} catch (ClientException& e) {
+    fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+    return 1;
+} catch (Exception& e) {
+    fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+    return 1;
 }
-
-
-int main(int argc, char const *argv[]) {
-	const char* coordinatorLocator = "infrc:host=rc30,port=12246";
-
-	RamCloud cloud(coordinatorLocator);
-	debug("[+] Connected\n");
-	cloud.createTable("tt");
-	int tableId = cloud.getTableId("tt");
-//	cloud.write(tableId, "key", 3, "value");
-	cloud.write(tableId, "key", 3, "value");
-	cloud.write(tableId, "key1", 4, "value1");
-	cloud.write(tableId, "key1", 4, "value1");
-
-	//
-	//		for (int i = 0; i < 60; i++){
-	//			string tableId = itoa(i);
-	//			cloud.createTable(tableId.c_str());
-	//			cout<< "[+] Created table " << i << endl;
-	//			cloud.getTableId(tableId.c_str());
-	//			cout << "[+] Opened table id " << tableId << endl;
-	//
-	//			uint64_t version;
-	//			for (unsigned int i = 0; i < 1000; i++) {
-	//				std::ostringstream str;
-	//				str << i;
-	//				std::string key(str.str());
-	//				cloud.write(0, key.c_str(), key.size(), "itemX", 5, NULL, &version);
-	//			}
-	//			printf("writing testdata done\n");
-	//		}
-
-
-	Context context(true);
-	Context::Guard _(context);
-
-	RamCloud client(context, coordinatorLocator);
-	std::set<Transport::SessionRef> sessions;
-	sessions = client.objectFinder.tableLookup(tableId);
-
-	//	Transport::SessionRef session = client.objectFinder.lookup(
-	//			downCast<uint32_t>(tableId), "0", 4);
-	std::set<Transport::SessionRef>::iterator it;
-	Transport::SessionRef session;
-	for (it=sessions.begin(); it != sessions.end(); it++){
-		session = *it;
-	}
-	MasterClient masterClient(session);
-	debug("[+] Migrating data...");
-
-	masterClient.migrateTablet(tableId, 0, ~0UL, RAMCloud::ServerId(2));
-	debug("done\n");
-
-	return 0;
-}
-
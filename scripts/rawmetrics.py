@@ -171,9 +171,9 @@ master.metric('recoveryTicks', 'the elapsed time during recoveries')
 master.metric('replicaManagerTicks', 'time spent in ReplicaManager')
 master.metric('segmentAppendTicks', 'time spent in Segment::append')
 master.metric('segmentAppendCopyTicks',
-    'time spent copying in Segment::append')
+    'time spent copying and checksumming entries in Segment::append')
 master.metric('segmentAppendChecksumTicks',
-    'time spent checksumming in Segment::append')
+    'time spent finishing entry checksums in Segment::append')
 master.metric('segmentReadCount',
     'number of BackupClient::getRecoveryData calls issued')
 master.metric('segmentReadTicks',
@@ -236,6 +236,12 @@ master.metric('openReplicaRecoveries',
     'of replicaRecoveries how many were for replicas which were open')
 master.metric('replicationTasks',
     'number of outstanding tasks in ReplicaManager')
+master.metric('migrationSegmentCount',
+    'number of segments sent to other masters during tablet migrations')
+master.metric('migrationByteCount',
+    'bytes in segments sent during tablet migrations')
+master.metric('migrationSegmentTicks',
+    'sum over migration segments of the time each one was in flight')
 
 backup = Group('Backup', 'metrics for backups')
 backup.metric('recoveryCount',
@@ -316,6 +322,10 @@ rpc.metric('receiveMigrationDataCount', 'number of invocations of RECEIVE_MIGRAT
 rpc.metric('reassignTabletOwnershipCount', 'number of invocations of REASSIGN_TABLET_OWNERSHIP RPC')
 rpc.metric('migrateTabletCount', 'number of invocations of MIGRATE_TABLET RPC')
 rpc.metric('isReplicaNeededCount', 'number of invocations of IS_REPLICA_NEEDED_RPC')
+rpc.metric('splitTabletByIdCount', 'number of invocations of SPLIT_TABLET_BY_ID RPC')
+rpc.metric('splitTabletAtMedianCount', 'number of invocations of SPLIT_TABLET_AT_MEDIAN RPC')
+rpc.metric('multiWriteCount', 'number of invocations of MULTI_WRITE RPC')
+rpc.metric('multiRemoveCount', 'number of invocations of MULTI_REMOVE RPC')
 rpc.metric('illegalRpcCount', 'number of invocations of RPCs with illegal opcodes')
 
 rpc.metric('rpc0Ticks', 'time spent executing RPC 0 (undefined)')
@@ -370,6 +380,10 @@ rpc.metric('receiveMigrationDataTicks', 'time spent executing RECEIVE_MIGRATION_
 rpc.metric('reassignTabletOwnershipTicks', 'time spent executing REASSIGN_TABLET_OWNERSHIP RPC')
 rpc.metric('migrateTabletTicks', 'time spent executing MIGRATE_TABLET RPC')
 rpc.metric('isReplicaNeededTicks', 'time spent executing IS_REPLICA_NEEDED_RPC')
+rpc.metric('splitTabletByIdTicks', 'time spent executing SPLIT_TABLET_BY_ID RPC')
+rpc.metric('splitTabletAtMedianTicks', 'time spent executing SPLIT_TABLET_AT_MEDIAN RPC')
+rpc.metric('multiWriteTicks', 'time spent executing MULTI_WRITE RPC')
+rpc.metric('multiRemoveTicks', 'time spent executing MULTI_REMOVE RPC')
 rpc.metric('illegalRpcTicks', 'time spent executing RPCs with illegal opcodes')
 
 transmit = Group('Transmit', 'metrics related to transmitting messages')
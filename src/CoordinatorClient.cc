@@ -121,6 +121,72 @@ CoordinatorClient::splitTablet(const char* name, uint64_t startKeyHash,
     checkStatus(HERE);
 }
 
+/**
+ * Split a tablet identified by its table id rather than its table name.
+ * This is used by code running alongside the coordinator (for example the
+ * TabletBalancer), which only ever sees table ids in the tablet map.
+ *
+ * \param tableId
+ *      Id of the table that contains the tablet to be split.
+ * \param startKeyHash
+ *      First key hash of the tablet to be split.
+ * \param endKeyHash
+ *      Last key hash of the tablet to be split.
+ * \param splitKeyHash
+ *      The first key hash of the second tablet after the split.
+ *
+ * \exception TabletDoesntExistException
+ * \exception RequestFormatError
+ */
+void
+CoordinatorClient::splitTabletById(uint64_t tableId, uint64_t startKeyHash,
+                                   uint64_t endKeyHash, uint64_t splitKeyHash)
+{
+    Buffer req, resp;
+    SplitTabletByIdRpc::Request& reqHdr(allocHeader<SplitTabletByIdRpc>(req));
+    reqHdr.tableId = tableId;
+    reqHdr.startKeyHash = startKeyHash;
+    reqHdr.endKeyHash = endKeyHash;
+    reqHdr.splitKeyHash = splitKeyHash;
+    sendRecv<SplitTabletByIdRpc>(session, req, resp);
+    checkStatus(HERE);
+}
+
+/**
+ * Split a tablet in two halves that carry about the same load, as measured
+ * by the access histogram of the master that owns it. With skewed key
+ * popularity this point can be far from the middle of the key hash range.
+ *
+ * \param tableId
+ *      Id of the table that contains the tablet to be split.
+ * \param startKeyHash
+ *      First key hash of the tablet to be split.
+ * \param endKeyHash
+ *      Last key hash of the tablet to be split.
+ * \return
+ *      The first key hash of the second tablet after the split.
+ *
+ * \exception TabletDoesntExistException
+ * \exception RequestFormatError
+ *      The tablet is too small to be split.
+ */
+uint64_t
+CoordinatorClient::splitTabletAtMedian(uint64_t tableId,
+                                       uint64_t startKeyHash,
+                                       uint64_t endKeyHash)
+{
+    Buffer req, resp;
+    SplitTabletAtMedianRpc::Request& reqHdr(
+        allocHeader<SplitTabletAtMedianRpc>(req));
+    reqHdr.tableId = tableId;
+    reqHdr.startKeyHash = startKeyHash;
+    reqHdr.endKeyHash = endKeyHash;
+    const SplitTabletAtMedianRpc::Response& respHdr(
+        sendRecv<SplitTabletAtMedianRpc>(session, req, resp));
+    checkStatus(HERE);
+    return respHdr.splitKeyHash;
+}
+
 /**
  * Look up a table by name and return a small integer handle that
  * can be used to access the table.
@@ -43,6 +43,10 @@ class CoordinatorClient : public Client {
     void dropTable(const char* name);
     void splitTablet(const char* name, uint64_t startKeyHash,
                 uint64_t endKeyHash, uint64_t splitKeyHash);
+    void splitTabletById(uint64_t tableId, uint64_t startKeyHash,
+                uint64_t endKeyHash, uint64_t splitKeyHash);
+    uint64_t splitTabletAtMedian(uint64_t tableId, uint64_t startKeyHash,
+                uint64_t endKeyHash);
     uint64_t getTableId(const char* name);
 
     ServerId enlistServer(ServerId replacesId,
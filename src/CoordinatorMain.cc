@@ -20,6 +20,7 @@
 #include "PingService.h"
 #include "ServerId.h"
 #include "ServiceManager.h"
+#include "TabletBalancer.h"
 #include "TransportManager.h"
 
 /**
@@ -35,8 +36,40 @@ main(int argc, char *argv[])
     Context context(true);
     Context::Guard _(context);
     try {
-        OptionParser optionParser(OptionsDescription("Coordinator"),
-                                  argc, argv);
+        TabletBalancer::Config balancerConfig;
+        bool balanceTablets;
+
+        OptionsDescription coordinatorOptions("Coordinator");
+        coordinatorOptions.add_options()
+            ("balanceTablets",
+             ProgramOptions::bool_switch(&balanceTablets),
+             "Periodically move and split tablets so that no master carries "
+             "much more than its share of the cluster's load")
+            ("balanceInterval",
+             ProgramOptions::value<uint32_t>(&balancerConfig.pollIntervalMs)->
+                default_value(1000),
+             "Milliseconds between tablet balancing rounds")
+            ("balanceThreshold",
+             ProgramOptions::value<double>(&balancerConfig.threshold)->
+                default_value(1.25),
+             "A master is rebalanced once its load exceeds this multiple of "
+             "the mean load of all masters")
+            ("maxConcurrentMigrations",
+             ProgramOptions::value<uint32_t>(
+                &balancerConfig.maxConcurrentMigrations)->default_value(2),
+             "Maximum number of tablet migrations the balancer runs at once")
+            ("balanceRateWindow",
+             ProgramOptions::value<uint32_t>(&balancerConfig.rateWindowMs)->
+                default_value(10000),
+             "Which averaging window of the masters' access rates to balance "
+             "on, in milliseconds (1000, 10000 or 60000)")
+            ("migrationBytesPerSecond",
+             ProgramOptions::value<uint64_t>(
+                &balancerConfig.migrationBytesPerSecond)->default_value(0),
+             "Limit on the rate at which each migration the balancer starts "
+             "sends data; 0 means the masters' own default");
+
+        OptionParser optionParser(coordinatorOptions, argc, argv);
 
         // Log all the command-line arguments.
         string args;
@@ -60,6 +93,9 @@ main(int argc, char *argv[])
                                                 COORDINATOR_SERVICE);
         PingService pingService;
         Context::get().serviceManager->addService(pingService, PING_SERVICE);
+        TabletBalancer balancer(localLocator, balancerConfig);
+        if (balanceTablets)
+            balancer.start();
         Dispatch& dispatch = *Context::get().dispatch;
         while (true) {
             dispatch.poll();
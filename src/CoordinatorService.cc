@@ -24,6 +24,7 @@
 #include "Recovery.h"
 #include "ShortMacros.h"
 #include "ServiceMask.h"
+#include "TabletStatistics.h"
 
 namespace RAMCloud {
 
@@ -113,6 +114,14 @@ CoordinatorService::dispatch(RpcOpcode opcode,
             callHandler<SplitTabletRpc, CoordinatorService,
                         &CoordinatorService::splitTablet>(rpc);
             break;
+        case SplitTabletByIdRpc::opcode:
+            callHandler<SplitTabletByIdRpc, CoordinatorService,
+                        &CoordinatorService::splitTabletById>(rpc);
+            break;
+        case SplitTabletAtMedianRpc::opcode:
+            callHandler<SplitTabletAtMedianRpc, CoordinatorService,
+                        &CoordinatorService::splitTabletAtMedian>(rpc);
+            break;
         default:
             throw UnimplementedRequestError(HERE);
     }
@@ -265,10 +274,6 @@ CoordinatorService::splitTablet(const SplitTabletRpc::Request& reqHdr,
          return;
     }
 
-    // Check that the tablet with the described key ranges exists.
-    // If the tablet exists, adjust its endKeyHash so it becomes the tablet
-    // for the first part after the split and also copy the tablet and use
-    // the copy for the second part after the split.
     const char* name = getString(rpc.requestPayload, sizeof(reqHdr),
                                  reqHdr.nameLength);
     Tables::iterator it(tables.find(name));
@@ -276,8 +281,117 @@ CoordinatorService::splitTablet(const SplitTabletRpc::Request& reqHdr,
         respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
         return;
     }
-    uint64_t tableId = it->second;
 
+    respHdr.common.status = splitTablet(it->second, reqHdr.startKeyHash,
+                                        reqHdr.endKeyHash,
+                                        reqHdr.splitKeyHash);
+}
+
+/**
+ * Top-level server method to handle the SPLIT_TABLET_BY_ID request.
+ *
+ * This is the same as SPLIT_TABLET except that the table is identified by
+ * its id. It is used by the TabletBalancer, which only knows about the
+ * tablet map.
+ *
+ * \copydetails Service::ping
+ */
+void
+CoordinatorService::splitTabletById(const SplitTabletByIdRpc::Request& reqHdr,
+                                    SplitTabletByIdRpc::Response& respHdr,
+                                    Rpc& rpc)
+{
+    respHdr.common.status = splitTablet(reqHdr.tableId, reqHdr.startKeyHash,
+                                        reqHdr.endKeyHash,
+                                        reqHdr.splitKeyHash);
+}
+
+/**
+ * Top-level server method to handle the SPLIT_TABLET_AT_MEDIAN request.
+ *
+ * Asks the master owning the tablet for its access histogram and splits the
+ * tablet where half of the recent accesses fall on either side. If the
+ * master hasn't seen any accesses to the tablet, it is split in the middle
+ * of its key hash range instead.
+ *
+ * \copydetails Service::ping
+ */
+void
+CoordinatorService::splitTabletAtMedian(
+    const SplitTabletAtMedianRpc::Request& reqHdr,
+    SplitTabletAtMedianRpc::Response& respHdr,
+    Rpc& rpc)
+{
+    const ProtoBuf::Tablets::Tablet* tablet = NULL;
+    foreach (const ProtoBuf::Tablets::Tablet& i, tabletMap.tablet()) {
+        if (i.table_id() == reqHdr.tableId &&
+            i.start_key_hash() == reqHdr.startKeyHash &&
+            i.end_key_hash() == reqHdr.endKeyHash) {
+            tablet = &i;
+            break;
+        }
+    }
+    if (tablet == NULL) {
+        respHdr.common.status = STATUS_TABLET_DOESNT_EXIST;
+        return;
+    }
+
+    ProtoBuf::ServerStatistics serverStats;
+    MasterClient master(serverList.getSession(ServerId(tablet->server_id())));
+    master.getServerStatistics(serverStats);
+
+    uint64_t splitKeyHash = 0;
+    foreach (const ProtoBuf::ServerStatistics::TabletEntry& entry,
+             serverStats.tabletentry()) {
+        if (entry.table_id() == reqHdr.tableId &&
+            entry.start_key_hash() == reqHdr.startKeyHash &&
+            entry.end_key_hash() == reqHdr.endKeyHash) {
+            splitKeyHash = TabletStatistics::findLoadMedian(entry);
+            break;
+        }
+    }
+    if (splitKeyHash == 0) {
+        LOG(NOTICE, "No load recorded for tablet (id %lu, range [%lu,%lu]); "
+            "splitting it in the middle", reqHdr.tableId,
+            reqHdr.startKeyHash, reqHdr.endKeyHash);
+        splitKeyHash = reqHdr.startKeyHash +
+                       (reqHdr.endKeyHash - reqHdr.startKeyHash) / 2 + 1;
+    }
+
+    respHdr.common.status = splitTablet(reqHdr.tableId, reqHdr.startKeyHash,
+                                        reqHdr.endKeyHash, splitKeyHash);
+    respHdr.splitKeyHash = splitKeyHash;
+}
+
+/**
+ * Split one of the tablets in #tabletMap in two and tell its master to do
+ * the same. Shared by the SPLIT_TABLET and SPLIT_TABLET_BY_ID handlers.
+ *
+ * \param tableId
+ *      Id of the table that contains the tablet to be split.
+ * \param startKeyHash
+ *      First key hash of the tablet to be split.
+ * \param endKeyHash
+ *      Last key hash of the tablet to be split.
+ * \param splitKeyHash
+ *      First key hash of the second tablet after the split.
+ * \return
+ *      STATUS_OK if the tablet was split, STATUS_REQUEST_FORMAT_ERROR if
+ *      the key hashes don't describe a valid split, or
+ *      STATUS_TABLET_DOESNT_EXIST if there is no such tablet.
+ */
+Status
+CoordinatorService::splitTablet(uint64_t tableId, uint64_t startKeyHash,
+                                uint64_t endKeyHash, uint64_t splitKeyHash)
+{
+    // Sanity check on provided key ranges
+    if (!(startKeyHash < (splitKeyHash - 1) && splitKeyHash < endKeyHash))
+        return STATUS_REQUEST_FORMAT_ERROR;
+
+    // Check that the tablet with the described key ranges exists.
+    // If the tablet exists, adjust its endKeyHash so it becomes the tablet
+    // for the first part after the split and also copy the tablet and use
+    // the copy for the second part after the split.
     bool tabletExists = false;
     ProtoBuf::Tablets_Tablet newTablet;
 
@@ -285,32 +399,29 @@ CoordinatorService::splitTablet(const SplitTabletRpc::Request& reqHdr,
         if (tabletMap.tablet(i).table_id() != tableId) {
             continue;
         }
-        if (tabletMap.tablet(i).start_key_hash() == reqHdr.startKeyHash &&
-            tabletMap.tablet(i).end_key_hash() == reqHdr.endKeyHash) {
+        if (tabletMap.tablet(i).start_key_hash() == startKeyHash &&
+            tabletMap.tablet(i).end_key_hash() == endKeyHash) {
                 tabletExists = true;
                 newTablet = tabletMap.tablet(i);
                 tabletMap.mutable_tablet(i)->
-                set_end_key_hash(reqHdr.splitKeyHash - 1);
+                set_end_key_hash(splitKeyHash - 1);
         }
     }
-    if (!tabletExists) {
-        respHdr.common.status = STATUS_TABLET_DOESNT_EXIST;
-        return;
-    }
+    if (!tabletExists)
+        return STATUS_TABLET_DOESNT_EXIST;
 
     // Adjust the start key hash for the tablet for the second part and add it
-    newTablet.set_start_key_hash(reqHdr.splitKeyHash);
+    newTablet.set_start_key_hash(splitKeyHash);
     *tabletMap.add_tablet() = newTablet;
 
     // Tell the master to split the tablet
     ServerId masterId(newTablet.server_id());
     MasterClient master(serverList.getSession(masterId));
-    master.splitMasterTablet(tableId, reqHdr.startKeyHash, reqHdr.endKeyHash,
-                       reqHdr.splitKeyHash);
+    master.splitMasterTablet(tableId, startKeyHash, endKeyHash, splitKeyHash);
 
-    LOG(NOTICE, "In table '%s' I split the tablet that started at key %lu and "
-                "ended at key %lu", name, reqHdr.startKeyHash,
-                reqHdr.endKeyHash);
+    LOG(NOTICE, "In table %lu I split the tablet that started at key %lu and "
+                "ended at key %lu", tableId, startKeyHash, endKeyHash);
+    return STATUS_OK;
 }
 
 /**
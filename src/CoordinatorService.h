@@ -58,6 +58,12 @@ class CoordinatorService : public Service {
     void splitTablet(const SplitTabletRpc::Request& reqHdr,
                    SplitTabletRpc::Response& respHdr,
                    Rpc& rpc);
+    void splitTabletById(const SplitTabletByIdRpc::Request& reqHdr,
+                         SplitTabletByIdRpc::Response& respHdr,
+                         Rpc& rpc);
+    void splitTabletAtMedian(const SplitTabletAtMedianRpc::Request& reqHdr,
+                             SplitTabletAtMedianRpc::Response& respHdr,
+                             Rpc& rpc);
     void getTableId(const GetTableIdRpc::Request& reqHdr,
                     GetTableIdRpc::Response& respHdr,
                     Rpc& rpc);
@@ -98,6 +104,8 @@ class CoordinatorService : public Service {
     void sendMembershipUpdate(ProtoBuf::ServerList& update,
                               ServerId excludeServerId);
     void sendServerList(ServerId destination);
+    Status splitTablet(uint64_t tableId, uint64_t startKeyHash,
+                       uint64_t endKeyHash, uint64_t splitKeyHash);
     void setMinOpenSegmentId(const SetMinOpenSegmentIdRpc::Request& reqHdr,
                              SetMinOpenSegmentIdRpc::Response& respHdr,
                              Rpc& rpc);
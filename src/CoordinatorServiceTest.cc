@@ -219,6 +219,30 @@ TEST_F(CoordinatorServiceTest, splitTablet) {
                  TableDoesntExistException);
 }
 
+TEST_F(CoordinatorServiceTest, splitTabletAtMedian) {
+    client->createTable("foo");
+    Table* table = reinterpret_cast<Table*>(
+                                    master->tablets.tablet(0).user_data());
+    // All of the accesses fall into the first of the 16 buckets of the
+    // histogram, [0, 2^60).
+    for (int i = 0; i < 100; i++)
+        table->statistics.recordRead(1UL << 40, 0);
+
+    EXPECT_EQ(1UL << 59, client->splitTabletAtMedian(0, 0, ~0UL));
+    ASSERT_EQ(2, service->tabletMap.tablet_size());
+    EXPECT_EQ((1UL << 59) - 1, service->tabletMap.tablet(0).end_key_hash());
+    EXPECT_EQ(1UL << 59, service->tabletMap.tablet(1).start_key_hash());
+    EXPECT_EQ(2, master->tablets.tablet_size());
+
+    // No accesses to the upper half: split it in the middle.
+    uint64_t start = 1UL << 59;
+    EXPECT_EQ(start + (~0UL - start) / 2 + 1,
+              client->splitTabletAtMedian(0, start, ~0UL));
+
+    EXPECT_THROW(client->splitTabletAtMedian(0, 0, 16),
+                 TabletDoesntExistException);
+}
+
 TEST_F(CoordinatorServiceTest, dropTable) {
     ServerConfig master2Config = masterConfig;
     master2Config.localLocator = "mock:host=master2";
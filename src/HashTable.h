@@ -16,6 +16,17 @@
 #ifndef RAMCLOUD_HASHTABLE_H
 #define RAMCLOUD_HASHTABLE_H
 
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#if __GNUC__ >= 4 && __GNUC_MINOR__ >= 5
+#include <atomic>
+#else
+#include <cstdatomic>
+#endif
+
 #include "Common.h"
 #include "BitOps.h"
 #include "CycleCounter.h"
@@ -23,6 +34,8 @@
 #include "Memory.h"
 #include "MurmurHash3.h"
 #include "KeyHash.h"
+#include "ThreadId.h"
+#include "Tub.h"
 
 namespace RAMCloud {
 
@@ -50,6 +63,18 @@ namespace RAMCloud {
  * buckets). In this case, the last hash table entry in each of the
  * non-terminal cache lines has a pointer to the next cache line instead of a
  * pointer to a referent.
+ *
+ * To search a cache line, the secondary hash bits of all of its entries are
+ * compared against the key's at once with SIMD instructions (see #matchTags()).
+ * The referents of all entries that match are prefetched before the first
+ * of them is dereferenced to compare the full key.
+ *
+ * The table can grow while it is in use. #startResize() allocates a table
+ * with twice as many buckets, #migrateBucket() then moves one bucket at a
+ * time into it, and #finishResize() makes it the only table once every
+ * bucket has moved. Each bucket splits into two buckets of the larger
+ * table; until it has been moved, its keys are looked up in the old table,
+ * afterwards in the new one.
  */
 template<typename T>
 class HashTable {
@@ -238,6 +263,29 @@ class HashTable {
         }
     };
 
+    /**
+     * One of the keys looked up by #lookupBatch().
+     */
+    struct BatchEntry {
+        BatchEntry()
+            : key1(0), key2(NULL), key2Length(0), referent(NULL)
+        {
+        }
+
+        /// The first 64 bits of the key.
+        uint64_t key1;
+
+        /// The variable-length part of the key.
+        const char* key2;
+
+        /// Size in bytes of #key2.
+        uint16_t key2Length;
+
+        /// The address of the referent, or \a NULL if there is none. Set
+        /// by #lookupBatch().
+        T referent;
+    };
+
     /**
      * Constructor for HashTable.
      * \param[in] numBuckets
@@ -249,7 +297,13 @@ class HashTable {
     explicit HashTable(uint64_t numBuckets)
         : numBuckets(BitOps::powerOfTwoLessOrEqual(numBuckets))
         , buckets(this->numBuckets * sizeof(CacheLine))
+        , newBuckets()
+        , migratedBuckets(0)
+        , entryCounts(static_cast<EntryCount*>(
+                Memory::xmemalign(HERE, BYTES_PER_CACHE_LINE,
+                                  NUM_ENTRY_COUNTS * sizeof(EntryCount))))
         , perfCounters()
+        , tagMatching(true)
     {
         // HashTable<T> requires that T be a pointer. Assert that.
         {
@@ -264,8 +318,13 @@ class HashTable {
                          this->numBuckets);
         }
 
-        if (numBuckets == 0)
+        for (uint32_t i = 0; i < NUM_ENTRY_COUNTS; i++)
+            new(&entryCounts[i]) EntryCount();
+
+        if (numBuckets == 0) {
+            free(entryCounts);
             throw Exception(HERE, "HashTable numBuckets == 0?!");
+        }
     }
 
     /**
@@ -273,7 +332,10 @@ class HashTable {
      */
     ~HashTable()
     {
-        // TODO(ongaro): free chained CacheLines that were allocated in insert()
+        freeChains(buckets.get(), numBuckets);
+        if (newBuckets)
+            freeChains(newBuckets->get(), 2 * numBuckets);
+        free(entryCounts);
     }
 
     /**
@@ -310,6 +372,43 @@ class HashTable {
         return entry->getReferent();
     }
 
+    /**
+     * Find the referents of several keys at once. This gives the same
+     * results as calling #lookup() for each key, but rather than going
+     * through the dependent cache misses of one key after the other, it
+     * hashes every key and prefetches its bucket, then prefetches the
+     * referents the buckets point to, and only then compares keys. That
+     * way the misses of all of the keys overlap.
+     *
+     * Batches should be small enough (a few dozen keys) that the lines
+     * prefetched for the first key are still cached when it is resolved.
+     *
+     * \param[in,out] batch
+     *      The keys to look up. Only their referents are filled in.
+     * \param count
+     *      The number of keys in \a batch.
+     */
+    void
+    lookupBatch(BatchEntry* batch, uint32_t count)
+    {
+        CacheLine* buckets[count];
+        uint64_t secondaryHashes[count];
+        for (uint32_t i = 0; i < count; i++) {
+            BatchEntry& b = batch[i];
+            buckets[i] = findBucket(b.key1, getKeyHash(b.key2, b.key2Length),
+                                    &secondaryHashes[i]);
+            prefetch(buckets[i]);
+        }
+        for (uint32_t i = 0; i < count; i++)
+            prefetchCandidates(buckets[i], secondaryHashes[i]);
+        for (uint32_t i = 0; i < count; i++) {
+            BatchEntry& b = batch[i];
+            Entry *entry = lookupEntry(buckets[i], secondaryHashes[i],
+                                       b.key1, b.key2, b.key2Length);
+            b.referent = (entry == NULL) ? NULL : entry->getReferent();
+        }
+    }
+
     /**
      * Remove a referent from the hash table.
      * \param[in] key1
@@ -342,6 +441,7 @@ class HashTable {
         if (retPtr != NULL)
             *retPtr = p;
         entry->clear();
+        __sync_fetch_and_sub(&entryCount(), 1);
         return true;
     }
 
@@ -365,7 +465,6 @@ class HashTable {
     replace(T ptr, T* retPtr = NULL)
     {
         CycleCounter<> cycles(&perfCounters.replaceCycles);
-        unsigned int i;
 
         ++perfCounters.replaceCalls;
 
@@ -388,31 +487,9 @@ class HashTable {
             return true;
         }
 
-        CacheLine *cl = bucket;
-        while (1) {
-            entry = cl->entries;
-            for (i = 0; i < ENTRIES_PER_CACHE_LINE; i++) {
-                if (entry->isAvailable()) {
-                    entry->setReferent(secondaryHash, ptr);
-                    return false;
-                }
-                entry++;
-            }
-
-            Entry &last = cl->entries[ENTRIES_PER_CACHE_LINE - 1];
-            cl = last.getChainPointer();
-            if (cl == NULL) {
-                // no empty space found, allocate a new cache line
-                void *buf = Memory::xmemalign(HERE, sizeof(CacheLine),
-                                              sizeof(CacheLine));
-                cl = static_cast<CacheLine *>(buf);
-                cl->entries[0] = last;
-                for (i = 1; i < ENTRIES_PER_CACHE_LINE; i++)
-                    cl->entries[i].clear();
-                last.setChainPointer(cl);
-            }
-            ++perfCounters.insertChainsFollowed;
-        }
+        insert(bucket, secondaryHash, ptr);
+        __sync_fetch_and_add(&entryCount(), 1);
+        return false;
     }
 
     /**
@@ -424,6 +501,8 @@ class HashTable {
      *      An opaque parameter to pass to the callback function.
      * \param bucket
      *      An index into the HashTable's buckets.  Must be < #numBuckets.
+     *      While the table is being resized, this covers both of the
+     *      buckets of the larger table this bucket splits into.
      * \return
      *      The total number of callbacks fired (i.e. the number of referents
      *      in the HashTable).
@@ -433,25 +512,13 @@ class HashTable {
                     void *cookie,
                     uint64_t bucket)
     {
-        uint64_t numCalls = 0;
-        CacheLine *cl = &buckets.get()[bucket];
-        while (1) {
-            for (uint32_t j = 0; j < ENTRIES_PER_CACHE_LINE; j++) {
-                Entry *e = &cl->entries[j];
-                if (!e->isAvailable() &&
-                    e->getChainPointer() == NULL) {
-                    T ptr = e->getReferent();
-                    callback(ptr, cookie);
-                    numCalls++;
-                }
-            }
-
-            Entry *entry = &cl->entries[ENTRIES_PER_CACHE_LINE - 1];
-            cl = entry->getChainPointer();
-            if (cl == NULL)
-                break;
+        if (bucket < migratedBuckets) {
+            CacheLine* larger = newBuckets->get();
+            return forEachInChain(callback, cookie, &larger[bucket]) +
+                   forEachInChain(callback, cookie,
+                                  &larger[bucket + numBuckets]);
         }
-        return numCalls;
+        return forEachInChain(callback, cookie, &buckets.get()[bucket]);
     }
 
     /**
@@ -550,7 +617,31 @@ class HashTable {
     }
 
     /**
-     * Returns the number of buckets allocated to the table.
+     * Return the index of the bucket that holds the entry for a key, if
+     * there is one. Operations on keys in different buckets touch disjoint
+     * parts of the table, so they may run concurrently (apart from the
+     * #perfCounters, which may then miss a few updates). This includes
+     * #migrateBucket(): while the table is being resized, a bucket's keys
+     * may already have moved to the larger table, but the index returned
+     * is still the one in a table of #getNumBuckets() buckets.
+     * \param[in] key1
+     *      The first 64 bits of the key.
+     * \param[in] key2
+     *      The variable-length part of the key.
+     * \param[in] key2Length
+     *      Length of \a key2 in bytes.
+     */
+    uint64_t
+    getBucketIndex(uint64_t key1, const char* key2, uint16_t key2Length)
+    {
+        uint64_t bucketHash = hash(key1, getKeyHash(key2, key2Length)) &
+                              0x0000ffffffffffffUL;
+        return bucketHash & (numBuckets - 1);
+    }
+
+    /**
+     * Returns the number of buckets allocated to the table. While the table
+     * is being resized, this is the number of buckets before the resize.
      */
     uint64_t
     getNumBuckets() const
@@ -558,6 +649,140 @@ class HashTable {
         return numBuckets;
     }
 
+    /**
+     * Choose how #lookupEntry() searches a cache line.
+     * \param enabled
+     *      If true (the default), candidates are found by comparing the
+     *      secondary hash bits of all entries at once and their referents
+     *      are prefetched before any key is compared. If false, entries are
+     *      checked one at a time. This only exists so that
+     *      HashTableBenchmark can compare the two.
+     */
+    void
+    setTagMatching(bool enabled)
+    {
+        tagMatching = enabled;
+    }
+
+    /**
+     * Return the number of referents in the table. While other threads
+     * are inserting or removing referents, this is merely close.
+     */
+    uint64_t
+    getNumEntries() const
+    {
+        int64_t total = 0;
+        for (uint32_t i = 0; i < NUM_ENTRY_COUNTS; i++)
+            total += entryCounts[i].count;
+        return total > 0 ? total : 0;
+    }
+
+    /**
+     * Return the fraction of the entries in the table's buckets (not
+     * counting overflow cache lines) that referents would take up if they
+     * were spread evenly. Chains grow quickly once this nears 1.
+     */
+    double
+    getLoadFactor() const
+    {
+        return static_cast<double>(getNumEntries()) /
+               static_cast<double>(numBuckets * ENTRIES_PER_CACHE_LINE);
+    }
+
+    /**
+     * Return whether #startResize() has been called without a matching
+     * #finishResize().
+     */
+    bool
+    isResizing() const
+    {
+        return newBuckets;
+    }
+
+    /**
+     * Start growing the table to twice its number of buckets.
+     *
+     * This only allocates the larger table, which no operation looks at
+     * until #migrateBucket() has moved a bucket to it, so it need not be
+     * kept from running concurrently with other operations.
+     *
+     * \throw FatalError
+     *      The memory for the larger table could not be allocated.
+     */
+    void
+    startResize()
+    {
+        assert(!isResizing());
+        newBuckets.construct(2 * numBuckets * sizeof(CacheLine));
+        migratedBuckets = 0;
+    }
+
+    /**
+     * Return the index of the bucket #migrateBucket() will move next, or
+     * #getNumBuckets() if every bucket has moved.
+     */
+    uint64_t
+    getNextBucketToMigrate() const
+    {
+        return migratedBuckets;
+    }
+
+    /**
+     * Move the referents of the bucket given by #getNextBucketToMigrate()
+     * into the larger table allocated by #startResize(), and free the
+     * bucket's overflow cache lines. No operation on a key in that bucket
+     * may run concurrently with this (see #getBucketIndex()).
+     */
+    void
+    migrateBucket()
+    {
+        uint64_t index = migratedBuckets;
+        assert(isResizing() && index < numBuckets);
+        CacheLine* larger = newBuckets->get();
+        CacheLine* bucket = &buckets.get()[index];
+
+        CacheLine* cl = bucket;
+        while (cl != NULL) {
+            CacheLine* next = NULL;
+            for (uint32_t i = 0; i < ENTRIES_PER_CACHE_LINE; i++) {
+                Entry& entry = cl->entries[i];
+                if (entry.isAvailable())
+                    continue;
+                if (entry.getChainPointer() != NULL) {
+                    next = entry.getChainPointer();
+                    continue;
+                }
+                T ptr = entry.getReferent();
+                uint64_t hashValue = hash(ptr->key1(),
+                        getKeyHash(ptr->key2(), ptr->key2Length()));
+                uint64_t bucketHash = hashValue & 0x0000ffffffffffffUL;
+                insert(&larger[bucketHash & (2 * numBuckets - 1)],
+                       hashValue >> 48, ptr);
+            }
+            if (cl != bucket)
+                free(cl);
+            cl = next;
+        }
+        memset(bucket, 0, sizeof(*bucket));
+
+        // Lookups in this bucket go to the larger table from now on.
+        migratedBuckets = index + 1;
+    }
+
+    /**
+     * Replace the table with the larger one once #migrateBucket() has moved
+     * every bucket. No other operation may run concurrently with this.
+     */
+    void
+    finishResize()
+    {
+        assert(isResizing() && migratedBuckets == numBuckets);
+        buckets.swap(*newBuckets);
+        numBuckets *= 2;
+        migratedBuckets = 0;
+        newBuckets.destroy();
+    }
+
   PRIVATE:
 
     // forward declarations
@@ -597,11 +822,16 @@ class HashTable {
         uint64_t hashValue = hash(key1, key2);
         uint64_t bucketHash = hashValue & 0x0000ffffffffffffUL;
         *secondaryHash = hashValue >> 48;
-        return &buckets.get()[bucketHash & (numBuckets - 1)];
+        uint64_t index = bucketHash & (numBuckets - 1);
         // This is equivalent to:
-        //     &buckets.get()[bucketHash % numBuckets]
+        //     bucketHash % numBuckets
         // since numBuckets is a power of two, and this saves about 14 cycles on
         // an Intel Core 2 (see src/misc/modulus.cc).
+        if (index < migratedBuckets) {
+            // The bucket has already moved to the larger table.
+            return &newBuckets->get()[bucketHash & (2 * numBuckets - 1)];
+        }
+        return &buckets.get()[index];
     }
 
     /**
@@ -629,7 +859,6 @@ class HashTable {
                 uint64_t key1, const char* key2, uint16_t key2Length)
     {
         CycleCounter<> cycles(&perfCounters.lookupEntryCycles);
-        unsigned int i;
 
         ++perfCounters.lookupEntryCalls;
 
@@ -638,23 +867,12 @@ class HashTable {
         while (1) {
 
             // Try this cache line.
-            Entry *candidate = cl->entries;
-            for (i = 0; i < ENTRIES_PER_CACHE_LINE; i++, candidate++) {
-
-                if (candidate->hashMatches(secondaryHash)) {
-                    // The hash within the hash table entry matches, so with
-                    // high probability this is the pointer we're looking for.
-                    // To check, we must go to the object.
-                    T c = candidate->getReferent();
-                    if (c->key1() == key1 &&
-                        c->key2Length() == key2Length &&
-                        memcmp(c->key2(), key2, key2Length) == 0) {
-                        perfCounters.lookupEntryDist.storeSample(cycles.stop());
-                        return candidate;
-                    } else {
-                        ++perfCounters.lookupEntryHashCollisions;
-                    }
-                }
+            Entry *candidate = tagMatching ?
+                searchByTag(cl, secondaryHash, key1, key2, key2Length) :
+                searchEntries(cl, secondaryHash, key1, key2, key2Length);
+            if (candidate != NULL) {
+                perfCounters.lookupEntryDist.storeSample(cycles.stop());
+                return candidate;
             }
 
             // Not found in this cache line, see if there's a chain to another
@@ -669,6 +887,236 @@ class HashTable {
         }
     }
 
+    /**
+     * Add an entry for a referent to a bucket, which must not have one for
+     * the referent's key yet. A cache line is added to the bucket's chain
+     * if there is no room left.
+     * \param bucket
+     *      The first cache line of the bucket.
+     * \param secondaryHash
+     *      Secondary hash bits of the referent's key (16 bits).
+     * \param ptr
+     *      The address of the referent.
+     */
+    void
+    insert(CacheLine *bucket, uint64_t secondaryHash, T ptr)
+    {
+        CacheLine *cl = bucket;
+        while (1) {
+            Entry *entry = cl->entries;
+            for (uint32_t i = 0; i < ENTRIES_PER_CACHE_LINE; i++) {
+                if (entry->isAvailable()) {
+                    entry->setReferent(secondaryHash, ptr);
+                    return;
+                }
+                entry++;
+            }
+
+            Entry &last = cl->entries[ENTRIES_PER_CACHE_LINE - 1];
+            cl = last.getChainPointer();
+            if (cl == NULL) {
+                // no empty space found, allocate a new cache line
+                void *buf = Memory::xmemalign(HERE, sizeof(CacheLine),
+                                              sizeof(CacheLine));
+                cl = static_cast<CacheLine *>(buf);
+                cl->entries[0] = last;
+                for (uint32_t i = 1; i < ENTRIES_PER_CACHE_LINE; i++)
+                    cl->entries[i].clear();
+                last.setChainPointer(cl);
+            }
+            ++perfCounters.insertChainsFollowed;
+        }
+    }
+
+    /**
+     * Apply a callback to each referent in a chain of cache lines.
+     * This is a helper to #forEachInBucket().
+     */
+    uint64_t
+    forEachInChain(void (*callback)(T, void *), void *cookie, CacheLine *cl)
+    {
+        uint64_t numCalls = 0;
+        while (1) {
+            for (uint32_t j = 0; j < ENTRIES_PER_CACHE_LINE; j++) {
+                Entry *e = &cl->entries[j];
+                if (!e->isAvailable() &&
+                    e->getChainPointer() == NULL) {
+                    T ptr = e->getReferent();
+                    callback(ptr, cookie);
+                    numCalls++;
+                }
+            }
+
+            Entry *entry = &cl->entries[ENTRIES_PER_CACHE_LINE - 1];
+            cl = entry->getChainPointer();
+            if (cl == NULL)
+                break;
+        }
+        return numCalls;
+    }
+
+    /**
+     * Free the overflow cache lines of every bucket in an array of buckets.
+     */
+    static void
+    freeChains(CacheLine *table, uint64_t numBuckets)
+    {
+        for (uint64_t i = 0; i < numBuckets; i++) {
+            CacheLine *cl = table[i].entries[ENTRIES_PER_CACHE_LINE - 1].
+                                getChainPointer();
+            while (cl != NULL) {
+                CacheLine *next = cl->entries[ENTRIES_PER_CACHE_LINE - 1].
+                                      getChainPointer();
+                free(cl);
+                cl = next;
+            }
+        }
+    }
+
+    /**
+     * Check whether a referent is the one for a key.
+     * This is a helper to #searchEntries() and #searchByTag().
+     */
+    static bool
+    keyMatches(T referent, uint64_t key1, const char* key2,
+               uint16_t key2Length)
+    {
+        return referent->key1() == key1 &&
+               referent->key2Length() == key2Length &&
+               memcmp(referent->key2(), key2, key2Length) == 0;
+    }
+
+    /**
+     * Search a single cache line for the entry of a key by checking its
+     * entries one at a time. See #lookupEntry() for the parameters.
+     * \return
+     *      The entry for the key, or \a NULL if it isn't in this cache line.
+     */
+    Entry *
+    searchEntries(CacheLine *cl, uint64_t secondaryHash,
+                  uint64_t key1, const char* key2, uint16_t key2Length)
+    {
+        Entry *candidate = cl->entries;
+        for (uint32_t i = 0; i < ENTRIES_PER_CACHE_LINE; i++, candidate++) {
+            if (candidate->hashMatches(secondaryHash)) {
+                // The hash within the hash table entry matches, so with
+                // high probability this is the pointer we're looking for.
+                // To check, we must go to the object.
+                if (keyMatches(candidate->getReferent(),
+                               key1, key2, key2Length)) {
+                    return candidate;
+                }
+                ++perfCounters.lookupEntryHashCollisions;
+            }
+        }
+        return NULL;
+    }
+
+    /**
+     * Search a single cache line for the entry of a key, using #matchTags()
+     * to find the candidates. See #lookupEntry() for the parameters.
+     * \return
+     *      The entry for the key, or \a NULL if it isn't in this cache line.
+     */
+    Entry *
+    searchByTag(CacheLine *cl, uint64_t secondaryHash,
+                uint64_t key1, const char* key2, uint16_t key2Length)
+    {
+        uint32_t tags = matchTags(cl, secondaryHash);
+        if (tags == 0)
+            return NULL;
+
+        // Weed out unused entries and chain pointers, and get the referents
+        // of the rest on their way so that, should there be more than one,
+        // their cache misses overlap.
+        uint32_t candidates = 0;
+        for (; tags != 0; tags &= tags - 1) {
+            uint32_t i = BitOps::findFirstSet(tags) - 1;
+            if (cl->entries[i].hashMatches(secondaryHash)) {
+                prefetch(cl->entries[i].getReferent(), BYTES_PER_CACHE_LINE);
+                candidates |= 1U << i;
+            }
+        }
+
+        for (; candidates != 0; candidates &= candidates - 1) {
+            Entry *candidate =
+                &cl->entries[BitOps::findFirstSet(candidates) - 1];
+            if (keyMatches(candidate->getReferent(), key1, key2, key2Length))
+                return candidate;
+            ++perfCounters.lookupEntryHashCollisions;
+        }
+        return NULL;
+    }
+
+    /**
+     * Prefetch the referents of the entries in a cache line whose secondary
+     * hash bits match a key's. This is a helper to #lookupBatch().
+     */
+    void
+    prefetchCandidates(CacheLine *cl, uint64_t secondaryHash)
+    {
+        for (uint32_t tags = matchTags(cl, secondaryHash); tags != 0;
+             tags &= tags - 1) {
+            Entry& entry = cl->entries[BitOps::findFirstSet(tags) - 1];
+            if (entry.hashMatches(secondaryHash))
+                prefetch(entry.getReferent(), BYTES_PER_CACHE_LINE);
+        }
+    }
+
+    /**
+     * Compare the secondary hash bits of every entry in a cache line
+     * against a key's at once.
+     * \param cl
+     *      The cache line to search.
+     * \param secondaryHash
+     *      The secondary hash bits of the key (16 bits).
+     * \return
+     *      A mask in which bit i is set if the hash bits of entry i equal
+     *      \a secondaryHash. Unused entries and chain pointers can match
+     *      too, so each candidate still needs Entry::hashMatches().
+     */
+    static uint32_t
+    matchTags(const CacheLine *cl, uint64_t secondaryHash)
+    {
+        // The hash bits are the most significant 16-bit word of each entry,
+        // so comparing the cache line 16 bits at a time leaves the result
+        // for entry i in the mask bit of byte 8 * i + 7.
+#if defined(__AVX2__)
+        __m256i tag = _mm256_set1_epi16(static_cast<int16_t>(secondaryHash));
+        const __m256i* line = reinterpret_cast<const __m256i*>(cl->entries);
+        uint32_t tags = 0;
+        for (uint32_t i = 0; i < sizeof(CacheLine) / sizeof(__m256i); i++) {
+            uint32_t bytes = _mm256_movemask_epi8(_mm256_cmpeq_epi16(
+                    _mm256_loadu_si256(line + i), tag));
+            tags |= tagBits(bytes, 4) << (4 * i);
+        }
+        return tags;
+#else
+        __m128i tag = _mm_set1_epi16(static_cast<int16_t>(secondaryHash));
+        const __m128i* line = reinterpret_cast<const __m128i*>(cl->entries);
+        uint32_t tags = 0;
+        for (uint32_t i = 0; i < sizeof(CacheLine) / sizeof(__m128i); i++) {
+            uint32_t bytes = _mm_movemask_epi8(_mm_cmpeq_epi16(
+                    _mm_loadu_si128(line + i), tag));
+            tags |= tagBits(bytes, 2) << (2 * i);
+        }
+        return tags;
+#endif
+    }
+
+    /**
+     * Gather bits 7, 15, 23, ... of a SIMD byte mask into a bit per entry.
+     * This is a helper to #matchTags().
+     */
+    static uint32_t
+    tagBits(uint32_t bytes, uint32_t numEntries)
+    {
+        uint32_t tags = 0;
+        for (uint32_t i = 0; i < numEntries; i++)
+            tags |= ((bytes >> (8 * i + 7)) & 1) << i;
+        return tags;
+    }
+
     /**
      * A hash table entry.
      *
@@ -896,10 +1344,41 @@ class HashTable {
     static_assert(sizeof(CacheLine) == sizeof(Entry) * ENTRIES_PER_CACHE_LINE,
                   "HashTable entries don't fit evenly into a cacheline");
 
+    /// Number of per-thread referent counts. See #entryCounts.
+    static const uint32_t NUM_ENTRY_COUNTS = 16;
+
     /**
-     * The number of buckets allocated to the table.
+     * The referent count of the threads mapped to one slot of
+     * #entryCounts, padded out to a cache line. The count is signed since
+     * a thread may remove more referents than it inserted.
      */
-    const uint64_t numBuckets;
+    struct EntryCount {
+        EntryCount()
+            : count(0)
+            , pad()
+        {
+        }
+
+        int64_t count;
+        char pad[BYTES_PER_CACHE_LINE - sizeof(int64_t)];
+    };
+    static_assert(sizeof(EntryCount) == BYTES_PER_CACHE_LINE,
+                  "HashTable::EntryCount must fill one cache line");
+
+    /**
+     * Return the slot of #entryCounts the calling thread should update.
+     */
+    int64_t&
+    entryCount()
+    {
+        return entryCounts[ThreadId::get() % NUM_ENTRY_COUNTS].count;
+    }
+
+    /**
+     * The number of buckets allocated to the table. While the table is
+     * being resized, the larger table has twice as many.
+     */
+    uint64_t numBuckets;
 
     /**
      * The array of buckets.
@@ -907,12 +1386,40 @@ class HashTable {
      */
     LargeBlockOfMemory<CacheLine> buckets;
 
+    /**
+     * The larger array of buckets the table is being resized into, if
+     * #startResize() has been called. See HashTable.
+     */
+    Tub<LargeBlockOfMemory<CacheLine>> newBuckets;
+
+    /**
+     * The buckets of #buckets below this index have been moved to
+     * #newBuckets. This is read by lookups in buckets other than the one
+     * being moved, hence atomic.
+     */
+    std::atomic<uint64_t> migratedBuckets;
+
+    /**
+     * #NUM_ENTRY_COUNTS cache-aligned counts of referents inserted minus
+     * referents removed, summed by #getNumEntries(). Each thread updates
+     * the count its ThreadId maps to, so that inserts and removes on
+     * different threads don't all write to one cache line. Threads can
+     * share a count, hence the atomic adds.
+     */
+    EntryCount* entryCounts;
+
     /**
      * The performance counters for the HashTable.
      * See #getPerfCounters().
      */
     PerfCounters perfCounters;
 
+    /**
+     * Whether #lookupEntry() uses #searchByTag() rather than
+     * #searchEntries(). See #setTagMatching().
+     */
+    bool tagMatching;
+
     friend void hashTableBenchmark(uint64_t nkeys, uint64_t nlines);
     DISALLOW_COPY_AND_ASSIGN(HashTable);
 };
@@ -19,6 +19,11 @@
  */
 
 #include <math.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
 
 #include "Common.h"
 #include "Context.h"
@@ -46,6 +51,102 @@ class TestObject {
 
 typedef HashTable<TestObject*> TestObjectMap;
 
+/**
+ * Counts the last-level cache misses of this thread with a hardware
+ * performance counter, if the kernel lets us have one.
+ */
+class CacheMissCounter {
+  public:
+    CacheMissCounter()
+        : fd(-1)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1,
+                                      -1, 0));
+    }
+
+    ~CacheMissCounter()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    /// Whether the counter could be opened.
+    bool available() const { return fd >= 0; }
+
+    void
+    start()
+    {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    /// Return the number of misses since #start().
+    uint64_t
+    stop()
+    {
+        uint64_t count = 0;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+            return 0;
+        return count;
+    }
+
+  private:
+    int fd;
+    DISALLOW_COPY_AND_ASSIGN(CacheMissCounter);
+};
+
+/**
+ * Look up every key in a random order and print the throughput, once
+ * checking the entries of each cache line one at a time and once matching
+ * their hash bits all at once (see HashTable::setTagMatching).
+ */
+void
+compareLookups(TestObjectMap& ht, uint64_t nkeys)
+{
+    vector<uint64_t> order(nkeys);
+    for (uint64_t i = 0; i < nkeys; i++)
+        order[i] = i;
+    std::random_shuffle(order.begin(), order.end());
+
+    CacheMissCounter misses;
+    printf("== lookup() in random order ==\n");
+    for (int tagMatching = 0; tagMatching <= 1; tagMatching++) {
+        ht.setTagMatching(tagMatching);
+        if (misses.available())
+            misses.start();
+        uint64_t start = Cycles::rdtsc();
+        foreach (uint64_t i, order) {
+            MakeKey key(i);
+            TestObject *p = ht.lookup(0, key.get(), key.length());
+            assert(p != NULL);
+            (void)p;
+        }
+        uint64_t cycles = Cycles::rdtsc() - start;
+        uint64_t missCount = misses.available() ? misses.stop() : 0;
+
+        printf("    %-22s %10.0f lookups/sec",
+               tagMatching ? "tag match + prefetch:" : "one entry at a time:",
+               static_cast<double>(nkeys) / Cycles::toSeconds(cycles));
+        if (misses.available()) {
+            printf(", %.2f cache misses/lookup",
+                   static_cast<double>(missCount) /
+                   static_cast<double>(nkeys));
+        } else {
+            printf(", cache misses unavailable");
+        }
+        printf("\n");
+    }
+}
+
 } // anonymous namespace
 
 void
@@ -212,6 +313,8 @@ hashTableBenchmark(uint64_t nkeys, uint64_t nlines)
         if (total >= 99.99)
             break;
     }
+
+    compareLookups(ht, nkeys);
 }
 
 } // namespace RAMCloud
@@ -277,7 +277,7 @@ class HashTableTest : public ::testing::Test {
         if (numCacheLines == 0)
             numCacheLines = 1;
         LargeBlockOfMemory<TestObjectMap::CacheLine> cacheLines(
-                numCacheLines * sizeof(TestObjectMap::CacheLine));
+                sizeof(TestObjectMap::CacheLine));
         insertArray(&ht, values, tableId, numEnt, &cacheLines,
                 numCacheLines);
     }
@@ -298,22 +298,28 @@ class HashTableTest : public ::testing::Test {
      * \param[in] numEnt
      *      The number of values in \a values.
      * \param[in] cacheLines
-     *      An array of cache lines to back the bucket with. 
+     *      The cache line to use as the bucket.
      * \param[in] numCacheLines
-     *      The number of cache lines in \a cacheLines.
+     *      The number of cache lines in the bucket's chain. All but the
+     *      first are allocated the way the hash table would, since it frees
+     *      them.
      */
     void insertArray(TestObjectMap *ht, TestObject *values,
                      uint64_t tableId, uint64_t numEnt,
                      LargeBlockOfMemory<TestObjectMap::CacheLine> *cacheLines,
                      uint64_t numCacheLines)
     {
-        TestObjectMap::CacheLine *cl;
-
         // chain all the cache lines
-        cl = &cacheLines->get()[0];
-        while (cl < &cacheLines->get()[numCacheLines - 1]) {
-            cl->entries[seven].setChainPointer(cl + 1);
-            cl++;
+        vector<TestObjectMap::CacheLine*> lines;
+        lines.push_back(&cacheLines->get()[0]);
+        while (lines.size() < numCacheLines) {
+            TestObjectMap::CacheLine *cl =
+                static_cast<TestObjectMap::CacheLine*>(Memory::xmemalign(
+                    HERE, sizeof(TestObjectMap::CacheLine),
+                    sizeof(TestObjectMap::CacheLine)));
+            memset(cl, 0, sizeof(*cl));
+            lines.back()->entries[seven].setChainPointer(cl);
+            lines.push_back(cl);
         }
 
         // fill in the "log" entries
@@ -328,9 +334,9 @@ class HashTableTest : public ::testing::Test {
 
             TestObjectMap::Entry *entry;
             if (0 < i && i == numEnt - 1 && i % seven == 0)
-                entry = &cacheLines->get()[i / seven - 1].entries[seven];
+                entry = &lines[i / seven - 1]->entries[seven];
             else
-                entry = &cacheLines->get()[i / seven].entries[i % seven];
+                entry = &lines[i / seven]->entries[i % seven];
             entry->setReferent(littleHash, &values[i]);
         }
 
@@ -488,6 +494,15 @@ TEST_F(HashTableTest, findBucket) {
     EXPECT_EQ(secondaryHash, hashValue >> 48);
 }
 
+TEST_F(HashTableTest, getBucketIndex) {
+    TestObjectMap ht(1024);
+    uint64_t secondaryHash;
+    TestObjectMap::CacheLine *bucket =
+        ht.findBucket(5, getKeyHash("key", 3), &secondaryHash);
+    EXPECT_EQ(static_cast<uint64_t>(bucket - ht.buckets.get()),
+              ht.getBucketIndex(5, "key", 3));
+}
+
 /**
  * Test #RAMCloud::HashTable::lookupEntry() when the key is not
  * found.
@@ -571,6 +586,39 @@ TEST_F(HashTableTest, lookupEntry_hashCollision) {
     EXPECT_EQ(1UL, ht.getPerfCounters().lookupEntryHashCollisions);
 }
 
+TEST_F(HashTableTest, lookupEntry_withoutTagMatching) {
+    ht.setTagMatching(false);
+    setup(0, TestObjectMap::ENTRIES_PER_CACHE_LINE * 5);
+    string key =
+            format("%u", (TestObjectMap::ENTRIES_PER_CACHE_LINE - 1) * 2);
+    EXPECT_EQ(&entryAt(&ht, 2, 0),
+              findBucketAndLookupEntry(&ht, 0, key.c_str(),
+                    downCast<uint16_t>(key.length())));
+    values[0]._key2.assign("randomKeyValue");
+    EXPECT_EQ(static_cast<TestObjectMap::Entry*>(NULL),
+              findBucketAndLookupEntry(&ht, 0, "0", 1));
+    EXPECT_EQ(1UL, ht.getPerfCounters().lookupEntryHashCollisions);
+}
+
+TEST_F(HashTableTest, matchTags) {
+    TestObjectMap::CacheLine cl;
+    TestObject* referent = reinterpret_cast<TestObject*>(0x1UL);
+    for (uint32_t i = 0; i < TestObjectMap::ENTRIES_PER_CACHE_LINE; i++)
+        cl.entries[i].clear();
+    cl.entries[0].setReferent(0xbeefUL, referent);
+    cl.entries[1].setReferent(0xbeeeUL, referent);
+    cl.entries[3].setReferent(0xbeefUL, referent);
+    cl.entries[6].setReferent(0xffffUL, referent);
+    cl.entries[seven].setChainPointer(&cl);
+
+    EXPECT_EQ(0x09U, TestObjectMap::matchTags(&cl, 0xbeefUL));
+    EXPECT_EQ(0x02U, TestObjectMap::matchTags(&cl, 0xbeeeUL));
+    EXPECT_EQ(0x40U, TestObjectMap::matchTags(&cl, 0xffffUL));
+    EXPECT_EQ(0U, TestObjectMap::matchTags(&cl, 0xfeedUL));
+    // Unused entries and the chain pointer carry hash bits of zero.
+    EXPECT_EQ(0xb4U, TestObjectMap::matchTags(&cl, 0UL));
+}
+
 TEST_F(HashTableTest, lookup) {
     TestObjectMap ht(1);
     TestObject *v = new TestObject(0, "0");
@@ -581,6 +629,39 @@ TEST_F(HashTableTest, lookup) {
     delete v;
 }
 
+TEST_F(HashTableTest, lookupBatch) {
+    // Two buckets with chained cache lines, so that some keys take more
+    // than one line to resolve.
+    TestObjectMap ht(2);
+    uint32_t numObjects = 40;
+    TestObject objects[numObjects];
+    for (uint32_t i = 0; i < numObjects; i++) {
+        objects[i] = TestObject(0, format("%u", i));
+        ht.replace(&objects[i]);
+    }
+
+    uint32_t count = numObjects + 2;
+    TestObjectMap::BatchEntry batch[count];
+    for (uint32_t i = 0; i < numObjects; i++) {
+        batch[i].key1 = 0;
+        batch[i].key2 = objects[i].key2();
+        batch[i].key2Length = objects[i].key2Length();
+    }
+    batch[numObjects].key1 = 0;
+    batch[numObjects].key2 = "missing";
+    batch[numObjects].key2Length = 7;
+    batch[numObjects + 1].key1 = 1;
+    batch[numObjects + 1].key2 = "0";
+    batch[numObjects + 1].key2Length = 1;
+    batch[numObjects + 1].referent = &objects[0];
+
+    ht.lookupBatch(batch, count);
+    for (uint32_t i = 0; i < numObjects; i++)
+        EXPECT_EQ(&objects[i], batch[i].referent);
+    EXPECT_EQ(NULL_OBJECT, batch[numObjects].referent);
+    EXPECT_EQ(NULL_OBJECT, batch[numObjects + 1].referent);
+}
+
 TEST_F(HashTableTest, remove) {
     TestObject * ptr;
     TestObjectMap ht(1);
@@ -641,8 +722,8 @@ TEST_F(HashTableTest, replace_cacheLine0Entry7) {
  */
 TEST_F(HashTableTest, replace_cacheLine2Entry0) {
     setup(0, TestObjectMap::ENTRIES_PER_CACHE_LINE * 2);
-    ht.buckets.get()[2].entries[0].clear();
-    ht.buckets.get()[2].entries[1].clear();
+    entryAt(&ht, 2, 0).clear();
+    entryAt(&ht, 2, 1).clear();
     TestObject v(0, "newKey");
     ht.replace(&v);
     assertEntryIs(&ht, 2, 0, &v);
@@ -716,4 +797,81 @@ TEST_F(HashTableTest, forEach) {
         EXPECT_EQ(1U, checkoff[i].count);
 }
 
+TEST_F(HashTableTest, getLoadFactor) {
+    TestObjectMap ht(2);
+    TestObject v(0, "0");
+    TestObject w(0, "0");
+    ht.replace(&v);
+    ht.replace(&w);
+    EXPECT_EQ(1UL, ht.getNumEntries());
+    EXPECT_DOUBLE_EQ(1.0 / 16, ht.getLoadFactor());
+    ht.remove(0, "0", 1);
+    EXPECT_EQ(0UL, ht.getNumEntries());
+    EXPECT_FALSE(ht.remove(0, "0", 1));
+    EXPECT_EQ(0UL, ht.getNumEntries());
+}
+
+/**
+ * Grow a table whose buckets are long chains, and check that every key
+ * can be found at each step.
+ */
+TEST_F(HashTableTest, resize) {
+    HashTable<ForEachTestStruct*> ht(2);
+    uint32_t arrayLen = 256;
+    ForEachTestStruct* objects = new ForEachTestStruct[arrayLen];
+    for (uint32_t i = 0; i < arrayLen; i++) {
+        objects[i] = ForEachTestStruct(0, format("%u", i));
+        ht.replace(&objects[i]);
+    }
+    vector<uint64_t> bucketIndexes;
+    for (uint32_t i = 0; i < arrayLen; i++) {
+        bucketIndexes.push_back(ht.getBucketIndex(0, objects[i].key2(),
+                                                  objects[i].key2Length()));
+    }
+
+    EXPECT_FALSE(ht.isResizing());
+    ht.startResize();
+    EXPECT_TRUE(ht.isResizing());
+    EXPECT_EQ(0UL, ht.getNextBucketToMigrate());
+
+    ht.migrateBucket();
+    EXPECT_EQ(1UL, ht.getNextBucketToMigrate());
+    EXPECT_EQ(2UL, ht.getNumBuckets());
+    for (uint32_t i = 0; i < arrayLen; i++) {
+        EXPECT_EQ(&objects[i], ht.lookup(0, objects[i].key2(),
+                                         objects[i].key2Length()));
+        EXPECT_EQ(bucketIndexes[i],
+                  ht.getBucketIndex(0, objects[i].key2(),
+                                    objects[i].key2Length()));
+    }
+    EXPECT_EQ(arrayLen, ht.forEach(test_forEach_callback,
+                                   reinterpret_cast<void *>(57)));
+
+    // Operations keep working in a bucket that has moved.
+    ForEachTestStruct extra(0, "extra");
+    EXPECT_FALSE(ht.replace(&extra));
+    EXPECT_EQ(&extra, ht.lookup(0, "extra", 5));
+    EXPECT_TRUE(ht.remove(0, "extra", 5));
+
+    ht.migrateBucket();
+    EXPECT_EQ(2UL, ht.getNextBucketToMigrate());
+    ht.finishResize();
+    EXPECT_FALSE(ht.isResizing());
+    EXPECT_EQ(4UL, ht.getNumBuckets());
+    EXPECT_EQ(0UL, ht.getNextBucketToMigrate());
+    EXPECT_EQ(arrayLen, ht.getNumEntries());
+    for (uint32_t i = 0; i < arrayLen; i++) {
+        EXPECT_EQ(&objects[i], ht.lookup(0, objects[i].key2(),
+                                         objects[i].key2Length()));
+        EXPECT_EQ(bucketIndexes[i],
+                  ht.getBucketIndex(0, objects[i].key2(),
+                                    objects[i].key2Length()) % 2);
+    }
+    EXPECT_EQ(arrayLen, ht.forEach(test_forEach_callback,
+                                   reinterpret_cast<void *>(57)));
+    for (uint32_t i = 0; i < arrayLen; i++)
+        EXPECT_EQ(2U, objects[i].count);
+    delete[] objects;
+}
+
 } // namespace RAMCloud
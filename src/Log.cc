@@ -21,6 +21,7 @@
 #include "LogCleaner.h"
 #include "ServerRpcPool.h"
 #include "ShortMacros.h"
+#include "ThreadId.h"
 #include "TransportManager.h" // for Log memory 0-copy registration hack
 
 namespace RAMCloud {
@@ -44,8 +45,18 @@ namespace RAMCloud {
  * \param[in] cleanerOption
  *      Cleaner option from the Log::CleanerOption enum. This lets the
  *      user of this object specify whether to use a cleaner, as well as
- *      whether to run it in a separate thread or inlined with the Log
+ *      whether to run it in separate threads or inlined with the Log
  *      code.
+ * \param[in] numCleanerThreads
+ *      Number of threads cleaning the log at once, if cleanerOption is
+ *      CONCURRENT_CLEANER.
+ * \param[in] minDiskUtilisation
+ *      Percentage of backup space that must hold live data before the
+ *      cleaner rewrites replicas. Until utilisation drops this low the
+ *      cleaner compacts Segments in memory only. 0 disables compaction.
+ * \param[in] numHeads
+ *      Number of head Segments appends are spread over, so that threads
+ *      appending to different heads need not wait for one another.
  * \throw LogException
  *      An exception is thrown if #logCapacity is not sufficient for
  *      a single segment's worth of log.
@@ -55,7 +66,10 @@ Log::Log(const ServerId& logId,
          uint32_t segmentCapacity,
          uint32_t maximumBytesPerAppend,
          ReplicaManager *replicaManager,
-         CleanerOption cleanerOption)
+         CleanerOption cleanerOption,
+         uint32_t numCleanerThreads,
+         uint32_t minDiskUtilisation,
+         uint32_t numHeads)
     : stats(),
       logCapacity((logCapacity / segmentCapacity) * segmentCapacity),
       segmentCapacity(segmentCapacity),
@@ -64,6 +78,7 @@ Log::Log(const ServerId& logId,
       segmentMemory(this->logCapacity),
       nextSegmentId(0),
       head(NULL),
+      heads(),
       emergencyCleanerList(),
       freeList(),
       cleanableNewList(),
@@ -76,11 +91,11 @@ Log::Log(const ServerId& logId,
       activeBaseAddressMap(),
       logTypeMap(),
       listLock(),
-      appendLock(),
       replicaManager(replicaManager),
       cleanerOption(cleanerOption),
       cleaner(this, replicaManager,
-              cleanerOption == CONCURRENT_CLEANER),
+              cleanerOption == CONCURRENT_CLEANER ? numCleanerThreads : 0,
+              minDiskUtilisation),
       logIteratorCount(0)
 {
     if (logCapacity == 0) {
@@ -95,6 +110,9 @@ Log::Log(const ServerId& logId,
             "for given segmentCapacity");
     }
 
+    for (uint32_t i = 0; i < std::max(numHeads, 1U); i++)
+        heads.push_back(new Head());
+
     for (uint64_t i = 0; i < logCapacity / segmentCapacity; i++) {
         locklessAddToFreeList(static_cast<char*>(segmentMemory.get()) +
             i * segmentCapacity);
@@ -114,21 +132,26 @@ Log::~Log()
     foreach (LogTypeMap::value_type& typeCallbackPair, logTypeMap)
         delete typeCallbackPair.second;
 
-    cleanableNewList.clear_and_dispose(SegmentDisposer());
-    cleanableList.clear_and_dispose(SegmentDisposer());
-    cleanablePendingDigestList.clear_and_dispose(SegmentDisposer());
-    freePendingDigestAndReferenceList.clear_and_dispose(SegmentDisposer());
+    // Oldest first: Segments compacted by the cleaner must be unlinked
+    // before the Segments holding them are disposed of.
     freePendingReferenceList.clear_and_dispose(SegmentDisposer());
+    freePendingDigestAndReferenceList.clear_and_dispose(SegmentDisposer());
+    cleanablePendingDigestList.clear_and_dispose(SegmentDisposer());
+    cleanableList.clear_and_dispose(SegmentDisposer());
+    cleanableNewList.clear_and_dispose(SegmentDisposer());
 
-    if (head)
-        delete head;
+    foreach (Head* slot, heads) {
+        delete slot->segment;
+        delete slot;
+    }
 }
 
 /**
- * Allocate a new head Segment and write the LogDigest before returning.
- * The current head is closed and replaced with the new one.  All the
- * usual log durability constraints are enforced by the underlying
- * ReplicaManager for safety during the transition to the new head.
+ * Allocate new head Segments and write the LogDigest before returning.
+ * Every one of the log's heads is closed and replaced with a new one (see
+ * #rollHeads).  All the usual log durability constraints are enforced by
+ * the underlying ReplicaManager for safety during the transition to the new
+ * heads.
  *
  * As we think about allowing concurrent workers code should
  * move to using an interface more like allocateHeadIfStillOn().
@@ -139,30 +162,55 @@ Log::~Log()
 void
 Log::allocateHead()
 {
-    Lock lock(listLock);
-    allocateHeadInternal(lock, {});
+    lockHeads();
+    try {
+        rollHeads();
+    } catch (...) {
+        unlockHeads();
+        throw;
+    }
+    unlockHeads();
 }
 
 /**
- * Allocate a new head Segment and write the LogDigest before returning if
- * the provided \a segmentId is still the current log head.
- * The current head is closed and replaced with the new one.  All the
- * usual log durability constraints are enforced by the underlying
- * ReplicaManager for safety during the transition to the new head.
+ * Allocate new head Segments and write the LogDigest before returning if
+ * the provided \a segmentId is still one of the log's heads.
+ * Every head is closed and replaced with a new one (see #rollHeads).  All
+ * the usual log durability constraints are enforced by the underlying
+ * ReplicaManager for safety during the transition to the new heads.
  *
  * \param segmentId
- *      Only allocate a new log head if the current log head is the one
- *      specified.  This is used to prevent useless allocations in the
+ *      Only allocate a new log head if the Segment specified is still open
+ *      as a log head.  This is used to prevent useless allocations in the
  *      case that multiple callers try to allocate new log heads at the
- *      same time.
+ *      same time.  If the log has no head at all, one is allocated
+ *      regardless.
  * \throw LogOutOfMemoryException
  *      If no Segments are free.
  */
 void
 Log::allocateHeadIfStillOn(uint64_t segmentId)
 {
-    Lock lock(listLock);
-    allocateHeadInternal(lock, { segmentId });
+    lockHeads();
+    try {
+        bool stillOn;
+        {
+            Lock lock(listLock);
+            stillOn = (head == NULL);
+            foreach (Head* slot, heads) {
+                if (slot->segment != NULL &&
+                    slot->segment->getId() == segmentId) {
+                    stillOn = true;
+                }
+            }
+        }
+        if (stillOn)
+            rollHeads();
+    } catch (...) {
+        unlockHeads();
+        throw;
+    }
+    unlockHeads();
 }
 
 /**
@@ -248,7 +296,6 @@ LogEntryHandleVector
 Log::multiAppend(LogMultiAppendVector& appends, bool sync)
 {
     SegmentEntryHandleVector handles;
-    bool allocatedHead = false;
 
     for (size_t i = 0; i < appends.size(); i++) {
         assert(getTypeInfo(appends[i].type) != NULL);
@@ -259,40 +306,55 @@ Log::multiAppend(LogMultiAppendVector& appends, bool sync)
         }
     }
 
-    std::lock_guard<SpinLock> lock(appendLock);
+    Head& slot = getHead();
+    Segment* appendedTo = NULL;
 
-    do {
-        if (head != NULL)
-            handles = head->multiAppend(appends, sync);
+    {
+        HeadLock lock(slot.appendLock);
+        if (slot.segment != NULL)
+            handles = slot.segment->multiAppend(appends, false);
+        appendedTo = slot.segment;
+    }
 
-        // If either the head Segment is full, or we've never allocated one,
-        // get a new head.
-        if (handles.size() == 0) {
-            // If we couldn't fit in the old head and allocated a new one and
-            // still cannot fit, then the request is simply too big.
-            if (allocatedHead) {
-                uint32_t appendSize = 0;
-                for (size_t i = 0; i < appends.size(); i++)
-                    appendSize += appends[i].length;
-                throw LogException(HERE,
-                   format("WARNING: multiAppend of length %u simply won't "
-                          "fit in segment of size %u: object(s) too large",
-                          appendSize,
-                          maximumBytesPerAppend));
+    // If either the head Segment is full, or we've never allocated one,
+    // get new heads. That takes every head's append lock, so ours had to
+    // be dropped first; another thread may have rolled them meanwhile.
+    if (handles.size() == 0) {
+        lockHeads();
+        try {
+            if (slot.segment != NULL && slot.segment != appendedTo)
+                handles = slot.segment->multiAppend(appends, false);
+            if (handles.size() == 0) {
+                rollHeads();
+                handles = slot.segment->multiAppend(appends, false);
             }
-
-            // allocateHead could throw if we're low on segments (we need to
+        } catch (LogOutOfMemoryException& e) {
+            unlockHeads();
+            // rollHeads could throw if we're low on segments (we need to
             // keep spares so that the cleaner can make forward progress).
-            try {
-                allocateHead();
-                allocatedHead = true;
-            } catch (LogOutOfMemoryException& e) {
-                if (cleanerOption == INLINED_CLEANER)
-                    cleaner.clean();
-                throw e;
-            }
+            if (cleanerOption == INLINED_CLEANER)
+                cleaner.clean();
+            throw e;
+        } catch (...) {
+            unlockHeads();
+            throw;
+        }
+        appendedTo = slot.segment;
+        unlockHeads();
+
+        // If we couldn't fit in the old head and allocated a new one and
+        // still cannot fit, then the request is simply too big.
+        if (handles.size() == 0) {
+            uint32_t appendSize = 0;
+            for (size_t i = 0; i < appends.size(); i++)
+                appendSize += appends[i].length;
+            throw LogException(HERE,
+               format("WARNING: multiAppend of length %u simply won't "
+                      "fit in segment of size %u: object(s) too large",
+                      appendSize,
+                      maximumBytesPerAppend));
         }
-    } while (handles.size() == 0);
+    }
 
     assert(handles.size() == appends.size());
 
@@ -301,6 +363,17 @@ Log::multiAppend(LogMultiAppendVector& appends, bool sync)
         stats.totalBytesAppended += handles[i]->totalLength();
     }
 
+    uint32_t syncOffset = handles.back()->logPosition().segmentOffset() +
+                          handles.back()->totalLength();
+
+    // Wait for backups only after dropping the append lock: other writers
+    // can then fill the head while this one's replication is in flight, and
+    // whatever they queue is carried by the next write RPC to each backup
+    // and acknowledged together (group commit). The segment cannot be freed
+    // under us, since the cleaner waits out all RPCs older than its epoch.
+    if (sync)
+        appendedTo->sync(syncOffset);
+
     if (cleanerOption == INLINED_CLEANER)
         cleaner.clean();
 
@@ -427,8 +500,11 @@ Log::getTypeInfo(LogEntryType type)
 void
 Log::sync()
 {
-    if (head)
-        head->sync();
+    foreach (Head* slot, heads) {
+        HeadLock lock(slot->appendLock);
+        if (slot->segment != NULL)
+            slot->segment->sync();
+    }
 }
 
 /**
@@ -542,8 +618,8 @@ Log::cleaningInto(Segment* segment)
 
 /**
  * Alert the Log that the following Segments have been cleaned. The Log
- * takes note of the newly cleaned Segments and any new Segments reported
- * via the #cleaningInto method. When the next head is allocated in
+ * takes note of the newly cleaned Segments and of the new Segments their
+ * live data was moved to. When the next head is allocated in
  * #allocateHead, the LogDigest will be updated to reflect all of the new
  * Segments and none of the cleaned ones. This method also checks previously
  * cleaned Segments and any that have been removed from the Log and are no
@@ -552,6 +628,12 @@ Log::cleaningInto(Segment* segment)
  * \param[in] clean
  *      Vector of pointers to Segments that have been cleaned.
  *
+ * \param[in] survivors
+ *      Vector of pointers to the Segments, previously reported via the
+ *      #cleaningInto method, that the live data in \a clean was moved to.
+ *      Survivors of passes that other cleaner threads are still working on
+ *      stay where they are until those passes complete.
+ *
  * \param[in] unusedSegmentMemory
  *      Vector of pointers to segment memory that were allocated for
  *      cleaning via #getSegmentMemoryForCleaning, but were not used. These
@@ -559,6 +641,7 @@ Log::cleaningInto(Segment* segment)
  */
 void
 Log::cleaningComplete(SegmentVector& clean,
+                      SegmentVector& survivors,
                       std::vector<void*>& unusedSegmentMemory)
 {
     std::lock_guard<SpinLock> lock(listLock);
@@ -574,10 +657,9 @@ Log::cleaningComplete(SegmentVector& clean,
     // New Segments we've added during cleaning need to wait
     // until the next head is written before they become part
     // of the Log.
-    while (!cleaningIntoList.empty()) {
-        Segment& s = cleaningIntoList.front();
-        cleaningIntoList.pop_front();
-        cleanablePendingDigestList.push_back(s);
+    foreach (Segment* s, survivors) {
+        cleaningIntoList.erase(cleaningIntoList.iterator_to(*s));
+        cleanablePendingDigestList.push_back(*s);
         change = true;
     }
 
@@ -609,17 +691,28 @@ Log::cleaningComplete(SegmentVector& clean,
             freeSegments.push_back(&s);
         }
     }
-    while (freeSegments.size() > 0) {
-        Segment* s = freeSegments.back();
-        freeSegments.pop_back();
-        activeIdMap.erase(s->getId());
+    // Free in the order cleaned, so that a compacted Segment has left its
+    // list before the Segment it was compacted into is freed.
+    foreach (Segment* s, freeSegments) {
         activeBaseAddressMap.erase(s->getBaseAddress());
         freePendingReferenceList.erase(
             freePendingReferenceList.iterator_to(*s));
         locklessAddToFreeList(const_cast<void*>(s->getBaseAddress()));
+        change = true;
+
+        // A compacted Segment's data lives on in another Segment, which
+        // depends on its replicas and frees them along with its own.
+        if (s->compacted)
+            continue;
+
+        foreach (Segment* compacted, s->compactedSegments) {
+            activeIdMap.erase(compacted->getId());
+            compacted->freeReplicas();
+            delete compacted;
+        }
+        activeIdMap.erase(s->getId());
         s->freeReplicas();
         delete s;
-        change = true;
     }
 
     if (change)
@@ -646,11 +739,91 @@ Log::allocateSegmentId()
 ////////////////////////////////////
 
 /**
- * Allocate a new head Segment and write the LogDigest before returning if
- * the optionally provided \a segmentId is still the current log head.
- * The current head is closed and replaced with the new one.  All the
- * usual log durability constraints are enforced by the underlying
- * ReplicaManager for safety during the transition to the new head.
+ * Return the head the calling thread appends to. Threads are spread over
+ * #heads by their ThreadId, so that a given thread always uses the same one.
+ */
+Log::Head&
+Log::getHead()
+{
+    return *heads[ThreadId::get() % heads.size()];
+}
+
+/**
+ * Return whether the given Segment is open as one of the log's #heads. The
+ * caller must hold #listLock.
+ */
+bool
+Log::isHead(const Segment* segment) const
+{
+    foreach (const Head* slot, heads) {
+        if (slot->segment == segment)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Acquire the append locks of all #heads, always in the same order, so
+ * that nothing can be appended to the log until #unlockHeads is called.
+ */
+void
+Log::lockHeads()
+{
+    foreach (Head* slot, heads)
+        slot->appendLock.lock();
+}
+
+/**
+ * Release the append locks acquired by #lockHeads.
+ */
+void
+Log::unlockHeads()
+{
+    foreach (Head* slot, heads)
+        slot->appendLock.unlock();
+}
+
+/**
+ * Replace every one of the #heads with a new Segment. The caller must hold
+ * the append locks of all the heads (see #lockHeads) but not #listLock.
+ *
+ * All of the new heads carry the same LogDigest, which names each of them,
+ * so the open heads always describe the whole log together and recovery
+ * may start from any one of them. The old heads are closed, and with more
+ * than one head this waits until backups have acknowledged all of those
+ * closes (and hence that the new heads are durably open) before any of
+ * the new heads take appends. Otherwise data acknowledged in one new head
+ * could be lost without a trace along with it, should recovery find only
+ * an old head that is still open, whose digest does not name the new one.
+ * ReplicatedSegment already orders a single head after its predecessor.
+ * Writers that want one of the heads meanwhile sleep on its append lock.
+ *
+ * \throw LogOutOfMemoryException
+ *      If not enough Segments are free.
+ */
+void
+Log::rollHeads()
+{
+    SegmentVector oldHeads;
+    {
+        Lock lock(listLock);
+        allocateHeadInternal(lock, oldHeads);
+    }
+
+    // Closed Segments are only freed once a later digest leaves them out,
+    // which cannot happen while the heads are locked.
+    if (heads.size() > 1) {
+        foreach (Segment* oldHead, oldHeads)
+            oldHead->sync();
+    }
+}
+
+/**
+ * Allocate a new head Segment for each of the #heads and write the
+ * LogDigest to them before returning. The Segments that were open in the
+ * slots, if any, are closed and replaced with the new ones.  All the usual
+ * log durability constraints are enforced by the underlying ReplicaManager
+ * for safety during the transition to each new head.
  *
  * \param lock
  *      Not used; just here to prove that the caller at least acquired some
@@ -658,44 +831,54 @@ Log::allocateSegmentId()
  *      #listLock.  This provides consistency of the lists but also
  *      ensures two threads aren't trying to allocate a new head at the same
  *      time.
- * \param segmentId
- *      Only allocate a new log head if the current log head is the one
- *      specified.  If \a segmentId is empty a new head is allocated
- *      regardless of which segment is currently the log head.  This is
- *      used to prevent useless allocations in the case that multiple
- *      callers try to allocate new log heads at the same time.
+ * \param[out] oldHeads
+ *      The heads that were closed are appended here.
  * \throw LogOutOfMemoryException
- *      If no Segments are free.
+ *      If not enough Segments are free.
  */
 void
-Log::allocateHeadInternal(Lock& lock, Tub<uint64_t> segmentId)
+Log::allocateHeadInternal(Lock& lock, SegmentVector& oldHeads)
 {
-    if (head && segmentId && head->getId() != *segmentId)
-        return;
-
     // these currently also take listLock, so rather than have
     // unlocked versions of those methods or duplicating code,
     // just do them before taking the big lock for this method.
-    void* baseAddress = getFromFreeList(lock, true);
+    std::vector<void*> baseAddresses;
+    try {
+        while (baseAddresses.size() < heads.size())
+            baseAddresses.push_back(getFromFreeList(lock, true));
+    } catch (LogOutOfMemoryException& e) {
+        while (!baseAddresses.empty()) {
+            freeList.push_back(baseAddresses.back());
+            baseAddresses.pop_back();
+        }
+        throw;
+    }
 
-    // NB: Allocate an ID _after_ having acquired memory. If we don't,
+    // NB: Allocate IDs _after_ having acquired memory. If we don't,
     //     the allocation could fail and we've just leaked a segment
     //     identifier (feel free to read the comments in allocateSegmentId
     //     if you don't know why this is bad.
-    LogDigest::SegmentId newHeadId = nextSegmentId++;
+    LogDigest::SegmentId firstHeadId = nextSegmentId;
+    nextSegmentId += heads.size();
 
-    if (head != NULL)
-        cleanableNewList.push_back(*head);
+    foreach (Head* slot, heads) {
+        if (slot->segment != NULL) {
+            cleanableNewList.push_back(*slot->segment);
+            oldHeads.push_back(slot->segment);
+        }
+    }
 
-    // New Log head + active Segments + cleaner pending Segments (but
-    // only if we're not locked out of freeing by LogIterator(s)).
-    size_t segmentCount = 1;
-    segmentCount += cleanableList.size() + cleanableNewList.size();
+    // New Log heads + active Segments + cleaner pending Segments (but only
+    // if we're not locked out of freeing by LogIterator(s)).
+    size_t segmentCount = heads.size();
+    segmentCount += getDigestSegmentCount(cleanableList) +
+                    getDigestSegmentCount(cleanableNewList);
 
     if (logIteratorCount == 0)
-        segmentCount += cleanablePendingDigestList.size();
+        segmentCount += getDigestSegmentCount(cleanablePendingDigestList);
     else
-        segmentCount += freePendingDigestAndReferenceList.size();
+        segmentCount += getDigestSegmentCount(
+            freePendingDigestAndReferenceList);
 
     size_t digestBytes = LogDigest::getBytesFromCount(segmentCount);
     char temp[digestBytes];
@@ -710,13 +893,10 @@ Log::allocateHeadInternal(Lock& lock, Tub<uint64_t> segmentId)
         }
     }
 
-    foreach (Segment& s, cleanableList)
-        digest.addSegment(downCast<LogDigest::SegmentId>(s.getId()));
-
-    foreach (Segment& s, cleanableNewList)
-        digest.addSegment(downCast<LogDigest::SegmentId>(s.getId()));
-
-    digest.addSegment(newHeadId);
+    addToDigest(digest, cleanableList);
+    addToDigest(digest, cleanableNewList);
+    for (size_t i = 0; i < heads.size(); i++)
+        digest.addSegment(firstHeadId + i);
 
     // Only preclude/free cleaned segments if no log iteration in progress.
     if (logIteratorCount == 0) {
@@ -726,23 +906,80 @@ Log::allocateHeadInternal(Lock& lock, Tub<uint64_t> segmentId)
             freePendingReferenceList.push_back(s);
         }
     } else {
-        foreach (Segment& s, freePendingDigestAndReferenceList)
-            digest.addSegment(downCast<LogDigest::SegmentId>(s.getId()));
+        addToDigest(digest, freePendingDigestAndReferenceList);
     }
 
-    Segment* nextHead = new Segment(this, true, newHeadId, baseAddress,
-        segmentCapacity, replicaManager, LOG_ENTRY_TYPE_LOGDIGEST, temp,
-        downCast<uint32_t>(digestBytes));
+    for (size_t i = 0; i < heads.size(); i++) {
+        Head& slot = *heads[i];
+        Segment* nextHead = new Segment(this, true, firstHeadId + i,
+            baseAddresses[i], segmentCapacity, replicaManager,
+            LOG_ENTRY_TYPE_LOGDIGEST, temp,
+            downCast<uint32_t>(digestBytes));
 
-    activeIdMap[nextHead->getId()] = nextHead;
-    activeBaseAddressMap[nextHead->getBaseAddress()] = nextHead;
+        activeIdMap[nextHead->getId()] = nextHead;
+        activeBaseAddressMap[nextHead->getBaseAddress()] = nextHead;
+
+        // only close the old head _after_ we've opened up the new head!
+        if (slot.segment != NULL) {
+            // an exception here would be problematic.
+            slot.segment->close(nextHead, false);
+        }
 
-    // only close the old head _after_ we've opened up the new head!
-    if (head) {
-        head->close(nextHead, false); // an exception here would be problematic.
+        slot.segment = nextHead;
+        head = nextHead;
     }
+}
 
-    head = nextHead;
+/**
+ * Count the Segment identifiers that #addToDigest will add for the given
+ * list. Segments the cleaner compacted in memory have no replicas of their
+ * own and stand for those of the Segments they were compacted from.
+ *
+ * \param list
+ *      The list of Segments to count. The caller must hold #listLock.
+ */
+size_t
+Log::getDigestSegmentCount(SegmentList& list)
+{
+    size_t count = 0;
+    foreach (Segment& s, list) {
+        if (!s.inMemoryOnly) {
+            count++;
+            continue;
+        }
+        foreach (Segment* compacted, s.compactedSegments) {
+            if (!compacted->inMemoryOnly)
+                count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Add the identifiers of the Segments in the given list to a LogDigest. For
+ * Segments the cleaner compacted in memory, the identifiers of the Segments
+ * whose replicas hold their data are added instead.
+ *
+ * \param digest
+ *      The LogDigest to add to.
+ * \param list
+ *      The list of Segments to add. The caller must hold #listLock.
+ */
+void
+Log::addToDigest(LogDigest& digest, SegmentList& list)
+{
+    foreach (Segment& s, list) {
+        if (!s.inMemoryOnly) {
+            digest.addSegment(downCast<LogDigest::SegmentId>(s.getId()));
+            continue;
+        }
+        foreach (Segment* compacted, s.compactedSegments) {
+            if (!compacted->inMemoryOnly) {
+                digest.addSegment(
+                    downCast<LogDigest::SegmentId>(compacted->getId()));
+            }
+        }
+    }
 }
 
 /**
@@ -948,18 +1185,58 @@ Log::getSegmentFromAddress(const void* address)
  * part of the tablet. This is important in tablet migration and when
  * creating, deleting, and re-creating the same tablet on a master since we
  * don't want recovery to resurrect old objects.
+ *
+ * If the log has several heads, the older ones are synced and closed first,
+ * so that every entry appended before this call lies before the position
+ * returned and every entry appended after it lies at or beyond it. The
+ * next append from one of their threads replaces all of the heads.
  */
 LogPosition
 Log::headOfLog()
 {
-    std::lock_guard<SpinLock> lock(listLock);
+    if (heads.size() == 1) {
+        std::lock_guard<SpinLock> lock(listLock);
 
-    if (head == NULL) {
-        assert(nextSegmentId == 0);
-        return { 0, 0 };
+        if (head == NULL) {
+            assert(nextSegmentId == 0);
+            return { 0, 0 };
+        }
+
+        return { head->getId(), head->getTotalBytesAppended() };
     }
 
-    return { head->getId(), head->getTotalBytesAppended() };
+    lockHeads();
+
+    LogPosition position;
+    SegmentVector closedHeads;
+    {
+        Lock lock(listLock);
+        if (head == NULL) {
+            assert(nextSegmentId == 0);
+        } else {
+            // The heads share a digest that names all of them, so the
+            // newest one stands in for the others on backups once they
+            // are closed.
+            foreach (Head* slot, heads) {
+                if (slot->segment == NULL || slot->segment == head)
+                    continue;
+                cleanableNewList.push_back(*slot->segment);
+                slot->segment->close(NULL, false);
+                closedHeads.push_back(slot->segment);
+                slot->segment = NULL;
+            }
+            position = { head->getId(), head->getTotalBytesAppended() };
+        }
+    }
+
+    // Wait for the closes as #rollHeads does, so that none of these can
+    // still be found open with their digest once the next heads take
+    // appends. Nor can they be freed before the heads are unlocked.
+    foreach (Segment* closed, closedHeads)
+        closed->sync();
+
+    unlockHeads();
+    return position;
 }
 
 /**
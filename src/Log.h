@@ -17,9 +17,16 @@
 #define RAMCLOUD_LOG_H
 
 #include <stdint.h>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
+#if __GNUC__ >= 4 && __GNUC_MINOR__ >= 5
+#include <atomic>
+#else
+#include <cstdatomic>
+#endif
+
 #include "BoostIntrusive.h"
 #include "LargeBlockOfMemory.h"
 #include "LogCleaner.h"
@@ -63,6 +70,8 @@ typedef bool (*log_liveness_cb_t)(LogEntryHandle, void *);
 typedef bool (*log_relocation_cb_t)(LogEntryHandle, LogEntryHandle, void *);
 typedef uint32_t (*log_timestamp_cb_t)(LogEntryHandle);
 
+class LogDigest;
+
 /**
  * Each append operation on a Log writes a typed blob. Types must
  * be registered with the Log before appending. This class describes
@@ -139,6 +148,13 @@ class LogTypeInfo {
  * LogCleaner actively defragments old Segments, providing fresh ones to use at
  * the head.
  *
+ * So that appends from different threads need not wait for one another, the
+ * Log may have several heads open at once. Each thread appends to one of them,
+ * chosen by its ThreadId. The heads are always replaced together and share
+ * one LogDigest that lists all of them, and the new heads take no appends
+ * until the old ones are durably closed, so any open head recovery finds
+ * describes the whole log.
+ *
  * This class is essentially just a manager of Segments, threading them together
  * to form the logical Log.
  */
@@ -160,7 +176,10 @@ class Log {
         uint32_t segmentCapacity,
         uint32_t maximumBytesPerAppend,
         ReplicaManager *replicaManager = NULL,
-        CleanerOption cleanerOption = CONCURRENT_CLEANER);
+        CleanerOption cleanerOption = CONCURRENT_CLEANER,
+        uint32_t numCleanerThreads = 1,
+        uint32_t minDiskUtilisation = 0,
+        uint32_t numHeads = 1);
     ~Log();
     void           allocateHead();
     void           allocateHeadIfStillOn(uint64_t segmentId);
@@ -197,6 +216,7 @@ class Log {
     void           getNewCleanableSegments(SegmentVector& out);
     void           cleaningInto(Segment* newSegment);
     void           cleaningComplete(SegmentVector &clean,
+                                    SegmentVector &survivors,
                                     std::vector<void*>& unusedSegmentMemory);
     void          *getSegmentMemoryForCleaning(bool useEmergencyReserve);
     size_t         freeListCount();
@@ -213,10 +233,14 @@ class Log {
         uint64_t getFrees() const;
 
       PRIVATE:
-        uint64_t totalBytesAppended;
-        uint64_t totalAppends;
-        uint64_t totalBytesFreed;
-        uint64_t totalFrees;
+        // Appends and frees may come from several threads at once (worker
+        // threads of the MasterService, or replay threads, see
+        // MasterService::recoverSegment). Appends to different heads are
+        // not serialized.
+        std::atomic<uint64_t> totalBytesAppended;
+        std::atomic<uint64_t> totalAppends;
+        std::atomic<uint64_t> totalBytesFreed;
+        std::atomic<uint64_t> totalFrees;
 
         friend class Log;
     };
@@ -234,6 +258,33 @@ class Log {
 
   PRIVATE:
     typedef std::lock_guard<SpinLock> Lock;
+    typedef std::lock_guard<std::mutex> HeadLock;
+
+    /**
+     * One of the Log's open head Segments, along with the lock that
+     * serializes appends to it.
+     */
+    struct Head {
+        Head()
+            : segment(NULL),
+              appendLock()
+        {
+        }
+
+        /// The open Segment appended to, or NULL if there is none yet (or
+        /// #headOfLog has closed it) and the next append must allocate one.
+        Segment* segment;
+
+        /// Serializes appends to #segment, which may be requested by any
+        /// number of threads at once. Syncing appends to backups happens
+        /// outside of it so that concurrent writers' data can be replicated
+        /// together. This is a blocking mutex rather than a SpinLock since
+        /// #rollHeads, #headOfLog and #sync hold it while waiting on backup
+        /// round trips; writers then sleep instead of spinning.
+        std::mutex appendLock;
+
+        DISALLOW_COPY_AND_ASSIGN(Head);
+    };
 
     /**
      * Class used when destroying boost intrusive lists and destroying/freeing
@@ -244,6 +295,12 @@ class Log {
         void
         operator()(Segment* segment)
         {
+            // Compacted Segments belong to the Segment they were compacted
+            // into. The lists are disposed of so that it comes later.
+            if (segment->compacted)
+                return;
+            foreach (Segment* compacted, segment->compactedSegments)
+                delete compacted;
             delete segment;
         }
     };
@@ -255,7 +312,14 @@ class Log {
     typedef std::unordered_map<uint64_t, Segment *> ActiveIdMap;
     typedef std::unordered_map<const void *, Segment *> BaseAddressMap;
 
-    void        allocateHeadInternal(Lock& lock, Tub<uint64_t> segmentId);
+    Head&       getHead();
+    bool        isHead(const Segment* segment) const;
+    void        lockHeads();
+    void        unlockHeads();
+    void        rollHeads();
+    void        allocateHeadInternal(Lock& lock, SegmentVector& oldHeads);
+    size_t      getDigestSegmentCount(SegmentList& list);
+    void        addToDigest(LogDigest& digest, SegmentList& list);
     void        dumpListStats();
     void        locklessAddToFreeList(void *p);
     void*       getFromFreeList(bool mayUseLastSegment);
@@ -293,9 +357,15 @@ class Log {
      * memory is on the freeList.
      */
 
-    /// Current head of the log.
+    /// The newest of the #heads: the one with the highest identifier. NULL
+    /// until the first head is allocated.
     Segment *head;
 
+    /// The heads appends are spread over, one per stripe of threads. There
+    /// is always at least one. They are all replaced at once, see
+    /// #rollHeads.
+    std::vector<Head*> heads;
+
     /// List of free #segmentCapacity blocks to be allocated to the cleaner
     /// under extreme memory pressure. The cleaner may only allocate from
     /// this list if it promises to free enough segments to replenish it to
@@ -326,8 +396,8 @@ class Log {
     /// live entries in). This is needed in case deletions of those entries
     /// occur before cleaning has finished (the Log code must be able to look
     /// up the Segment* from the pointer into the Segment to update the
-    /// statistics). When #cleaningComplete() is called, this list is drained
-    /// into the #cleanablePendingDigestList.
+    /// statistics). When #cleaningComplete() is called for the pass that
+    /// filled them, they move to the #cleanablePendingDigestList.
     SegmentList cleaningIntoList;
 
     /// List of new Segments generated by the cleaner that need to be added
@@ -377,10 +447,6 @@ class Log {
     /// various lists and maps that represent their current state.
     SpinLock listLock;
 
-    /// Lock taken around log append operations. This is currently only used
-    /// to delay appends to the log head while migration is underway.
-    SpinLock appendLock;
-
     /// Given to Segments to make them durable
     ReplicaManager *replicaManager;
 
@@ -398,6 +464,7 @@ class Log {
     int logIteratorCount;
 
     friend class LogIterator;
+    friend class LogCleanerBenchmark;
 
     DISALLOW_COPY_AND_ASSIGN(Log);
 };
@@ -35,26 +35,38 @@ namespace RAMCloud {
  * \param[in] replicaManager
  *      The ReplicaManager to use for Segments written out by
  *      the cleaner.
- * \param[in] startThread
- *      If true, start a new thread that polls for work and calls
- *      the #clean method. If false, it's expected that the owner of
+ * \param[in] numThreads
+ *      Number of threads to start that poll for work and clean disjoint
+ *      sets of Segments at once. If 0, it's expected that the owner of
  *      this object will call the #clean method when they want cleaning
  *      to occur.
+ * \param[in] minDiskUtilisation
+ *      Percentage of backup space that must hold live data before passes
+ *      rewrite replicas; until then they compact Segments in memory only.
+ *      If 0, Segments are never compacted. See #minDiskUtilisation.
  */
 LogCleaner::LogCleaner(Log* log,
                        ReplicaManager *replicaManager,
-                       bool startThread)
+                       uint32_t numThreads,
+                       uint32_t minDiskUtilisation)
     : bytesFreedBeforeLastCleaning(0),
       scanList(),
       cleanableSegments(),
       log(log),
       replicaManager(replicaManager),
-      thread(),
+      candidateMutex(),
+      threads(),
       threadShouldExit(false),
+      minDiskUtilisation(minDiskUtilisation),
       perfCounters()
 {
-    if (startThread)
-        thread.construct(cleanerThreadEntry, this, &Context::get());
+    for (uint32_t i = 0; i < numThreads; i++) {
+        CleanerThread* cleanerThread = new CleanerThread();
+        threads.push_back(cleanerThread);
+        cleanerThread->thread.construct(cleanerThreadEntry, this,
+                                        &cleanerThread->perfCounters,
+                                        &Context::get());
+    }
 }
 
 LogCleaner::~LogCleaner()
@@ -73,31 +85,116 @@ LogCleaner::~LogCleaner()
 bool
 LogCleaner::clean()
 {
-    CycleCounter<uint64_t> totalTicks(&perfCounters.cleanTicks);
+    return doCleaningPass(perfCounters);
+}
+
+/**
+ * Halt the cleaner threads (if any are running). Once halted, they cannot
+ * be restarted. This method does not return until all cleaner threads have
+ * terminated.
+ */
+void
+LogCleaner::halt()
+{
+    if (threads.empty())
+        return;
+
+    threadShouldExit = true;
+    Fence::sfence();
+    foreach (CleanerThread* cleanerThread, threads) {
+        cleanerThread->thread->join();
+        delete cleanerThread;
+    }
+    threads.clear();
+    threadShouldExit = false;
+}
+
+////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////
+
+/**
+ * Entry point for a cleaner thread. This is invoked via the
+ * std::thread() constructor. This thread performs continuous
+ * cleaning on an as-needed basis.
+ *
+ * \param logCleaner
+ *      The cleaner the thread works for.
+ * \param counters
+ *      The thread's own performance counters.
+ * \param context
+ *      The context of the thread that created the cleaner.
+ */
+void
+LogCleaner::cleanerThreadEntry(LogCleaner* logCleaner,
+                               PerfCounters* counters,
+                               Context* context)
+{
+    Context::Guard _(*context);
+    LOG(NOTICE, "LogCleaner thread spun up");
+
+    while (1) {
+        Fence::lfence();
+        if (logCleaner->threadShouldExit)
+            break;
+        if (!logCleaner->doCleaningPass(*counters))
+            usleep(LogCleaner::POLL_USEC);
+    }
+}
+
+/**
+ * Do a cleaning pass if it's worth doing at the moment; see #clean.
+ * Several threads may do this at once. They take turns choosing the
+ * Segments to clean, but relocate the live data from them, which is most
+ * of the work, in parallel. Each pass writes into survivor Segments of its
+ * own and hands them, along with the Segments it cleaned, to the Log in
+ * Log::cleaningComplete.
+ *
+ * If #minDiskUtilisation is set and backups are still well utilised, the
+ * pass compacts Segments in memory instead of writing survivors to backups.
+ *
+ * \param counters
+ *      Performance counters of the calling thread.
+ * \return
+ *      true if cleaning was performed, otherwise false.
+ */
+bool
+LogCleaner::doCleaningPass(PerfCounters& counters)
+{
+    CycleCounter<uint64_t> totalTicks(&counters.cleanTicks);
     CycleCounter<uint64_t> totalPassTicks;
-    PerfCounters before = perfCounters;
+    PerfCounters before = counters;
+
+    Lock lock(candidateMutex);
 
     // Get new cleanable segments from the log and scan them to keep
     // track of space used by tombstones.
-    scanNewCleanableSegments();
+    scanNewCleanableSegments(counters);
 
     // Scan some cleanable Segments to update free space accounting.
-    scanForFreeSpace();
+    scanForFreeSpace(counters);
 
     SegmentVector segmentsToClean;
     LiveSegmentEntryHandleVector liveEntries;
     std::vector<void*> cleanSegmentMemory;
+    std::vector<SegmentVector> compactions;
+    bool emergency = false;
+
+    // Replicas lost since Segments were compacted must be recreated first,
+    // and only a pass that writes to backups can do that.
+    bool lostReplicas = (minDiskUtilisation != 0 && updateLostReplicas());
 
     // Check to see if the Log is out of memory. If so, we need to do an
     // emergency cleaning pass.
     if (log->freeListCount() == 0) {
-        if (!setUpEmergencyCleaningPass(liveEntries,
+        if (!setUpEmergencyCleaningPass(counters,
+                                        liveEntries,
                                         cleanSegmentMemory,
                                         segmentsToClean)) {
             // Reset counters to ignore this failed pass.
-            perfCounters = before;
-            perfCounters.failedNormalPasses++;
-            perfCounters.failedNormalPassTicks += totalTicks.stop();
+            counters = before;
+            counters.failedNormalPasses++;
+            counters.failedNormalPassTicks += totalTicks.stop();
             return false;
         }
 
@@ -105,90 +202,87 @@ LogCleaner::clean()
             "segments using %zd clean segments)", liveEntries.size(),
             cleanSegmentMemory.size(), segmentsToClean.size());
 
-        perfCounters.cleaningPasses++;
-        perfCounters.emergencyCleaningPasses++;
+        counters.cleaningPasses++;
+        counters.emergencyCleaningPasses++;
+        emergency = true;
+    } else if (minDiskUtilisation != 0 && !lostReplicas &&
+               getDiskUtilisation() >= static_cast<int>(minDiskUtilisation)) {
+        if (!setUpCompactionPass(lock,
+                                 counters,
+                                 compactions,
+                                 cleanSegmentMemory,
+                                 segmentsToClean)) {
+            // Reset counters to ignore this failed pass.
+            counters = before;
+            counters.failedNormalPasses++;
+            counters.failedNormalPassTicks += totalTicks.stop();
+            return false;
+        }
+
+        counters.cleaningPasses++;
+        counters.compactionPasses++;
     } else {
-        if (!setUpNormalCleaningPass(liveEntries,
+        if (!setUpNormalCleaningPass(lock,
+                                     counters,
+                                     liveEntries,
                                      cleanSegmentMemory,
-                                     segmentsToClean)) {
+                                     segmentsToClean,
+                                     minDiskUtilisation != 0)) {
             // Reset counters to ignore this failed pass.
-            perfCounters = before;
-            perfCounters.failedEmergencyPasses++;
-            perfCounters.failedEmergencyPassTicks += totalTicks.stop();
+            counters = before;
+            counters.failedEmergencyPasses++;
+            counters.failedEmergencyPassTicks += totalTicks.stop();
             return false;
         }
 
-        perfCounters.cleaningPasses++;
+        counters.cleaningPasses++;
     }
 
-    moveLiveData(liveEntries, cleanSegmentMemory, segmentsToClean);
-    perfCounters.segmentsCleaned += segmentsToClean.size();
+    // The Segments to clean are ours alone now.
+    if (lock.owns_lock())
+        lock.unlock();
+
+    SegmentVector survivors;
+    if (compactions.empty()) {
+        // Emergency passes have just enough memory for a single stream.
+        moveLiveData(counters, liveEntries, cleanSegmentMemory,
+                     segmentsToClean, survivors, !emergency);
+    } else {
+        compactSegments(counters, compactions, cleanSegmentMemory, survivors);
+    }
+    counters.segmentsCleaned += segmentsToClean.size();
 
-    CycleCounter<uint64_t> logTicks(&perfCounters.cleaningCompleteTicks);
-    log->cleaningComplete(segmentsToClean, cleanSegmentMemory);
+    CycleCounter<uint64_t> logTicks(&counters.cleaningCompleteTicks);
+    log->cleaningComplete(segmentsToClean, survivors, cleanSegmentMemory);
     logTicks.stop();
 
     totalTicks.stop();
-    perfCounters.cleaningPassTicks += totalPassTicks.stop();
-    dumpCleaningPassStats(before);
+    counters.cleaningPassTicks += totalPassTicks.stop();
+    dumpCleaningPassStats(counters, before);
 
     return true;
 }
 
-/**
- * Halt the cleaner thread (if one is running). Once halted, it cannot be
- * restarted. This method does not return until the cleaner thread has
- * terminated.
- */
-void
-LogCleaner::halt()
-{
-    if (thread) {
-        threadShouldExit = true;
-        Fence::sfence();
-        thread->join();
-        threadShouldExit = false;
-        thread.destroy();
-    }
-}
-
-////////////////////////////////////////
-/// Private Methods
-////////////////////////////////////////
-
-/**
- * Entry point for the cleaner thread. This is invoked via the
- * std::thread() constructor. This thread performs continuous
- * cleaning on an as-needed basis.
- */
-void
-LogCleaner::cleanerThreadEntry(LogCleaner* logCleaner, Context* context)
-{
-    Context::Guard _(*context);
-    LOG(NOTICE, "LogCleaner thread spun up");
-
-    while (1) {
-        Fence::lfence();
-        if (logCleaner->threadShouldExit)
-            break;
-        if (!logCleaner->clean())
-            usleep(LogCleaner::POLL_USEC);
-    }
-}
-
 /**
  * Dump a table of various cleaning times and counters to the log
  * for human consumption.
+ *
+ * \param counters
+ *      Performance counters of the thread that did the pass.
+ * \param before
+ *      The thread's counters as they were before the pass.
  */
 void
-LogCleaner::dumpCleaningPassStats(PerfCounters& before)
+LogCleaner::dumpCleaningPassStats(PerfCounters& counters,
+                                  PerfCounters& before)
 {
     LogLevel level = DEBUG;
 
-    PerfCounters delta = perfCounters - before;
+    PerfCounters delta = counters - before;
 
     LOG(level, "============ %sCleaning Pass Complete ============",
-        delta.emergencyCleaningPasses ? "EMERGENCY " : "");
+        delta.emergencyCleaningPasses ? "EMERGENCY " :
+        delta.compactionPasses ? "COMPACTION " : "");
 
     double cleanedBytesPerSec =
         static_cast<double>(delta.segmentsCleaned) *
@@ -207,20 +301,26 @@ LogCleaner::dumpCleaningPassStats(PerfCounters& before)
 
     LOG(level, "  Counters/Rates:");
     LOG(level, "    Total Cleaning Passes:          %9lu",
-        perfCounters.cleaningPasses + perfCounters.emergencyCleaningPasses);
+        counters.cleaningPasses + counters.emergencyCleaningPasses);
     LOG(level, "      Emergency Cleaning Passes:    %9lu   (%.2f%%)",
-        perfCounters.emergencyCleaningPasses,
-        100.0 * static_cast<double>(perfCounters.emergencyCleaningPasses) /
-        static_cast<double>(perfCounters.cleaningPasses +
-                            perfCounters.emergencyCleaningPasses));
+        counters.emergencyCleaningPasses,
+        100.0 * static_cast<double>(counters.emergencyCleaningPasses) /
+        static_cast<double>(counters.cleaningPasses +
+                            counters.emergencyCleaningPasses));
+    LOG(level, "      Compaction Passes:            %9lu   (%.2f%%)",
+        counters.compactionPasses,
+        100.0 * static_cast<double>(counters.compactionPasses) /
+        static_cast<double>(counters.cleaningPasses));
     LOG(level, "    Write Cost:                     %9.3f   (%.3f avg)",
         delta.writeCostSum,
-        perfCounters.writeCostSum /
-        static_cast<double>(perfCounters.cleaningPasses));
+        counters.writeCostSum /
+        static_cast<double>(counters.cleaningPasses));
     LOG(level, "    Segments Cleaned:               %9lu   (%.2f MB/s)",
         delta.segmentsCleaned, cleanedBytesPerSec / 1024.0 / 1024.0);
     LOG(level, "    Segments Generated:             %9lu   (%.2f MB/s)",
         delta.segmentsGenerated, generatedBytesPerSec / 1024.0 / 1024.0);
+    LOG(level, "      In Memory Only:               %9lu   (%lu overall)",
+        delta.compactedSegmentsGenerated, counters.compactedSegmentsGenerated);
     LOG(level, "    Net Clean Segments:             %9lu   (%.2f MB/s)",
         delta.segmentsCleaned - delta.segmentsGenerated,
         netCleanBytesPerSec / 1024.0 / 1024.0);
@@ -238,32 +338,32 @@ LogCleaner::dumpCleaningPassStats(PerfCounters& before)
         "(%lu bytes overall)",
         (delta.entriesLivenessChecked == 0) ? 0 :
         delta.liveEntryBytes / delta.entriesLivenessChecked,
-        (perfCounters.entriesLivenessChecked == 0) ? 0 :
-        perfCounters.liveEntryBytes / perfCounters.entriesLivenessChecked);
+        (counters.entriesLivenessChecked == 0) ? 0 :
+        counters.liveEntryBytes / counters.entriesLivenessChecked);
     LOG(level, "    Cleaned Segment Utilisation:    %9.2f%%  (%.2f%% avg)",
         100.0 * static_cast<double>(delta.liveEntriesRelocated) /
         static_cast<double>(delta.entriesLivenessChecked),
-        100.0 * static_cast<double>(perfCounters.liveEntriesRelocated) /
-        static_cast<double>(perfCounters.entriesLivenessChecked));
+        100.0 * static_cast<double>(counters.liveEntriesRelocated) /
+        static_cast<double>(counters.entriesLivenessChecked));
     LOG(level, "    Generated Segment Utilisation:  %9.2f%%  (%.2f%% avg)",
         static_cast<double>(delta.generatedUtilisationSum) /
         static_cast<double>(delta.segmentsGenerated),
-        static_cast<double>(perfCounters.generatedUtilisationSum) /
-        static_cast<double>(perfCounters.segmentsGenerated));
+        static_cast<double>(counters.generatedUtilisationSum) /
+        static_cast<double>(counters.segmentsGenerated));
     LOG(level, "    Last Seg Packing Util Incr:     %9.1f%%  (%.1f%% avg)",
         static_cast<double>(delta.packLastImprovementSum) /
         static_cast<double>(delta.cleaningPasses),
-        static_cast<double>(perfCounters.packLastImprovementSum) /
-        static_cast<double>(perfCounters.cleaningPasses));
+        static_cast<double>(counters.packLastImprovementSum) /
+        static_cast<double>(counters.cleaningPasses));
     LOG(level, "    Total Segs Pack Last Improved:  %9lu   (%.2f%% of passes)",
-        perfCounters.packLastDidWork,
-        100.0 * static_cast<double>(perfCounters.packLastDidWork) /
-        static_cast<double>(perfCounters.cleaningPasses));
+        counters.packLastDidWork,
+        100.0 * static_cast<double>(counters.packLastDidWork) /
+        static_cast<double>(counters.cleaningPasses));
     LOG(level, "    Segs Scanned for Free Space:    %9lu   (%lu overall)",
-        delta.scanForFreeSpaceSegments, perfCounters.scanForFreeSpaceSegments);
+        delta.scanForFreeSpaceSegments, counters.scanForFreeSpaceSegments);
     LOG(level, "      Attempts That Found Free Space: %7.3f%%   (overall)",
-        100.0 * static_cast<double>(perfCounters.scanForFreeSpaceProgress) /
-        static_cast<double>(perfCounters.scanForFreeSpaceSegments));
+        100.0 * static_cast<double>(counters.scanForFreeSpaceProgress) /
+        static_cast<double>(counters.scanForFreeSpaceSegments));
 
     #define _pctAndTime(_x)                             \
         Cycles::toNanoseconds(delta._x) / 1000 / 1000,  \
@@ -273,8 +373,8 @@ LogCleaner::dumpCleaningPassStats(PerfCounters& before)
     LOG(level, "  Time Breakdown:");
     LOG(level, "    Total:                       %9lu ms   (%lu avg)",
         Cycles::toNanoseconds(delta.cleaningPassTicks) / 1000 / 1000,
-        Cycles::toNanoseconds(perfCounters.cleaningPassTicks) /
-        perfCounters.cleaningPasses / 1000 / 1000);
+        Cycles::toNanoseconds(counters.cleaningPassTicks) /
+        counters.cleaningPasses / 1000 / 1000);
     LOG(level, "      Scan New Segments:         %9lu ms   (%.2f%%)",
         _pctAndTime(newScanTicks));
     LOG(level, "      Scan For Free Space:       %9lu ms   (%.2f%%)",
@@ -306,31 +406,32 @@ LogCleaner::dumpCleaningPassStats(PerfCounters& before)
 
     size_t i;
     LOG(level, "  Entry Types Checked for Liveness:");
-    for (i = 0; i < arrayLength(perfCounters.entryTypeCounts); i++) {
-        if (perfCounters.entryTypeCounts[i] == 0)
+    for (i = 0; i < arrayLength(counters.entryTypeCounts); i++) {
+        if (counters.entryTypeCounts[i] == 0)
             continue;
         LOG(level, "      %3zd ('%c')           %18lu    "
             "(%.2f%% avg, %.2f%% overall)",
             i, downCast<char>(i), delta.entryTypeCounts[i],
             100.0 * static_cast<double>(delta.entryTypeCounts[i]) /
             static_cast<double>(delta.entriesInCleanedSegments),
-            100.0 * static_cast<double>(perfCounters.entryTypeCounts[i]) /
-            static_cast<double>(perfCounters.entriesInCleanedSegments));
+            100.0 * static_cast<double>(counters.entryTypeCounts[i]) /
+            static_cast<double>(counters.entriesInCleanedSegments));
     }
 
     LOG(level, "  Entry Types Relocated:");
-    for (i = 0; i < arrayLength(perfCounters.relocEntryTypeCounts); i++) {
-        if (perfCounters.relocEntryTypeCounts[i] == 0)
+    for (i = 0; i < arrayLength(counters.relocEntryTypeCounts); i++) {
+        if (counters.relocEntryTypeCounts[i] == 0)
             continue;
         LOG(level, "      %3zd ('%c')           %18lu    "
             "(%.2f%% avg, %.2f%% overall)",
             i, downCast<char>(i), delta.relocEntryTypeCounts[i],
             100.0 * static_cast<double>(delta.relocEntryTypeCounts[i]) /
             static_cast<double>(delta.liveEntriesRelocated),
-            100.0 * static_cast<double>(perfCounters.relocEntryTypeCounts[i]) /
-            static_cast<double>(perfCounters.liveEntriesRelocated));
+            100.0 * static_cast<double>(counters.relocEntryTypeCounts[i]) /
+            static_cast<double>(counters.liveEntriesRelocated));
     }
 
+    Lock lock(candidateMutex);
     uint64_t histogram[10];
     uint64_t totalUtil = 0;
     memset(histogram, 0, sizeof(histogram));
@@ -376,7 +477,7 @@ LogCleaner::getCleanSegmentMemory(size_t segmentsNeeded,
     } catch (LogOutOfMemoryException& e) {
         // We didn't get enough. Return any allocated segment memory to the log.
         SegmentVector empty;
-        log->cleaningComplete(empty, cleanSegmentMemory);
+        log->cleaningComplete(empty, empty, cleanSegmentMemory);
         cleanSegmentMemory.clear();
         return false;
     }
@@ -419,9 +520,9 @@ LogCleaner::isCleanable(double _writeCost)
  * See #scanSegment for more details.
  */
 void
-LogCleaner::scanNewCleanableSegments()
+LogCleaner::scanNewCleanableSegments(PerfCounters& counters)
 {
-    CycleCounter<uint64_t> _(&perfCounters.newScanTicks);
+    CycleCounter<uint64_t> _(&counters.newScanTicks);
 
     log->getNewCleanableSegments(scanList);
 
@@ -483,9 +584,9 @@ LogCleaner::scanSegment(Segment*  segment,
  * for them.
  */
 void
-LogCleaner::scanForFreeSpace()
+LogCleaner::scanForFreeSpace(PerfCounters& counters)
 {
-    CycleCounter<uint64_t> _(&perfCounters.scanForFreeSpaceTicks);
+    CycleCounter<uint64_t> _(&counters.scanForFreeSpaceTicks);
 
     foreach (CleanableSegment& cs, cleanableSegments) {
         // Only bother scanning if the difference would affect the
@@ -504,7 +605,7 @@ LogCleaner::scanForFreeSpace()
             continue;
         }
 
-        scanSegmentForFreeSpace(cs);
+        scanSegmentForFreeSpace(counters, cs);
     }
 }
 
@@ -515,7 +616,8 @@ LogCleaner::scanForFreeSpace()
  * and update the Segment's statistics.
  */
 void
-LogCleaner::scanSegmentForFreeSpace(CleanableSegment& cleanableSegment)
+LogCleaner::scanSegmentForFreeSpace(PerfCounters& counters,
+                                    CleanableSegment& cleanableSegment)
 {
     uint32_t freeByteSum = 0;
     uint32_t freedEntries = 0;
@@ -538,12 +640,12 @@ LogCleaner::scanSegmentForFreeSpace(CleanableSegment& cleanableSegment)
     if (freedEntries != cleanableSegment.implicitlyFreedEntries) {
         cleanableSegment.implicitlyFreedBytes = freeByteSum;
         cleanableSegment.implicitlyFreedEntries = freedEntries;
-        perfCounters.scanForFreeSpaceProgress++;
+        counters.scanForFreeSpaceProgress++;
     }
 
     segment->setImplicitlyFreedCounts(freeByteSum, freeSpaceTimeSum);
 
-    perfCounters.scanForFreeSpaceSegments++;
+    counters.scanForFreeSpaceSegments++;
 }
 
 /**
@@ -552,25 +654,50 @@ LogCleaner::scanSegmentForFreeSpace(CleanableSegment& cleanableSegment)
  * to clean, how many to clean, and whether or not to clean at all right
  * now. Note that any Segments returned from this method have NOT already
  * been removed from the #cleanableSegments vector. If cleaning is performed
- * they should be removed from that vector.
+ * they should be removed from that vector before #candidateMutex, which the
+ * caller holds, is released.
  *
+ * \param counters
+ *      Performance counters of the calling thread.
  * \param[out] segmentsToClean
  *      Pointers to Segments that should be cleaned are appended to this
  *      empty vector. 
+ * \param onDisk
+ *      If true, judge Segments by the backup space their replicas take up
+ *      rather than by their memory, since the pass will free the former.
+ *      Segments whose replicas were lost are then chosen first, whatever
+ *      it costs to clean them.
  */
 void
-LogCleaner::getSegmentsToClean(SegmentVector& segmentsToClean)
+LogCleaner::getSegmentsToClean(PerfCounters& counters,
+                               SegmentVector& segmentsToClean,
+                               bool onDisk)
 {
-    CycleCounter<uint64_t> _(&perfCounters.getSegmentsTicks);
+    CycleCounter<uint64_t> _(&counters.getSegmentsTicks);
 
     assert(segmentsToClean.size() == 0);
 
-    if (cleanableSegments.size() < CLEANED_SEGMENTS_PER_PASS)
-        return;
-
     std::sort(cleanableSegments.begin(),
               cleanableSegments.end(),
-              CostBenefitLessThan());
+              CostBenefitLessThan(onDisk));
+
+    // Data whose replicas were lost is not durable until rewritten. The
+    // sort put such Segments last.
+    while (onDisk && segmentsToClean.size() < cleanableSegments.size()) {
+        CleanableSegment& cs = cleanableSegments[
+            cleanableSegments.size() - segmentsToClean.size() - 1];
+        if (!cs.lostReplicas)
+            break;
+        segmentsToClean.push_back(cs.segment);
+    }
+    if (segmentsToClean.size() > 0) {
+        LOG(NOTICE, "Rewriting %zd segments whose replicas were lost",
+            segmentsToClean.size());
+        return;
+    }
+
+    if (cleanableSegments.size() < CLEANED_SEGMENTS_PER_PASS)
+        return;
 
     // Calculate the write cost for the best candidate Segments, i.e.
     // the number of bytes we need to write out in total to write however
@@ -587,7 +714,10 @@ LogCleaner::getSegmentsToClean(SegmentVector& segmentsToClean)
         Segment* s = cleanableSegments[segmentIndex].segment;
         assert(s != NULL);
         totalLiveBytes += (s->getCapacity() - s->getFreeBytes());
-        totalCapacity += s->getCapacity();
+        if (onDisk)
+            totalCapacity += cleanableSegments[segmentIndex].diskCapacity;
+        else
+            totalCapacity += s->getCapacity();
 
         if ((totalCapacity - totalLiveBytes) >= wantFreeBytes) {
             i++;
@@ -621,11 +751,81 @@ LogCleaner::getSegmentsToClean(SegmentVector& segmentsToClean)
     LOG(DEBUG, "writeCost %.2f", cost);
 }
 
+/**
+ * Return the number of bytes of backup space that hold the given Segment's
+ * data. For a Segment compacted in memory this is the space taken by the
+ * replicas of the Segments it was compacted from, which can be much more
+ * than its own capacity.
+ *
+ * \param segment
+ *      The Segment whose data we're interested in.
+ */
+uint64_t
+LogCleaner::getDiskCapacity(Segment* segment)
+{
+    if (!segment->inMemoryOnly)
+        return segment->getCapacity();
+
+    uint64_t diskCapacity = 0;
+    foreach (Segment* compacted, segment->compactedSegments) {
+        if (!compacted->inMemoryOnly)
+            diskCapacity += compacted->getCapacity();
+    }
+    return diskCapacity;
+}
+
+/**
+ * Return the percentage of the backup space holding the cleanable Segments'
+ * data that is taken by live data. The caller must hold #candidateMutex.
+ */
+int
+LogCleaner::getDiskUtilisation()
+{
+    uint64_t liveBytes = 0;
+    uint64_t diskCapacity = 0;
+    foreach (CleanableSegment& cs, cleanableSegments) {
+        liveBytes += cs.segment->getLiveBytes();
+        diskCapacity += cs.diskCapacity;
+    }
+
+    if (diskCapacity == 0)
+        return 100;
+    return static_cast<int>(100 * liveBytes / diskCapacity);
+}
+
+/**
+ * Find the cleanable Segments whose data is no longer fully replicated
+ * because a backup failed after the Segments holding its replicas were
+ * compacted (see Segment::detachReplicas), and mark them so that
+ * #getSegmentsToClean chooses them first. The caller must hold
+ * #candidateMutex.
+ *
+ * \return
+ *      True if any cleanable Segment has lost replicas.
+ */
+bool
+LogCleaner::updateLostReplicas()
+{
+    bool anyLost = false;
+    foreach (CleanableSegment& cs, cleanableSegments) {
+        cs.lostReplicas = false;
+        foreach (Segment* compacted, cs.segment->compactedSegments) {
+            if (compacted->hasLostReplicas())
+                cs.lostReplicas = true;
+        }
+        if (cs.lostReplicas)
+            anyLost = true;
+    }
+    return anyLost;
+}
+
 /**
  * Walk a segment, extract all live entries, and append them to the
  * provided output vector. Return the total number of bytes in live
  * entries.
  *
+ * \param counters
+ *      Performance counters of the calling thread.
  * \param[in] segment
  *      Pointer to the Segment to scan.
  * \param[out] liveEntries
@@ -636,24 +836,25 @@ LogCleaner::getSegmentsToClean(SegmentVector& segmentsToClean)
  *      the bytes in the entries themselves.
  */
 size_t
-LogCleaner::getLiveEntries(Segment* segment,
+LogCleaner::getLiveEntries(PerfCounters& counters,
+                           Segment* segment,
                            LiveSegmentEntryHandleVector& liveEntries)
 {
     uint64_t liveEntryBytes = 0;
 
-    CycleCounter<uint64_t> collectTicks(&perfCounters.collectLiveEntriesTicks);
+    CycleCounter<uint64_t> collectTicks(&counters.collectLiveEntriesTicks);
     for (SegmentIterator i(segment); !i.isDone(); i.next()) {
         SegmentEntryHandle handle = i.getHandle();
 
-        perfCounters.entryTypeCounts[handle->type()]++;
-        perfCounters.entriesInCleanedSegments++;
+        counters.entryTypeCounts[handle->type()]++;
+        counters.entriesInCleanedSegments++;
 
         const LogTypeInfo *ti = log->getTypeInfo(handle->type());
         if (ti != NULL) {
-            perfCounters.entriesLivenessChecked++;
+            counters.entriesLivenessChecked++;
 
             CycleCounter<uint64_t> livenessTicks(
-                &perfCounters.livenessCallbackTicks);
+                &counters.livenessCallbackTicks);
             bool isLive = ti->livenessCB(handle, ti->livenessArg);
             livenessTicks.stop();
 
@@ -661,7 +862,7 @@ LogCleaner::getLiveEntries(Segment* segment,
                 assert(ti->timestampCB != NULL);
                 liveEntries.push_back({ handle, ti->timestampCB(handle) });
                 liveEntryBytes += handle->length();
-                perfCounters.liveEntryBytes += handle->totalLength();
+                counters.liveEntryBytes += handle->totalLength();
             }
         }
     }
@@ -681,6 +882,8 @@ LogCleaner::getLiveEntries(Segment* segment,
  * checking and updating their references, as well as returning a new
  * liveness boolean. See #moveLiveData. 
  *
+ * \param counters
+ *      Performance counters of the calling thread.
  * \param[in] segments
  *      Vector of Segment pointers to extract live entries from.
  * \param[out] liveEntries
@@ -691,15 +894,16 @@ LogCleaner::getLiveEntries(Segment* segment,
  *      the bytes in the entries themselves.
  */
 size_t
-LogCleaner::getSortedLiveEntries(SegmentVector& segments,
+LogCleaner::getSortedLiveEntries(PerfCounters& counters,
+                                 SegmentVector& segments,
                                  LiveSegmentEntryHandleVector& liveEntries)
 {
     uint64_t liveEntryBytes = 0;
 
     foreach (Segment* segment, segments)
-        liveEntryBytes += getLiveEntries(segment, liveEntries);
+        liveEntryBytes += getLiveEntries(counters, segment, liveEntries);
 
-    CycleCounter<uint64_t> _(&perfCounters.sortLiveEntriesTicks);
+    CycleCounter<uint64_t> _(&counters.sortLiveEntriesTicks);
     std::sort(liveEntries.begin(),
               liveEntries.end(),
               SegmentEntryAgeLessThan(log));
@@ -717,6 +921,8 @@ LogCleaner::getSortedLiveEntries(SegmentVector& segments,
  * order so long as their live objects all fit in whatever space is left
  * over.
  *
+ * \param counters
+ *      Performance counters of the calling thread.
  * \param[in] lastNewSegment
  *      The last Segment created by moveLiveData().
  * \param[out] segmentsToClean
@@ -725,14 +931,17 @@ LogCleaner::getSortedLiveEntries(SegmentVector& segments,
  *      to add them here.
  */
 void
-LogCleaner::moveToFillSegment(Segment* lastNewSegment,
+LogCleaner::moveToFillSegment(PerfCounters& counters,
+                              Segment* lastNewSegment,
                               SegmentVector& segmentsToClean)
 {
-    CycleCounter<uint64_t> _(&perfCounters.packLastTicks);
+    CycleCounter<uint64_t> _(&counters.packLastTicks);
 
     if (lastNewSegment == NULL)
         return;
 
+    // Other threads may be choosing Segments to clean meanwhile.
+    Lock lock(candidateMutex);
     int utilisationBefore = lastNewSegment->getUtilisation();
 
     // Keep going so long as we make progress.
@@ -753,8 +962,8 @@ LogCleaner::moveToFillSegment(Segment* lastNewSegment,
             for (SegmentIterator it(segment); !it.isDone(); it.next()) {
                 SegmentEntryHandle handle = it.getHandle();
 
-                perfCounters.entryTypeCounts[handle->type()]++;
-                perfCounters.entriesInCleanedSegments++;
+                counters.entryTypeCounts[handle->type()]++;
+                counters.entriesInCleanedSegments++;
 
                 const LogTypeInfo *ti = log->getTypeInfo(handle->type());
                 if (ti == NULL || !ti->livenessCB(handle, ti->livenessArg))
@@ -765,10 +974,10 @@ LogCleaner::moveToFillSegment(Segment* lastNewSegment,
                 assert(newHandle != NULL);
 
                 if (ti->relocationCB(handle, newHandle, ti->relocationArg)) {
-                    perfCounters.liveEntriesRelocated++;
-                    perfCounters.relocEntryTypeCounts[handle->type()]++;
+                    counters.liveEntriesRelocated++;
+                    counters.relocEntryTypeCounts[handle->type()]++;
                 } else {
-                    perfCounters.entriesRolledBack++;
+                    counters.entriesRolledBack++;
                     lastNewSegment->rollBack(newHandle);
                 }
             }
@@ -785,11 +994,35 @@ LogCleaner::moveToFillSegment(Segment* lastNewSegment,
 
     int gain = lastNewSegment->getUtilisation() - utilisationBefore;
     if (gain) {
-        perfCounters.packLastDidWork++;
-        perfCounters.packLastImprovementSum += gain;
+        counters.packLastDidWork++;
+        counters.packLastImprovementSum += gain;
     }
 }
 
+/**
+ * Return the stream of survivor Segments that live data written at the
+ * given time belongs in. Stream 0 takes data less than #AGE_STREAM_SPAN
+ * seconds old, and each later stream data up to #AGE_STREAM_SPAN times older
+ * than the one before. The last stream takes all older data.
+ *
+ * \param now
+ *      The current time, as returned by secondsTimestamp().
+ * \param timestamp
+ *      The time at which the data was written.
+ */
+int
+LogCleaner::getAgeStream(uint32_t now, uint32_t timestamp)
+{
+    uint64_t age = (now > timestamp) ? now - timestamp : 0;
+    uint64_t streamLimit = AGE_STREAM_SPAN;
+    int stream = 0;
+    while (stream < AGE_STREAMS - 1 && age >= streamLimit) {
+        stream++;
+        streamLimit *= AGE_STREAM_SPAN;
+    }
+    return stream;
+}
+
 /**
  * Move the specified live data to new Segments and call the appropriate
  * type handler to deal with the relocation. Any newly created Segments
@@ -804,6 +1037,8 @@ LogCleaner::moveToFillSegment(Segment* lastNewSegment,
  * we must write the data first, we must roll it back from the Segment if it's
  * not live anymore.
  *
+ * \param counters
+ *      Performance counters of the calling thread.
  * \param[in] liveData
  *      Vector of SegmentEntryHandles of recently live data to move.
  * \param[in] cleanSegmentMemory
@@ -818,17 +1053,31 @@ LogCleaner::moveToFillSegment(Segment* lastNewSegment,
  *      Vector of Segments from which liveData came. This is only to be used
  *      if we choose to clean addition Segmnts not previously specified (e.g.
  *      in the moveToFillSegment method when packing the last new Segment).
+ * \param[out] segmentsAdded
+ *      The survivor Segments created by this pass are appended here. They
+ *      belong to the calling thread until it passes them to
+ *      Log::cleaningComplete.
+ * \param segregateByAge
+ *      If true, write data of each age class to a stream of Segments of its
+ *      own (see #getAgeStream). Each stream may leave one more Segment
+ *      partly empty, so \a cleanSegmentMemory must allow for that.
  */
 void
-LogCleaner::moveLiveData(LiveSegmentEntryHandleVector& liveData,
+LogCleaner::moveLiveData(PerfCounters& counters,
+                         LiveSegmentEntryHandleVector& liveData,
                          std::vector<void*>& cleanSegmentMemory,
-                         SegmentVector& segmentsToClean)
+                         SegmentVector& segmentsToClean,
+                         SegmentVector& segmentsAdded,
+                         bool segregateByAge)
 {
-    CycleCounter<uint64_t> _(&perfCounters.moveLiveDataTicks);
+    CycleCounter<uint64_t> _(&counters.moveLiveDataTicks);
 
     LogPosition headPosition = log->headOfLog();
-    SegmentVector segmentsAdded;
-    PowerOfTwoSegmentBins segmentBins(perfCounters);
+    uint32_t now = secondsTimestamp();
+    Tub<PowerOfTwoSegmentBins> streamBins[AGE_STREAMS];
+    Segment* lastSegmentInStream[AGE_STREAMS];
+    for (int stream = 0; stream < AGE_STREAMS; stream++)
+        lastSegmentInStream[stream] = NULL;
 
     // Ensure we'll avoid the zombie apocalypse by maintaining the invariant
     // that only objects from segments of IDs lower than the current log
@@ -862,6 +1111,14 @@ LogCleaner::moveLiveData(LiveSegmentEntryHandleVector& liveData,
         // we have the opportunity to do better if we can pack in more data
         // that ends up staying alive longer.
 
+        // Only pack into Segments of the entry's own stream, though, lest
+        // hot and cold data end up together after all.
+        int stream = segregateByAge ?
+            getAgeStream(now, liveEntry.timestamp) : 0;
+        if (!streamBins[stream])
+            streamBins[stream].construct(counters);
+        PowerOfTwoSegmentBins& segmentBins = *streamBins[stream];
+
         SegmentEntryHandle handle = liveEntry.handle;
         SegmentEntryHandle newHandle = NULL;
         Segment* segmentUsed = NULL;
@@ -885,45 +1142,160 @@ LogCleaner::moveLiveData(LiveSegmentEntryHandleVector& liveData,
 
                 segmentsAdded.push_back(newSeg);
                 segmentBins.addSegment(newSeg);
+                lastSegmentInStream[stream] = newSeg;
                 log->cleaningInto(newSeg);
                 continue;
             }
 
-            CycleCounter<uint64_t> _(&perfCounters.segmentAppendTicks);
+            CycleCounter<uint64_t> _(&counters.segmentAppendTicks);
             newHandle = segmentUsed->append(handle, false);
         }
 
         const LogTypeInfo* ti = log->getTypeInfo(handle->type());
 
-        CycleCounter<uint64_t> relTicks(&perfCounters.relocationCallbackTicks);
+        CycleCounter<uint64_t> relTicks(&counters.relocationCallbackTicks);
         bool relocated = ti->relocationCB(handle, newHandle, ti->relocationArg);
         relTicks.stop();
 
         if (relocated) {
-            perfCounters.liveEntriesRelocated++;
-            perfCounters.relocEntryTypeCounts[handle->type()]++;
+            counters.liveEntriesRelocated++;
+            counters.relocEntryTypeCounts[handle->type()]++;
             segmentBins.updateSegment(segmentUsed);
         } else {
-            perfCounters.entriesRolledBack++;
+            counters.entriesRolledBack++;
             segmentUsed->rollBack(newHandle);
         }
     }
 
-    // End game: try to get good utilisation out of the last Segment.
-    if (segmentsAdded.size() > 0)
-        moveToFillSegment(segmentsAdded.back(), segmentsToClean);
+    // End game: try to get good utilisation out of the last Segment of
+    // each stream.
+    for (int stream = 0; stream < AGE_STREAMS; stream++) {
+        moveToFillSegment(counters, lastSegmentInStream[stream],
+                          segmentsToClean);
+    }
 
     // Close and sync all newly created Segments.
-    CycleCounter<uint64_t> syncTicks(&perfCounters.closeAndSyncTicks);
+    CycleCounter<uint64_t> syncTicks(&counters.closeAndSyncTicks);
     foreach (Segment* segment, segmentsAdded)
         segment->close(NULL, true);
     syncTicks.stop();
 
     // Now we're done. Save some stats.
     foreach (Segment* segment, segmentsAdded)
-        perfCounters.generatedUtilisationSum += segment->getUtilisation();
+        counters.generatedUtilisationSum += segment->getUtilisation();
+
+    counters.segmentsGenerated += segmentsAdded.size();
+}
+
+/**
+ * Compact groups of Segments in memory: move the live data of each group
+ * into a new Segment of its own and call the appropriate type handler to
+ * deal with the relocation, as #moveLiveData does. The new Segments are not
+ * replicated. Backups keep the replicas of the compacted Segments instead,
+ * and the Log lists those in its LogDigest in the new Segment's place (see
+ * Segment::compactedSegments), until a later pass cleans the new Segment
+ * and writes its live data to backups.
+ *
+ * \param counters
+ *      Performance counters of the calling thread.
+ * \param compactions
+ *      Groups of Segments to compact, as set up by #setUpCompactionPass.
+ *      Each group's live data must fit in one Segment.
+ * \param[in] cleanSegmentMemory
+ *      Vector of clean segment memory, one per group. Memory that is used
+ *      from this vector is removed from it.
+ * \param[out] segmentsAdded
+ *      The new Segments are appended here. They belong to the calling
+ *      thread until it passes them to Log::cleaningComplete.
+ */
+void
+LogCleaner::compactSegments(PerfCounters& counters,
+                            std::vector<SegmentVector>& compactions,
+                            std::vector<void*>& cleanSegmentMemory,
+                            SegmentVector& segmentsAdded)
+{
+    CycleCounter<uint64_t> _(&counters.moveLiveDataTicks);
+
+    LogPosition headPosition = log->headOfLog();
+
+    foreach (SegmentVector& compaction, compactions) {
+        void* segmentMemory = cleanSegmentMemory.back();
+        cleanSegmentMemory.pop_back();
+
+        Segment* newSeg = new Segment(log,
+                                      false, // !isLogHead
+                                      log->allocateSegmentId(),
+                                      segmentMemory,
+                                      log->getSegmentCapacity(),
+                                      NULL, // never replicated
+                                      LOG_ENTRY_TYPE_UNINIT, NULL, 0,
+                                      headPosition.segmentId());
+        newSeg->inMemoryOnly = true;
+
+        // The compacted Segments' replicas must be complete before their
+        // memory may be reused.
+        foreach (Segment* segment, compaction) {
+            assert(segment->getId() < headPosition.segmentId());
+            segment->detachReplicas();
+            segment->compacted = true;
+            newSeg->compactedSegments.insert(
+                newSeg->compactedSegments.end(),
+                segment->compactedSegments.begin(),
+                segment->compactedSegments.end());
+            newSeg->compactedSegments.push_back(segment);
+        }
+
+        segmentsAdded.push_back(newSeg);
+        log->cleaningInto(newSeg);
+
+        foreach (Segment* segment, compaction) {
+            for (SegmentIterator it(segment); !it.isDone(); it.next()) {
+                SegmentEntryHandle handle = it.getHandle();
+
+                counters.entryTypeCounts[handle->type()]++;
+                counters.entriesInCleanedSegments++;
+
+                const LogTypeInfo *ti = log->getTypeInfo(handle->type());
+                if (ti == NULL)
+                    continue;
+
+                CycleCounter<uint64_t> liveTicks(
+                    &counters.livenessCallbackTicks);
+                bool isLive = ti->livenessCB(handle, ti->livenessArg);
+                liveTicks.stop();
+                counters.entriesLivenessChecked++;
+                if (!isLive)
+                    continue;
+                counters.liveEntryBytes += handle->totalLength();
+
+                CycleCounter<uint64_t> appendTicks(
+                    &counters.segmentAppendTicks);
+                SegmentEntryHandle newHandle = newSeg->append(handle, false);
+                appendTicks.stop();
+                assert(newHandle != NULL);
 
-    perfCounters.segmentsGenerated += segmentsAdded.size();
+                CycleCounter<uint64_t> relTicks(
+                    &counters.relocationCallbackTicks);
+                bool relocated =
+                    ti->relocationCB(handle, newHandle, ti->relocationArg);
+                relTicks.stop();
+
+                if (relocated) {
+                    counters.liveEntriesRelocated++;
+                    counters.relocEntryTypeCounts[handle->type()]++;
+                } else {
+                    counters.entriesRolledBack++;
+                    newSeg->rollBack(newHandle);
+                }
+            }
+        }
+
+        newSeg->close(NULL, false);
+        counters.generatedUtilisationSum += newSeg->getUtilisation();
+    }
+
+    counters.segmentsGenerated += segmentsAdded.size();
+    counters.compactedSegmentsGenerated += segmentsAdded.size();
 }
 
 /**
@@ -931,6 +1303,13 @@ LogCleaner::moveLiveData(LiveSegmentEntryHandleVector& liveData,
  * includes choosing which segments to clean, extracting live entries,
  * and allocating space for survivor data.
  *
+ * \param lock
+ *      Holds #candidateMutex on entry. The Segments are chosen under it;
+ *      it's released while their live entries are collected.
+ *
+ * \param counters
+ *      Performance counters of the calling thread.
+ *
  * \param[out] liveEntries
  *      Vector of live entries to store references to entries in segments that
  *      will be cleaned.
@@ -942,29 +1321,49 @@ LogCleaner::moveLiveData(LiveSegmentEntryHandleVector& liveData,
  * \param[out] segmentsToClean
  *      Vector of segments that will be cleaned.
  *
+ * \param onDisk
+ *      Choose the segments by how well their replicas use backup space;
+ *      see #getSegmentsToClean.
+ *
  * \return
  *      Returns false if normal cleaning cannot proceed. Otherwise, returns
  *      true and the out parameters are appropriate set up for an invocation
  *      of moveLiveData.
  */
 bool
-LogCleaner::setUpNormalCleaningPass(LiveSegmentEntryHandleVector& liveEntries,
+LogCleaner::setUpNormalCleaningPass(Lock& lock,
+                                    PerfCounters& counters,
+                                    LiveSegmentEntryHandleVector& liveEntries,
                                     std::vector<void*>& cleanSegmentMemory,
-                                    SegmentVector& segmentsToClean)
+                                    SegmentVector& segmentsToClean,
+                                    bool onDisk)
 {
-    getSegmentsToClean(segmentsToClean);
+    getSegmentsToClean(counters, segmentsToClean, onDisk);
 
     if (segmentsToClean.size() == 0) {
         // Even if there's nothing to do, call into the Log
         // to give it a chance to free up Segments that were
         // waiting on existing references.
-        log->cleaningComplete(segmentsToClean, cleanSegmentMemory);
+        lock.unlock();
+        log->cleaningComplete(segmentsToClean, segmentsToClean,
+                              cleanSegmentMemory);
         return false;
     }
 
+    // Take the Segments out of the running so that other threads choose
+    // different ones while this one collects their live entries. They're
+    // put back if the pass can't proceed.
+    std::vector<CleanableSegment> chosen(
+        cleanableSegments.end() - segmentsToClean.size(),
+        cleanableSegments.end());
+    cleanableSegments.erase(cleanableSegments.end() - chosen.size(),
+                            cleanableSegments.end());
+    lock.unlock();
+
     liveEntries.reserve(segmentsToClean.size() *
         (log->getSegmentCapacity() / MIN_ENTRY_BYTES));
-    uint64_t liveEntryBytes = getSortedLiveEntries(segmentsToClean,
+    uint64_t liveEntryBytes = getSortedLiveEntries(counters,
+                                                   segmentsToClean,
                                                    liveEntries);
     size_t segmentsNeeded = Segment::maximumSegmentsNeededForEntries(
                                                 liveEntries.size(),
@@ -972,24 +1371,135 @@ LogCleaner::setUpNormalCleaningPass(LiveSegmentEntryHandleVector& liveEntries,
                                                 log->maximumBytesPerAppend,
                                                 log->getSegmentCapacity());
 
+    // Each age stream but the first may leave one more Segment partly empty.
+    segmentsNeeded += AGE_STREAMS - 1;
+
     // Try to allocate the number of clean segments we'll need to complete
     // this pass up front. There's no guarantee that we'll have enough. If we
     // don't, just return. The log will soon run out and we'll kick into
     // emergency cleaning mode.
     if (!getCleanSegmentMemory(segmentsNeeded, cleanSegmentMemory)) {
         LOG(WARNING, "Cleaning pass failed: insufficient free log memory!");
+        lock.lock();
+        cleanableSegments.insert(cleanableSegments.end(),
+                                 chosen.begin(), chosen.end());
         return false;
     }
 
     // TODO(Rumble): liveEntryBytes does _not_ include SegmentEntry counts.
-    perfCounters.writeCostSum += writeCost(segmentsToClean.size() *
+    counters.writeCostSum += writeCost(segmentsToClean.size() *
         log->getSegmentCapacity(), liveEntryBytes);
 
-    // We're guaranteed to succeed in this cleaning pass. Remove the segments
-    // we'll be cleaning and proceed.
-    for (size_t i = 0; i < segmentsToClean.size(); i++)
-        cleanableSegments.pop_back();
+    // We're guaranteed to succeed in this cleaning pass.
+    return true;
+}
+
+/**
+ * Set everything up to compact Segments in memory. This includes choosing
+ * which Segments to compact, grouping them into the new Segments that will
+ * hold their live data, and allocating memory for those.
+ *
+ * Segments are chosen by cost-benefit as for a normal pass, but each is
+ * moved whole into a new Segment: groups are packed first fit by live
+ * bytes. This way, every new Segment's data is held on backups by the
+ * replicas of a known set of old Segments.
+ *
+ * \param lock
+ *      Holds #candidateMutex on entry. The Segments are chosen under it;
+ *      it's released while they are grouped.
+ *
+ * \param counters
+ *      Performance counters of the calling thread.
+ *
+ * \param[out] compactions
+ *      Groups of Segments whose live data is to be moved to a new Segment
+ *      of their own.
+ *
+ * \param[out] cleanSegmentMemory
+ *      Vector of segment memory that will be used for the new segments.
+ *
+ * \param[out] segmentsToClean
+ *      Vector of segments that will be compacted.
+ *
+ * \return
+ *      Returns false if compaction would free no memory or cannot proceed.
+ *      Otherwise, returns true and the out parameters are set up for an
+ *      invocation of compactSegments.
+ */
+bool
+LogCleaner::setUpCompactionPass(Lock& lock,
+                                PerfCounters& counters,
+                                std::vector<SegmentVector>& compactions,
+                                std::vector<void*>& cleanSegmentMemory,
+                                SegmentVector& segmentsToClean)
+{
+    getSegmentsToClean(counters, segmentsToClean);
+
+    if (segmentsToClean.size() == 0) {
+        // As in a normal pass, give the Log a chance to free Segments.
+        lock.unlock();
+        log->cleaningComplete(segmentsToClean, segmentsToClean,
+                              cleanSegmentMemory);
+        return false;
+    }
+
+    std::vector<CleanableSegment> chosen(
+        cleanableSegments.end() - segmentsToClean.size(),
+        cleanableSegments.end());
+    cleanableSegments.erase(cleanableSegments.end() - chosen.size(),
+                            cleanableSegments.end());
+    lock.unlock();
+
+    uint32_t appendableBytes =
+        Segment::maximumAppendableBytes(log->getSegmentCapacity());
+    std::vector<uint32_t> bytesLeft;
+    SegmentVector compacting;
+    uint64_t liveBytes = 0;
+    foreach (Segment* segment, segmentsToClean) {
+        uint32_t segmentLiveBytes = segment->getLiveBytes();
+        if (segmentLiveBytes > appendableBytes)
+            continue;
+
+        size_t i = 0;
+        while (i < compactions.size() && bytesLeft[i] < segmentLiveBytes)
+            i++;
+        if (i == compactions.size()) {
+            compactions.push_back(SegmentVector());
+            bytesLeft.push_back(appendableBytes);
+        }
+        compactions[i].push_back(segment);
+        bytesLeft[i] -= segmentLiveBytes;
+        compacting.push_back(segment);
+        liveBytes += segmentLiveBytes;
+    }
 
+    // Go ahead only if this frees memory and we get enough to compact into.
+    bool proceed = compactions.size() < compacting.size();
+    if (proceed && !getCleanSegmentMemory(compactions.size(),
+                                          cleanSegmentMemory)) {
+        LOG(WARNING, "Compaction failed: insufficient free log memory!");
+        proceed = false;
+    }
+    if (!proceed) {
+        compactions.clear();
+        compacting.clear();
+    }
+
+    // Put back whatever we won't compact.
+    lock.lock();
+    foreach (CleanableSegment& cs, chosen) {
+        if (std::find(compacting.begin(), compacting.end(), cs.segment) ==
+          compacting.end()) {
+            cleanableSegments.push_back(cs);
+        }
+    }
+    segmentsToClean.swap(compacting);
+
+    if (!proceed)
+        return false;
+
+    counters.writeCostSum += writeCost(segmentsToClean.size() *
+        log->getSegmentCapacity(), liveBytes);
     return true;
 }
 
@@ -1004,6 +1514,12 @@ LogCleaner::setUpNormalCleaningPass(LiveSegmentEntryHandleVector& liveEntries,
  * emergency segments used (to keep that supply replenished) plus one
  * (so the log can be usefully appended to).
  *
+ * The caller holds #candidateMutex throughout, so emergency passes are
+ * set up by one thread at a time.
+ *
+ * \param counters
+ *      Performance counters of the calling thread.
+ *
  * \param[out] liveEntries
  *      Vector of live entries to store references to entries in segments that
  *      will be cleaned.
@@ -1022,6 +1538,7 @@ LogCleaner::setUpNormalCleaningPass(LiveSegmentEntryHandleVector& liveEntries,
  */
 bool
 LogCleaner::setUpEmergencyCleaningPass(
+                                    PerfCounters& counters,
                                     LiveSegmentEntryHandleVector& liveEntries,
                                     std::vector<void*>& cleanSegmentMemory,
                                     SegmentVector& segmentsToClean)
@@ -1036,7 +1553,7 @@ LogCleaner::setUpEmergencyCleaningPass(
     }
 
     // Walk the Segments in order of increasing utilisation.
-    CycleCounter<uint64_t> getSegmentsTicks(&perfCounters.getSegmentsTicks);
+    CycleCounter<uint64_t> getSegmentsTicks(&counters.getSegmentsTicks);
     std::sort(cleanableSegments.begin(),
               cleanableSegments.end(),
               UtilisationLessThan());
@@ -1051,7 +1568,7 @@ LogCleaner::setUpEmergencyCleaningPass(
         segmentsToClean.push_back(s);
 
         totalCapacity += s->getCapacity();
-        totalLiveBytes += getLiveEntries(s, liveEntries);
+        totalLiveBytes += getLiveEntries(counters, s, liveEntries);
         size_t segmentsNeeded = Segment::maximumSegmentsNeededForEntries(
                                                     liveEntries.size(),
                                                     totalLiveBytes,
@@ -1082,7 +1599,7 @@ LogCleaner::setUpEmergencyCleaningPass(
     if (!abort) {
         // Sort the live entries.
         SegmentVector empty;
-        getSortedLiveEntries(empty, liveEntries);
+        getSortedLiveEntries(counters, empty, liveEntries);
 
         // Be sure to remove the Segments we'll clean from the list.
         for (i = 0; i < segmentsToClean.size(); i++)
@@ -1091,7 +1608,7 @@ LogCleaner::setUpEmergencyCleaningPass(
         // Also, calculate and update our write cost stats while here.
         // TODO(Rumble): totalLiveBytes does _not_ include SegmentEntry counts.
         double cost = writeCost(totalCapacity, totalLiveBytes);
-        perfCounters.writeCostSum += cost;
+        counters.writeCostSum += cost;
 
         return true;
     }
@@ -1100,7 +1617,7 @@ LogCleaner::setUpEmergencyCleaningPass(
 
     // Return the emergency memory to the log.
     SegmentVector empty;
-    log->cleaningComplete(empty, cleanSegmentMemory);
+    log->cleaningComplete(empty, empty, cleanSegmentMemory);
 
     // It's possible that our sort by utilisation is off (implicitly freed entry
     // counts may not be accurate), so scan some segments to update the counts
@@ -1114,10 +1631,10 @@ LogCleaner::setUpEmergencyCleaningPass(
 
         if (cleanableSegments[indexA].timesRandomlyScanned <
           cleanableSegments[indexB].timesRandomlyScanned) {
-            scanSegmentForFreeSpace(cleanableSegments[indexA]);
+            scanSegmentForFreeSpace(counters, cleanableSegments[indexA]);
             cleanableSegments[indexA].timesRandomlyScanned++;
         } else {
-            scanSegmentForFreeSpace(cleanableSegments[indexB]);
+            scanSegmentForFreeSpace(counters, cleanableSegments[indexB]);
             cleanableSegments[indexB].timesRandomlyScanned++;
         }
     }
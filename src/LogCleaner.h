@@ -16,6 +16,7 @@
 #ifndef RAMCLOUD_LOGCLEANER_H
 #define RAMCLOUD_LOGCLEANER_H
 
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -34,8 +35,10 @@ class Log;
  * The LogCleaner defragments a Log's closed Segments, writing out any live
  * data to new "survivor" Segments and passing the survivors, as well as the
  * cleaned Segments, to the Log that owns them. The cleaner is designed to
- * run asynchronously in a separate thread, though it can be run inline with
- * the Log code as well.
+ * run asynchronously in one or more separate threads, though it can be run
+ * inline with the Log code as well. Several threads clean disjoint sets of
+ * Segments at once, each into survivor Segments of its own, so that the
+ * cleaner can keep up with heavy overwrite workloads.
  *
  * The cleaner employs some heuristics to aid efficiency. For instance, it
  * tries to minimise the cost of cleaning by choosing Segments that have a
@@ -45,17 +48,27 @@ class Log;
  * cleaning old data will reduce fragmentation and not soon require another
  * cleaning).
  *
- * In addition, the LogCleaner attempts to segregate entries by age in the
- * hopes of packing old data and new data into different Segments. This has
- * two main benefits. First, old data is less likely to fragment (be freed)
- * so those Segments will maintain high utilisation and therefore require
- * less cleaning. Second, new data is more likely to fragment, so Segments
+ * In addition, the LogCleaner segregates entries by age in the hopes of
+ * packing old data and new data into different Segments: survivors of each
+ * age class are written to a separate stream of Segments. This has two main
+ * benefits. First, old data is less likely to fragment (be freed) so those
+ * Segments will maintain high utilisation and therefore require less
+ * cleaning. Second, new data is more likely to fragment, so Segments
  * containing newer data will hopefully be cheaper to clean in the future.
+ *
+ * Cleaning can also be split into two levels, so that memory is reclaimed
+ * without using backup bandwidth. While enough of the backups' space holds
+ * live data (see #minDiskUtilisation), passes compact Segments in memory
+ * only: the live data of whole Segments is packed into new Segments that
+ * are never replicated, and backups keep the replicas of the compacted
+ * Segments in their place. Once backup utilisation drops, normal passes
+ * choose Segments by their utilisation on backups and rewrite their live
+ * data to new replicas, which finally frees the old ones.
  */
 class LogCleaner {
   public:
-    explicit LogCleaner(Log* log, ReplicaManager* replicaManager,
-                        bool startThread);
+    LogCleaner(Log* log, ReplicaManager* replicaManager,
+               uint32_t numThreads, uint32_t minDiskUtilisation = 0);
     ~LogCleaner();
     bool clean();
     void halt();
@@ -95,7 +108,9 @@ class LogCleaner {
               implicitlyFreedEntries(0),
               implicitlyFreeableBytes(implicitlyFreeableBytes),
               implicitlyFreedBytes(0),
-              timesRandomlyScanned(0)
+              timesRandomlyScanned(0),
+              diskCapacity(getDiskCapacity(segment)),
+              lostReplicas(false)
         {
         }
 
@@ -120,6 +135,14 @@ class LogCleaner {
         /// Times this segment has been randomly scanned. Used to Mitzenmacher
         /// between a few random choices to get appoximately even scanning.
         uint64_t timesRandomlyScanned;
+
+        /// Bytes of backup space that replicas of this Segment's data take
+        /// up; see #getDiskCapacity.
+        uint64_t diskCapacity;
+
+        /// True if replicas holding this Segment's data were lost and can
+        /// only be recreated by cleaning it. See #updateLostReplicas.
+        bool lostReplicas;
     };
 
     /**
@@ -129,20 +152,31 @@ class LogCleaner {
      * candidates) come last. This lets us easily remove them by popping
      * the back, rather than pulling from the front and shifting all elements
      * down.
+     *
+     * If told to, utilisation is that of the backup space holding each
+     * Segment's data rather than of its memory. Segments whose replicas were
+     * lost always come last.
      */
     struct CostBenefitLessThan {
       public:
-        CostBenefitLessThan()
-            : now(secondsTimestamp())
+        explicit CostBenefitLessThan(bool onDisk = false)
+            : now(secondsTimestamp()),
+              onDisk(onDisk)
         {
         }
 
         uint64_t
-        costBenefit(Segment *s)
+        costBenefit(const CleanableSegment& cs)
         {
             uint64_t costBenefit = ~(0UL);       // empty Segments are priceless
 
+            Segment* s = cs.segment;
             int utilisation = s->getUtilisation();
+            if (onDisk) {
+                assert(cs.diskCapacity != 0);
+                utilisation = static_cast<int>(
+                    100 * s->getLiveBytes() / cs.diskCapacity);
+            }
             if (utilisation != 0) {
                 uint64_t timestamp = s->getAverageTimestamp();
 
@@ -164,11 +198,14 @@ class LogCleaner {
         bool
         operator()(CleanableSegment a, CleanableSegment b)
         {
-            return costBenefit(a.segment) < costBenefit(b.segment);
+            if (a.lostReplicas != b.lostReplicas)
+                return b.lostReplicas;
+            return costBenefit(a) < costBenefit(b);
         }
 
       private:
         uint64_t now;
+        bool onDisk;
     };
 
     /**
@@ -251,6 +288,7 @@ class LogCleaner {
               cleaningPassTicks(0),
               cleaningPasses(0),
               emergencyCleaningPasses(0),
+              compactionPasses(0),
               failedNormalPasses(0),
               failedNormalPassTicks(0),
               failedEmergencyPasses(0),
@@ -261,6 +299,7 @@ class LogCleaner {
               liveEntriesRelocated(0),
               entriesRolledBack(0),
               segmentsGenerated(0),
+              compactedSegmentsGenerated(0),
               segmentsCleaned(0),
               packLastDidWork(0),
               packLastImprovementSum(0),
@@ -303,6 +342,7 @@ class LogCleaner {
             _sub(cleaningPassTicks);
             _sub(cleaningPasses);
             _sub(emergencyCleaningPasses);
+            _sub(compactionPasses);
             _sub(failedNormalPasses),
             _sub(failedNormalPassTicks),
             _sub(failedEmergencyPasses),
@@ -313,6 +353,7 @@ class LogCleaner {
             _sub(liveEntriesRelocated);
             _sub(entriesRolledBack);
             _sub(segmentsGenerated);
+            _sub(compactedSegmentsGenerated);
             _sub(segmentsCleaned);
             _sub(packLastDidWork);
             _sub(packLastImprovementSum);
@@ -345,6 +386,7 @@ class LogCleaner {
         uint64_t cleaningPassTicks;         /// Time in clean() when we clean.
         uint64_t cleaningPasses;            /// Total cleaning passes done.
         uint64_t emergencyCleaningPasses;   /// Total emergency cleaning passes.
+        uint64_t compactionPasses;          /// Total in-memory compactions.
         uint64_t failedNormalPasses;        /// Total normal passes that failed.
         uint64_t failedNormalPassTicks;     /// Time in failed normal passes.
         uint64_t failedEmergencyPasses;     /// Total emerg. passes that failed.
@@ -355,6 +397,7 @@ class LogCleaner {
         uint64_t liveEntriesRelocated;      /// Entries successfully relocated.
         uint64_t entriesRolledBack;         /// Entries rolled back (not live).
         uint64_t segmentsGenerated;         /// New segments with live data.
+        uint64_t compactedSegmentsGenerated; /// Of those, not replicated.
         uint64_t segmentsCleaned;           /// Clean segments produced.
         uint64_t packLastDidWork;           /// # of segments pack last helped.
         uint64_t packLastImprovementSum;    /// % improvement packing last segs.
@@ -497,34 +540,81 @@ class LogCleaner {
         PerfCounters& perfCounters;
     };
 
+    /**
+     * A thread that cleans the log, along with the counters of the passes
+     * it has made.
+     */
+    struct CleanerThread {
+        CleanerThread()
+            : thread(),
+              perfCounters()
+        {
+        }
+
+        Tub<std::thread> thread;
+        PerfCounters perfCounters;
+
+        DISALLOW_COPY_AND_ASSIGN(CleanerThread);
+    };
+
+    typedef std::unique_lock<std::mutex> Lock;
+
     // cleaner thread entry point
-    static void cleanerThreadEntry(LogCleaner* logCleaner, Context* context);
+    static void cleanerThreadEntry(LogCleaner* logCleaner,
+                                   PerfCounters* counters,
+                                   Context* context);
 
-    void dumpCleaningPassStats(PerfCounters& before);
+    bool doCleaningPass(PerfCounters& counters);
+    void dumpCleaningPassStats(PerfCounters& counters, PerfCounters& before);
     bool getCleanSegmentMemory(size_t segmentsNeeded,
                                std::vector<void*>& cleanSegmentMemory);
     static double writeCost(uint64_t totalCapacity, uint64_t liveBytes);
     static bool isCleanable(double _writeCost);
-    void scanNewCleanableSegments();
+    void scanNewCleanableSegments(PerfCounters& counters);
     void scanSegment(Segment*  segment,
                      uint32_t* implicitlyFreeableEntries,
                      uint32_t* implicitlyFreeableBytes);
-    void scanForFreeSpace();
-    void scanSegmentForFreeSpace(CleanableSegment& cleanableSegment);
-    void getSegmentsToClean(SegmentVector&);
-    size_t getLiveEntries(Segment* segment,
+    void scanForFreeSpace(PerfCounters& counters);
+    void scanSegmentForFreeSpace(PerfCounters& counters,
+                                 CleanableSegment& cleanableSegment);
+    static uint64_t getDiskCapacity(Segment* segment);
+    int getDiskUtilisation();
+    bool updateLostReplicas();
+    void getSegmentsToClean(PerfCounters& counters, SegmentVector&,
+                            bool onDisk = false);
+    size_t getLiveEntries(PerfCounters& counters,
+                          Segment* segment,
                           LiveSegmentEntryHandleVector& liveEntries);
-    size_t getSortedLiveEntries(SegmentVector& segments,
+    size_t getSortedLiveEntries(PerfCounters& counters,
+                                SegmentVector& segments,
                                 LiveSegmentEntryHandleVector& liveEntries);
-    void moveToFillSegment(Segment* lastNewSegment,
+    void moveToFillSegment(PerfCounters& counters,
+                           Segment* lastNewSegment,
                            SegmentVector& segmentsToClean);
-    void moveLiveData(LiveSegmentEntryHandleVector& data,
+    static int getAgeStream(uint32_t now, uint32_t timestamp);
+    void moveLiveData(PerfCounters& counters,
+                      LiveSegmentEntryHandleVector& data,
                       std::vector<void*>& cleanSegmentMemory,
-                      SegmentVector& segmentsToClean);
-    bool setUpNormalCleaningPass(LiveSegmentEntryHandleVector& data,
+                      SegmentVector& segmentsToClean,
+                      SegmentVector& segmentsAdded,
+                      bool segregateByAge = true);
+    void compactSegments(PerfCounters& counters,
+                         std::vector<SegmentVector>& compactions,
+                         std::vector<void*>& cleanSegmentMemory,
+                         SegmentVector& segmentsAdded);
+    bool setUpNormalCleaningPass(Lock& lock,
+                                 PerfCounters& counters,
+                                 LiveSegmentEntryHandleVector& data,
                                  std::vector<void*>& cleanSegmentMemory,
-                                 SegmentVector& segmentsToClean);
-    bool setUpEmergencyCleaningPass(LiveSegmentEntryHandleVector& data,
+                                 SegmentVector& segmentsToClean,
+                                 bool onDisk = false);
+    bool setUpCompactionPass(Lock& lock,
+                             PerfCounters& counters,
+                             std::vector<SegmentVector>& compactions,
+                             std::vector<void*>& cleanSegmentMemory,
+                             SegmentVector& segmentsToClean);
+    bool setUpEmergencyCleaningPass(PerfCounters& counters,
+                                    LiveSegmentEntryHandleVector& data,
                                     std::vector<void*>& cleanSegmentMemory,
                                     SegmentVector& segmentsToClean);
 
@@ -534,6 +624,15 @@ class LogCleaner {
     /// Number of clean Segments to produce in each cleaning pass.
     static const size_t CLEANED_SEGMENTS_PER_PASS = 10;
 
+    /// Number of streams of survivor Segments that normal cleaning passes
+    /// segregate live data into by age. See #getAgeStream.
+    static const int AGE_STREAMS = 4;
+
+    /// Survivors less than this many seconds old go into the first (hottest)
+    /// stream. Each further stream takes data up to this many times older
+    /// than the one before, and the last takes anything older still.
+    static const uint32_t AGE_STREAM_SPAN = 16;
+
     // Initializing a double statically from a constant is (still) not legal
     // C++, though g++ 4.4 allowed it.  g++ 4.6 now disallows it but C++11 now
     // supports this via constexpr, but, of course, g++ 4.4 doesn't support
@@ -591,16 +690,30 @@ class LogCleaner {
     /// to manage the Segments we create while cleaning.
     ReplicaManager* replicaManager;
 
-    /// Tub containing our cleaning thread, if we're told to instantiate one
-    /// by whoever constructs this object.
-    Tub<std::thread> thread;
+    /// Serialises the cleaning threads' choice of Segments to clean:
+    /// protects #scanList and #cleanableSegments. A pass holds it while it
+    /// picks its Segments and removes them from #cleanableSegments, but
+    /// not while it relocates their live data, so that passes relocate
+    /// data from disjoint sets of Segments in parallel.
+    std::mutex candidateMutex;
 
-    /// Set by halt() to ask the cleaning thread to exit.
+    /// Our cleaning threads, if we're told to instantiate any by whoever
+    /// constructs this object.
+    std::vector<CleanerThread*> threads;
+
+    /// Set by halt() to ask the cleaning threads to exit.
     bool threadShouldExit;
 
-    // Current performance counters.
+    /// Percentage of the backup space taken by cleanable Segments' replicas
+    /// that must hold live data before we rewrite any of them. Until
+    /// utilisation drops this low, we only compact Segments in memory. If 0,
+    /// we never compact and every pass writes to backups.
+    const uint32_t minDiskUtilisation;
+
+    // Performance counters of the passes made by #clean.
     PerfCounters perfCounters;
 
+    friend class LogCleanerBenchmark;
     DISALLOW_COPY_AND_ASSIGN(LogCleaner);
 };
 
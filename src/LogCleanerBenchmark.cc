@@ -18,8 +18,20 @@
  * This implements a series of benchmarks for the log cleaner. Many of the
  * tests are cribbed from descriptions of the LFS simulator. We run this as
  * a client for end-to-end evaluation.
+ *
+ * With --cleanerThreads, the benchmark instead runs masters in this process
+ * and writes straight to MasterService::dispatch, so that the cleaner is the
+ * bottleneck rather than the network. It then reports the write throughput
+ * at a range of memory utilisations for 1 up to the given number of cleaner
+ * threads.
+ * Alongside the throughput it reports the write cost: the bytes written to the
+ * log by clients and the cleaner together, per byte written by clients. Use
+ * the zipfian distribution to see how well the cleaner separates hot objects
+ * from cold ones.
  */
 
+#include <cmath>
+
 #include "Common.h"
 
 #include "Context.h"
@@ -28,6 +40,7 @@
 #include "MasterService.h"
 #include "OptionParser.h"
 #include "MasterClient.h"
+#include "Tablets.pb.h"
 #include "Tub.h"
 
 namespace RAMCloud {
@@ -61,6 +74,44 @@ hotAndCold(uint64_t maxKeyVal)
     }
 }
 
+/**
+ * Choose keys with a Zipfian distribution, as YCSB does: the i-th most popular
+ * of the maxKeyVal + 1 keys is chosen with probability proportional to
+ * 1 / i^ZIPF_SKEW, and key 0 is the most popular. This uses the method of
+ * Gray et al., "Quickly Generating Billion-Record Synthetic Databases".
+ */
+static uint64_t
+zipfian(uint64_t maxKeyVal)
+{
+    static const double ZIPF_SKEW = 0.99;
+
+    // These depend only on the number of keys, so compute them once.
+    static uint64_t numKeys = 0;
+    static double zetaN = 0;
+    static double eta = 0;
+    if (numKeys != maxKeyVal + 1) {
+        numKeys = maxKeyVal + 1;
+        zetaN = 0;
+        for (uint64_t i = 1; i <= numKeys; i++)
+            zetaN += 1.0 / pow(static_cast<double>(i), ZIPF_SKEW);
+        double zeta2 = 1.0 + 1.0 / pow(2.0, ZIPF_SKEW);
+        eta = (1.0 - pow(2.0 / static_cast<double>(numKeys),
+                         1.0 - ZIPF_SKEW)) /
+              (1.0 - zeta2 / zetaN);
+    }
+
+    double u = static_cast<double>(generateRandom()) /
+               static_cast<double>(~0UL);
+    double uz = u * zetaN;
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, ZIPF_SKEW))
+        return std::min(1UL, maxKeyVal);
+    uint64_t key = static_cast<uint64_t>(static_cast<double>(numKeys) *
+        pow(eta * u - eta + 1.0, 1.0 / (1.0 - ZIPF_SKEW)));
+    return std::min(key, maxKeyVal);
+}
+
 static void
 runIt(RamCloud* client,
       uint64_t tableId,
@@ -111,6 +162,135 @@ runIt(RamCloud* client,
     printf("\n");
 }
 
+/**
+ * Runs masters in this process, so that the cleaner can be measured without
+ * the network and the transports getting in the way.
+ */
+class LogCleanerBenchmark {
+  public:
+    /**
+     * Fill a master running in this process to the given utilisation and
+     * then overwrite its objects many times over, as fast as a single thread
+     * can hand the writes to MasterService::dispatch.
+     *
+     * \param numCleanerThreads
+     *      Number of threads cleaning the master's log.
+     * \param logBytes
+     *      Size of the master's log.
+     * \param utilisation
+     *      Percentage of the log taken up by live objects.
+     * \param objectSize
+     *      Size of each object in bytes.
+     * \param nextId
+     *      Chooses the key of the next object to overwrite.
+     * \param[out] retries
+     *      Number of writes the master asked to retry, having run out of clean
+     *      segments, is returned here.
+     * \param[out] writeCost
+     *      Bytes appended to the log by both the writes and the cleaner while
+     *      overwriting, divided by the bytes appended by the writes alone.
+     * \return
+     *      Megabytes of objects written per second while overwriting.
+     */
+    static double
+    runLocal(uint32_t numCleanerThreads,
+             uint64_t logBytes,
+             int utilisation,
+             int objectSize,
+             uint64_t (*nextId)(uint64_t),
+             uint64_t* retries,
+             double* writeCost)
+    {
+        ServerConfig config = ServerConfig::forTesting();
+        config.localLocator = "bogus";
+        config.coordinatorLocator = "bogus";
+        config.services = {MASTER_SERVICE};
+        config.master.logBytes = logBytes;
+        config.master.hashTableBytes = logBytes / 10;
+        config.master.numReplicas = 0;
+        config.master.disableLogCleaner = false;
+        config.master.numCleanerThreads = numCleanerThreads;
+        ServerList serverList;
+        MasterService service(config, NULL, serverList);
+        service.init(ServerId(1, 0));
+
+        ProtoBuf::Tablets_Tablet& tablet(*service.tablets.add_tablet());
+        tablet.set_table_id(0);
+        tablet.set_start_key_hash(0);
+        tablet.set_end_key_hash(~0UL);
+        tablet.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
+        tablet.set_server_id(service.serverId.getId());
+        tablet.set_user_data(reinterpret_cast<uint64_t>(new Table(0, 0, ~0UL)));
+        service.indexTablets();
+
+        uint64_t maxId = static_cast<uint64_t>(static_cast<double>(logBytes) /
+            objectSize * utilisation / 100.0);
+        char value[objectSize];
+        memset(value, 'x', objectSize);
+        *retries = 0;
+
+        // Write every object once first, then overwrite them 10 times over.
+        uint64_t numWrites = maxId * 11;
+        uint64_t startTime = 0;
+        uint64_t startBytesAppended = 0;
+        uint64_t startBytesRelocated = 0;
+        for (uint64_t i = 0; i < numWrites; i++) {
+            if (i == maxId) {
+                startTime = Cycles::rdtsc();
+                startBytesAppended = service.log.getBytesAppended();
+                startBytesRelocated = bytesRelocated(service.log.cleaner);
+            }
+            char key[24];
+            uint16_t keyLength = downCast<uint16_t>(snprintf(key, sizeof(key),
+                "%lu", i < maxId ? i : nextId(maxId - 1)));
+            while (1) {
+                Buffer request;
+                Buffer reply;
+                WriteRpc::Request& reqHdr(
+                    *new(&request, APPEND) WriteRpc::Request);
+                memset(&reqHdr, 0, sizeof(reqHdr));
+                reqHdr.common.opcode = WriteRpc::opcode;
+                reqHdr.tableId = 0;
+                reqHdr.keyLength = keyLength;
+                reqHdr.length = objectSize;
+                reqHdr.async = 1;
+                Buffer::Chunk::appendToBuffer(&request, key, keyLength);
+                Buffer::Chunk::appendToBuffer(&request, value, objectSize);
+                Service::Rpc rpc(NULL, request, reply);
+                service.dispatch(WriteRpc::opcode, rpc);
+                Status status = reply.getStart<WriteRpc::Response>()->
+                    common.status;
+                if (status != STATUS_RETRY)
+                    break;
+                (*retries)++;
+            }
+        }
+
+        double seconds = Cycles::toSeconds(Cycles::rdtsc() - startTime);
+        double bytesAppended = static_cast<double>(
+            service.log.getBytesAppended() - startBytesAppended);
+        *writeCost = (bytesAppended + static_cast<double>(
+            bytesRelocated(service.log.cleaner) - startBytesRelocated)) /
+            bytesAppended;
+        return static_cast<double>(numWrites - maxId) * objectSize /
+            seconds / 1024 / 1024;
+    }
+
+  PRIVATE:
+    /**
+     * Return the bytes of live entries that all of the given cleaner's
+     * passes have relocated to survivor segments so far.
+     */
+    static uint64_t
+    bytesRelocated(LogCleaner& cleaner)
+    {
+        uint64_t bytes = cleaner.perfCounters.liveEntryBytes;
+        foreach (LogCleaner::CleanerThread* thread, cleaner.threads)
+            bytes += thread->perfCounters.liveEntryBytes;
+        return bytes;
+    }
+};
+
 } // namespace RAMCloud
 
 using namespace RAMCloud;
@@ -127,6 +307,7 @@ try
     int utilisation;
     string distribution;
     string tableName;
+    uint32_t maxCleanerThreads;
 
     OptionsDescription benchOptions("Bench");
     benchOptions.add_options()
@@ -149,8 +330,15 @@ try
         ("distribution,d",
          ProgramOptions::value<string>(&distribution)->
            default_value("uniform"),
-         "Object distribution; choose one of \"uniform\" or "
-         "\"hotAndCold\"");
+         "Object distribution; choose one of \"uniform\", "
+         "\"hotAndCold\" or \"zipfian\"")
+        ("cleanerThreads,c",
+         ProgramOptions::value<uint32_t>(&maxCleanerThreads)->
+           default_value(0),
+         "If non-zero, run masters in this process rather than writing to "
+         "a cluster, and report the write throughput with 1 up to this "
+         "many cleaner threads at each multiple of 10% utilisation up to "
+         "the one given.");
 
     OptionParser optionParser(benchOptions, argc, argv);
 
@@ -163,9 +351,10 @@ try
             "inclusive\n");
         exit(1);
     }
-    if (distribution != "uniform" && distribution != "hotAndCold") {
-        fprintf(stderr, "ERROR: Distribution must be one of \"uniform\" or "
-            "\"hotAndCold\"\n");
+    if (distribution != "uniform" && distribution != "hotAndCold" &&
+        distribution != "zipfian") {
+        fprintf(stderr, "ERROR: Distribution must be one of \"uniform\", "
+            "\"hotAndCold\" or \"zipfian\"\n");
         exit(1);
     }
     if (objectSize < 1 || objectSize > MAX_OBJECT_SIZE) {
@@ -173,6 +362,38 @@ try
             MAX_OBJECT_SIZE);
     }
 
+    uint64_t (*nextId)(uint64_t) = uniform;
+    if (distribution == "hotAndCold")
+        nextId = hotAndCold;
+    else if (distribution == "zipfian")
+        nextId = zipfian;
+
+    if (maxCleanerThreads > 0) {
+        printf("========== Log Cleaner Benchmark ==========\n");
+        printf(" %dMB Log, %d-byte objects, %s distribution, in process\n",
+            logSize, objectSize, distribution.c_str());
+        printf(" write throughput in MB/s (writes retried, write cost)\n");
+        printf("%5s", "util");
+        for (uint32_t t = 1; t <= maxCleanerThreads; t++)
+            printf("  %18u thr", t);
+        printf("\n");
+        for (int u = 10; u <= utilisation; u += 10) {
+            printf("%4d%%", u);
+            for (uint32_t t = 1; t <= maxCleanerThreads; t++) {
+                uint64_t retries;
+                double writeCost;
+                double mbPerSecond = LogCleanerBenchmark::runLocal(t,
+                    static_cast<uint64_t>(logSize) * 1024 * 1024, u,
+                    objectSize, nextId, &retries, &writeCost);
+                printf("  %7.1f (%5lu, %5.2f)", mbPerSecond, retries,
+                    writeCost);
+                fflush(stdout);
+            }
+            printf("\n");
+        }
+        return 0;
+    }
+
     uint64_t maxKeyVal = ((uint64_t)logSize * 1024 * 1024) / objectSize;
     maxKeyVal = static_cast<uint64_t>(static_cast<double>(maxKeyVal) *
          static_cast<double>(utilisation) / 100.0);
@@ -189,10 +410,7 @@ try
     client->createTable(tableName.c_str());
     uint64_t table = client->getTableId(tableName.c_str());
 
-    if (distribution == "uniform")
-        runIt(client, table, maxKeyVal, objectSize, uniform);
-    else
-        runIt(client, table, maxKeyVal, objectSize, hotAndCold);
+    runIt(client, table, maxKeyVal, objectSize, nextId);
 
     return 0;
 } catch (ClientException& e) {
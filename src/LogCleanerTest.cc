@@ -53,6 +53,17 @@ TEST_F(LogCleanerTest, constructor) {
     EXPECT_EQ(0U, cleaner->cleanableSegments.size());
     EXPECT_EQ(&log, cleaner->log);
     EXPECT_EQ(log.replicaManager, cleaner->replicaManager);
+    EXPECT_EQ(0U, cleaner->minDiskUtilisation);
+}
+
+TEST_F(LogCleanerTest, constructor_threads) {
+    Log log(serverId, 5 * 8192, 8192, 4298, NULL, Log::CONCURRENT_CLEANER, 3);
+    LogCleaner* cleaner = &log.cleaner;
+    EXPECT_EQ(3U, cleaner->threads.size());
+
+    cleaner->halt();
+    EXPECT_EQ(0U, cleaner->threads.size());
+    EXPECT_FALSE(cleaner->threadShouldExit);
 }
 
 TEST_F(LogCleanerTest, getCleanSegmentMemory) {
@@ -66,7 +77,7 @@ TEST_F(LogCleanerTest, getCleanSegmentMemory) {
     EXPECT_EQ(4U, cleanMemory.size());
 
     SegmentVector empty;
-    log.cleaningComplete(empty, cleanMemory);
+    log.cleaningComplete(empty, empty, cleanMemory);
 }
 
 TEST_F(LogCleanerTest, writeCost) {
@@ -99,7 +110,7 @@ TEST_F(LogCleanerTest, scanNewCleanableSegments) {
     cleaner->scanList.push_back(&s1);
     cleaner->scanList.push_back(&s3);
 
-    cleaner->scanNewCleanableSegments();
+    cleaner->scanNewCleanableSegments(cleaner->perfCounters);
     EXPECT_EQ(0U, cleaner->scanList.size());
 }
 
@@ -169,7 +180,7 @@ TEST_F(LogCleanerTest, scanForFreeSpace) {
     Segment cleanableSeg(1, 2, cleanableBuf, sizeof(cleanableBuf));
     cleanableSeg.append(LOG_ENTRY_TYPE_OBJ, "hi", 2);
     cleaner->cleanableSegments.push_back({ &cleanableSeg, 0, 0 });
-    cleaner->scanForFreeSpace();
+    cleaner->scanForFreeSpace(cleaner->perfCounters);
     EXPECT_EQ(0, negativeLiveCBCalled);
 
     // Add a seg that's not cleanable and has no implicitly freeable bytes.
@@ -177,7 +188,7 @@ TEST_F(LogCleanerTest, scanForFreeSpace) {
     Segment notCleanableSeg(1, 2, notCleanableBuf, sizeof(notCleanableBuf));
     notCleanableSeg.append(LOG_ENTRY_TYPE_OBJ, sourceBuf, 8100);
     cleaner->cleanableSegments.push_back({ &notCleanableSeg, 0, 0 });
-    cleaner->scanForFreeSpace();
+    cleaner->scanForFreeSpace(cleaner->perfCounters);
     EXPECT_EQ(0, negativeLiveCBCalled);
 
     // Add a seg that's not cleanable now, but could be due to implicit bytes.
@@ -190,7 +201,7 @@ TEST_F(LogCleanerTest, scanForFreeSpace) {
         LOG_ENTRY_TYPE_OBJTOMB, sourceBuf, 8100);
     cleaner->cleanableSegments.push_back(
         { &almostCleanableSeg, 1, h->totalLength() });
-    cleaner->scanForFreeSpace();
+    cleaner->scanForFreeSpace(cleaner->perfCounters);
     EXPECT_EQ(1, negativeLiveCBCalled);
 
     // Clean up.
@@ -225,7 +236,7 @@ TEST_F(LogCleanerTest, scanSegmentForFreeSpace) {
     LogEntryHandle h = s.append(LOG_ENTRY_TYPE_OBJTOMB, "dead!", 5);
 
     LogCleaner::CleanableSegment cs(&s, 1, h->totalLength());
-    cleaner->scanSegmentForFreeSpace(cs);
+    cleaner->scanSegmentForFreeSpace(cleaner->perfCounters, cs);
     EXPECT_EQ(h->totalLength(), cs.implicitlyFreedBytes);
     EXPECT_EQ(1U, cs.implicitlyFreedEntries);
     EXPECT_EQ(h->totalLength(), s.bytesImplicitlyFreed);
@@ -246,8 +257,8 @@ TEST_F(LogCleanerTest, getSegmentsToClean) {
     while (segmentsToClean.size() == 0) {
         LogEntryHandle h = log.append(LOG_ENTRY_TYPE_OBJ, buf, sizeof(buf));
         log.free(h);
-        cleaner->scanNewCleanableSegments();
-        cleaner->getSegmentsToClean(segmentsToClean);
+        cleaner->scanNewCleanableSegments(cleaner->perfCounters);
+        cleaner->getSegmentsToClean(cleaner->perfCounters, segmentsToClean);
     }
 
     size_t freeableBytes = 0;
@@ -265,6 +276,78 @@ TEST_F(LogCleanerTest, getSegmentsToClean) {
     }
 }
 
+TEST_F(LogCleanerTest, getSegmentsToClean_lostReplicas) {
+    Log log(serverId, 8192 * 20, 8192, 8000, NULL, Log::CLEANER_DISABLED);
+    LogCleaner* cleaner = &log.cleaner;
+
+    char buf1[8192] __attribute__((aligned(8192)));
+    char buf2[8192] __attribute__((aligned(8192)));
+    Segment lost(1, 1, buf1, sizeof(buf1));
+    Segment other(1, 2, buf2, sizeof(buf2));
+    *const_cast<Log**>(&lost.log) = &log;
+    *const_cast<Log**>(&other.log) = &log;
+    cleaner->cleanableSegments.push_back({ &lost, 0, 0 });
+    cleaner->cleanableSegments.push_back({ &other, 0, 0 });
+    cleaner->cleanableSegments[0].lostReplicas = true;
+
+    // Too few Segments to be worth cleaning otherwise.
+    SegmentVector segmentsToClean;
+    cleaner->getSegmentsToClean(cleaner->perfCounters, segmentsToClean);
+    EXPECT_EQ(0U, segmentsToClean.size());
+
+    cleaner->getSegmentsToClean(cleaner->perfCounters, segmentsToClean, true);
+    EXPECT_EQ(1U, segmentsToClean.size());
+    EXPECT_EQ(&lost, segmentsToClean[0]);
+    EXPECT_EQ(&lost, cleaner->cleanableSegments.back().segment);
+}
+
+TEST_F(LogCleanerTest, getDiskCapacity) {
+    char buf1[8192] __attribute__((aligned(8192)));
+    char buf2[8192] __attribute__((aligned(8192)));
+    char buf3[8192] __attribute__((aligned(8192)));
+    char buf4[8192] __attribute__((aligned(8192)));
+    Segment replicated1(1, 1, buf1, sizeof(buf1));
+    Segment replicated2(1, 2, buf2, sizeof(buf2));
+    Segment inMemory1(1, 3, buf3, sizeof(buf3));
+    Segment inMemory2(1, 4, buf4, sizeof(buf4));
+
+    EXPECT_EQ(8192U, LogCleaner::getDiskCapacity(&replicated1));
+
+    inMemory1.inMemoryOnly = true;
+    inMemory1.compactedSegments.push_back(&replicated1);
+    EXPECT_EQ(8192U, LogCleaner::getDiskCapacity(&inMemory1));
+
+    // Compacted in memory twice over; only the replicated Segments count.
+    inMemory2.inMemoryOnly = true;
+    inMemory2.compactedSegments.push_back(&replicated1);
+    inMemory2.compactedSegments.push_back(&inMemory1);
+    inMemory2.compactedSegments.push_back(&replicated2);
+    EXPECT_EQ(2 * 8192U, LogCleaner::getDiskCapacity(&inMemory2));
+}
+
+TEST_F(LogCleanerTest, getDiskUtilisation) {
+    Log log(serverId, 8192 * 20, 8192, 8000, NULL, Log::CLEANER_DISABLED);
+    LogCleaner* cleaner = &log.cleaner;
+    EXPECT_EQ(100, cleaner->getDiskUtilisation());
+
+    char sourceBuf[8192];
+    char buf1[8192] __attribute__((aligned(8192)));
+    char buf2[8192] __attribute__((aligned(8192)));
+    char buf3[8192] __attribute__((aligned(8192)));
+    Segment replicated1(1, 1, buf1, sizeof(buf1));
+    Segment replicated2(1, 2, buf2, sizeof(buf2));
+    Segment inMemory(1, 3, buf3, sizeof(buf3));
+    inMemory.append(LOG_ENTRY_TYPE_OBJ, sourceBuf, 4000);
+    inMemory.inMemoryOnly = true;
+    inMemory.compactedSegments.push_back(&replicated1);
+    inMemory.compactedSegments.push_back(&replicated2);
+
+    cleaner->cleanableSegments.push_back({ &inMemory, 0, 0 });
+    EXPECT_EQ(2 * 8192U, cleaner->cleanableSegments[0].diskCapacity);
+    EXPECT_EQ(static_cast<int>(100 * inMemory.getLiveBytes() / (2 * 8192)),
+              cleaner->getDiskUtilisation());
+}
+
 static bool
 getSegmentsToCleanFilter(string s)
 {
@@ -315,8 +398,8 @@ TEST_F(LogCleanerTest, getSegmentsToClean_writeCost) {
             LogEntryHandle h = log.append(LOG_ENTRY_TYPE_OBJ, buf, sizeof(buf));
             if (freeEveryNth && (j++ % freeEveryNth) == 0)
                 log.free(h);
-            cleaner->scanNewCleanableSegments();
-            cleaner->getSegmentsToClean(segmentsToClean);
+            cleaner->scanNewCleanableSegments(cleaner->perfCounters);
+            cleaner->getSegmentsToClean(cleaner->perfCounters, segmentsToClean);
         }
 
         double writeCost;
@@ -344,7 +427,7 @@ TEST_F(LogCleanerTest, getSegmentsToClean_costBenefitOrder) {
     while (cleaner->cleanableSegments.size() == 0) {
         LogEntryHandle h = log.append(LOG_ENTRY_TYPE_OBJ, buf, sizeof(buf));
         log.free(h);
-        cleaner->scanNewCleanableSegments();
+        cleaner->scanNewCleanableSegments(cleaner->perfCounters);
     }
 
     // Make a bunch more that are ~90% free space.
@@ -353,8 +436,8 @@ TEST_F(LogCleanerTest, getSegmentsToClean_costBenefitOrder) {
         LogEntryHandle h = log.append(LOG_ENTRY_TYPE_OBJ, buf, sizeof(buf));
         if ((i % 10) != 0)
             log.free(h);
-        cleaner->scanNewCleanableSegments();
-        cleaner->getSegmentsToClean(segmentsToClean);
+        cleaner->scanNewCleanableSegments(cleaner->perfCounters);
+        cleaner->getSegmentsToClean(cleaner->perfCounters, segmentsToClean);
     }
 
     int lastUtilisation = 0;
@@ -415,7 +498,8 @@ TEST_F(LogCleanerTest, getLiveEntries) {
     s.append(LOG_ENTRY_TYPE_OBJTOMB, "dead", 4);
 
     wantNewer = h1;
-    size_t liveBytes = cleaner->getLiveEntries(&s, entries);
+    size_t liveBytes = cleaner->getLiveEntries(cleaner->perfCounters, &s,
+                                               entries);
     EXPECT_EQ(h1->length(), liveBytes);
     EXPECT_EQ(1U, entries.size());
     EXPECT_EQ(h1, entries[0].handle);
@@ -443,7 +527,8 @@ TEST_F(LogCleanerTest, getSortedLiveEntries) {
     wantNewer = newer;
     log.append(LOG_ENTRY_TYPE_OBJ, buf, 8192 - 2048);   // force old head closed
 
-    size_t liveBytes = cleaner->getSortedLiveEntries(segments, liveEntries);
+    size_t liveBytes = cleaner->getSortedLiveEntries(cleaner->perfCounters,
+                                                     segments, liveEntries);
 
     EXPECT_EQ(2U, liveEntries.size());
     EXPECT_EQ(older, liveEntries[0].handle);
@@ -507,13 +592,15 @@ TEST_F(LogCleanerTest, moveToFillSegment) {
     SegmentVector segsToClean;
     cleaner->cleanableSegments.push_back({ &sourceSegDoesNotFit, 0, 0 });
     uint32_t liveBefore = segToAppendTo.getLiveBytes();
-    cleaner->moveToFillSegment(&segToAppendTo, segsToClean);
+    cleaner->moveToFillSegment(cleaner->perfCounters, &segToAppendTo,
+                               segsToClean);
     EXPECT_EQ(liveBefore, segToAppendTo.getLiveBytes());
     EXPECT_EQ(0U, segsToClean.size());
 
     cleaner->cleanableSegments.push_back({ &sourceSegFits, 0, 0 });
     EXPECT_EQ(2U, cleaner->cleanableSegments.size());
-    cleaner->moveToFillSegment(&segToAppendTo, segsToClean);
+    cleaner->moveToFillSegment(cleaner->perfCounters, &segToAppendTo,
+                               segsToClean);
     EXPECT_EQ(1U, segsToClean.size());
     EXPECT_EQ(&sourceSegFits, segsToClean[0]);
     EXPECT_EQ(1U, cleaner->cleanableSegments.size());
@@ -540,6 +627,207 @@ TEST_F(LogCleanerTest, moveToFillSegment) {
     EXPECT_EQ(0, tombs);
 }
 
+// Entries whose data starts with 'L' are live.
+static bool
+markedLiveCB(LogEntryHandle h, void* cookie)
+{
+    return *h->userData<char>() == 'L';
+}
+
+TEST_F(LogCleanerTest, compactSegments) {
+    Log log(serverId, 8192 * 1000, 8192, 4298, NULL, Log::CLEANER_DISABLED,
+            1, 50);
+    LogCleaner* cleaner = &log.cleaner;
+    log.registerType(LOG_ENTRY_TYPE_OBJ,
+                     true,
+                     markedLiveCB, NULL,
+                     relocationCBTrue, NULL,
+                     timestampCB);
+    char live[64];
+    char dead[64];
+    memset(live, 'L', sizeof(live));
+    memset(dead, 'D', sizeof(dead));
+
+    // Fill Segments that are ~90% free until enough can be compacted.
+    std::vector<SegmentVector> compactions;
+    std::vector<void*> cleanSegmentMemory;
+    SegmentVector segmentsToClean;
+    for (size_t i = 0; compactions.size() == 0; i++) {
+        LogEntryHandle h = log.append(LOG_ENTRY_TYPE_OBJ,
+            (i % 10) == 0 ? live : dead, sizeof(live));
+        if ((i % 10) != 0)
+            log.free(h);
+
+        LogCleaner::Lock lock(cleaner->candidateMutex);
+        cleaner->scanNewCleanableSegments(cleaner->perfCounters);
+        cleaner->setUpCompactionPass(lock, cleaner->perfCounters,
+                                     compactions, cleanSegmentMemory,
+                                     segmentsToClean);
+    }
+
+    // Whole Segments are packed into fewer new ones.
+    size_t compacting = 0;
+    foreach (SegmentVector& compaction, compactions)
+        compacting += compaction.size();
+    EXPECT_EQ(segmentsToClean.size(), compacting);
+    EXPECT_LT(compactions.size(), segmentsToClean.size());
+    EXPECT_EQ(compactions.size(), cleanSegmentMemory.size());
+    foreach (LogCleaner::CleanableSegment& cs, cleaner->cleanableSegments) {
+        EXPECT_TRUE(std::find(segmentsToClean.begin(), segmentsToClean.end(),
+            cs.segment) == segmentsToClean.end());
+    }
+
+    SegmentVector survivors;
+    cleaner->compactSegments(cleaner->perfCounters, compactions,
+                             cleanSegmentMemory, survivors);
+    EXPECT_EQ(0U, cleanSegmentMemory.size());
+    EXPECT_EQ(compactions.size(), survivors.size());
+    EXPECT_EQ(survivors.size(),
+              cleaner->perfCounters.compactedSegmentsGenerated);
+
+    size_t liveEntries = 0;
+    for (size_t i = 0; i < survivors.size(); i++) {
+        Segment* survivor = survivors[i];
+        EXPECT_TRUE(survivor->inMemoryOnly);
+        EXPECT_TRUE(survivor->replicatedSegment == NULL);
+        EXPECT_TRUE(survivor->closed);
+        EXPECT_EQ(compactions[i], survivor->compactedSegments);
+        foreach (Segment* compacted, compactions[i])
+            EXPECT_TRUE(compacted->compacted);
+
+        for (SegmentIterator it(survivor); !it.isDone(); it.next()) {
+            if (it.getType() != LOG_ENTRY_TYPE_OBJ)
+                continue;
+            EXPECT_EQ('L', *it.getHandle()->userData<char>());
+            liveEntries++;
+        }
+    }
+    EXPECT_EQ(cleaner->perfCounters.liveEntriesRelocated, liveEntries);
+
+    log.cleaningComplete(segmentsToClean, survivors, cleanSegmentMemory);
+}
+
+TEST_F(LogCleanerTest, compactSegments_alreadyCompacted) {
+    Log log(serverId, 8192 * 20, 8192, 8000, NULL, Log::CLEANER_DISABLED,
+            1, 50);
+    LogCleaner* cleaner = &log.cleaner;
+
+    Segment* replicated = new Segment(&log, false, log.allocateSegmentId(),
+        log.getFromFreeList(false), 8192, NULL, LOG_ENTRY_TYPE_UNINIT,
+        NULL, 0);
+    Segment* inMemory = new Segment(&log, false, log.allocateSegmentId(),
+        log.getFromFreeList(false), 8192, NULL, LOG_ENTRY_TYPE_UNINIT,
+        NULL, 0);
+    replicated->close(NULL);
+    replicated->compacted = true;
+    inMemory->close(NULL);
+    inMemory->inMemoryOnly = true;
+    inMemory->compactedSegments.push_back(replicated);
+    log.cleanableList.push_back(*inMemory);
+    log.allocateHead();
+
+    // Compacting an in-memory Segment again takes on what it stood for.
+    std::vector<SegmentVector> compactions(1, SegmentVector(1, inMemory));
+    std::vector<void*> cleanSegmentMemory(1, log.getFromFreeList(false));
+    SegmentVector survivors;
+    cleaner->compactSegments(cleaner->perfCounters, compactions,
+                             cleanSegmentMemory, survivors);
+    ASSERT_EQ(1U, survivors.size());
+    EXPECT_TRUE(inMemory->compacted);
+    ASSERT_EQ(2U, survivors[0]->compactedSegments.size());
+    EXPECT_EQ(replicated, survivors[0]->compactedSegments[0]);
+    EXPECT_EQ(inMemory, survivors[0]->compactedSegments[1]);
+
+    SegmentVector clean(1, inMemory);
+    log.cleaningComplete(clean, survivors, cleanSegmentMemory);
+
+    // Segments above are deallocated by the log destructor.
+}
+
+TEST_F(LogCleanerTest, getAgeStream) {
+    EXPECT_EQ(0, LogCleaner::getAgeStream(1000000, 1000000));
+    EXPECT_EQ(0, LogCleaner::getAgeStream(1000000, 1000001));
+    EXPECT_EQ(0, LogCleaner::getAgeStream(1000000, 1000000 - 15));
+    EXPECT_EQ(1, LogCleaner::getAgeStream(1000000, 1000000 - 16));
+    EXPECT_EQ(1, LogCleaner::getAgeStream(1000000, 1000000 - 255));
+    EXPECT_EQ(2, LogCleaner::getAgeStream(1000000, 1000000 - 256));
+    EXPECT_EQ(2, LogCleaner::getAgeStream(1000000, 1000000 - 4095));
+    EXPECT_EQ(3, LogCleaner::getAgeStream(1000000, 1000000 - 4096));
+    EXPECT_EQ(3, LogCleaner::getAgeStream(1000000, 0));
+}
+
+static void
+moveLiveDataSetUp(Log& log, LogCleaner::LiveSegmentEntryHandleVector& live,
+                  std::vector<void*>& cleanSegmentMemory)
+{
+    log.registerType(LOG_ENTRY_TYPE_OBJ,
+                     true,
+                     livenessCB, NULL,
+                     relocationCBTrue, NULL,
+                     timestampCB);
+
+    // Hot and cold data, interleaved in the Segment being cleaned.
+    uint32_t now = secondsTimestamp();
+    for (int i = 0; i < 4; i++) {
+        bool hot = (i % 2) != 0;
+        LogEntryHandle h = log.append(LOG_ENTRY_TYPE_OBJ,
+                                      hot ? "hot" : "old", 4);
+        live.push_back({ h, hot ? now : now - 100000 });
+    }
+    log.allocateHead();
+
+    for (int i = 0; i < 4; i++)
+        cleanSegmentMemory.push_back(log.getSegmentMemoryForCleaning(false));
+}
+
+TEST_F(LogCleanerTest, moveLiveData_segregateByAge) {
+    Log log(serverId, 8192 * 20, 8192, 8000, NULL, Log::CLEANER_DISABLED);
+    LogCleaner* cleaner = &log.cleaner;
+    LogCleaner::LiveSegmentEntryHandleVector live;
+    std::vector<void*> cleanSegmentMemory;
+    moveLiveDataSetUp(log, live, cleanSegmentMemory);
+
+    SegmentVector segmentsToClean;
+    SegmentVector survivors;
+    cleaner->moveLiveData(cleaner->perfCounters, live, cleanSegmentMemory,
+                          segmentsToClean, survivors);
+    ASSERT_EQ(2U, survivors.size());
+    EXPECT_EQ(4U, cleaner->perfCounters.liveEntriesRelocated);
+
+    for (size_t i = 0; i < survivors.size(); i++) {
+        int objs = 0;
+        const char* expected = (i == 0) ? "old" : "hot";
+        for (SegmentIterator it(survivors[i]); !it.isDone(); it.next()) {
+            if (it.getType() != LOG_ENTRY_TYPE_OBJ)
+                continue;
+            EXPECT_STREQ(expected, it.getHandle()->userData<char>());
+            objs++;
+        }
+        EXPECT_EQ(2, objs);
+    }
+
+    SegmentVector clean;
+    log.cleaningComplete(clean, survivors, cleanSegmentMemory);
+}
+
+TEST_F(LogCleanerTest, moveLiveData_noSegregation) {
+    Log log(serverId, 8192 * 20, 8192, 8000, NULL, Log::CLEANER_DISABLED);
+    LogCleaner* cleaner = &log.cleaner;
+    LogCleaner::LiveSegmentEntryHandleVector live;
+    std::vector<void*> cleanSegmentMemory;
+    moveLiveDataSetUp(log, live, cleanSegmentMemory);
+
+    SegmentVector segmentsToClean;
+    SegmentVector survivors;
+    cleaner->moveLiveData(cleaner->perfCounters, live, cleanSegmentMemory,
+                          segmentsToClean, survivors, false);
+    EXPECT_EQ(1U, survivors.size());
+    EXPECT_EQ(4U, cleaner->perfCounters.liveEntriesRelocated);
+
+    SegmentVector clean;
+    log.cleaningComplete(clean, survivors, cleanSegmentMemory);
+}
+
 // Ensure we fill objects into older destination Segments in order
 // to get better utilisation.
 TEST_F(LogCleanerTest, moveLiveData_packOldFirst) {
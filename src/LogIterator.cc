@@ -38,16 +38,16 @@ namespace RAMCloud {
  *
  * Since additional appends to the log may occur during iteration, locks have to
  * sometimes be briefly acquired when stepping between Segments (since the list
- * of active Segments may be changing). Furthermore, once the Log head is
- * reached, it is locked to avoid any modifications during iteration and not
- * unlocked until the iterator is destroyed). Locking is not done for any of the
- * closed Segments, however, as they are immutable. Finally, although cleaning
- * may occur during iteration, any cleaned segments will have been pinned (they
- * are not permitted to be reclaimed so long as any iterator exists) so as to
- * avoid any races. This effectively delays the return of any freed memory to
- * the system until all iterators are either destroyed or have finished walking
- * the entire log. (We can relax this in the future to unpin segments after all
- * iterators have passed over them).
+ * of active Segments may be changing). Furthermore, once a Log head is
+ * reached, all of the heads are locked to avoid any modifications during
+ * iteration and not unlocked until the iterator is destroyed). Locking is not
+ * done for any of the closed Segments, however, as they are immutable.
+ * Finally, although cleaning may occur during iteration, any cleaned segments
+ * will have been pinned (they are not permitted to be reclaimed so long as any
+ * iterator exists) so as to avoid any races. This effectively delays the
+ * return of any freed memory to the system until all iterators are either
+ * destroyed or have finished walking the entire log. (We can relax this in the
+ * future to unpin segments after all iterators have passed over them).
  *
  * Locking the head once we reach it and keeping it locked until the iterator
  * has been destroyed allows the caller to ensure that once they've iterated
@@ -62,12 +62,16 @@ LogIterator::LogIterator(Log& log)
       segmentList(),
       currentIterator(),
       currentSegmentId(Segment::INVALID_SEGMENT_ID),
-      headLocked(false)
+      headLocked(false),
+      start(),
+      end(),
+      rangeDone(false),
+      segmentIds(NULL)
 {
     // If there's no log head yet we need to preclude any appends.
     log.listLock.lock();
     if (log.head == NULL) {
-        log.appendLock.lock();
+        log.lockHeads();
         headLocked = true;
     }
     log.iteratorCreated();
@@ -76,10 +80,57 @@ LogIterator::LogIterator(Log& log)
     next();
 }
 
+/**
+ * Construct a LogIterator that only visits the entries appended between two
+ * positions of the log.
+ *
+ * Unlike an iterator over the whole log, this one never locks the head:
+ * entries before \a end are no longer changing, so appends may carry on
+ * while it is in use. This is what lets a caller walk the log in several
+ * passes, each ending at what was the head when the pass began, without
+ * holding up writes.
+ *
+ * Segments cleaned after the iterator was created are kept around while it
+ * exists, just as with any other LogIterator, so every entry in the range
+ * is visited at the position it was appended at, even if the cleaner has
+ * since copied it elsewhere. Segments created by the cleaner after the
+ * iterator was created are not visited.
+ *
+ * \param log
+ *      The log to iterate over.
+ * \param start
+ *      Position of the first entry to visit.
+ * \param end
+ *      Position just past the last entry to visit; normally a value
+ *      returned by Log::headOfLog() some time earlier.
+ * \param segmentIds
+ *      If not NULL, segments whose IDs aren't in this set are skipped
+ *      without looking at their entries. The set must not change while
+ *      the iterator exists.
+ */
+LogIterator::LogIterator(Log& log, LogPosition start, LogPosition end,
+                         const std::unordered_set<uint64_t>* segmentIds)
+    : log(log),
+      segmentList(),
+      currentIterator(),
+      currentSegmentId(start.segmentId() - 1),
+      headLocked(false),
+      start(start),
+      end(end),
+      rangeDone(false),
+      segmentIds(segmentIds)
+{
+    log.listLock.lock();
+    log.iteratorCreated();
+    log.listLock.unlock();
+
+    nextInRange();
+}
+
 LogIterator::~LogIterator()
 {
     if (headLocked)
-        log.appendLock.unlock();
+        log.unlockHeads();
     std::lock_guard<SpinLock> lock(log.listLock);
     log.iteratorDestroyed();
 }
@@ -95,6 +146,9 @@ LogIterator::~LogIterator()
 bool
 LogIterator::isDone() const
 {
+    if (end)
+        return rangeDone;
+
     if (currentIterator && !currentIterator->isDone())
         return false;
 
@@ -110,6 +164,11 @@ LogIterator::isDone() const
 void
 LogIterator::next()
 {
+    if (end) {
+        nextInRange();
+        return;
+    }
+
     if (currentIterator && !currentIterator->isDone()) {
         currentIterator->next();
         return;
@@ -129,8 +188,8 @@ LogIterator::next()
     if (segmentList.size() == 0)
         return;
 
-    if (segmentList.back() == log.head) {
-        log.appendLock.lock();
+    if (!headLocked && log.isHead(segmentList.back())) {
+        log.lockHeads();
         headLocked = true;
     }
 
@@ -139,11 +198,12 @@ LogIterator::next()
 
     // If we've just iterated over the head, then the only segments
     // that can exist in the log with higher IDs must have been generated
-    // by the cleaner prior to iteration.
+    // by the cleaner prior to iteration. With several heads, they may also
+    // be the other heads or Segments those have filled since.
     //
     // TODO(rumble): It's a bummer that we're holding the head locked. Should
     // we not iterate over these segments before the head?
-    if (headLocked && log.head != segmentList.back())
+    if (headLocked && log.heads.size() == 1 && log.head != segmentList.back())
         assert(currentIterator->isCleanerSegment());
 
     segmentList.pop_back();
@@ -174,6 +234,48 @@ LogIterator::getHandle() const
 // PRIVATE METHODS
 //
 
+/**
+ * Implementation of #next for iterators over a range of the log: advance to
+ * the next entry at or after #start, or set #rangeDone if there is none
+ * before #end.
+ */
+void
+LogIterator::nextInRange()
+{
+    while (!rangeDone) {
+        if (currentIterator && !currentIterator->isDone()) {
+            currentIterator->next();
+        } else {
+            if (currentIterator)
+                currentIterator.destroy();
+
+            std::lock_guard<SpinLock> lock(log.listLock);
+            if (segmentList.size() == 0)
+                populateSegmentList(currentSegmentId + 1);
+            while (segmentIds != NULL && segmentList.size() > 0 &&
+                   segmentIds->count(segmentList.back()->getId()) == 0)
+                segmentList.pop_back();
+            if (segmentList.size() == 0 ||
+                segmentList.back()->getId() > end->segmentId()) {
+                segmentList.clear();
+                rangeDone = true;
+                return;
+            }
+            currentIterator.construct(segmentList.back());
+            currentSegmentId = segmentList.back()->getId();
+            segmentList.pop_back();
+        }
+
+        if (currentIterator->isDone())
+            continue;
+        LogPosition position = currentIterator->getLogPosition();
+        if (position >= *end)
+            rangeDone = true;
+        else if (position >= start)
+            return;
+    }
+}
+
 /**
  * Populate our list of segments from the log. Only segments newer than or
  * equal to the specified Segment ID are added. This method should only be
@@ -204,8 +306,10 @@ LogIterator::populateSegmentList(uint64_t nextSegmentId)
         }
     }
 
-    if (log.head != NULL && log.head->getId() >= nextSegmentId)
-        segmentList.push_back(log.head);
+    foreach (Log::Head* slot, log.heads) {
+        if (slot->segment != NULL && slot->segment->getId() >= nextSegmentId)
+            segmentList.push_back(slot->segment);
+    }
 
     // Sort in descending order (so we can pop oldest ones off the back).
     std::sort(segmentList.begin(),
@@ -17,6 +17,7 @@
 #define RAMCLOUD_LOGITERATOR_H
 
 #include <stdint.h>
+#include <unordered_set>
 #include <vector>
 #include "Log.h"
 #include "SegmentIterator.h"
@@ -26,6 +27,8 @@ namespace RAMCloud {
 class LogIterator {
   PUBLIC:
     explicit LogIterator(Log& log);
+    LogIterator(Log& log, LogPosition start, LogPosition end,
+                const std::unordered_set<uint64_t>* segmentIds = NULL);
     ~LogIterator();
 
     bool                isDone() const;
@@ -47,6 +50,7 @@ class LogIterator {
     };
 
     void populateSegmentList(uint64_t nextSegmentId);
+    void nextInRange();
 
     /// Reference to the Log we're iterating.
     Log& log;
@@ -64,6 +68,21 @@ class LogIterator {
     /// Indication that the head is locked and must be unlocked on destruction.
     bool headLocked;
 
+    /// For iterators over a range of the log: the first position to visit.
+    LogPosition start;
+
+    /// For iterators over a range of the log: the position just past the
+    /// last entry to visit. Empty when iterating the whole log.
+    Tub<LogPosition> end;
+
+    /// For iterators over a range of the log: set once the end of the range
+    /// has been reached.
+    bool rangeDone;
+
+    /// For iterators over a range of the log: if not NULL, only segments
+    /// with these IDs are visited.
+    const std::unordered_set<uint64_t>* segmentIds;
+
     DISALLOW_COPY_AND_ASSIGN(LogIterator);
 };
 
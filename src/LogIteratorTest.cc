@@ -83,9 +83,9 @@ TEST_F(LogIteratorTest, destructor) {
     {
         LogIterator i(l);
         EXPECT_TRUE(i.headLocked);
-        EXPECT_NE(0, l.appendLock.mutex.load());
+        EXPECT_TRUE(TestUtil::isLocked(l.heads[0]->appendLock));
     }
-    EXPECT_EQ(0, l.appendLock.mutex.load());
+    EXPECT_FALSE(TestUtil::isLocked(l.heads[0]->appendLock));
     EXPECT_EQ(0, l.logIteratorCount);
 }
 
@@ -219,6 +219,115 @@ TEST_F(LogIteratorTest, next) {
     }
 }
 
+TEST_F(LogIteratorTest, constructor_range) {
+    l.append(LOG_ENTRY_TYPE_OBJ, &serverId, sizeof(serverId));
+    LogIterator i(l, LogPosition(), l.headOfLog());
+    EXPECT_FALSE(i.headLocked);
+    EXPECT_FALSE(TestUtil::isLocked(l.heads[0]->appendLock));
+    EXPECT_TRUE(i.currentIterator);
+    EXPECT_FALSE(i.isDone());
+    EXPECT_EQ(LOG_ENTRY_TYPE_SEGHEADER, i.getHandle()->type());
+    EXPECT_EQ(1, l.logIteratorCount);
+}
+
+TEST_F(LogIteratorTest, constructor_emptyRange) {
+    {
+        LogIterator i(l, LogPosition(), LogPosition());
+        EXPECT_TRUE(i.isDone());
+        EXPECT_FALSE(i.headLocked);
+        EXPECT_EQ(1, l.logIteratorCount);
+    }
+    EXPECT_EQ(0, l.logIteratorCount);
+
+    l.append(LOG_ENTRY_TYPE_OBJ, &serverId, sizeof(serverId));
+    LogPosition head = l.headOfLog();
+    LogIterator i(l, head, head);
+    EXPECT_TRUE(i.isDone());
+}
+
+TEST_F(LogIteratorTest, next_range) {
+    l.append(LOG_ENTRY_TYPE_OBJ, &serverId, sizeof(serverId));
+    LogPosition first = l.headOfLog();
+    l.append(LOG_ENTRY_TYPE_OBJTOMB, &serverId, sizeof(serverId));
+    LogPosition second = l.headOfLog();
+
+    {
+        // Just the tombstone.
+        LogIterator i(l, first, second);
+        EXPECT_EQ(LOG_ENTRY_TYPE_OBJTOMB, i.getHandle()->type());
+        EXPECT_EQ(first, i.getHandle()->logPosition());
+        i.next();
+        EXPECT_TRUE(i.isDone());
+    }
+
+    int objCnt = 0, otherCnt = 0;
+    for (LogIterator i(l, LogPosition(), first); !i.isDone(); i.next()) {
+        if (i.getHandle()->type() == LOG_ENTRY_TYPE_OBJ)
+            objCnt++;
+        else
+            otherCnt++;
+    }
+    EXPECT_EQ(1, objCnt);
+    EXPECT_EQ(2, otherCnt);
+
+    // Span a segment boundary, and keep appending while iterating: the
+    // head isn't locked, and nothing past the end of the range is visited.
+    int origObjCnt = 0;
+    Segment* oldHead = l.head;
+    while (l.head == oldHead) {
+        l.append(LOG_ENTRY_TYPE_OBJ, &serverId, sizeof(serverId));
+        origObjCnt++;
+    }
+    LogPosition third = l.headOfLog();
+    EXPECT_EQ(1U, third.segmentId());
+
+    objCnt = 0;
+    int tombCnt = 0;
+    otherCnt = 0;
+    for (LogIterator i(l, first, third); !i.isDone(); i.next()) {
+        l.append(LOG_ENTRY_TYPE_OBJ, &serverId, sizeof(serverId));
+        LogEntryType type = i.getHandle()->type();
+        if (type == LOG_ENTRY_TYPE_OBJ)
+            objCnt++;
+        else if (type == LOG_ENTRY_TYPE_OBJTOMB)
+            tombCnt++;
+        else
+            otherCnt++;
+    }
+    EXPECT_EQ(origObjCnt, objCnt);
+    EXPECT_EQ(1, tombCnt);
+    // The old head's padding and footer, the new head's header and digest.
+    EXPECT_EQ(4, otherCnt);
+}
+
+TEST_F(LogIteratorTest, next_rangeSegmentFilter) {
+    l.append(LOG_ENTRY_TYPE_OBJ, &serverId, sizeof(serverId));
+    Segment* oldHead = l.head;
+    while (l.head == oldHead)
+        l.append(LOG_ENTRY_TYPE_OBJ, &serverId, sizeof(serverId));
+    l.append(LOG_ENTRY_TYPE_OBJTOMB, &serverId, sizeof(serverId));
+    LogPosition end = l.headOfLog();
+    EXPECT_EQ(1U, end.segmentId());
+
+    // Only the second segment: its header, the digest, the first object
+    // (which didn't fit into the first segment) and the tombstone.
+    std::unordered_set<uint64_t> segmentIds = { 1 };
+    int tombCnt = 0, cnt = 0;
+    for (LogIterator i(l, LogPosition(), end, &segmentIds); !i.isDone();
+         i.next()) {
+        EXPECT_EQ(1U, i.getHandle()->logPosition().segmentId());
+        if (i.getHandle()->type() == LOG_ENTRY_TYPE_OBJTOMB)
+            tombCnt++;
+        cnt++;
+    }
+    EXPECT_EQ(1, tombCnt);
+    EXPECT_EQ(4, cnt);
+
+    segmentIds.clear();
+    LogIterator i(l, LogPosition(), end, &segmentIds);
+    EXPECT_TRUE(i.isDone());
+}
+
 TEST_F(LogIteratorTest, populateSegmentList) {
         char alignedBuf[8192] __attribute__((aligned(8192)));
         Segment seg1(*serverId, 17243, alignedBuf, sizeof(alignedBuf));
@@ -276,7 +385,9 @@ TEST_F(LogIteratorTest, cleanerInteraction) {
     EXPECT_EQ(1U, clean.size());
     EXPECT_EQ(1U, l.cleanableList.size());
     clean.push_back(&l.cleanableList.back());
-    l.cleaningComplete(clean, unused);
+    SegmentVector survivors;
+    survivors.push_back(&cleanerSeg);
+    l.cleaningComplete(clean, survivors, unused);
 
     // Sanity: seg 2 (cleaner seg) mustn't immediately become part of the log
     while (!i->isDone()) {
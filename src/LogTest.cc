@@ -152,6 +152,44 @@ TEST_F(LogTest, allocateHead_lists) {
     // Segments allocated above are deallocated in the Log destructor.
 }
 
+TEST_F(LogTest, allocateHead_compactedSegments) {
+    Log l(serverId, 6 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED);
+
+    Segment* compacted1 = new Segment(&l, false, l.allocateSegmentId(),
+        l.getFromFreeList(false), 8192, NULL, LOG_ENTRY_TYPE_UNINIT,
+        NULL, 0);
+    compacted1->compacted = true;
+    l.freePendingReferenceList.push_back(*compacted1);
+
+    Segment* compacted2 = new Segment(&l, false, l.allocateSegmentId(),
+        l.getFromFreeList(false), 8192, NULL, LOG_ENTRY_TYPE_UNINIT,
+        NULL, 0);
+    compacted2->compacted = true;
+    l.freePendingReferenceList.push_back(*compacted2);
+
+    Segment* inMemory = new Segment(&l, false, l.allocateSegmentId(),
+        l.getFromFreeList(false), 8192, NULL, LOG_ENTRY_TYPE_UNINIT,
+        NULL, 0);
+    inMemory->inMemoryOnly = true;
+    inMemory->compactedSegments.push_back(compacted1);
+    inMemory->compactedSegments.push_back(compacted2);
+    l.cleanableList.push_back(*inMemory);
+
+    l.allocateHead();
+
+    const SegmentEntry *se = reinterpret_cast<const SegmentEntry*>(
+        (const char *)l.head->getBaseAddress() + sizeof(SegmentEntry) +
+        sizeof(SegmentHeader));
+    EXPECT_EQ(LOG_ENTRY_TYPE_LOGDIGEST, se->type);
+    LogDigest digest(se + 1, se->length);
+    EXPECT_EQ(3, digest.getSegmentCount());
+    EXPECT_EQ(compacted1->getId(), digest.getSegmentIds()[0]);
+    EXPECT_EQ(compacted2->getId(), digest.getSegmentIds()[1]);
+    EXPECT_EQ(l.head->getId(), digest.getSegmentIds()[2]);
+
+    // Segments allocated above are deallocated in the Log destructor.
+}
+
 TEST_F(LogTest, allocateHeadIfStillOn) {
     Log l(serverId, 4 * 8192, 8192, 4298);
 
@@ -165,6 +203,109 @@ TEST_F(LogTest, allocateHeadIfStillOn) {
     EXPECT_EQ(oldHead, l.head);
 }
 
+TEST_F(LogTest, allocateHead_multipleHeads) {
+    Log l(serverId, 6 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED,
+          1, 0, 2);
+    EXPECT_EQ(2U, l.heads.size());
+
+    l.allocateHead();
+    Segment* first = l.heads[0]->segment;
+    Segment* second = l.heads[1]->segment;
+    EXPECT_EQ(second, l.head);
+    EXPECT_EQ(first->getId() + 1, second->getId());
+
+    // Both heads carry the same digest, which names each of them.
+    foreach (Log::Head* slot, l.heads) {
+        const SegmentEntry *se = reinterpret_cast<const SegmentEntry*>(
+            (const char *)slot->segment->getBaseAddress() +
+            sizeof(SegmentEntry) + sizeof(SegmentHeader));
+        LogDigest digest(se + 1, se->length);
+        EXPECT_EQ(2, digest.getSegmentCount());
+        EXPECT_EQ(first->getId(), digest.getSegmentIds()[0]);
+        EXPECT_EQ(second->getId(), digest.getSegmentIds()[1]);
+    }
+
+    // Rolling over replaces and closes both heads.
+    l.allocateHead();
+    Segment* third = l.heads[0]->segment;
+    Segment* fourth = l.heads[1]->segment;
+    EXPECT_NE(first, third);
+    EXPECT_NE(second, fourth);
+    EXPECT_EQ(fourth, l.head);
+    EXPECT_EQ(2U, l.cleanableNewList.size());
+    EXPECT_THROW(first->close(NULL), SegmentException);
+    EXPECT_THROW(second->close(NULL), SegmentException);
+    EXPECT_FALSE(TestUtil::isLocked(l.heads[0]->appendLock));
+    EXPECT_FALSE(TestUtil::isLocked(l.heads[1]->appendLock));
+
+    const SegmentEntry *se = reinterpret_cast<const SegmentEntry*>(
+        (const char *)third->getBaseAddress() + sizeof(SegmentEntry) +
+        sizeof(SegmentHeader));
+    LogDigest digest(se + 1, se->length);
+    EXPECT_EQ(4, digest.getSegmentCount());
+    EXPECT_EQ(first->getId(), digest.getSegmentIds()[0]);
+    EXPECT_EQ(second->getId(), digest.getSegmentIds()[1]);
+    EXPECT_EQ(third->getId(), digest.getSegmentIds()[2]);
+    EXPECT_EQ(fourth->getId(), digest.getSegmentIds()[3]);
+
+    // Only one Segment is left free, so the heads stay as they are.
+    EXPECT_EQ(1U, l.freeList.size());
+    EXPECT_THROW(l.allocateHead(), LogOutOfMemoryException);
+    EXPECT_EQ(1U, l.freeList.size());
+    EXPECT_FALSE(TestUtil::isLocked(l.heads[0]->appendLock));
+    EXPECT_FALSE(TestUtil::isLocked(l.heads[1]->appendLock));
+}
+
+TEST_F(LogTest, allocateHeadIfStillOn_multipleHeads) {
+    Log l(serverId, 6 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED,
+          1, 0, 2);
+
+    // With no head at all, they are allocated regardless.
+    l.allocateHeadIfStillOn(5lu);
+    Segment* first = l.heads[0]->segment;
+    Segment* second = l.heads[1]->segment;
+    EXPECT_TRUE(first != NULL);
+    EXPECT_TRUE(second != NULL);
+
+    // Any one of the heads rolls them all over.
+    l.allocateHeadIfStillOn(first->getId());
+    EXPECT_NE(first, l.heads[0]->segment);
+    EXPECT_NE(second, l.heads[1]->segment);
+    EXPECT_EQ(l.heads[1]->segment, l.head);
+
+    // Heads that have since been replaced are left alone.
+    Segment* newest = l.head;
+    l.allocateHeadIfStillOn(second->getId());
+    EXPECT_EQ(newest, l.head);
+}
+
+TEST_F(LogTest, headOfLog_multipleHeads) {
+    Log l(serverId, 6 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED,
+          1, 0, 2);
+    EXPECT_EQ(LogPosition(), l.headOfLog());
+
+    l.allocateHead();
+    Segment* older = l.heads[0]->segment;
+    Segment* newest = l.heads[1]->segment;
+
+    // Nothing more may be appended to the older head, lest it land before
+    // the position returned.
+    LogPosition position = l.headOfLog();
+    EXPECT_EQ(newest->getId(), position.segmentId());
+    EXPECT_EQ(newest->getTotalBytesAppended(), position.segmentOffset());
+    EXPECT_TRUE(NULL == l.heads[0]->segment);
+    EXPECT_EQ(newest, l.heads[1]->segment);
+    EXPECT_EQ(older, &l.cleanableNewList.front());
+    EXPECT_THROW(older->close(NULL), SegmentException);
+    EXPECT_FALSE(TestUtil::isLocked(l.heads[0]->appendLock));
+    EXPECT_FALSE(TestUtil::isLocked(l.heads[1]->appendLock));
+
+    // The next roll over replaces the one left open, too.
+    l.allocateHead();
+    EXPECT_TRUE(l.heads[0]->segment != NULL);
+    EXPECT_NE(newest, l.heads[1]->segment);
+    EXPECT_THROW(newest->close(NULL), SegmentException);
+}
 
 TEST_F(LogTest, locklessAddToFreeList) {
     Log l(serverId, 2 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED);
@@ -457,8 +598,11 @@ TEST_F(LogTest, cleaningComplete) {
     l.cleanableList.push_back(*cleanSeg);
     clean.push_back(cleanSeg);
 
+    SegmentVector survivors;
+    survivors.push_back(liveSeg);
     std::vector<void*> empty;
-    l.cleaningComplete(clean, empty);
+    l.cleaningComplete(clean, survivors, empty);
+    survivors.clear();
 
     EXPECT_EQ(1U, l.cleanablePendingDigestList.size());
     EXPECT_EQ(1U, l.freePendingDigestAndReferenceList.size());
@@ -475,11 +619,11 @@ TEST_F(LogTest, cleaningComplete) {
     TestServerRpc* rpc = pool.construct();
     clean.pop_back();
     cleanSeg->cleanedEpoch = 6;
-    l.cleaningComplete(clean, empty);
+    l.cleaningComplete(clean, survivors, empty);
     EXPECT_EQ(1U, l.freePendingReferenceList.size());
 
     pool.destroy(rpc);
-    l.cleaningComplete(clean, empty);
+    l.cleaningComplete(clean, survivors, empty);
     EXPECT_EQ(0U, l.freePendingReferenceList.size());
 
     // check returning unused segments memory
@@ -487,12 +631,91 @@ TEST_F(LogTest, cleaningComplete) {
     void* toFreeAgain = l.freeList.back();
     l.freeList.pop_back();
     empty.push_back(toFreeAgain);
-    l.cleaningComplete(clean, empty);
+    l.cleaningComplete(clean, survivors, empty);
     EXPECT_EQ(toFreeAgain, l.freeList.back());
 
     // Segments above are deallocated by log destructor
 }
 
+TEST_F(LogTest, cleaningComplete_survivorsOfOtherPasses) {
+    Log l(serverId, 3 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED);
+
+    Segment* ours = new Segment(&l, false, l.allocateSegmentId(),
+        l.getFromFreeList(false), 8192, NULL, LOG_ENTRY_TYPE_UNINIT,
+        NULL, 0);
+    Segment* theirs = new Segment(&l, false, l.allocateSegmentId(),
+        l.getFromFreeList(false), 8192, NULL, LOG_ENTRY_TYPE_UNINIT,
+        NULL, 0);
+    l.cleaningInto(ours);
+    l.cleaningInto(theirs);
+
+    // Another cleaner thread is still filling its survivor, which mustn't
+    // become part of the log yet.
+    SegmentVector clean;
+    SegmentVector survivors;
+    survivors.push_back(ours);
+    std::vector<void*> empty;
+    l.cleaningComplete(clean, survivors, empty);
+    EXPECT_EQ(1U, l.cleanablePendingDigestList.size());
+    EXPECT_EQ(ours, &l.cleanablePendingDigestList.front());
+    EXPECT_EQ(1U, l.cleaningIntoList.size());
+    EXPECT_EQ(theirs, &l.cleaningIntoList.front());
+
+    survivors[0] = theirs;
+    l.cleaningComplete(clean, survivors, empty);
+    EXPECT_EQ(2U, l.cleanablePendingDigestList.size());
+    EXPECT_EQ(0U, l.cleaningIntoList.size());
+
+    // Segments above are deallocated by log destructor
+}
+
+TEST_F(LogTest, cleaningComplete_compactedSegments) {
+    Log l(serverId, 3 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED);
+
+    ServerRpcPoolInternal::currentEpoch = 5;
+
+    Segment* compacted = new Segment(&l, false, l.allocateSegmentId(),
+        l.getFromFreeList(false), 8192, NULL, LOG_ENTRY_TYPE_UNINIT,
+        NULL, 0);
+    compacted->close(NULL);
+    compacted->compacted = true;
+    compacted->cleanedEpoch = 0;
+    l.activeIdMap[compacted->getId()] = compacted;
+    l.activeBaseAddressMap[compacted->getBaseAddress()] = compacted;
+    l.freePendingReferenceList.push_back(*compacted);
+
+    Segment* inMemory = new Segment(&l, false, l.allocateSegmentId(),
+        l.getFromFreeList(false), 8192, NULL, LOG_ENTRY_TYPE_UNINIT,
+        NULL, 0);
+    inMemory->close(NULL);
+    inMemory->inMemoryOnly = true;
+    inMemory->compactedSegments.push_back(compacted);
+    l.activeIdMap[inMemory->getId()] = inMemory;
+    l.activeBaseAddressMap[inMemory->getBaseAddress()] = inMemory;
+    l.cleanableList.push_back(*inMemory);
+
+    // The compacted Segment's memory is reused, but its replicas stand in
+    // for the in-memory Segment's, so it stays live.
+    SegmentVector clean;
+    SegmentVector survivors;
+    std::vector<void*> empty;
+    l.cleaningComplete(clean, survivors, empty);
+    EXPECT_EQ(0U, l.freePendingReferenceList.size());
+    EXPECT_EQ(compacted->getBaseAddress(), l.freeList.back());
+    EXPECT_EQ(0U, l.activeBaseAddressMap.count(compacted->getBaseAddress()));
+    EXPECT_TRUE(l.isSegmentLive(compacted->getId()));
+
+    size_t freeSegments = l.freeList.size();
+    uint64_t compactedId = compacted->getId();
+    uint64_t inMemoryId = inMemory->getId();
+    l.cleanableList.erase(l.cleanableList.iterator_to(*inMemory));
+    inMemory->cleanedEpoch = 0;
+    l.freePendingReferenceList.push_back(*inMemory);
+    l.cleaningComplete(clean, survivors, empty);
+    EXPECT_EQ(freeSegments + 1, l.freeList.size());
+    EXPECT_FALSE(l.isSegmentLive(compactedId));
+    EXPECT_FALSE(l.isSegmentLive(inMemoryId));
+}
 
 /**
  * Unit tests for LogDigest.
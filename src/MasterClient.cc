@@ -266,22 +266,52 @@ MasterClient::prepForMigration(uint64_t tableId,
  *
  * \param newOwnerMasterId
  *      ServerId of the node to which the tablet should be migrated.
+ *
+ * \param bytesPerSecond
+ *      Limit on the rate at which the tablet's data is sent, or 0 to use
+ *      the master's default (see ServerConfig::Master).
  */
 void
 MasterClient::migrateTablet(uint64_t tableId,
                             uint64_t firstKey,
                             uint64_t lastKey,
-                            ServerId newOwnerMasterId)
+                            ServerId newOwnerMasterId,
+                            uint64_t bytesPerSecond)
 {
-    Buffer req, resp;
+    MigrateTablet(*this, tableId, firstKey, lastKey, newOwnerMasterId,
+                  bytesPerSecond)();
+}
 
-    MigrateTabletRpc::Request& reqHdr(allocHeader<MigrateTabletRpc>(req));
+/// Start a migrateTablet RPC. See MasterClient::migrateTablet.
+MasterClient::MigrateTablet::MigrateTablet(MasterClient& client,
+                                           uint64_t tableId,
+                                           uint64_t firstKey,
+                                           uint64_t lastKey,
+                                           ServerId newOwnerMasterId,
+                                           uint64_t bytesPerSecond)
+    : client(client)
+    , requestBuffer()
+    , responseBuffer()
+    , state()
+{
+    MigrateTabletRpc::Request& reqHdr(
+        client.allocHeader<MigrateTabletRpc>(requestBuffer));
     reqHdr.tableId = tableId;
     reqHdr.firstKey = firstKey;
     reqHdr.lastKey = lastKey;
     reqHdr.newOwnerMasterId = *newOwnerMasterId;
-    sendRecv<MigrateTabletRpc>(session, req, resp);
-    checkStatus(HERE);
+    reqHdr.bytesPerSecond = bytesPerSecond;
+    state = client.send<MigrateTabletRpc>(client.session,
+                                          requestBuffer,
+                                          responseBuffer);
+}
+
+/// Wait for the migrateTablet RPC to complete.
+void
+MasterClient::MigrateTablet::operator()()
+{
+    client.recv<MigrateTabletRpc>(state);
+    client.checkStatus(HERE);
 }
 
 /**
@@ -307,19 +337,38 @@ MasterClient::receiveMigrationData(uint64_t tableId,
                                    const void* segment,
                                    uint32_t segmentBytes)
 {
-    Buffer req, resp;
+    ReceiveMigrationData(*this, tableId, firstKey, segment, segmentBytes)();
+}
 
+/// Start a receiveMigrationData RPC. See MasterClient::receiveMigrationData.
+MasterClient::ReceiveMigrationData::ReceiveMigrationData(
+        MasterClient& client,
+        uint64_t tableId,
+        uint64_t firstKey,
+        const void* segment,
+        uint32_t segmentBytes)
+    : client(client)
+    , requestBuffer()
+    , responseBuffer()
+    , state()
+{
     ReceiveMigrationDataRpc::Request& reqHdr(
-        allocHeader<ReceiveMigrationDataRpc>(req));
+        client.allocHeader<ReceiveMigrationDataRpc>(requestBuffer));
     reqHdr.tableId = tableId;
     reqHdr.firstKey = firstKey;
     reqHdr.segmentBytes = segmentBytes;
-    memcpy(new(&req, APPEND) char[segmentBytes],
-           segment,
-           segmentBytes);
+    Buffer::Chunk::appendToBuffer(&requestBuffer, segment, segmentBytes);
+    state = client.send<ReceiveMigrationDataRpc>(client.session,
+                                                 requestBuffer,
+                                                 responseBuffer);
+}
 
-    sendRecv<ReceiveMigrationDataRpc>(session, req, resp);
-    checkStatus(HERE);
+/// Wait for the receiveMigrationData RPC to complete.
+void
+MasterClient::ReceiveMigrationData::operator()()
+{
+    client.recv<ReceiveMigrationDataRpc>(state);
+    client.checkStatus(HERE);
 }
 
 /// Start a multiRead RPC. See MasterClient::multiRead.
@@ -408,6 +457,140 @@ MasterClient::multiRead(std::vector<ReadObject*> requests)
     MultiRead(*this, requests).complete();
 }
 
+/// Start a multiRemove RPC. See MasterClient::multiRemove.
+MasterClient::MultiRemove::MultiRemove(MasterClient& client,
+                                       std::vector<RemoveObject*>& requests)
+    : client(client)
+    , requestBuffer()
+    , responseBuffer()
+    , state()
+    , requests(requests)
+{
+    MultiRemoveRpc::Request&
+        reqHdr(client.allocHeader<MultiRemoveRpc>(requestBuffer));
+    reqHdr.count = downCast<uint32_t>(requests.size());
+
+    foreach (RemoveObject *request, requests) {
+        new(&requestBuffer, APPEND)
+            MultiRemoveRpc::Request::Part(request->tableId,
+                                          request->keyLength,
+                                          request->rejectRules ?
+                                              *request->rejectRules :
+                                              defaultRejectRules);
+        Buffer::Chunk::appendToBuffer(&requestBuffer, request->key,
+                                      request->keyLength);
+    }
+
+    state = client.send<MultiRemoveRpc>(client.session, requestBuffer,
+                                        responseBuffer);
+}
+
+/// Wait for multiRemove RPC to complete.
+void
+MasterClient::MultiRemove::complete()
+{
+    const MultiRemoveRpc::Response& respHdr(
+        client.recv<MultiRemoveRpc>(state));
+    client.checkStatus(HERE);
+
+    uint32_t respOffset = downCast<uint32_t>(sizeof(respHdr));
+    foreach (RemoveObject *request, requests) {
+        const MultiRemoveRpc::Response::Part* part =
+            responseBuffer.getOffset<MultiRemoveRpc::Response::Part>(
+                respOffset);
+        respOffset += downCast<uint32_t>(sizeof(*part));
+        request->status = part->status;
+        request->version = part->version;
+    }
+}
+
+/**
+ * Delete multiple objects, with a single round trip to the server and a
+ * single wait for their tombstones to be replicated.
+ *
+ * \param requests
+ *      Vector (of RemoveObject's) listing the objects to be removed. The
+ *      status and version of each are filled in; see MasterClient::remove.
+ *
+ * \exception InternalError
+ */
+void
+MasterClient::multiRemove(std::vector<RemoveObject*> requests)
+{
+    MultiRemove(*this, requests).complete();
+}
+
+/// Start a multiWrite RPC. See MasterClient::multiWrite.
+MasterClient::MultiWrite::MultiWrite(MasterClient& client,
+                                     std::vector<WriteObject*>& requests,
+                                     bool async)
+    : client(client)
+    , requestBuffer()
+    , responseBuffer()
+    , state()
+    , requests(requests)
+{
+    MultiWriteRpc::Request&
+        reqHdr(client.allocHeader<MultiWriteRpc>(requestBuffer));
+    reqHdr.count = downCast<uint32_t>(requests.size());
+    reqHdr.async = async;
+
+    foreach (WriteObject *request, requests) {
+        new(&requestBuffer, APPEND)
+            MultiWriteRpc::Request::Part(request->tableId,
+                                         request->keyLength,
+                                         request->valueLength,
+                                         request->rejectRules ?
+                                             *request->rejectRules :
+                                             defaultRejectRules);
+        Buffer::Chunk::appendToBuffer(&requestBuffer, request->key,
+                                      request->keyLength);
+        Buffer::Chunk::appendToBuffer(&requestBuffer, request->value,
+                                      request->valueLength);
+    }
+
+    state = client.send<MultiWriteRpc>(client.session, requestBuffer,
+                                       responseBuffer);
+}
+
+/// Wait for multiWrite RPC to complete.
+void
+MasterClient::MultiWrite::complete()
+{
+    const MultiWriteRpc::Response& respHdr(client.recv<MultiWriteRpc>(state));
+    client.checkStatus(HERE);
+
+    uint32_t respOffset = downCast<uint32_t>(sizeof(respHdr));
+    foreach (WriteObject *request, requests) {
+        const MultiWriteRpc::Response::Part* part =
+            responseBuffer.getOffset<MultiWriteRpc::Response::Part>(
+                respOffset);
+        respOffset += downCast<uint32_t>(sizeof(*part));
+        request->status = part->status;
+        request->version = part->version;
+    }
+}
+
+/**
+ * Write multiple objects, with a single round trip to the server. The
+ * server appends them to its log in groups rather than one by one and
+ * waits for replication just once.
+ *
+ * \param requests
+ *      Vector (of WriteObject's) listing the objects to be written. The
+ *      status and version of each are filled in; see MasterClient::write.
+ * \param async
+ *      If true, the new objects will not be replicated to backups before
+ *      the call returns.
+ *
+ * \exception InternalError
+ */
+void
+MasterClient::multiWrite(std::vector<WriteObject*> requests, bool async)
+{
+    MultiWrite(*this, requests, async).complete();
+}
+
 /**
  * Increments a numeric object by a specifiable value. The
  * object should be an 8-byte, two's complement, little-endian integer.
@@ -87,6 +87,133 @@ class MasterClient : public Client {
         }
     };
 
+    /**
+     * Format for requesting a write of an object as a part of multiWrite
+     */
+    struct WriteObject {
+        /**
+         * The table containing the object (return value from a previous
+         * call to getTableId).
+         */
+        uint64_t tableId;
+        /**
+         * Variable length key that uniquely identifies the object within table.
+         * It does not necessarily have to be null terminated like a string.
+         */
+        const char* key;
+        /**
+         * Length of key
+         */
+        uint16_t keyLength;
+        /**
+         * The new value of the object. It is not copied, so it must stay
+         * intact until the multiWrite has completed.
+         */
+        const void* value;
+        /**
+         * Length of value in bytes
+         */
+        uint32_t valueLength;
+        /**
+         * If non-NULL, specifies conditions under which the write
+         * should be aborted with an error.
+         */
+        const RejectRules* rejectRules;
+        /**
+         * The version number of the object is returned here: the new one
+         * if the write succeeded, otherwise the current one.
+         */
+        uint64_t version;
+        /**
+         * The status of write (either that the write succeeded, or the
+         * error in case it didn't) is returned here.
+         */
+        Status status;
+
+        WriteObject(uint64_t tableId, const char* key, uint16_t keyLength,
+                    const void* value, uint32_t valueLength,
+                    const RejectRules* rejectRules = NULL)
+            : tableId(tableId)
+            , key(key)
+            , keyLength(keyLength)
+            , value(value)
+            , valueLength(valueLength)
+            , rejectRules(rejectRules)
+            , version()
+            , status()
+        {
+        }
+
+        WriteObject()
+            : tableId()
+            , key()
+            , keyLength()
+            , value()
+            , valueLength()
+            , rejectRules()
+            , version()
+            , status()
+        {
+        }
+    };
+
+    /**
+     * Format for requesting the removal of an object as a part of
+     * multiRemove
+     */
+    struct RemoveObject {
+        /**
+         * The table containing the object (return value from a previous
+         * call to getTableId).
+         */
+        uint64_t tableId;
+        /**
+         * Variable length key that uniquely identifies the object within table.
+         * It does not necessarily have to be null terminated like a string.
+         */
+        const char* key;
+        /**
+         * Length of key
+         */
+        uint16_t keyLength;
+        /**
+         * If non-NULL, specifies conditions under which the removal
+         * should be aborted with an error.
+         */
+        const RejectRules* rejectRules;
+        /**
+         * The version number of the object just before the removal is
+         * returned here, or VERSION_NONEXISTENT if it didn't exist.
+         */
+        uint64_t version;
+        /**
+         * The status of removal (either that the removal succeeded, or the
+         * error in case it didn't) is returned here.
+         */
+        Status status;
+
+        RemoveObject(uint64_t tableId, const char* key, uint16_t keyLength,
+                     const RejectRules* rejectRules = NULL)
+            : tableId(tableId)
+            , key(key)
+            , keyLength(keyLength)
+            , rejectRules(rejectRules)
+            , version()
+            , status()
+        {
+        }
+
+        RemoveObject()
+            : tableId()
+            , key()
+            , keyLength()
+            , rejectRules()
+            , version()
+            , status()
+        {
+        }
+    };
+
     /// An asynchronous version of #multiread().
     class MultiRead {
       public:
@@ -103,6 +230,38 @@ class MasterClient : public Client {
         DISALLOW_COPY_AND_ASSIGN(MultiRead);
     };
 
+    /// An asynchronous version of #multiRemove().
+    class MultiRemove {
+      public:
+        MultiRemove(MasterClient& client,
+                    std::vector<RemoveObject*>& requests);
+        bool isReady() { return state.isReady(); }
+        void complete();
+      private:
+        MasterClient& client;
+        Buffer requestBuffer;
+        Buffer responseBuffer;
+        AsyncState state;
+        std::vector<RemoveObject*>& requests;
+        DISALLOW_COPY_AND_ASSIGN(MultiRemove);
+    };
+
+    /// An asynchronous version of #multiWrite().
+    class MultiWrite {
+      public:
+        MultiWrite(MasterClient& client,
+                   std::vector<WriteObject*>& requests, bool async = false);
+        bool isReady() { return state.isReady(); }
+        void complete();
+      private:
+        MasterClient& client;
+        Buffer requestBuffer;
+        Buffer responseBuffer;
+        AsyncState state;
+        std::vector<WriteObject*>& requests;
+        DISALLOW_COPY_AND_ASSIGN(MultiWrite);
+    };
+
     /// An asynchronous version of #read().
     class Read {
       public:
@@ -122,6 +281,40 @@ class MasterClient : public Client {
         DISALLOW_COPY_AND_ASSIGN(Read);
     };
 
+    /// An asynchronous version of #migrateTablet().
+    class MigrateTablet {
+      public:
+        MigrateTablet(MasterClient& client,
+                      uint64_t tableId, uint64_t firstKey, uint64_t lastKey,
+                      ServerId newOwnerMasterId, uint64_t bytesPerSecond = 0);
+        bool isReady() { return state.isReady(); }
+        void operator()();
+      private:
+        MasterClient& client;
+        Buffer requestBuffer;
+        Buffer responseBuffer;
+        AsyncState state;
+        DISALLOW_COPY_AND_ASSIGN(MigrateTablet);
+    };
+
+    /// An asynchronous version of #receiveMigrationData(). The segment is
+    /// not copied, so it must stay intact until the RPC has completed.
+    class ReceiveMigrationData {
+      public:
+        ReceiveMigrationData(MasterClient& client,
+                             uint64_t tableId, uint64_t firstKey,
+                             const void* segment, uint32_t segmentBytes);
+        void cancel() { state.cancel(); }
+        bool isReady() { return state.isReady(); }
+        void operator()();
+      private:
+        MasterClient& client;
+        Buffer requestBuffer;
+        Buffer responseBuffer;
+        AsyncState state;
+        DISALLOW_COPY_AND_ASSIGN(ReceiveMigrationData);
+    };
+
     class Recover {
       public:
         Recover(MasterClient& client,
@@ -172,6 +365,8 @@ class MasterClient : public Client {
     bool isReplicaNeeded(ServerId backupServerId, uint64_t segmentId);
     LogPosition getHeadOfLog();
     void multiRead(std::vector<ReadObject*> requests);
+    void multiRemove(std::vector<RemoveObject*> requests);
+    void multiWrite(std::vector<WriteObject*> requests, bool async = false);
     void getServerStatistics(ProtoBuf::ServerStatistics& serverStats);
     void read(uint64_t tableId, const char* key, uint16_t keyLength,
               Buffer* value, const RejectRules* rejectRules = NULL,
@@ -188,7 +383,8 @@ class MasterClient : public Client {
     void migrateTablet(uint64_t tableId,
                        uint64_t firstKey,
                        uint64_t lastKey,
-                       ServerId newMasterOwnerId);
+                       ServerId newMasterOwnerId,
+                       uint64_t bytesPerSecond = 0);
     void recover(ServerId masterId, uint64_t partitionId,
                  const ProtoBuf::Tablets& tablets,
                  const RecoverRpc::Replica* replicas, uint32_t numReplicas);
@@ -13,6 +13,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -57,6 +59,10 @@ MasterService::Replica::Replica(uint64_t backupId, uint64_t segmentId,
 
 // --- MasterService ---
 
+// At this load factor about 2% of the buckets of #objectMap overflow their
+// first cache line.
+const double MasterService::MAX_OBJECT_MAP_LOAD_FACTOR = 0.5;
+
 bool objectLivenessCallback(LogEntryHandle handle,
                             void* cookie);
 bool objectRelocationCallback(LogEntryHandle oldHandle,
@@ -90,7 +96,8 @@ MasterService::MasterService(const ServerConfig& config,
     , serverId()
     , serverList(serverList)
     , replicaManager(serverList, serverId,
-                     config.master.numReplicas, &config.coordinatorLocator)
+                     config.master.numReplicas, &config.coordinatorLocator,
+                     config.master.groupCommitMicros)
     , bytesWritten(0)
     , log(serverId,
           config.master.logBytes,
@@ -100,13 +107,26 @@ MasterService::MasterService(const ServerConfig& config,
                 config.maxObjectDataSize,
           &replicaManager,
           config.master.disableLogCleaner ? Log::CLEANER_DISABLED :
-                                            Log::CONCURRENT_CLEANER)
-    , objectMap(config.master.hashTableBytes /
-        HashTable<LogEntryHandle>::bytesPerCacheLine())
+                                            Log::CONCURRENT_CLEANER,
+          config.master.numCleanerThreads,
+          config.master.minDiskUtilisation,
+          config.master.numLogHeads)
+    // With at least one bucket per object lock, the lock of a bucket
+    // stays the same when the table doubles (see #objectLock).
+    , objectMap(std::max(config.master.hashTableBytes /
+                             HashTable<LogEntryHandle>::bytesPerCacheLine(),
+                         static_cast<uint64_t>(NUM_OBJECT_LOCKS)))
     , tablets()
+    , tabletIndex()
     , initCalled(false)
+    , outgoingMigration(NULL)
+    , migrationReplayThrottle(config.master.migrationBytesPerSecond,
+                              MIGRATION_SEGMENT_BYTES)
     , anyWrites(false)
-    , objectUpdateLock()
+    , objectLocks()
+    , allObjectLocks(*this)
+    , objectMapResizer()
+    , replayThreads(*this, config.master.numReplayThreads)
 {
     log.registerType(LOG_ENTRY_TYPE_OBJ,
                      true,
@@ -128,6 +148,10 @@ MasterService::MasterService(const ServerConfig& config,
 
 MasterService::~MasterService()
 {
+    {
+        Dispatch::Lock lock;
+        objectMapResizer.destroy();
+    }
     replicaManager.haltFailureMonitor();
     std::set<Table*> tables;
     foreach (const ProtoBuf::Tablets::Tablet& tablet, tablets.tablet())
@@ -141,7 +165,54 @@ MasterService::dispatch(RpcOpcode opcode, Rpc& rpc)
 {
     assert(initCalled);
 
-    std::lock_guard<SpinLock> lock(objectUpdateLock);
+    // Requests on objects lock just the objects they touch, so that they
+    // can run in parallel. Migrations take locks themselves, and only for
+    // short periods, so that the master keeps serving the tablet
+    // meanwhile. Incoming migration data may have to wait for its turn
+    // (see #migrationReplayThrottle), which mustn't hold up anything else.
+    switch (opcode) {
+        case IncrementRpc::opcode:
+            callHandler<IncrementRpc, MasterService,
+                        &MasterService::increment>(rpc);
+            return;
+        case MigrateTabletRpc::opcode:
+            callHandler<MigrateTabletRpc, MasterService,
+                        &MasterService::migrateTablet>(rpc);
+            return;
+        case MultiReadRpc::opcode:
+            callHandler<MultiReadRpc, MasterService,
+                        &MasterService::multiRead>(rpc);
+            return;
+        case MultiRemoveRpc::opcode:
+            callHandler<MultiRemoveRpc, MasterService,
+                        &MasterService::multiRemove>(rpc);
+            return;
+        case MultiWriteRpc::opcode:
+            callHandler<MultiWriteRpc, MasterService,
+                        &MasterService::multiWrite>(rpc);
+            return;
+        case ReadRpc::opcode:
+            callHandler<ReadRpc, MasterService,
+                        &MasterService::read>(rpc);
+            return;
+        case ReceiveMigrationDataRpc::opcode:
+            callHandler<ReceiveMigrationDataRpc, MasterService,
+                        &MasterService::receiveMigrationData>(rpc);
+            return;
+        case RemoveRpc::opcode:
+            callHandler<RemoveRpc, MasterService,
+                        &MasterService::remove>(rpc);
+            return;
+        case WriteRpc::opcode:
+            callHandler<WriteRpc, MasterService,
+                        &MasterService::write>(rpc);
+            return;
+        default:
+            break;
+    }
+
+    // Everything else is rare enough to simply exclude all other requests.
+    std::lock_guard<AllObjectLocks> lock(allObjectLocks);
 
     switch (opcode) {
         case DropTabletOwnershipRpc::opcode:
@@ -152,10 +223,6 @@ MasterService::dispatch(RpcOpcode opcode, Rpc& rpc)
             callHandler<FillWithTestDataRpc, MasterService,
                         &MasterService::fillWithTestData>(rpc);
             break;
-        case IncrementRpc::opcode:
-            callHandler<IncrementRpc, MasterService,
-                        &MasterService::increment>(rpc);
-            break;
         case IsReplicaNeededRpc::opcode:
             callHandler<IsReplicaNeededRpc, MasterService,
                         &MasterService::isReplicaNeeded>(rpc);
@@ -168,34 +235,14 @@ MasterService::dispatch(RpcOpcode opcode, Rpc& rpc)
             callHandler<GetHeadOfLogRpc, MasterService,
                         &MasterService::getHeadOfLog>(rpc);
             break;
-        case MigrateTabletRpc::opcode:
-            callHandler<MigrateTabletRpc, MasterService,
-                        &MasterService::migrateTablet>(rpc);
-            break;
-        case MultiReadRpc::opcode:
-            callHandler<MultiReadRpc, MasterService,
-                        &MasterService::multiRead>(rpc);
-            break;
         case PrepForMigrationRpc::opcode:
             callHandler<PrepForMigrationRpc, MasterService,
                         &MasterService::prepForMigration>(rpc);
             break;
-        case ReadRpc::opcode:
-            callHandler<ReadRpc, MasterService,
-                        &MasterService::read>(rpc);
-            break;
-        case ReceiveMigrationDataRpc::opcode:
-            callHandler<ReceiveMigrationDataRpc, MasterService,
-                        &MasterService::receiveMigrationData>(rpc);
-            break;
         case RecoverRpc::opcode:
             callHandler<RecoverRpc, MasterService,
                         &MasterService::recover>(rpc);
             break;
-        case RemoveRpc::opcode:
-            callHandler<RemoveRpc, MasterService,
-                        &MasterService::remove>(rpc);
-            break;
         case SplitMasterTabletRpc::opcode:
             callHandler<SplitMasterTabletRpc, MasterService,
                         &MasterService::splitMasterTablet>(rpc);
@@ -204,10 +251,6 @@ MasterService::dispatch(RpcOpcode opcode, Rpc& rpc)
             callHandler<TakeTabletOwnershipRpc, MasterService,
                         &MasterService::takeTabletOwnership>(rpc);
             break;
-        case WriteRpc::opcode:
-            callHandler<WriteRpc, MasterService,
-                        &MasterService::write>(rpc);
-            break;
         default:
             throw UnimplementedRequestError(HERE);
     }
@@ -227,6 +270,11 @@ MasterService::init(ServerId id)
     LOG(NOTICE, "My server ID is %lu", serverId.getId());
     metrics->serverId = serverId.getId();
 
+    {
+        Dispatch::Lock lock;
+        objectMapResizer.construct(*this);
+    }
+
     initCalled = true;
 }
 
@@ -310,9 +358,16 @@ MasterService::getServerStatistics(
 {
     ProtoBuf::ServerStatistics serverStats;
 
+    uint64_t now = Cycles::rdtsc();
     foreach (const ProtoBuf::Tablets::Tablet& i, tablets.tablet()) {
         Table* table = reinterpret_cast<Table*>(i.user_data());
-        *serverStats.add_tabletentry() = table->statEntry;
+        table->statistics.sample(now);
+        ProtoBuf::ServerStatistics::TabletEntry& entry(
+            *serverStats.add_tabletentry());
+        entry.set_table_id(i.table_id());
+        entry.set_start_key_hash(i.start_key_hash());
+        entry.set_end_key_hash(i.end_key_hash());
+        table->statistics.serialize(entry);
     }
 
     respHdr.serverStatsLength = serializeToResponse(rpc.replyPayload,
@@ -348,39 +403,303 @@ MasterService::multiRead(const MultiReadRpc::Request& reqHdr,
 
     respHdr.count = numRequests;
 
-    // Each iteration extracts one request from request rpc, finds the
-    // corresponding object, and appends the response to the response rpc.
-    for (uint32_t i = 0; i < numRequests; i++) {
-        const MultiReadRpc::Request::Part *currentReq =
-            rpc.requestPayload.getOffset<MultiReadRpc::Request::Part>(
-            reqOffset);
-        reqOffset += downCast<uint32_t>(sizeof(MultiReadRpc::Request::Part));
-        const char* key =
-            static_cast<const char*>(rpc.requestPayload.getRange(
-            reqOffset, currentReq->keyLength));
-        reqOffset += downCast<uint32_t>(currentReq->keyLength);
-
-        Status* status = new(&rpc.replyPayload, APPEND) Status(STATUS_OK);
-        // We must note the status if the table does not exist. Also, we might
-        // have an entry in the hash table that's invalid because its tablet no
-        // longer lives here.
-        if (getTable(currentReq->tableId, key, currentReq->keyLength) == NULL) {
-            *status = STATUS_UNKNOWN_TABLE;
-            continue;
+    // Each iteration extracts a group of requests from request rpc, finds
+    // the corresponding objects, and appends the responses to the response
+    // rpc. The objects of a group are looked up in #objectMap together, so
+    // that the cache misses of the lookups overlap.
+    for (uint32_t first = 0; first < numRequests;
+         first += MULTIREAD_BATCH_SIZE) {
+        uint32_t count = numRequests - first;
+        if (count > MULTIREAD_BATCH_SIZE)
+            count = MULTIREAD_BATCH_SIZE;
+
+        HashTable<LogEntryHandle>::BatchEntry batch[MULTIREAD_BATCH_SIZE];
+        ObjectLockGroup locks;
+        for (uint32_t i = 0; i < count; i++) {
+            const MultiReadRpc::Request::Part *currentReq =
+                rpc.requestPayload.getOffset<MultiReadRpc::Request::Part>(
+                reqOffset);
+            reqOffset +=
+                downCast<uint32_t>(sizeof(MultiReadRpc::Request::Part));
+            const char* key =
+                static_cast<const char*>(rpc.requestPayload.getRange(
+                reqOffset, currentReq->keyLength));
+            reqOffset += downCast<uint32_t>(currentReq->keyLength);
+
+            batch[i].key1 = currentReq->tableId;
+            batch[i].key2 = key;
+            batch[i].key2Length = currentReq->keyLength;
+            locks.add(objectLock(currentReq->tableId, key,
+                                 currentReq->keyLength));
+        }
+        locks.lock();
+
+        objectMap.lookupBatch(batch, count);
+
+        for (uint32_t i = 0; i < count; i++) {
+            Status* status = new(&rpc.replyPayload, APPEND) Status(STATUS_OK);
+
+            // We must note the status if the table does not exist. Also, we
+            // might have an entry in the hash table that's invalid because
+            // its tablet no longer lives here.
+            HashType keyHash = getKeyHash(batch[i].key2, batch[i].key2Length);
+            Table* table = getTableForHash(batch[i].key1, keyHash);
+            if (table == NULL) {
+                *status = STATUS_UNKNOWN_TABLE;
+                continue;
+            }
+            LogEntryHandle handle = batch[i].referent;
+            if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ) {
+                 table->statistics.recordRead(keyHash, 0);
+                 *status = STATUS_OBJECT_DOESNT_EXIST;
+                 continue;
+            }
+            table->statistics.recordRead(keyHash,
+                handle->userData<Object>()->dataLength(handle->length()));
+
+            const SegmentEntry* entry =
+                reinterpret_cast<const SegmentEntry*>(handle);
+            Buffer::Chunk::appendToBuffer(&rpc.replyPayload, entry,
+                downCast<uint32_t>(sizeof(SegmentEntry)) + handle->length());
+        }
+    }
+}
+
+/**
+ * Top-level server method to handle the MULTI_REMOVE request.
+ *
+ * The removals are made in groups (see #PendingUpdate); the tombstones of
+ * each group are appended to the log at once, and the request waits for
+ * replication just once at the end.
+ *
+ * \copydetails MasterService::multiRead
+ */
+void
+MasterService::multiRemove(const MultiRemoveRpc::Request& reqHdr,
+                           MultiRemoveRpc::Response& respHdr,
+                           Rpc& rpc)
+{
+    uint32_t numRequests = reqHdr.count;
+    uint32_t reqOffset = downCast<uint32_t>(sizeof(reqHdr));
+
+    respHdr.count = numRequests;
+
+    vector<PendingUpdate> updates;
+    updates.reserve(MULTIWRITE_BATCH_SIZE);
+    uint32_t i = 0;
+    bool truncated = false;
+    while (i < numRequests && !truncated) {
+        // Extract the next group of requests from request rpc.
+        updates.clear();
+        ObjectLockGroup locks;
+        for (; i < numRequests; i++) {
+            const MultiRemoveRpc::Request::Part *currentReq =
+                rpc.requestPayload.getOffset<MultiRemoveRpc::Request::Part>(
+                reqOffset);
+            uint32_t keyOffset = reqOffset +
+                downCast<uint32_t>(sizeof(MultiRemoveRpc::Request::Part));
+            if (currentReq == NULL || rpc.requestPayload.getTotalLength() <
+                                      keyOffset + currentReq->keyLength) {
+                truncated = true;
+                break;
+            }
+            const char* key =
+                static_cast<const char*>(rpc.requestPayload.getRange(
+                keyOffset, currentReq->keyLength));
+            if (!fitsInUpdateGroup(updates, currentReq->tableId, key,
+                                   currentReq->keyLength, 0))
+                break;
+            reqOffset = keyOffset + currentReq->keyLength;
+
+            updates.push_back(PendingUpdate(currentReq->tableId, key,
+                                            currentReq->keyLength, 0,
+                                            currentReq->rejectRules));
+            locks.add(objectLock(currentReq->tableId, key,
+                                 currentReq->keyLength));
+        }
+        locks.lock();
+
+        lookupUpdates(updates);
+        foreach (PendingUpdate& update, updates) {
+            if (update.status != STATUS_OK)
+                continue;
+            LogEntryHandle handle = update.handle;
+            if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ) {
+                update.status = rejectOperation(update.rejectRules,
+                                                VERSION_NONEXISTENT);
+                continue;
+            }
+
+            // Abort if we're trying to delete the wrong version.
+            const Object* obj = handle->userData<Object>();
+            update.version = obj->version;
+            update.status = rejectOperation(update.rejectRules,
+                                            obj->version);
+            if (update.status != STATUS_OK)
+                continue;
+
+            uint32_t tombLength =
+                downCast<uint32_t>(sizeof(ObjectTombstone)) + obj->keyLength;
+            update.tombstone.resize((tombLength + 7) / 8);
+            new(&update.tombstone[0]) ObjectTombstone(tombLength,
+                                                      log.getSegmentId(obj),
+                                                      obj);
+        }
+        appendUpdates(updates);
+
+        foreach (PendingUpdate& update, updates) {
+            MultiRemoveRpc::Response::Part* result =
+                new(&rpc.replyPayload, APPEND) MultiRemoveRpc::Response::Part;
+            result->status = update.status;
+            result->version = update.version;
+        }
+    }
+
+    // The rest of a request cut short can't be found, so none of it is
+    // carried out.
+    for (; i < numRequests; i++) {
+        MultiRemoveRpc::Response::Part* result =
+            new(&rpc.replyPayload, APPEND) MultiRemoveRpc::Response::Part;
+        result->status = STATUS_MESSAGE_TOO_SHORT;
+        result->version = VERSION_NONEXISTENT;
+    }
+
+    if (numRequests > 0)
+        log.sync();
+}
+
+/**
+ * Top-level server method to handle the MULTI_WRITE request.
+ *
+ * The writes are made in groups (see #PendingUpdate): each group takes the
+ * locks of its objects together and appends all of its objects and
+ * tombstones to the log at once. Unless the request is asynchronous it
+ * waits for replication just once, after the last group, so its objects may
+ * be read before they are durable, as those of asynchronous writes are;
+ * its reply is only sent once they are.
+ *
+ * \copydetails MasterService::multiRead
+ */
+void
+MasterService::multiWrite(const MultiWriteRpc::Request& reqHdr,
+                          MultiWriteRpc::Response& respHdr,
+                          Rpc& rpc)
+{
+    uint32_t numRequests = reqHdr.count;
+    uint32_t reqOffset = downCast<uint32_t>(sizeof(reqHdr));
+
+    respHdr.count = numRequests;
+    if (numRequests > 0)
+        openBackupSessionsOnFirstWrite();
+
+    vector<PendingUpdate> updates;
+    updates.reserve(MULTIWRITE_BATCH_SIZE);
+    uint32_t i = 0;
+    bool truncated = false;
+    while (i < numRequests && !truncated) {
+        // Extract the next group of requests from request rpc.
+        updates.clear();
+        ObjectLockGroup locks;
+        vector<uint32_t> keyOffsets;
+        for (; i < numRequests; i++) {
+            const MultiWriteRpc::Request::Part *currentReq =
+                rpc.requestPayload.getOffset<MultiWriteRpc::Request::Part>(
+                reqOffset);
+            uint32_t keyOffset = reqOffset +
+                downCast<uint32_t>(sizeof(MultiWriteRpc::Request::Part));
+            if (currentReq == NULL || rpc.requestPayload.getTotalLength() <
+                                      keyOffset + currentReq->keyLength) {
+                truncated = true;
+                break;
+            }
+            const char* key =
+                static_cast<const char*>(rpc.requestPayload.getRange(
+                keyOffset, currentReq->keyLength));
+            if (!fitsInUpdateGroup(updates, currentReq->tableId, key,
+                                   currentReq->keyLength, currentReq->length))
+                break;
+            reqOffset = keyOffset + currentReq->keyLength + currentReq->length;
+
+            updates.push_back(PendingUpdate(currentReq->tableId, key,
+                                            currentReq->keyLength,
+                                            currentReq->length,
+                                            currentReq->rejectRules));
+            // The value is copied straight from the request into the log,
+            // so it had better all be there.
+            if (rpc.requestPayload.getTotalLength() < reqOffset)
+                updates.back().status = STATUS_MESSAGE_TOO_SHORT;
+            keyOffsets.push_back(keyOffset);
+            locks.add(objectLock(currentReq->tableId, key,
+                                 currentReq->keyLength));
         }
-        LogEntryHandle handle = objectMap.lookup(currentReq->tableId,
-                                                 key, currentReq->keyLength);
-        if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ) {
-             *status = STATUS_OBJECT_DOESNT_EXIST;
-             continue;
+        locks.lock();
+
+        lookupUpdates(updates);
+        for (uint32_t j = 0; j < updates.size(); j++) {
+            PendingUpdate& update = updates[j];
+            if (update.status != STATUS_OK)
+                continue;
+
+            const Object *obj = NULL;
+            if (update.handle != NULL) {
+                if (update.handle->type() == LOG_ENTRY_TYPE_OBJTOMB) {
+                    recoveryCleanup(update.handle, this);
+                    update.handle = NULL;
+                } else {
+                    assert(update.handle->type() == LOG_ENTRY_TYPE_OBJ);
+                    obj = update.handle->userData<Object>();
+                }
+            }
+
+            update.version = (obj != NULL) ? obj->version
+                                           : VERSION_NONEXISTENT;
+            update.status = rejectOperation(update.rejectRules,
+                                            update.version);
+            if (update.status != STATUS_OK)
+                continue;
+
+            update.object.resize((sizeof(Object) + 7) / 8);
+            Object* newObject =
+                new(&update.object[0]) Object(sizeof(Object));
+            newObject->keyLength = update.keyLength;
+            newObject->tableId = update.tableId;
+            update.keyAndData = &rpc.requestPayload;
+            update.keyOffset = keyOffsets[j];
+            if (obj != NULL)
+                newObject->version = obj->version + 1;
+            else
+                newObject->version = update.table->AllocateVersion();
+            assert(obj == NULL || newObject->version > obj->version);
+
+            if (obj != NULL) {
+                uint32_t tombLength = downCast<uint32_t>(
+                    sizeof(ObjectTombstone)) + obj->keyLength;
+                update.tombstone.resize((tombLength + 7) / 8);
+                new(&update.tombstone[0]) ObjectTombstone(
+                    tombLength, log.getSegmentId(obj), obj);
+            }
         }
+        appendUpdates(updates);
 
-        const SegmentEntry* entry =
-            reinterpret_cast<const SegmentEntry*>(handle);
-        Buffer::Chunk::appendToBuffer(&rpc.replyPayload, entry,
-            downCast<uint32_t>(sizeof(SegmentEntry)) + handle->length());
+        foreach (PendingUpdate& update, updates) {
+            MultiWriteRpc::Response::Part* result =
+                new(&rpc.replyPayload, APPEND) MultiWriteRpc::Response::Part;
+            result->status = update.status;
+            result->version = update.version;
+        }
+    }
 
+    // The rest of a request cut short can't be found, so none of it is
+    // carried out.
+    for (; i < numRequests; i++) {
+        MultiWriteRpc::Response::Part* result =
+            new(&rpc.replyPayload, APPEND) MultiWriteRpc::Response::Part;
+        result->status = STATUS_MESSAGE_TOO_SHORT;
+        result->version = VERSION_NONEXISTENT;
     }
+
+    if (numRequests > 0 && !reqHdr.async)
+        log.sync();
 }
 
 /**
@@ -409,11 +728,16 @@ MasterService::read(const ReadRpc::Request& reqHdr,
     const char* key = static_cast<const char*>(rpc.requestPayload.getRange(
                                                reqOffset, reqHdr.keyLength));
 
+    std::lock_guard<SpinLock> lock(objectLock(reqHdr.tableId, key,
+                                              reqHdr.keyLength));
+
     // We must return table doesn't exist if the table does not exist. Also, we
     // might have an entry in the hash table that's invalid because its tablet
     // no longer lives here.
 
-    if (getTable(reqHdr.tableId, key, reqHdr.keyLength) == NULL) {
+    HashType keyHash = getKeyHash(key, reqHdr.keyLength);
+    Table* table = getTableForHash(reqHdr.tableId, keyHash);
+    if (table == NULL) {
         respHdr.common.status = STATUS_UNKNOWN_TABLE;
         return;
     }
@@ -422,11 +746,13 @@ MasterService::read(const ReadRpc::Request& reqHdr,
                                              key, reqHdr.keyLength);
 
     if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ) {
+        table->statistics.recordRead(keyHash, 0);
         respHdr.common.status = STATUS_OBJECT_DOESNT_EXIST;
         return;
     }
 
     const Object* obj = handle->userData<Object>();
+    table->statistics.recordRead(keyHash, obj->dataLength(handle->length()));
     respHdr.version = obj->version;
     Status status = rejectOperation(reqHdr.rejectRules, obj->version);
     if (status != STATUS_OK) {
@@ -469,6 +795,7 @@ MasterService::dropTabletOwnership(
             tablets.mutable_tablet()->SwapElements(
                 tablets.tablet_size() - 1, index);
             tablets.mutable_tablet()->RemoveLast();
+            indexTablets();
             return;
         }
 
@@ -496,6 +823,18 @@ MasterService::splitMasterTablet(
     Rpc& rpc)
 {
     ProtoBuf::Tablets_Tablet newTablet;
+    Table* oldTable = NULL;
+
+    if (outgoingMigration != NULL &&
+        outgoingMigration->tableId == reqHdr.tableId &&
+        outgoingMigration->firstKey <= reqHdr.endKeyHash &&
+        outgoingMigration->lastKey >= reqHdr.startKeyHash) {
+        LOG(NOTICE, "Can't split tablet (id %lu, range [%lu,%lu]) while it "
+            "is being migrated", reqHdr.tableId, reqHdr.startKeyHash,
+            reqHdr.endKeyHash);
+        respHdr.common.status = STATUS_RETRY;
+        return;
+    }
 
     foreach (ProtoBuf::Tablets::Tablet& i, *tablets.mutable_tablet()) {
         if (reqHdr.tableId == i.table_id() &&
@@ -504,9 +843,9 @@ MasterService::splitMasterTablet(
 
             newTablet = i;
 
-            Table* newTable = new Table(reqHdr.tableId, reqHdr.startKeyHash,
-                                 reqHdr.splitKeyHash - 1);
-            i.set_user_data(reinterpret_cast<uint64_t>(newTable));
+            // The lower half keeps the existing Table, and with it the
+            // access statistics gathered so far.
+            oldTable = reinterpret_cast<Table*>(i.user_data());
             i.set_end_key_hash(reqHdr.splitKeyHash - 1);
         }
 
@@ -516,8 +855,13 @@ MasterService::splitMasterTablet(
     Table* newTable = new Table(reqHdr.tableId, reqHdr.splitKeyHash,
                                  reqHdr.endKeyHash);
     newTablet.set_user_data(reinterpret_cast<uint64_t>(newTable));
+    if (oldTable != NULL) {
+        oldTable->statistics.split(reqHdr.splitKeyHash, newTable->statistics);
+        newTable->segmentIds = oldTable->segmentIds;
+    }
 
     *tablets.add_tablet() = newTablet;
+    indexTablets();
 
     LOG(NOTICE, "In table '%lu' I split the tablet that started at key %lu and "
                 "ended at key %lu", reqHdr.tableId, reqHdr.startKeyHash,
@@ -586,6 +930,7 @@ MasterService::takeTabletOwnership(
         Table* table = new Table(reqHdr.tableId, reqHdr.firstKey,
                                  reqHdr.lastKey);
         newTablet.set_user_data(reinterpret_cast<uint64_t>(table));
+        indexTablets();
     } else {
         LOG(NOTICE, "Taking ownership of existing tablet (%lu, range "
             "[%lu,%lu]) in state %d", reqHdr.tableId, reqHdr.firstKey,
@@ -641,6 +986,7 @@ MasterService::prepForMigration(const PrepForMigrationRpc::Request& reqHdr,
     Table* table = new Table(reqHdr.tableId, reqHdr.firstKey,
                              reqHdr.lastKey);
     tablet.set_user_data(reinterpret_cast<uint64_t>(table));
+    indexTablets();
 
     // TODO(rumble) would be nice to have a method to get a SL from an Rpc
     // object.
@@ -654,6 +1000,19 @@ MasterService::prepForMigration(const PrepForMigrationRpc::Request& reqHdr,
  * This is used to manually initiate the migration of a tablet (or piece of a
  * tablet) that this master owns to another master.
  *
+ * The tablet keeps being served while its data is copied. The first round
+ * sends everything in the log up to what was the head when it started;
+ * each of the following catch-up rounds sends only what was appended to
+ * the log during the previous one. Once a round has little left to send
+ * (see #MIGRATION_FINAL_ROUND_BYTES), writes to the tablet are refused
+ * with STATUS_RETRY for the last round, and ownership is handed over to
+ * the recipient. Writes are thus held up for as long as it takes to send
+ * a small delta, regardless of the size of the tablet. Reads are served
+ * throughout.
+ *
+ * Only one migration away from this master runs at a time; further
+ * requests are answered with STATUS_RETRY until it is done.
+ *
  * \copydetails Service::ping
  */
 void
@@ -666,161 +1025,105 @@ MasterService::migrateTablet(const MigrateTabletRpc::Request& reqHdr,
     uint64_t lastKey = reqHdr.lastKey;
     ServerId newOwnerMasterId(reqHdr.newOwnerMasterId);
 
-    // Find the tablet we're trying to move. We only support migration
-    // when the tablet to be migrated consists of a range within a single,
-    // contiguous tablet of ours.
-    const ProtoBuf::Tablets::Tablet* tablet = NULL;
-    int tabletIndex = 0;
-    foreach (const ProtoBuf::Tablets::Tablet& i, tablets.tablet()) {
-        if (tableId == i.table_id() &&
-          firstKey >= i.start_key_hash() &&
-          lastKey <= i.end_key_hash()) {
-            tablet = &i;
-            break;
+    Tub<OutgoingMigration> migration;
+    {
+        std::lock_guard<AllObjectLocks> lock(allObjectLocks);
+
+        // Find the tablet we're trying to move. We only support migration
+        // when the tablet to be migrated consists of a range within a
+        // single, contiguous tablet of ours.
+        const ProtoBuf::Tablets::Tablet* tablet = NULL;
+        foreach (const ProtoBuf::Tablets::Tablet& i, tablets.tablet()) {
+            if (tableId == i.table_id() &&
+              firstKey >= i.start_key_hash() &&
+              lastKey <= i.end_key_hash()) {
+                tablet = &i;
+                break;
+            }
         }
-        tabletIndex++;
-    }
-
-    if (tablet == NULL) {
-        LOG(WARNING, "Migration request for range this master does not "
-            "own. TableId %lu, range [%lu,%lu]", tableId, firstKey, lastKey);
-        respHdr.common.status = STATUS_UNKNOWN_TABLE;
-        return;
-    }
 
-    if (newOwnerMasterId == serverId) {
-        LOG(WARNING, "Migrating to myself doesn't make much sense");
-        respHdr.common.status = STATUS_REQUEST_FORMAT_ERROR;
-        return;
-    }
+        if (tablet == NULL) {
+            LOG(WARNING, "Migration request for range this master does not "
+                "own. TableId %lu, range [%lu,%lu]", tableId, firstKey,
+                lastKey);
+            respHdr.common.status = STATUS_UNKNOWN_TABLE;
+            return;
+        }
 
-    Transport::SessionRef session = serverList.getSession(newOwnerMasterId);
-    MasterClient recipient(session);
+        if (newOwnerMasterId == serverId) {
+            LOG(WARNING, "Migrating to myself doesn't make much sense");
+            respHdr.common.status = STATUS_REQUEST_FORMAT_ERROR;
+            return;
+        }
 
-    Table* table = reinterpret_cast<Table*>(tablet->user_data());
+        if (outgoingMigration != NULL) {
+            LOG(NOTICE, "Can't migrate tablet (id %lu, range [%lu,%lu]) "
+                "while migrating tablet (id %lu, range [%lu,%lu])",
+                tableId, firstKey, lastKey, outgoingMigration->tableId,
+                outgoingMigration->firstKey, outgoingMigration->lastKey);
+            respHdr.common.status = STATUS_RETRY;
+            return;
+        }
 
-    // TODO(rumble/slaughter) what if we end up splitting?!?
+        uint64_t bytesPerSecond = reqHdr.bytesPerSecond;
+        if (bytesPerSecond == 0)
+            bytesPerSecond = config.master.migrationBytesPerSecond;
+        migration.construct(*this, tableId, firstKey, lastKey,
+                            newOwnerMasterId, bytesPerSecond);
+    }
 
     // TODO(rumble/slaughter) add method to query TabletProfiler for # objs,
     // # bytes in a range in order for this to really work, we'll need to
     // split on a bucket
     // boundary. Otherwise we can't tell where bytes are in the chosen range.
-    recipient.prepForMigration(tableId, firstKey, lastKey, 0, 0);
+    migration->recipient.prepForMigration(tableId, firstKey, lastKey, 0, 0);
 
     LOG(NOTICE, "Migrating tablet (id %lu, first %lu, last %lu) to "
         "ServerId %lu (\"%s\")", tableId, firstKey, lastKey,
-        *newOwnerMasterId, session->getServiceLocator().c_str());
-
-    // We'll send over objects in Segment containers for better network
-    // efficiency and convenience.
-    void* transferBuf = Memory::xmemalign(HERE, 8*1024*1024, 8*1024*1024);
-    Tub<Segment> transferSeg;
-
-    // TODO(rumble/slaughter): These should probably be metrics.
-    uint64_t totalObjects = 0;
-    uint64_t totalTombstones = 0;
-    uint64_t totalBytes = 0;
-
-    // Hold on the the iterator since it locks the head Segment, avoiding any
-    // additional appends once we've finished iterating.
-    LogIterator it(log);
-    for (; !it.isDone(); it.next()) {
-        LogEntryHandle h = it.getHandle();
-        if (h->type() == LOG_ENTRY_TYPE_OBJ) {
-            const Object* logObj = h->userData<Object>();
-
-            // Skip if not applicable.
-            if (logObj->tableId != tableId)
-                continue;
-
-            if (logObj->keyHash() < firstKey || logObj->keyHash() > lastKey)
-                continue;
-
-            // Only send objects when they're currently in the hash table (
-            // otherwise they're dead).
-            LogEntryHandle curHandle = objectMap.lookup(logObj->tableId,
-                                                        logObj->getKey(),
-                                                        logObj->keyLength);
-            if (curHandle == NULL)
-                continue;
-
-            if (curHandle->type() != LOG_ENTRY_TYPE_OBJ)
-                continue;
-
-            // NB: The cleaner is currently locked out due to the global
-            //     objectUpdateLock. In the future this may not be the
-            //     case and objects may be moved forward during iteration.
-            if (curHandle->userData<Object>() != logObj)
-                continue;
-
-            totalObjects++;
-        } else if (h->type() == LOG_ENTRY_TYPE_OBJTOMB) {
-            const ObjectTombstone* logTomb = h->userData<ObjectTombstone>();
-
-            // Skip if not applicable.
-            if (logTomb->tableId != tableId)
-                continue;
-
-            if (logTomb->keyHash() < firstKey || logTomb->keyHash() > lastKey)
-                continue;
-
-            // We must always send tombstones, since an object we may have sent
-            // could have been deleted more recently. We could be smarter and
-            // more selective here, but that'd require keeping extra state to
-            // know what we've already sent.
-            //
-            // TODO(rumble/slaughter) Actually, we can do better. The stupid way
-            //      is to track each object or tombstone we've sent. The smarter
-            //      way is to just record the LogPosition when we started
-            //      iterating and only send newer tombstones.
-
-            totalTombstones++;
-        } else {
-            // We're not interested in any other types.
-            continue;
+        *newOwnerMasterId,
+        serverList.getSession(newOwnerMasterId)->getServiceLocator().c_str());
+
+    // An iterator over an empty range visits nothing, but like any other
+    // LogIterator it keeps the cleaner from freeing segments while it
+    // exists. This way every entry appended during the migration can still
+    // be found where it was appended when its round comes.
+    LogIterator pin(log, LogPosition(), LogPosition());
+
+    LogPosition position;
+    LogPosition end;
+    for (uint32_t round = 0; ; round++) {
+        {
+            std::lock_guard<AllObjectLocks> lock(allObjectLocks);
+            end = log.headOfLog();
         }
-
-        totalBytes += h->totalLength();
-
-        if (!transferSeg)
-            transferSeg.construct(-1, -1, transferBuf, 8*1024*1024);
-
-        // If we can't fit it, send the current buffer and retry.
-        if (transferSeg->append(it.getHandle(), false) == NULL) {
-            transferSeg->close(NULL, false);
-            recipient.receiveMigrationData(tableId,
-                                          firstKey,
-                                          transferSeg->getBaseAddress(),
-                                          transferSeg->getTotalBytesAppended());
-            LOG(DEBUG, "Sending migration segment");
-
-            transferSeg.destroy();
-            transferSeg.construct(-1, -1, transferBuf, 8*1024*1024);
-
-            // If it doesn't fit this time, we're in trouble.
-            if (transferSeg->append(it.getHandle(), false) == NULL) {
-                LOG(ERROR, "Tablet migration failed: could not fit object "
-                    "into empty segment (obj bytes %u)",
-                    it.getHandle()->length());
-                respHdr.common.status = STATUS_INTERNAL_ERROR;
-                transferSeg.destroy();
-                free(transferBuf);
-                return;
-            }
+        uint64_t bytesBefore = migration->totalBytes;
+        Status status = migrateLogRange(*migration, position, end);
+        if (status != STATUS_OK) {
+            respHdr.common.status = status;
+            return;
         }
+        position = end;
+        uint64_t roundBytes = migration->totalBytes - bytesBefore;
+        LOG(DEBUG, "Migration round %u sent %lu bytes", round, roundBytes);
+        if (roundBytes <= MIGRATION_FINAL_ROUND_BYTES ||
+            round == MIGRATION_MAX_CATCH_UP_ROUNDS)
+            break;
     }
 
-    if (transferSeg) {
-        transferSeg->close(NULL, false);
-        recipient.receiveMigrationData(tableId,
-                                        firstKey,
-                                        transferSeg->getBaseAddress(),
-                                        transferSeg->getTotalBytesAppended());
-        LOG(DEBUG, "Sending last migration segment");
-        transferSeg.destroy();
+    // Final round: nothing can be written to the tablet from here on, so
+    // once this round is sent the recipient has everything.
+    uint64_t freezeStart = Cycles::rdtsc();
+    {
+        std::lock_guard<AllObjectLocks> lock(allObjectLocks);
+        migration->writesFrozen = true;
+        end = log.headOfLog();
     }
-
-    free(transferBuf);
+    Status status = migrateLogRange(*migration, position, end);
+    if (status != STATUS_OK) {
+        respHdr.common.status = status;
+        return;
+    }
+    drainMigrationSegments(*migration);
 
     // Now that all data has been transferred, we can reassign ownership of
     // the tablet. If this succeeds, we are free to drop the tablet. The
@@ -829,76 +1132,373 @@ MasterService::migrateTablet(const MigrateTabletRpc::Request& reqHdr,
     coordinator->reassignTabletOwnership(
         tableId, firstKey, lastKey, newOwnerMasterId);
 
-    LOG(NOTICE, "Tablet migration succeeded. Sent %lu objects and %lu "
-        "tombstones. %lu bytes in total.", totalObjects, totalTombstones,
-        totalBytes);
+    {
+        std::lock_guard<AllObjectLocks> lock(allObjectLocks);
+        for (int i = 0; i < tablets.tablet_size(); i++) {
+            const ProtoBuf::Tablets::Tablet& tablet(tablets.tablet(i));
+            if (tableId == tablet.table_id() &&
+              firstKey >= tablet.start_key_hash() &&
+              lastKey <= tablet.end_key_hash()) {
+                delete reinterpret_cast<Table*>(tablet.user_data());
+                tablets.mutable_tablet()->SwapElements(
+                    tablets.tablet_size() - 1, i);
+                tablets.mutable_tablet()->RemoveLast();
+                indexTablets();
+                break;
+            }
+        }
+    }
 
-    tablets.mutable_tablet()->SwapElements(tablets.tablet_size() - 1,
-                                           tabletIndex);
-    tablets.mutable_tablet()->RemoveLast();
-    free(table);
+    LOG(NOTICE, "Tablet migration succeeded. Sent %lu objects and %lu "
+        "tombstones. %lu bytes in total. Writes were held up for %.1f ms.",
+        migration->totalObjects, migration->totalTombstones,
+        migration->totalBytes,
+        Cycles::toSeconds(Cycles::rdtsc() - freezeStart) * 1e03);
 }
 
 /**
- * Top-level server method to handle the RECEIVE_MIGRATION_DATA request.
- *
- * This RPC delivers tablet data to be added to a master during migration.
- * It must have been preceeded by an appropriate PREP_FOR_MIGRATION rpc.
+ * Register a new migration with \a service. The caller must hold the
+ * service's allObjectLocks, and the service must not have a migration
+ * in progress already.
  *
- * \copydetails Service::ping
+ * \param service
+ *      The master the tablet is migrated away from.
+ * \param tableId
+ *      Table containing the range to migrate.
+ * \param firstKey
+ *      First key hash of the range to migrate.
+ * \param lastKey
+ *      Last key hash of the range to migrate.
+ * \param newOwner
+ *      The master the range is migrated to.
+ * \param bytesPerSecond
+ *      Limit on the rate at which data is sent to \a newOwner; 0 means
+ *      unlimited.
  */
-void
-MasterService::receiveMigrationData(
-    const ReceiveMigrationDataRpc::Request& reqHdr,
-    ReceiveMigrationDataRpc::Response& respHdr,
-    Rpc& rpc)
+MasterService::OutgoingMigration::OutgoingMigration(MasterService& service,
+                                                    uint64_t tableId,
+                                                    uint64_t firstKey,
+                                                    uint64_t lastKey,
+                                                    ServerId newOwner,
+                                                    uint64_t bytesPerSecond)
+    : service(service)
+    , tableId(tableId)
+    , firstKey(firstKey)
+    , lastKey(lastKey)
+    , newOwner(newOwner)
+    , recipient(service.serverList.getSession(newOwner))
+    , writesFrozen(false)
+    , throttle(bytesPerSecond, MIGRATION_SEGMENT_BYTES)
+    , transfers()
+    , current(0)
+    , totalObjects(0)
+    , totalTombstones(0)
+    , totalBytes(0)
 {
-    uint64_t tableId = reqHdr.tableId;
-    uint64_t firstKey = reqHdr.firstKey;
-    uint32_t segmentBytes = reqHdr.segmentBytes;
-
-    // TODO(rumble/slaughter) need to make sure we already have a table
-    // created that was previously prepped for migration.
-    const ProtoBuf::Tablets::Tablet* tablet = NULL;
-    foreach (const ProtoBuf::Tablets::Tablet& i, tablets.tablet()) {
-        if (tableId == i.table_id() && firstKey == i.start_key_hash()) {
-            tablet = &i;
-            break;
-        }
-    }
+    assert(service.outgoingMigration == NULL);
+    service.outgoingMigration = this;
+}
 
-    if (tablet == NULL) {
-        LOG(WARNING, "migration data received for unknown tablet %lu, "
-            "firstKey %lu", tableId, firstKey);
-        respHdr.common.status = STATUS_UNKNOWN_TABLE;
-        return;
-    }
+MasterService::OutgoingMigration::~OutgoingMigration()
+{
+    std::lock_guard<AllObjectLocks> lock(service.allObjectLocks);
+    service.outgoingMigration = NULL;
+}
 
-    if (tablet->state() != ProtoBuf::Tablets_Tablet_State_RECOVERING) {
-        LOG(WARNING, "migration data received for tablet not in the "
-            "RECOVERING state (state = %s)!",
-            ProtoBuf::Tablets_Tablet_State_Name(tablet->state()).c_str());
-        // TODO(rumble/slaughter): better error code here?
-        respHdr.common.status = STATUS_INTERNAL_ERROR;
-        return;
-    }
+MasterService::OutgoingMigration::Transfer::Transfer()
+    : buffer(Memory::xmemalign(HERE, MIGRATION_SEGMENT_BYTES,
+                               MIGRATION_SEGMENT_BYTES))
+    , segment()
+    , entries(0)
+    , rpc()
+    , sendTime(0)
+{
+}
 
-    LOG(NOTICE, "RECEIVED MIGRATION DATA (tbl %lu, fk %lu, bytes %u)!\n",
-        tableId, firstKey, segmentBytes);
+MasterService::OutgoingMigration::Transfer::~Transfer()
+{
+    // Only a failed migration leaves RPCs behind; the transport must be
+    // done with #buffer before it is freed.
+    if (rpc)
+        rpc->cancel();
+    rpc.destroy();
+    segment.destroy();
+    free(buffer);
+}
 
-    rpc.requestPayload.truncateFront(sizeof(reqHdr));
-    if (rpc.requestPayload.getTotalLength() != segmentBytes) {
-        LOG(ERROR, "RPC size (%u) does not match advertised length (%u)",
-            rpc.requestPayload.getTotalLength(),
-            segmentBytes);
-        respHdr.common.status = STATUS_REQUEST_FORMAT_ERROR;
-        return;
-    }
-    const void* segmentMemory = rpc.requestPayload.getStart<const void*>();
-    recoverSegment(-1, segmentMemory, segmentBytes);
+/**
+ * Return whether the object with key hash \a keyHash in table \a tableId
+ * is part of the range being migrated.
+ */
+bool
+MasterService::OutgoingMigration::covers(uint64_t tableId,
+                                         HashType keyHash) const
+{
+    return tableId == this->tableId && keyHash >= firstKey &&
+           keyHash <= lastKey;
+}
 
-    // TODO(rumble/slaughter) what about tablet version numbers?
-    //          - need to be made per-server now, no? then take max of two?
+/**
+ * Return whether writes to an object are currently refused because the
+ * object's tablet is in the last round of being migrated away. Must be
+ * called with the object's lock held (see #objectLock).
+ *
+ * \param tableId
+ *      Table containing the object.
+ * \param keyHash
+ *      Hash of the object's key.
+ */
+bool
+MasterService::isWriteFrozen(uint64_t tableId, HashType keyHash)
+{
+    return outgoingMigration != NULL && outgoingMigration->writesFrozen &&
+           outgoingMigration->covers(tableId, keyHash);
+}
+
+/**
+ * Send the live objects and the tombstones of a migrating range that were
+ * appended to the log between two positions. Helper for #migrateTablet.
+ *
+ * Only segments that may hold entries of the tablet (see Table::segmentIds)
+ * are scanned, so a small tablet doesn't cost a scan of the whole log.
+ * Only the lock of the object being examined is held at any time, so the
+ * scan barely gets in the way of other requests.
+ *
+ * \param migration
+ *      The migration in progress.
+ * \param start
+ *      Position in the log of the first entry to consider.
+ * \param end
+ *      Position in the log just past the last entry to consider.
+ * \return
+ *      STATUS_OK, or STATUS_INTERNAL_ERROR if an entry doesn't even fit
+ *      into an empty segment.
+ */
+Status
+MasterService::migrateLogRange(OutgoingMigration& migration,
+                               LogPosition start, LogPosition end)
+{
+    // Only visit the segments holding entries of the tablet. Entries
+    // appended after this snapshot lie beyond the end of the range anyway.
+    std::unordered_set<uint64_t> segmentIds;
+    {
+        std::lock_guard<AllObjectLocks> lock(allObjectLocks);
+        Table* table = getTableForHash(migration.tableId, migration.firstKey);
+        if (table != NULL) {
+            std::lock_guard<SpinLock> tableLock(table->mutex);
+            segmentIds = table->segmentIds;
+        }
+    }
+
+    // Objects are checked for liveness under their lock. The iterator keeps
+    // the segments alive, so entries can be copied without any locks.
+    LogIterator it(log, start, end, &segmentIds);
+    while (!it.isDone()) {
+        bool segmentFull = false;
+        for (; !it.isDone(); it.next()) {
+            LogEntryHandle h = it.getHandle();
+            bool isObject = false;
+            if (h->type() == LOG_ENTRY_TYPE_OBJ) {
+                const Object* logObj = h->userData<Object>();
+                if (!migration.covers(logObj->tableId, logObj->keyHash()))
+                    continue;
+
+                // Only send objects when they're currently in the hash
+                // table (otherwise they're dead). The cleaner may have
+                // copied the object elsewhere since it was appended
+                // here; any copy of the same version will do.
+                std::lock_guard<SpinLock> lock(objectLock(
+                    logObj->tableId, logObj->getKey(), logObj->keyLength));
+                LogEntryHandle curHandle = objectMap.lookup(
+                    logObj->tableId, logObj->getKey(), logObj->keyLength);
+                if (curHandle == NULL ||
+                    curHandle->type() != LOG_ENTRY_TYPE_OBJ ||
+                    curHandle->userData<Object>()->version != logObj->version)
+                    continue;
+                isObject = true;
+            } else if (h->type() == LOG_ENTRY_TYPE_OBJTOMB) {
+                const ObjectTombstone* logTomb =
+                    h->userData<ObjectTombstone>();
+
+                // We must always send tombstones, since an object we
+                // may have sent could have been deleted more recently.
+                // Only those appended since the previous round get
+                // here, though.
+                if (!migration.covers(logTomb->tableId,
+                                      logTomb->keyHash()))
+                    continue;
+            } else {
+                // We're not interested in any other types.
+                continue;
+            }
+
+            OutgoingMigration::Transfer& transfer =
+                migration.transfers[migration.current];
+            if (!transfer.segment) {
+                transfer.segment.construct(-1, -1, transfer.buffer,
+                                           MIGRATION_SEGMENT_BYTES);
+            }
+            if (transfer.segment->append(h, false) == NULL) {
+                if (transfer.entries == 0) {
+                    LOG(ERROR, "Tablet migration failed: could not fit "
+                        "object into empty segment (obj bytes %u)",
+                        h->length());
+                    return STATUS_INTERNAL_ERROR;
+                }
+                // Send what we have and then come back for this entry.
+                segmentFull = true;
+                break;
+            }
+            transfer.entries++;
+            migration.totalBytes += h->totalLength();
+            if (isObject)
+                migration.totalObjects++;
+            else
+                migration.totalTombstones++;
+        }
+        if (segmentFull)
+            sendMigrationSegment(migration);
+    }
+    sendMigrationSegment(migration);
+    return STATUS_OK;
+}
+
+/**
+ * Start sending the objects and tombstones collected in a migration's
+ * current transfer segment to the recipient, if there are any, and move
+ * on to the next segment. This only waits if the next segment is still
+ * being sent, or if the migration's rate limit calls for a pause. Must be
+ * called without any of #objectLocks held.
+ *
+ * The recipient replays migrated segments the same way as recovery
+ * segments, so they may arrive in any order.
+ */
+void
+MasterService::sendMigrationSegment(OutgoingMigration& migration)
+{
+    OutgoingMigration::Transfer& transfer =
+        migration.transfers[migration.current];
+    if (!transfer.segment)
+        return;
+    Segment& segment = *transfer.segment;
+    segment.close(NULL, false);
+    migration.throttle.wait(segment.getTotalBytesAppended());
+    transfer.sendTime = Cycles::rdtsc();
+    transfer.rpc.construct(migration.recipient, migration.tableId,
+                           migration.firstKey, segment.getBaseAddress(),
+                           segment.getTotalBytesAppended());
+    metrics->master.migrationSegmentCount++;
+    metrics->master.migrationByteCount += segment.getTotalBytesAppended();
+
+    migration.current = (migration.current + 1) % MIGRATION_PIPELINE_DEPTH;
+    completeMigrationSegment(migration.transfers[migration.current]);
+}
+
+/**
+ * Wait for the RPC sending a transfer segment to complete, if one is
+ * outstanding, and make the segment available for filling again.
+ *
+ * \throw ClientException
+ *      The recipient rejected the segment.
+ */
+void
+MasterService::completeMigrationSegment(OutgoingMigration::Transfer& transfer)
+{
+    if (!transfer.rpc)
+        return;
+    (*transfer.rpc)();
+    uint64_t ticks = Cycles::rdtsc() - transfer.sendTime;
+    metrics->master.migrationSegmentTicks += ticks;
+    LOG(DEBUG, "Sent migration segment with %u entries in %lu us",
+        transfer.entries, Cycles::toNanoseconds(ticks) / 1000);
+    transfer.rpc.destroy();
+    transfer.segment.destroy();
+    transfer.entries = 0;
+}
+
+/**
+ * Wait until the recipient of a migration has acknowledged every segment
+ * sent so far.
+ */
+void
+MasterService::drainMigrationSegments(OutgoingMigration& migration)
+{
+    foreach (OutgoingMigration::Transfer& transfer, migration.transfers)
+        completeMigrationSegment(transfer);
+}
+
+/**
+ * Top-level server method to handle the RECEIVE_MIGRATION_DATA request.
+ *
+ * This RPC delivers tablet data to be added to a master during migration.
+ * It must have been preceeded by an appropriate PREP_FOR_MIGRATION rpc.
+ *
+ * Unlike most requests, this is called without #allObjectLocks held, so
+ * that it can wait for #migrationReplayThrottle without holding up others.
+ * It takes them only to check the tablet; the data is then replayed with
+ * just the lock of each object held in turn, so that reads and writes of
+ * other tablets carry on meanwhile.
+ *
+ * \copydetails Service::ping
+ */
+void
+MasterService::receiveMigrationData(
+    const ReceiveMigrationDataRpc::Request& reqHdr,
+    ReceiveMigrationDataRpc::Response& respHdr,
+    Rpc& rpc)
+{
+    uint64_t tableId = reqHdr.tableId;
+    uint64_t firstKey = reqHdr.firstKey;
+    uint32_t segmentBytes = reqHdr.segmentBytes;
+
+    migrationReplayThrottle.wait(segmentBytes);
+
+    {
+        std::lock_guard<AllObjectLocks> lock(allObjectLocks);
+
+        // TODO(rumble/slaughter) need to make sure we already have a table
+        // created that was previously prepped for migration.
+        const ProtoBuf::Tablets::Tablet* tablet = NULL;
+        foreach (const ProtoBuf::Tablets::Tablet& i, tablets.tablet()) {
+            if (tableId == i.table_id() && firstKey == i.start_key_hash()) {
+                tablet = &i;
+                break;
+            }
+        }
+
+        if (tablet == NULL) {
+            LOG(WARNING, "migration data received for unknown tablet %lu, "
+                "firstKey %lu", tableId, firstKey);
+            respHdr.common.status = STATUS_UNKNOWN_TABLE;
+            return;
+        }
+
+        if (tablet->state() != ProtoBuf::Tablets_Tablet_State_RECOVERING) {
+            LOG(WARNING, "migration data received for tablet not in the "
+                "RECOVERING state (state = %s)!",
+                ProtoBuf::Tablets_Tablet_State_Name(tablet->state()).c_str());
+            // TODO(rumble/slaughter): better error code here?
+            respHdr.common.status = STATUS_INTERNAL_ERROR;
+            return;
+        }
+    }
+
+    LOG(NOTICE, "RECEIVED MIGRATION DATA (tbl %lu, fk %lu, bytes %u)!\n",
+        tableId, firstKey, segmentBytes);
+
+    rpc.requestPayload.truncateFront(sizeof(reqHdr));
+    if (rpc.requestPayload.getTotalLength() != segmentBytes) {
+        LOG(ERROR, "RPC size (%u) does not match advertised length (%u)",
+            rpc.requestPayload.getTotalLength(),
+            segmentBytes);
+        respHdr.common.status = STATUS_REQUEST_FORMAT_ERROR;
+        return;
+    }
+    const void* segmentMemory = rpc.requestPayload.getStart<const void*>();
+    recoverSegment(-1, segmentMemory, segmentBytes, true);
+
+    // TODO(rumble/slaughter) what about tablet version numbers?
+    //          - need to be made per-server now, no? then take max of two?
     //            but this needs to happen at the end (after head on orig.
     //            master is locked)
     //    - what about autoincremented keys?
@@ -1060,19 +1660,6 @@ class RecoveryTask {
 using namespace MasterServiceInternal; // NOLINT
 
 
-/**
- * Increments the access statistics for each read and write operation
- * on the repsective tablet.
- * \param *table
- *      Pointer to the table object that is assosiated with each tablet.
- */
-void
-MasterService::incrementReadAndWriteStatistics(Table* table)
-{
-    table->statEntry.set_number_read_and_writes(
-                                table->statEntry.number_read_and_writes() + 1);
-}
-
 /**
  * Look through \a backups and ensure that for each segment id that appears
  * in the list that at least one copy of that segment was replayed.
@@ -1459,6 +2046,7 @@ MasterService::recover(const RecoverRpc::Request& reqHdr,
         newTablet.set_state(ProtoBuf::Tablets::Tablet::RECOVERING);
         newTablets.push_back(&newTablet);
     }
+    indexTablets();
 
     // Record the log position before recovery started.
     LogPosition headOfLog = log.headOfLog();
@@ -1502,49 +2090,53 @@ MasterService::recover(const RecoverRpc::Request& reqHdr,
 }
 
 /**
- * Given a RecoverySegmentIterator for the Segment we're currently
- * recovering, advance it and issue prefetches on the hash tables.
- * This is used exclusively by recoverSegment().
+ * Find the key of an object or tombstone in a segment.
  *
- * \param[in] i
- *      A RecoverySegmentIterator to use for prefetching. Note that this
- *      method modifies the iterator, so the caller should not use
- *      it for its own iteration.
+ * \param entry
+ *      The entry to examine.
+ * \param[out] tableId
+ *      The table the entry belongs to.
+ * \param[out] key
+ *      The entry's key.
+ * \param[out] keyLength
+ *      Length of \a key in bytes.
+ * \return
+ *      False if the entry is neither an object nor a tombstone, in which
+ *      case the output parameters are left alone.
  */
-void
-MasterService::recoverSegmentPrefetcher(RecoverySegmentIterator& i)
+static bool
+getEntryKey(SegmentEntryHandle entry, uint64_t* tableId, const char** key,
+            uint16_t* keyLength)
 {
-    i.next();
-
-    if (i.isDone())
-        return;
-
-    LogEntryType type = i.getType();
-
-    uint64_t tblId = ~0UL;
-    const char* key = "";
-    uint16_t keyLength = 0;
-
-    if (type == LOG_ENTRY_TYPE_OBJ) {
-        const Object *recoverObj =
-            reinterpret_cast<const Object *>(i.getPointer());
-        tblId = recoverObj->tableId;
-        key = recoverObj->getKey();
-        keyLength = recoverObj->keyLength;
-    } else if (type == LOG_ENTRY_TYPE_OBJTOMB) {
-        const ObjectTombstone *recoverTomb =
-            reinterpret_cast<const ObjectTombstone *>(i.getPointer());
-        tblId = recoverTomb->tableId;
-        key = recoverTomb->getKey();
-        keyLength = recoverTomb->keyLength;
+    if (entry->type() == LOG_ENTRY_TYPE_OBJ) {
+        const Object* object = entry->userData<Object>();
+        *tableId = object->tableId;
+        *key = object->getKey();
+        *keyLength = object->keyLength;
+        return true;
     }
-
-    objectMap.prefetchBucket(tblId, key, keyLength);
+    if (entry->type() == LOG_ENTRY_TYPE_OBJTOMB) {
+        const ObjectTombstone* tomb = entry->userData<ObjectTombstone>();
+        *tableId = tomb->tableId;
+        *key = tomb->getKey();
+        *keyLength = tomb->keyLength;
+        return true;
+    }
+    return false;
 }
 
 /**
  * Replay a filtered segment from a crashed Master that this Master is taking
- * over for.
+ * over for. This is also how data migrated from another master is taken in.
+ *
+ * The objects and tombstones of the segment are split into
+ * config.master.numReplayThreads partitions by the #objectLock their key
+ * falls under, and the partitions are replayed concurrently by
+ * #replayThreads and the calling thread. All entries for a key end up in
+ * the same partition, in segment order, so the outcome is the same as that
+ * of a serial replay; and since the partitions touch disjoint sets of
+ * buckets, they don't need to synchronize on the hash table. Appends to the
+ * log are still serialized by the Log itself.
  *
  * \param segmentId
  *      The segmentId of the segment as it was in the log of the crashed Master.
@@ -1554,144 +2146,274 @@ MasterService::recoverSegmentPrefetcher(RecoverySegmentIterator& i)
  *      will be responsible for after the recovery completes.
  * \param bufferLength
  *      Length of the buffer in bytes.
+ * \param lockObjects
+ *      False if the caller holds #allObjectLocks, as recovery does. True
+ *      if it doesn't, in which case each entry is replayed holding just its
+ *      own #objectLock, so that requests for other objects carry on.
  */
 void
 MasterService::recoverSegment(uint64_t segmentId, const void *buffer,
-                              uint32_t bufferLength)
+                              uint32_t bufferLength, bool lockObjects)
 {
-    uint64_t startReplicationTicks = metrics->master.replicaManagerTicks;
     LOG(DEBUG, "recoverSegment %lu, ...", segmentId);
     CycleCounter<RawMetric> _(&metrics->master.recoverSegmentTicks);
 
-    RecoverySegmentIterator i(buffer, bufferLength);
-    RecoverySegmentIterator prefetch(buffer, bufferLength);
+    size_t numPartitions = replayThreads.getNumPartitions();
+    vector<ReplayPartition> partitions(numPartitions);
+    foreach (ReplayPartition& partition, partitions)
+        partition.lockObjects = lockObjects;
 
-    uint64_t lastOffsetBackupProgress = 0;
-    while (!i.isDone()) {
-        LogEntryType type = i.getType();
+    for (RecoverySegmentIterator i(buffer, bufferLength);
+         !i.isDone(); i.next()) {
+        metrics->master.recoverySegmentEntryCount++;
+        metrics->master.recoverySegmentEntryBytes += i.getLength();
 
-        if (i.getOffset() > lastOffsetBackupProgress + 50000) {
-            lastOffsetBackupProgress = i.getOffset();
+        SegmentEntryHandle entry =
+            reinterpret_cast<SegmentEntryHandle>(&i.getEntry());
+        uint64_t tblId;
+        const char* key;
+        uint16_t keyLength;
+        if (!getEntryKey(entry, &tblId, &key, &keyLength))
+            continue;
+        // Partitioning by lock rather than by bucket range keeps an entry
+        // in the same partition should #objectMap grow meanwhile.
+        uint64_t partition = 0;
+        if (numPartitions > 1) {
+            uint64_t bucket = objectMap.getBucketIndex(tblId, key, keyLength);
+            partition = (bucket & (NUM_OBJECT_LOCKS - 1)) * numPartitions /
+                        NUM_OBJECT_LOCKS;
+        }
+        partitions[partition].entries.push_back(entry);
+    }
+
+    replayThreads.replay(partitions);
+
+    foreach (ReplayPartition& partition, partitions) {
+        metrics->master.objectAppendCount += partition.objectAppendCount;
+        metrics->master.objectDiscardCount += partition.objectDiscardCount;
+        metrics->master.tombstoneAppendCount +=
+            partition.tombstoneAppendCount;
+        metrics->master.tombstoneDiscardCount +=
+            partition.tombstoneDiscardCount;
+        metrics->master.liveObjectCount += partition.liveObjectCount;
+        metrics->master.liveObjectBytes += partition.liveObjectBytes;
+        metrics->master.verifyChecksumTicks += partition.verifyChecksumTicks;
+    }
+    foreach (ReplayPartition& partition, partitions) {
+        if (partition.error != std::exception_ptr())
+            std::rethrow_exception(partition.error);
+    }
+    foreach (ReplayPartition& partition, partitions) {
+        for (size_t i = 0; i < partition.appendedTo.size(); i++) {
+            noteAppend(partition.appendedTo[i].first,
+                       partition.appendedTo[i].second);
+        }
+    }
+    if (numPartitions > 1)
+        replicaManager.proceed();
+    LOG(DEBUG, "Segment %lu replay complete", segmentId);
+}
+
+/**
+ * Replay the entries of one partition of a segment; see recoverSegment().
+ *
+ * \param partition
+ *      The entries to replay. What became of them is recorded here too.
+ * \param onServiceThread
+ *      True if the caller is the service thread and no other partitions
+ *      are being replayed, in which case the ReplicaManager is given a
+ *      chance to make progress now and then. It mustn't be called upon
+ *      while other threads may be appending to the log.
+ */
+void
+MasterService::replayPartition(ReplayPartition& partition,
+                               bool onServiceThread)
+{
+    uint64_t bytesSinceProceed = 0;
+    vector<SegmentEntryHandle>& entries = partition.entries;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (onServiceThread && bytesSinceProceed > 50000) {
+            bytesSinceProceed = 0;
             replicaManager.proceed();
         }
+        bytesSinceProceed += entries[i]->totalLength();
+
+        // Pull in the bucket for the next entry while this one is replayed.
+        uint64_t tblId;
+        const char* key;
+        uint16_t keyLength;
+        if (i + 1 < entries.size() &&
+            getEntryKey(entries[i + 1], &tblId, &key, &keyLength)) {
+            objectMap.prefetchBucket(tblId, key, keyLength);
+        }
 
-        recoverSegmentPrefetcher(prefetch);
+        replayEntry(entries[i], partition);
+    }
+}
 
-        metrics->master.recoverySegmentEntryCount++;
-        metrics->master.recoverySegmentEntryBytes += i.getLength();
+/**
+ * Replay a single object or tombstone from a recovery segment: unless
+ * this master already has a newer version of the object, append the entry
+ * to the log and point objectMap at it. This may run on several threads
+ * at once, as long as they work on keys in different objectMap buckets.
+ *
+ * \param entry
+ *      The object or tombstone to replay.
+ * \param partition
+ *      The partition \a entry belongs to; unless it has lockObjects set,
+ *      the tablet and segment the entry was appended to are recorded in
+ *      its appendedTo list.
+ */
+void
+MasterService::replayEntry(SegmentEntryHandle entry,
+                           ReplayPartition& partition)
+{
+    LogEntryHandle newHandle = NULL;
+    Table* table = NULL;
+
+    Tub<std::lock_guard<SpinLock>> lock;
+    if (partition.lockObjects) {
+        uint64_t tblId;
+        const char* key;
+        uint16_t keyLength;
+        if (!getEntryKey(entry, &tblId, &key, &keyLength))
+            return;
+        lock.construct(objectLock(tblId, key, keyLength));
+    }
 
-        if (type == LOG_ENTRY_TYPE_OBJ) {
-            const Object *recoverObj =
-                  reinterpret_cast<const Object *>(i.getPointer());
-            uint64_t tblId = recoverObj->tableId;
-            const char* key = recoverObj->getKey();
-            uint16_t keyLength = recoverObj->keyLength;
-
-            const Object *localObj = NULL;
-            const ObjectTombstone *tomb = NULL;
-            LogEntryHandle handle = objectMap.lookup(tblId, key, keyLength);
-            if (handle != NULL) {
-                if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB)
-                    tomb = handle->userData<ObjectTombstone>();
-                else
-                    localObj = handle->userData<Object>();
-            }
+    if (entry->type() == LOG_ENTRY_TYPE_OBJ) {
+        const Object *recoverObj = entry->userData<Object>();
+        uint64_t tblId = recoverObj->tableId;
+        const char* key = recoverObj->getKey();
+        uint16_t keyLength = recoverObj->keyLength;
+
+        const Object *localObj = NULL;
+        const ObjectTombstone *tomb = NULL;
+        LogEntryHandle handle = objectMap.lookup(tblId, key, keyLength);
+        if (handle != NULL) {
+            if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB)
+                tomb = handle->userData<ObjectTombstone>();
+            else
+                localObj = handle->userData<Object>();
+        }
 
-            // can't have both a tombstone and an object in the hash tables
-            assert(tomb == NULL || localObj == NULL);
-
-            uint64_t minSuccessor = 0;
-            if (localObj != NULL)
-                minSuccessor = localObj->version + 1;
-            else if (tomb != NULL)
-                minSuccessor = tomb->objectVersion + 1;
-
-            if (recoverObj->version >= minSuccessor) {
-                // write to log (with lazy backup flush) & update hash table
-                LogEntryHandle newObjHandle = log.append(LOG_ENTRY_TYPE_OBJ,
-                    recoverObj, i.getLength(), false, i.checksum());
-                ++metrics->master.objectAppendCount;
-                metrics->master.liveObjectBytes +=
-                    recoverObj->dataLength(i.getLength());
-
-                // The TabletProfiler is updated asynchronously.
-                objectMap.replace(newObjHandle);
-
-                // The cleaner will figure out that the tombstone is dead.
-
-                // nuke the old object, if it existed
-                if (localObj != NULL) {
-                    metrics->master.liveObjectBytes -=
-                        localObj->dataLength(handle->length());
-                    log.free(handle);
-                } else {
-                    ++metrics->master.liveObjectCount;
+        // can't have both a tombstone and an object in the hash tables
+        assert(tomb == NULL || localObj == NULL);
+
+        uint64_t minSuccessor = 0;
+        if (localObj != NULL)
+            minSuccessor = localObj->version + 1;
+        else if (tomb != NULL)
+            minSuccessor = tomb->objectVersion + 1;
+
+        if (recoverObj->version >= minSuccessor) {
+            // write to log (with lazy backup flush) & update hash table
+            newHandle = log.append(LOG_ENTRY_TYPE_OBJ,
+                recoverObj, entry->length(), false, entry->checksum());
+            ++partition.objectAppendCount;
+            partition.liveObjectBytes +=
+                recoverObj->dataLength(entry->length());
+
+            // The TabletProfiler is updated asynchronously.
+            objectMap.replace(newHandle);
+
+            // The cleaner will figure out that the tombstone is dead.
+
+            // nuke the old object, if it existed
+            HashType keyHash = getKeyHash(key, keyLength);
+            table = getTableForHash(tblId, keyHash);
+            if (localObj != NULL) {
+                partition.liveObjectBytes -=
+                    localObj->dataLength(handle->length());
+                if (table != NULL) {
+                    table->statistics.objectRemoved(keyHash,
+                        localObj->dataLength(handle->length()));
                 }
+                log.free(handle);
             } else {
-                ++metrics->master.objectDiscardCount;
+                ++partition.liveObjectCount;
             }
-        } else if (type == LOG_ENTRY_TYPE_OBJTOMB) {
-            const ObjectTombstone *recoverTomb =
-                  reinterpret_cast<const ObjectTombstone *>(i.getPointer());
-            uint64_t tblId = recoverTomb->tableId;
-            const char* key = recoverTomb->getKey();
-            uint16_t keyLength = recoverTomb->keyLength;
-
-            bool checksumIsValid = ({
-                CycleCounter<RawMetric> c(&metrics->master.verifyChecksumTicks);
-                i.isChecksumValid();
-            });
-            if (!checksumIsValid) {
-                LOG(WARNING, "invalid tombstone checksum! tbl: %lu, obj: %.*s, "
-                    "ver: %lu", tblId, keyLength, key,
-                    recoverTomb->objectVersion);
+            if (table != NULL) {
+                table->statistics.objectAdded(keyHash,
+                    recoverObj->dataLength(entry->length()));
             }
+        } else {
+            ++partition.objectDiscardCount;
+        }
+    } else if (entry->type() == LOG_ENTRY_TYPE_OBJTOMB) {
+        const ObjectTombstone *recoverTomb =
+            entry->userData<ObjectTombstone>();
+        uint64_t tblId = recoverTomb->tableId;
+        const char* key = recoverTomb->getKey();
+        uint16_t keyLength = recoverTomb->keyLength;
+
+        bool checksumIsValid = ({
+            CycleCounter<uint64_t> c(&partition.verifyChecksumTicks);
+            entry->isChecksumValid();
+        });
+        if (!checksumIsValid) {
+            LOG(WARNING, "invalid tombstone checksum! tbl: %lu, obj: %.*s, "
+                "ver: %lu", tblId, keyLength, key,
+                recoverTomb->objectVersion);
+        }
 
-            const Object *localObj = NULL;
-            const ObjectTombstone *tomb = NULL;
-            LogEntryHandle handle = objectMap.lookup(tblId, key, keyLength);
-            if (handle != NULL) {
-                if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB)
-                    tomb = handle->userData<ObjectTombstone>();
-                else
-                    localObj = handle->userData<Object>();
-            }
+        const Object *localObj = NULL;
+        const ObjectTombstone *tomb = NULL;
+        LogEntryHandle handle = objectMap.lookup(tblId, key, keyLength);
+        if (handle != NULL) {
+            if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB)
+                tomb = handle->userData<ObjectTombstone>();
+            else
+                localObj = handle->userData<Object>();
+        }
 
-            // can't have both a tombstone and an object in the hash tables
-            assert(tomb == NULL || localObj == NULL);
-
-            uint64_t minSuccessor = 0;
-            if (localObj != NULL)
-                minSuccessor = localObj->version;
-            else if (tomb != NULL)
-                minSuccessor = tomb->objectVersion + 1;
-
-            if (recoverTomb->objectVersion >= minSuccessor) {
-                ++metrics->master.tombstoneAppendCount;
-                LogEntryHandle newTomb =
-                    log.append(LOG_ENTRY_TYPE_OBJTOMB, recoverTomb,
-                               recoverTomb->tombLength(), false, i.checksum());
-                objectMap.replace(newTomb);
-
-                // The cleaner will figure out that the tombstone is dead.
-
-                // nuke the object, if it existed
-                if (localObj != NULL) {
-                    --metrics->master.liveObjectCount;
-                    metrics->master.liveObjectBytes -=
-                        localObj->dataLength(handle->length());
-                    log.free(handle);
+        // can't have both a tombstone and an object in the hash tables
+        assert(tomb == NULL || localObj == NULL);
+
+        uint64_t minSuccessor = 0;
+        if (localObj != NULL)
+            minSuccessor = localObj->version;
+        else if (tomb != NULL)
+            minSuccessor = tomb->objectVersion + 1;
+
+        if (recoverTomb->objectVersion >= minSuccessor) {
+            ++partition.tombstoneAppendCount;
+            newHandle = log.append(LOG_ENTRY_TYPE_OBJTOMB, recoverTomb,
+                                   recoverTomb->tombLength(), false,
+                                   entry->checksum());
+            objectMap.replace(newHandle);
+            HashType keyHash = getKeyHash(key, keyLength);
+            table = getTableForHash(tblId, keyHash);
+
+            // The cleaner will figure out that the tombstone is dead.
+
+            // nuke the object, if it existed
+            if (localObj != NULL) {
+                --partition.liveObjectCount;
+                partition.liveObjectBytes -=
+                    localObj->dataLength(handle->length());
+                if (table != NULL) {
+                    table->statistics.objectRemoved(keyHash,
+                        localObj->dataLength(handle->length()));
                 }
-            } else {
-                ++metrics->master.tombstoneDiscardCount;
+                log.free(handle);
             }
+        } else {
+            ++partition.tombstoneDiscardCount;
         }
+    }
 
-        i.next();
+    if (newHandle == NULL || table == NULL)
+        return;
+    if (partition.lockObjects) {
+        // The Table may be gone once the object's lock is released.
+        noteAppend(table, newHandle);
+        return;
     }
-    LOG(DEBUG, "Segment %lu replay complete", segmentId);
-    metrics->master.backupInRecoverTicks +=
-        metrics->master.replicaManagerTicks - startReplicationTicks;
+    std::pair<Table*, uint64_t> appended(table,
+                                         newHandle->logPosition().segmentId());
+    if (partition.appendedTo.empty() || partition.appendedTo.back() != appended)
+        partition.appendedTo.push_back(appended);
 }
 
 /**
@@ -1706,12 +2428,19 @@ MasterService::remove(const RemoveRpc::Request& reqHdr,
 {
     const char* key = static_cast<const char*>(rpc.requestPayload.getRange(
                       downCast<uint32_t>(sizeof(reqHdr)), reqHdr.keyLength));
+    std::lock_guard<SpinLock> lock(objectLock(reqHdr.tableId, key,
+                                              reqHdr.keyLength));
 
-    Table* table = getTable(reqHdr.tableId, key, reqHdr.keyLength);
+    HashType keyHash = getKeyHash(key, reqHdr.keyLength);
+    Table* table = getTableForHash(reqHdr.tableId, keyHash);
     if (table == NULL) {
         respHdr.common.status = STATUS_UNKNOWN_TABLE;
         return;
     }
+    if (isWriteFrozen(reqHdr.tableId, keyHash)) {
+        respHdr.common.status = STATUS_RETRY;
+        return;
+    }
 
     LogEntryHandle handle = objectMap.lookup(reqHdr.tableId,
                                              key, reqHdr.keyLength);
@@ -1739,7 +2468,8 @@ MasterService::remove(const RemoveRpc::Request& reqHdr,
     // Write the tombstone into the Log, increment the tablet version
     // number, and remove from the hash table.
     try {
-        log.append(LOG_ENTRY_TYPE_OBJTOMB, &tomb, tomb->tombLength());
+        noteAppend(table, log.append(LOG_ENTRY_TYPE_OBJTOMB, &tomb,
+                                     tomb->tombLength()));
     } catch (LogException& e) {
         // The log is out of space. Tell the client to retry and hope
         // that either the cleaner makes space soon or we shift load
@@ -1749,6 +2479,9 @@ MasterService::remove(const RemoveRpc::Request& reqHdr,
     }
 
     table->RaiseVersion(obj->version + 1);
+    table->statistics.recordWrite(keyHash, 0);
+    table->statistics.objectRemoved(keyHash,
+                                    obj->dataLength(handle->length()));
     log.free(handle);
     objectMap.remove(reqHdr.tableId, key, reqHdr.keyLength);
 }
@@ -1768,7 +2501,14 @@ MasterService::increment(const IncrementRpc::Request& reqHdr,
     const char* key = static_cast<const char*>(rpc.requestPayload.getRange(
                                                reqOffset, reqHdr.keyLength));
 
-    if (getTable(reqHdr.tableId, key, reqHdr.keyLength) == NULL) {
+    // The lock is held across the read and the write, so that concurrent
+    // increments of the same object can't lose updates.
+    std::lock_guard<SpinLock> lock(objectLock(reqHdr.tableId, key,
+                                              reqHdr.keyLength));
+
+    HashType keyHash = getKeyHash(key, reqHdr.keyLength);
+    Table* table = getTableForHash(reqHdr.tableId, keyHash);
+    if (table == NULL) {
         respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
         return;
     }
@@ -1777,11 +2517,14 @@ MasterService::increment(const IncrementRpc::Request& reqHdr,
                                              key, reqHdr.keyLength);
 
     if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ) {
+        table->statistics.recordRead(keyHash, 0);
         respHdr.common.status = STATUS_OBJECT_DOESNT_EXIST;
         return;
     }
 
+    // The write of the new value is accounted for by storeData.
     const Object* obj = handle->userData<Object>();
+    table->statistics.recordRead(keyHash, obj->dataLength(handle->length()));
     Status status = rejectOperation(reqHdr.rejectRules, obj->version);
     if (status != STATUS_OK) {
         respHdr.common.status = status;
@@ -1847,6 +2590,11 @@ MasterService::write(const WriteRpc::Request& reqHdr,
                      WriteRpc::Response& respHdr,
                      Rpc& rpc)
 {
+    const char* key = static_cast<const char*>(rpc.requestPayload.getRange(
+                      downCast<uint32_t>(sizeof(reqHdr)), reqHdr.keyLength));
+    std::lock_guard<SpinLock> lock(objectLock(reqHdr.tableId, key,
+                                              reqHdr.keyLength));
+
     Status status = storeData(reqHdr.tableId, &reqHdr.rejectRules,
                               &rpc.requestPayload,
                               static_cast<uint32_t>(sizeof(reqHdr)),
@@ -1878,16 +2626,7 @@ MasterService::write(const WriteRpc::Request& reqHdr,
 Table*
 MasterService::getTable(uint64_t tableId, const char* key, uint16_t keyLength)
 {
-
-    ProtoBuf::Tablets::Tablet const* tablet = getTabletForHash(tableId,
-                                                        getKeyHash(key,
-                                                                   keyLength));
-    if (tablet == NULL)
-        return NULL;
-
-    Table* table = reinterpret_cast<Table*>(tablet->user_data());
-    incrementReadAndWriteStatistics(table);
-    return table;
+    return getTableForHash(tableId, getKeyHash(key, keyLength));
 }
 
 /**
@@ -1907,13 +2646,10 @@ MasterService::getTable(uint64_t tableId, const char* key, uint16_t keyLength)
 Table*
 MasterService::getTableForHash(uint64_t tableId, HashType keyHash)
 {
-    ProtoBuf::Tablets::Tablet const* tablet = getTabletForHash(tableId,
-                                                               keyHash);
-    if (tablet == NULL)
+    const IndexedTablet* entry = findIndexedTablet(tableId, keyHash);
+    if (entry == NULL)
         return NULL;
-
-    Table* table = reinterpret_cast<Table*>(tablet->user_data());
-    return table;
+    return entry->table;
 }
 
 /**
@@ -1927,20 +2663,580 @@ MasterService::getTableForHash(uint64_t tableId, HashType keyHash)
  *      Hash value of the variable length key of the object.
  *
  * \return
- *      The Table of which the tablet containing this object is a part,
- *      or NULL if this master does not own the tablet.
+ *      The tablet containing this object, or NULL if this master does not
+ *      own the tablet.
  */
 ProtoBuf::Tablets::Tablet const*
 MasterService::getTabletForHash(uint64_t tableId, HashType keyHash)
 {
+    const IndexedTablet* entry = findIndexedTablet(tableId, keyHash);
+    if (entry == NULL)
+        return NULL;
+    return entry->tablet;
+}
+
+/**
+ * Find the entry of #tabletIndex for the tablet holding an object, in time
+ * logarithmic in the number of tablets.
+ *
+ * \param tableId
+ *      Identifier for a desired table.
+ * \param keyHash
+ *      Hash value of the variable length key of the object.
+ *
+ * \return
+ *      The tablet's entry, or NULL if this master does not own the tablet.
+ */
+const MasterService::IndexedTablet*
+MasterService::findIndexedTablet(uint64_t tableId, HashType keyHash)
+{
+    IndexedTablet key(tableId, keyHash, keyHash, NULL, NULL);
+
+    // Find the last tablet starting at or before keyHash.
+    vector<IndexedTablet>::const_iterator it =
+        std::upper_bound(tabletIndex.begin(), tabletIndex.end(), key);
+    if (it == tabletIndex.begin())
+        return NULL;
+    --it;
+    if (it->tableId != tableId || keyHash > it->endKeyHash)
+        return NULL;
+    return &*it;
+}
+
+/**
+ * Rebuild #tabletIndex from #tablets. Must be called after every change to
+ * the set of tablets, with #allObjectLocks held (as it is for any such
+ * change): the new index then replaces the old one before any request can
+ * look at it.
+ */
+void
+MasterService::indexTablets()
+{
+    vector<IndexedTablet> index;
+    index.reserve(tablets.tablet_size());
     foreach (const ProtoBuf::Tablets::Tablet& tablet, tablets.tablet()) {
-        if (tablet.table_id() == tableId &&
-            tablet.start_key_hash() <= keyHash &&
-            keyHash <= tablet.end_key_hash()) {
-            return &tablet;
+        index.push_back(IndexedTablet(
+            tablet.table_id(), tablet.start_key_hash(),
+            tablet.end_key_hash(),
+            reinterpret_cast<Table*>(tablet.user_data()), &tablet));
+    }
+    std::sort(index.begin(), index.end());
+    tabletIndex.swap(index);
+}
+
+/**
+ * Return the lock among #objectLocks that must be held to look at or
+ * change an object. Objects that share a bucket of #objectMap always
+ * share a lock. Since #objectMap has at least #NUM_OBJECT_LOCKS buckets,
+ * an object's lock doesn't change when the table doubles in size.
+ *
+ * \param tableId
+ *      Table containing the object.
+ * \param key
+ *      Key of the object.
+ * \param keyLength
+ *      Size in bytes of the key.
+ */
+SpinLock&
+MasterService::objectLock(uint64_t tableId, const char* key,
+                          uint16_t keyLength)
+{
+    uint64_t bucket = objectMap.getBucketIndex(tableId, key, keyLength);
+    return objectLocks[bucket & (NUM_OBJECT_LOCKS - 1)].lock;
+}
+
+/**
+ * Acquire the locks added to the group, in ascending order and each one
+ * just once, so that this can't deadlock with anyone else who holds more
+ * than one of #objectLocks.
+ */
+void
+MasterService::ObjectLockGroup::lock()
+{
+    std::sort(locks.begin(), locks.end());
+    locks.erase(std::unique(locks.begin(), locks.end()), locks.end());
+    for (; held < locks.size(); held++)
+        locks[held]->lock();
+}
+
+/**
+ * Release the locks acquired by #lock, if any.
+ */
+void
+MasterService::ObjectLockGroup::unlock()
+{
+    for (; held > 0; held--)
+        locks[held - 1]->unlock();
+}
+
+/**
+ * Acquire every one of #objectLocks. They are always taken in the same
+ * order, so two threads doing this at once can't deadlock.
+ */
+void
+MasterService::AllObjectLocks::lock()
+{
+    for (uint32_t i = 0; i < NUM_OBJECT_LOCKS; i++)
+        service.objectLocks[i].lock.lock();
+}
+
+/**
+ * Release the locks acquired by #lock.
+ */
+void
+MasterService::AllObjectLocks::unlock()
+{
+    for (uint32_t i = NUM_OBJECT_LOCKS; i > 0; i--)
+        service.objectLocks[i - 1].lock.unlock();
+}
+
+// --- MasterService::ObjectMapResizer ---
+
+/**
+ * Start watching the load factor of a master's #objectMap. The caller must
+ * hold the Dispatch lock.
+ */
+MasterService::ObjectMapResizer::ObjectMapResizer(MasterService& service)
+    : Dispatch::Poller(*Context::get().dispatch)
+    , service(service)
+{
+}
+
+/**
+ * Start growing #objectMap if it is too full, or move the next few of its
+ * buckets if it is already growing.
+ */
+void
+MasterService::ObjectMapResizer::poll()
+{
+    HashTable<LogEntryHandle>& objectMap = service.objectMap;
+    if (!objectMap.isResizing()) {
+        if (objectMap.getLoadFactor() <= MAX_OBJECT_MAP_LOAD_FACTOR)
+            return;
+        LOG(NOTICE, "Object map load factor is %.2f, growing it from %lu "
+            "to %lu buckets", objectMap.getLoadFactor(),
+            objectMap.getNumBuckets(), 2 * objectMap.getNumBuckets());
+        objectMap.startResize();
+        return;
+    }
+
+    for (uint32_t i = 0; i < BUCKETS_PER_POLL; i++) {
+        uint64_t bucket = objectMap.getNextBucketToMigrate();
+        if (bucket == objectMap.getNumBuckets()) {
+            if (!lockAll())
+                return;
+            objectMap.finishResize();
+            unlockAll();
+            LOG(NOTICE, "Object map now has %lu buckets",
+                objectMap.getNumBuckets());
+            return;
+        }
+
+        // This is the lock of every key in the bucket, whichever of the
+        // two tables it is in (see #objectLock).
+        SpinLock& lock =
+            service.objectLocks[bucket & (NUM_OBJECT_LOCKS - 1)].lock;
+        if (!lock.try_lock())
+            return;
+        objectMap.migrateBucket();
+        lock.unlock();
+    }
+}
+
+/**
+ * Take all of #objectLocks, which swapping in the larger table needs, if
+ * they are all free right now. Should one of them be taken, those taken
+ * so far are released again rather than kept until the next poll: they
+ * would hold up requests for as long as the busy one stays busy.
+ *
+ * \return
+ *      Whether all of them are held.
+ */
+bool
+MasterService::ObjectMapResizer::lockAll()
+{
+    for (uint32_t i = 0; i < NUM_OBJECT_LOCKS; i++) {
+        if (!service.objectLocks[i].lock.try_lock()) {
+            while (i > 0) {
+                i--;
+                service.objectLocks[i].lock.unlock();
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Release the locks taken by #lockAll.
+ */
+void
+MasterService::ObjectMapResizer::unlockAll()
+{
+    for (uint32_t i = NUM_OBJECT_LOCKS; i > 0; i--)
+        service.objectLocks[i - 1].lock.unlock();
+}
+
+// --- MasterService::ReplayThreadPool ---
+
+/**
+ * Start the threads that replay segments for a master.
+ *
+ * \param service
+ *      The master whose segments are replayed.
+ * \param numPartitions
+ *      Number of partitions segments are split into, one of which the
+ *      caller of #replay replays itself. 0 is taken as 1, in which case no
+ *      threads are started.
+ */
+MasterService::ReplayThreadPool::ReplayThreadPool(MasterService& service,
+                                                  uint32_t numPartitions)
+    : service(service)
+    , replayMutex()
+    , mutex()
+    , workAvailable()
+    , workDone()
+    , partitions(NULL)
+    , generation(0)
+    , busyThreads(0)
+    , exiting(false)
+    , threads()
+{
+    for (size_t p = 1; p < numPartitions; p++) {
+        threads.push_back(new std::thread(threadMain, this, p,
+                                          &Context::get()));
+    }
+}
+
+/**
+ * Stop the threads. Must not be called while a segment is being replayed.
+ */
+MasterService::ReplayThreadPool::~ReplayThreadPool()
+{
+    {
+        Lock lock(mutex);
+        exiting = true;
+        workAvailable.notify_all();
+    }
+    foreach (std::thread* thread, threads) {
+        thread->join();
+        delete thread;
+    }
+}
+
+/**
+ * Replay the partitions of a segment, the first one on the calling thread
+ * and the others each on one of the threads, and return once all of them
+ * are done. Exceptions are stored in the error field of the partition that
+ * threw them rather than propagated.
+ *
+ * \param partitions
+ *      The partitions to replay; there must be #getNumPartitions of them.
+ */
+void
+MasterService::ReplayThreadPool::replay(vector<ReplayPartition>& partitions)
+{
+    assert(partitions.size() == getNumPartitions());
+    std::lock_guard<std::mutex> _(replayMutex);
+    {
+        Lock lock(mutex);
+        this->partitions = &partitions;
+        busyThreads = threads.size();
+        generation++;
+        workAvailable.notify_all();
+    }
+
+    try {
+        service.replayPartition(partitions[0], threads.empty());
+    } catch (...) {
+        partitions[0].error = std::current_exception();
+    }
+
+    Lock lock(mutex);
+    while (busyThreads > 0)
+        workDone.wait(lock);
+    this->partitions = NULL;
+}
+
+/**
+ * Main function of the threads: replay one partition of every segment
+ * handed to #replay until the pool is destroyed.
+ *
+ * \param pool
+ *      The pool the thread belongs to.
+ * \param partition
+ *      Index of the partition of each segment that the thread replays.
+ * \param context
+ *      The context of the master.
+ */
+void
+MasterService::ReplayThreadPool::threadMain(ReplayThreadPool* pool,
+                                            size_t partition,
+                                            Context* context)
+{
+    Context::Guard _(*context);
+    uint64_t lastGeneration = 0;
+    Lock lock(pool->mutex);
+    while (true) {
+        while (!pool->exiting && pool->generation == lastGeneration)
+            pool->workAvailable.wait(lock);
+        if (pool->exiting)
+            return;
+        lastGeneration = pool->generation;
+        ReplayPartition& work = (*pool->partitions)[partition];
+
+        lock.unlock();
+        if (!work.entries.empty()) {
+            try {
+                pool->service.replayPartition(work, false);
+            } catch (...) {
+                work.error = std::current_exception();
+            }
+        }
+        lock.lock();
+
+        if (--pool->busyThreads == 0)
+            pool->workDone.notify_all();
+    }
+}
+
+/**
+ * Decide whether another update can join a group of #PendingUpdates that
+ * #multiWrite or #multiRemove is putting together.
+ *
+ * A group is appended with a single multi-append, so it must fit into one
+ * segment: it is kept to a quarter of one unless it's a single update.
+ * And it can't update the same object twice, as its updates are checked
+ * before any of them is made.
+ *
+ * \param updates
+ *      The group so far.
+ * \param tableId
+ *      The table of the object to update.
+ * \param key
+ *      The key of the object to update.
+ * \param keyLength
+ *      Size in bytes of the key.
+ * \param dataLength
+ *      Size in bytes of the object's new value; 0 for a removal.
+ * \return
+ *      True if the update can join the group.
+ */
+bool
+MasterService::fitsInUpdateGroup(const vector<PendingUpdate>& updates,
+                                 uint64_t tableId, const char* key,
+                                 uint16_t keyLength, uint32_t dataLength)
+{
+    if (updates.empty())
+        return true;
+    if (updates.size() >= MULTIWRITE_BATCH_SIZE)
+        return false;
+
+    // Room for the object as well as a tombstone for its old version.
+    uint64_t bytes = sizeof(Object) + sizeof(ObjectTombstone) +
+                     2 * keyLength + dataLength;
+    foreach (const PendingUpdate& update, updates) {
+        if (update.tableId == tableId && update.keyLength == keyLength &&
+            memcmp(update.key, key, keyLength) == 0) {
+            return false;
+        }
+        bytes += sizeof(Object) + sizeof(ObjectTombstone) +
+                 2 * update.keyLength + update.dataLength;
+    }
+    return bytes <= log.getSegmentCapacity() / 4;
+}
+
+/**
+ * Find the tablets and the current entries in #objectMap of a group of
+ * #PendingUpdates. Updates of objects in tablets this master doesn't own
+ * or can't currently write are given their failure status. The caller
+ * must hold the locks of the objects.
+ */
+void
+MasterService::lookupUpdates(vector<PendingUpdate>& updates)
+{
+    HashTable<LogEntryHandle>::BatchEntry batch[MULTIWRITE_BATCH_SIZE];
+    uint32_t count = downCast<uint32_t>(updates.size());
+    assert(count <= MULTIWRITE_BATCH_SIZE);
+    for (uint32_t i = 0; i < count; i++) {
+        batch[i].key1 = updates[i].tableId;
+        batch[i].key2 = updates[i].key;
+        batch[i].key2Length = updates[i].keyLength;
+    }
+    objectMap.lookupBatch(batch, count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        PendingUpdate& update = updates[i];
+        update.handle = batch[i].referent;
+        update.table = getTableForHash(update.tableId, update.keyHash);
+        if (update.table == NULL)
+            update.status = STATUS_UNKNOWN_TABLE;
+        else if (isWriteFrozen(update.tableId, update.keyHash))
+            update.status = STATUS_RETRY;
+    }
+}
+
+/**
+ * Append the new objects and tombstones of a group of #PendingUpdates to
+ * the log with a single multi-append, without waiting for replication, and
+ * bring #objectMap, the version numbers and the statistics of the tablets
+ * up to date. Updates with neither an object nor a tombstone are left
+ * alone. Should the log be out of space, the status of every update that
+ * was to be appended becomes STATUS_RETRY. The caller must hold the locks
+ * of the objects.
+ */
+void
+MasterService::appendUpdates(vector<PendingUpdate>& updates)
+{
+    LogMultiAppendVector appends;
+    foreach (PendingUpdate& update, updates) {
+        if (update.status != STATUS_OK)
+            continue;
+        if (!update.tombstone.empty()) {
+            ObjectTombstone* tomb =
+                reinterpret_cast<ObjectTombstone*>(&update.tombstone[0]);
+            appends.push_back({ LOG_ENTRY_TYPE_OBJTOMB,
+                                tomb,
+                                tomb->tombLength() });
+        }
+        if (!update.object.empty()) {
+            Object* obj = reinterpret_cast<Object*>(&update.object[0]);
+            appends.push_back({ LOG_ENTRY_TYPE_OBJ,
+                                obj,
+                                obj->objectLength(update.dataLength),
+                                update.keyAndData,
+                                update.keyOffset,
+                                update.keyLength + update.dataLength });
+        }
+    }
+    if (appends.empty())
+        return;
+
+    LogEntryHandleVector handles;
+    try {
+        handles = log.multiAppend(appends, false);
+    } catch (LogOutOfMemoryException& e) {
+        // The log is out of space. Tell the client to retry and hope
+        // that either the cleaner makes space soon or we shift load
+        // off of this server.
+        foreach (PendingUpdate& update, updates) {
+            if (update.status == STATUS_OK &&
+                (!update.tombstone.empty() || !update.object.empty())) {
+                update.status = STATUS_RETRY;
+            }
+        }
+        return;
+    }
+
+    uint32_t next = 0;
+    foreach (PendingUpdate& update, updates) {
+        if (update.status != STATUS_OK)
+            continue;
+        Table* table = update.table;
+        if (!update.tombstone.empty())
+            noteAppend(table, handles[next++]);
+        if (!update.object.empty()) {
+            LogEntryHandle objHandle = handles[next++];
+            noteAppend(table, objHandle);
+            objectMap.replace(objHandle);
+            update.version = objHandle->userData<Object>()->version;
+            table->statistics.recordWrite(update.keyHash, update.dataLength);
+            table->statistics.objectAdded(update.keyHash, update.dataLength);
+            bytesWritten += update.keyLength + update.dataLength;
+        } else if (!update.tombstone.empty()) {
+            // A removal.
+            const Object* obj = update.handle->userData<Object>();
+            table->RaiseVersion(obj->version + 1);
+            table->statistics.recordWrite(update.keyHash, 0);
+        }
+        if (!update.tombstone.empty()) {
+            const Object* obj = update.handle->userData<Object>();
+            table->statistics.objectRemoved(update.keyHash,
+                obj->dataLength(update.handle->length()));
+            log.free(update.handle);
+            if (update.object.empty()) {
+                objectMap.remove(update.tableId, update.key,
+                                 update.keyLength);
+            }
         }
     }
-    return NULL;
+    assert(next == handles.size());
+}
+
+/**
+ * The first write to this master is used as a trigger to update the
+ * cluster configuration information and open a session with each backup,
+ * so it won't slow down recovery benchmarks.  This is a temporary hack,
+ * and needs to be replaced with a more robust approach to updating cluster
+ * configuration information.
+ */
+void
+MasterService::openBackupSessionsOnFirstWrite()
+{
+    if (anyWrites.exchange(true))
+        return;
+
+    // NULL coordinator means we're in test mode, so skip this.
+    if (coordinator) {
+        ProtoBuf::ServerList backups;
+        coordinator->getBackupList(backups);
+        TransportManager& transportManager =
+            *Context::get().transportManager;
+        foreach(auto& backup, backups.server())
+            transportManager.getSession(backup.service_locator().c_str());
+    }
+}
+
+/**
+ * Record that an object or tombstone of a tablet was just appended to the
+ * log, so that migrating the tablet can skip segments holding none of its
+ * entries (see Table::segmentIds). Takes the Table's mutex, so any number
+ * of threads may call this at once.
+ *
+ * \param table
+ *      The tablet the entry belongs to. If NULL, nothing is recorded.
+ * \param handle
+ *      The entry that was appended.
+ */
+void
+MasterService::noteAppend(Table* table, LogEntryHandle handle)
+{
+    noteAppend(table, handle->logPosition().segmentId());
+}
+
+/**
+ * Record that an object or tombstone of a tablet was appended to a
+ * particular log segment; see noteAppend(Table*, LogEntryHandle).
+ *
+ * \param table
+ *      The tablet the entry belongs to. If NULL, nothing is recorded.
+ * \param segmentId
+ *      Identifies the segment the entry was appended to.
+ */
+void
+MasterService::noteAppend(Table* table, uint64_t segmentId)
+{
+    if (table == NULL)
+        return;
+    std::lock_guard<SpinLock> lock(table->mutex);
+    if (!table->addSegment(segmentId))
+        return;
+    if (table->segmentIds.size() <= table->segmentIdsPruneSize)
+        return;
+
+    // Segment IDs are never reused, so those of freed segments can go.
+    // Segments that are merely cleaned stay live while any LogIterator
+    // exists, which keeps them around for a migration in progress.
+    std::unordered_set<uint64_t>::iterator it = table->segmentIds.begin();
+    while (it != table->segmentIds.end()) {
+        if (log.isSegmentLive(*it))
+            ++it;
+        else
+            it = table->segmentIds.erase(it);
+    }
+    table->segmentIdsPruneSize = 2 * table->segmentIds.size();
+    if (table->segmentIdsPruneSize < Table::MIN_SEGMENT_IDS_PRUNE_SIZE)
+        table->segmentIdsPruneSize = Table::MIN_SEGMENT_IDS_PRUNE_SIZE;
 }
 
 /**
@@ -1998,7 +3294,9 @@ objectLivenessCallback(LogEntryHandle handle, void* cookie)
     const Object* evictObj = handle->userData<Object>();
     assert(evictObj != NULL);
 
-    std::lock_guard<SpinLock> lock(svr->objectUpdateLock);
+    std::lock_guard<SpinLock> lock(svr->objectLock(evictObj->tableId,
+                                                   evictObj->getKey(),
+                                                   evictObj->keyLength));
 
     Table* t = svr->getTable(evictObj->tableId,
                              evictObj->getKey(),
@@ -2056,7 +3354,9 @@ objectRelocationCallback(LogEntryHandle oldHandle,
     const Object* evictObj = oldHandle->userData<Object>();
     assert(evictObj != NULL);
 
-    std::lock_guard<SpinLock> lock(svr->objectUpdateLock);
+    std::lock_guard<SpinLock> lock(svr->objectLock(evictObj->tableId,
+                                                   evictObj->getKey(),
+                                                   evictObj->keyLength));
 
     Table* table = svr->getTable(evictObj->tableId,
                                  evictObj->getKey(),
@@ -2082,6 +3382,7 @@ objectRelocationCallback(LogEntryHandle oldHandle,
         keepNewObject = (hashTblObj == evictObj);
         if (keepNewObject) {
             svr->objectMap.replace(newHandle);
+            svr->noteAppend(table, newHandle);
         }
     }
 
@@ -2178,6 +3479,10 @@ tombstoneRelocationCallback(LogEntryHandle oldHandle,
     // see if the referent is still there
     bool keepNewTomb = svr->log.isSegmentLive(tomb->segmentId);
 
+    std::lock_guard<SpinLock> lock(svr->objectLock(tomb->tableId,
+                                                   tomb->getKey(),
+                                                   tomb->keyLength));
+
     Table* table = svr->getTable(tomb->tableId,
                                  tomb->getKey(),
                                  tomb->keyLength);
@@ -2185,6 +3490,8 @@ tombstoneRelocationCallback(LogEntryHandle oldHandle,
         table->tombstoneCount--;
         table->tombstoneBytes -= oldHandle->length();
     }
+    if (keepNewTomb)
+        svr->noteAppend(table, newHandle);
 
     return keepNewTomb;
 }
@@ -2207,6 +3514,9 @@ tombstoneTimestampCallback(LogEntryHandle handle)
 }
 
 /**
+ * Write an object to the log and point #objectMap at it. Must be called
+ * with the object's lock held (see #objectLock).
+ *
  * \param tableId
  *      The table in which to store the object.
  * \param rejectRules
@@ -2248,45 +3558,29 @@ MasterService::storeData(uint64_t tableId,
                          uint64_t* newVersion,
                          bool async)
 {
-    DECLARE_OBJECT(newObject, keyLength, dataLength);
-
-    newObject->keyLength = keyLength;
-    newObject->tableId = tableId;
-
-    // Copy both the key and the data from keyAndData blob into keyAndData
-    // field in newObject.
-    // In this field, the data should immediately follow the key, like in
-    // the keyAndData blob. Hence, we can copy both of them together.
-    keyAndData->copy(keyOffset, keyLength + dataLength,
-                     newObject->getKeyLocation());
-
-    Table* table = getTable(tableId, newObject->getKey(), keyLength);
+    // The key and data go straight from keyAndData into the log, right
+    // behind the Object header built here, so that they are copied only
+    // once. In the log, like in keyAndData, the data immediately follows
+    // the key.
+    if (keyAndData->getTotalLength() < keyOffset + keyLength + dataLength)
+        return STATUS_MESSAGE_TOO_SHORT;
+    Object newObject(sizeof(Object));
+    newObject.keyLength = keyLength;
+    newObject.tableId = tableId;
+    const char* key = static_cast<const char*>(
+        keyAndData->getRange(keyOffset, keyLength));
+
+    HashType keyHash = getKeyHash(key, keyLength);
+    Table* table = getTableForHash(tableId, keyHash);
     if (table == NULL)
         return STATUS_UNKNOWN_TABLE;
+    if (isWriteFrozen(tableId, keyHash))
+        return STATUS_RETRY;
 
-    if (!anyWrites) {
-        // This is the first write; use this as a trigger to update the
-        // cluster configuration information and open a session with each
-        // backup, so it won't slow down recovery benchmarks.  This is a
-        // temporary hack, and needs to be replaced with a more robust
-        // approach to updating cluster configuration information.
-        anyWrites = true;
-
-        // NULL coordinator means we're in test mode, so skip this.
-        if (coordinator) {
-            ProtoBuf::ServerList backups;
-            coordinator->getBackupList(backups);
-            TransportManager& transportManager =
-                *Context::get().transportManager;
-            foreach(auto& backup, backups.server())
-                transportManager.getSession(backup.service_locator().c_str());
-        }
-    }
+    openBackupSessionsOnFirstWrite();
 
     const Object *obj = NULL;
-    LogEntryHandle handle = objectMap.lookup(tableId,
-                                             newObject->getKey(),
-                                             keyLength);
+    LogEntryHandle handle = objectMap.lookup(tableId, key, keyLength);
     if (handle != NULL) {
         if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB) {
             recoveryCleanup(handle,
@@ -2307,11 +3601,11 @@ MasterService::storeData(uint64_t tableId,
     }
 
     if (obj != NULL)
-        newObject->version = obj->version + 1;
+        newObject.version = obj->version + 1;
     else
-        newObject->version = table->AllocateVersion();
+        newObject.version = table->AllocateVersion();
 
-    assert(obj == NULL || newObject->version > obj->version);
+    assert(obj == NULL || newObject.version > obj->version);
 
     // Perform a multi-append to atomically add the tombstone and
     // new object (if we need a tombstone for the prior one).
@@ -2327,16 +3621,25 @@ MasterService::storeData(uint64_t tableId,
 
     try {
         appends.push_back({ LOG_ENTRY_TYPE_OBJ,
-                            newObject,
-                            newObject->objectLength(dataLength) });
+                            &newObject,
+                            newObject.objectLength(dataLength),
+                            keyAndData,
+                            keyOffset,
+                            keyLength + dataLength });
         LogEntryHandleVector objHandles = log.multiAppend(appends, !async);
+        foreach (LogEntryHandle objHandle, objHandles)
+            noteAppend(table, objHandle);
         if (obj == NULL) {
             objectMap.replace(objHandles[0]);
         } else {
             objectMap.replace(objHandles[1]);
+            table->statistics.objectRemoved(keyHash,
+                obj->dataLength(handle->length()));
             log.free(handle);
         }
-        *newVersion = newObject->version;
+        table->statistics.recordWrite(keyHash, dataLength);
+        table->statistics.objectAdded(keyHash, dataLength);
+        *newVersion = newObject.version;
         bytesWritten += keyLength + dataLength;
         return STATUS_OK;
     } catch (LogOutOfMemoryException& e) {
@@ -16,11 +16,24 @@
 #ifndef RAMCLOUD_MASTERSERVICE_H
 #define RAMCLOUD_MASTERSERVICE_H
 
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#if __GNUC__ >= 4 && __GNUC_MINOR__ >= 5
+#include <atomic>
+#else
+#include <cstdatomic>
+#endif
+
 #include "Common.h"
 #include "CoordinatorClient.h"
+#include "Dispatch.h"
 #include "Log.h"
 #include "LogCleaner.h"
 #include "HashTable.h"
+#include "MasterClient.h"
 #include "Object.h"
 #include "RecoverySegmentIterator.h"
 #include "ReplicaManager.h"
@@ -31,6 +44,7 @@
 #include "ServerConfig.h"
 #include "SpinLock.h"
 #include "Table.h"
+#include "TokenBucket.h"
 
 namespace RAMCloud {
 
@@ -54,6 +68,25 @@ class MasterService : public Service {
     void dispatch(RpcOpcode opcode,
                   Rpc& rpc);
 
+    /**
+     * Reads, writes, removes and increments only lock the objects they
+     * touch (see #objectLocks), so they run on as many threads as the
+     * master is configured with. There are always at least two, so that
+     * other requests are served while a tablet is being migrated.
+     */
+    virtual int maxThreads() {
+        return std::max(2, static_cast<int>(config.master.numWorkerThreads));
+    }
+
+    /**
+     * Taking in migrated data is background work: it mustn't keep reads
+     * and writes from being served.
+     */
+    virtual bool isBackground(RpcOpcode opcode) {
+        return opcode == PREP_FOR_MIGRATION ||
+               opcode == RECEIVE_MIGRATION_DATA;
+    }
+
   PRIVATE:
 
     /**
@@ -99,6 +132,12 @@ class MasterService : public Service {
     void multiRead(const MultiReadRpc::Request& reqHdr,
                    MultiReadRpc::Response& respHdr,
                    Rpc& rpc);
+    void multiRemove(const MultiRemoveRpc::Request& reqHdr,
+                     MultiRemoveRpc::Response& respHdr,
+                     Rpc& rpc);
+    void multiWrite(const MultiWriteRpc::Request& reqHdr,
+                    MultiWriteRpc::Response& respHdr,
+                    Rpc& rpc);
     void read(const ReadRpc::Request& reqHdr,
               ReadRpc::Response& respHdr,
               Rpc& rpc);
@@ -120,12 +159,211 @@ class MasterService : public Service {
     void receiveMigrationData(const ReceiveMigrationDataRpc::Request& reqHdr,
                               ReceiveMigrationDataRpc::Response& respHdr,
                               Rpc& rpc);
+
+    /// Size of the segments in which #migrateTablet sends data.
+    static const uint32_t MIGRATION_SEGMENT_BYTES = 8 * 1024 * 1024;
+
+    /// Number of segments #migrateTablet has on the go at once: one being
+    /// filled from the log, the rest being sent to the recipient. With a
+    /// depth of 1 the log scan would stall for every round trip.
+    static const uint32_t MIGRATION_PIPELINE_DEPTH = 4;
+
+    /**
+     * State of a tablet (or part of one) that #migrateTablet is moving to
+     * another master. Creating one registers it as the master's
+     * #outgoingMigration; the caller must hold #allObjectLocks while
+     * doing so. Destroying it unregisters it again and takes the locks
+     * itself.
+     */
+    class OutgoingMigration {
+      public:
+        OutgoingMigration(MasterService& service, uint64_t tableId,
+                          uint64_t firstKey, uint64_t lastKey,
+                          ServerId newOwner, uint64_t bytesPerSecond);
+        ~OutgoingMigration();
+        bool covers(uint64_t tableId, HashType keyHash) const;
+
+        /// The master the data is migrated from.
+        MasterService& service;
+
+        uint64_t tableId;
+        uint64_t firstKey;
+        uint64_t lastKey;
+
+        /// The master the data is migrated to.
+        ServerId newOwner;
+        MasterClient recipient;
+
+        /// Set while the last catch-up round runs: writes to the range are
+        /// then refused with STATUS_RETRY, so that nothing can be missed.
+        bool writesFrozen;
+
+        /// Paces the segments sent to #recipient.
+        TokenBucket throttle;
+
+        /**
+         * A segment's worth of objects and tombstones for #recipient,
+         * either being filled or on its way.
+         */
+        struct Transfer {
+            Transfer();
+            ~Transfer();
+
+            /// Memory backing #segment.
+            void* buffer;
+
+            /// The segment being filled or sent, if any.
+            Tub<Segment> segment;
+
+            /// Number of entries in #segment.
+            uint32_t entries;
+
+            /// The RPC sending #segment, while it is outstanding.
+            Tub<MasterClient::ReceiveMigrationData> rpc;
+
+            /// Cycles::rdtsc() when #rpc was started.
+            uint64_t sendTime;
+
+            DISALLOW_COPY_AND_ASSIGN(Transfer);
+        };
+
+        /// Segments cycle through these: one is filled while the RPCs
+        /// for the others are in flight. The one at #current is never
+        /// being sent.
+        Transfer transfers[MIGRATION_PIPELINE_DEPTH];
+
+        /// Index into #transfers of the segment being filled.
+        uint32_t current;
+
+        /// Totals over the whole migration, for the log.
+        uint64_t totalObjects;
+        uint64_t totalTombstones;
+        uint64_t totalBytes;
+
+        DISALLOW_COPY_AND_ASSIGN(OutgoingMigration);
+    };
+
+    bool isWriteFrozen(uint64_t tableId, HashType keyHash);
+    Status migrateLogRange(OutgoingMigration& migration, LogPosition start,
+                           LogPosition end)
+        __attribute__((warn_unused_result));
+    void sendMigrationSegment(OutgoingMigration& migration);
+    void completeMigrationSegment(OutgoingMigration::Transfer& transfer);
+    void drainMigrationSegments(OutgoingMigration& migration);
     void recover(const RecoverRpc::Request& reqHdr,
                  RecoverRpc::Response& respHdr,
                  Rpc& rpc);
-    void recoverSegmentPrefetcher(RecoverySegmentIterator& i);
+
+    /**
+     * The objects and tombstones of a segment that one thread replays in
+     * #recoverSegment, and what came of it.
+     */
+    struct ReplayPartition {
+        ReplayPartition()
+            : entries()
+            , appendedTo()
+            , error()
+            , lockObjects(false)
+            , objectAppendCount(0)
+            , objectDiscardCount(0)
+            , tombstoneAppendCount(0)
+            , tombstoneDiscardCount(0)
+            , liveObjectCount(0)
+            , liveObjectBytes(0)
+            , verifyChecksumTicks(0)
+        {
+        }
+
+        /// Entries to replay, in segment order.
+        vector<SegmentEntryHandle> entries;
+
+        /// Tablets that replayed entries belong to along with the log
+        /// segments the entries were appended to, for #noteAppend once all
+        /// threads are done. Consecutive duplicates are left out.
+        vector<std::pair<Table*, uint64_t>> appendedTo;
+
+        /// Set if replaying the partition threw; #recoverSegment rethrows
+        /// it on the service thread.
+        std::exception_ptr error;
+
+        /// If set, each entry is replayed holding its #objectLock, and
+        /// #noteAppend is called right away instead of via #appendedTo.
+        /// Otherwise the caller holds #allObjectLocks throughout.
+        bool lockObjects;
+
+        /// What replaying the partition adds to the counters of the same
+        /// names in metrics->master. #recoverSegment adds them up once all
+        /// threads are done, rather than have the threads share the
+        /// counters' cache lines. The live counts wrap when they shrink.
+        uint64_t objectAppendCount;
+        uint64_t objectDiscardCount;
+        uint64_t tombstoneAppendCount;
+        uint64_t tombstoneDiscardCount;
+        uint64_t liveObjectCount;
+        uint64_t liveObjectBytes;
+        uint64_t verifyChecksumTicks;
+    };
+
+    /**
+     * Threads that #recoverSegment hands all partitions of a segment but
+     * the first to; the calling thread replays the first one itself. They
+     * are started along with the master and wait for a segment in between,
+     * rather than being started for every segment.
+     */
+    class ReplayThreadPool {
+      public:
+        ReplayThreadPool(MasterService& service, uint32_t numPartitions);
+        ~ReplayThreadPool();
+        void replay(vector<ReplayPartition>& partitions);
+
+        /// Number of partitions #replay expects a segment in.
+        size_t getNumPartitions() const { return threads.size() + 1; }
+
+      PRIVATE:
+        typedef std::unique_lock<std::mutex> Lock;
+
+        static void threadMain(ReplayThreadPool* pool, size_t partition,
+                               Context* context);
+
+        /// The master whose segments are replayed.
+        MasterService& service;
+
+        /// Serializes calls to #replay, which come from recoveries as well
+        /// as from any number of incoming migrations.
+        std::mutex replayMutex;
+
+        /// Protects the fields below.
+        std::mutex mutex;
+
+        /// Notified when #generation advances or #exiting is set.
+        std::condition_variable workAvailable;
+
+        /// Notified when #busyThreads drops to zero.
+        std::condition_variable workDone;
+
+        /// Partitions of the segment being replayed; NULL in between.
+        vector<ReplayPartition>* partitions;
+
+        /// Incremented for every segment handed to the threads, so that
+        /// each can tell a new segment from the one it last replayed.
+        uint64_t generation;
+
+        /// Number of threads still replaying the current segment.
+        size_t busyThreads;
+
+        /// Set by the destructor to ask the threads to exit.
+        bool exiting;
+
+        /// The thread at index i replays partition i + 1.
+        vector<std::thread*> threads;
+
+        DISALLOW_COPY_AND_ASSIGN(ReplayThreadPool);
+    };
+
     void recoverSegment(uint64_t segmentId, const void *buffer,
-                        uint32_t bufferLength);
+                        uint32_t bufferLength, bool lockObjects = false);
+    void replayPartition(ReplayPartition& partition, bool onServiceThread);
+    void replayEntry(SegmentEntryHandle entry, ReplayPartition& partition);
     void recover(ServerId masterId,
                  uint64_t partitionId,
                  vector<Replica>& replicas);
@@ -164,7 +402,7 @@ class MasterService : public Service {
     static const uint64_t maxReferentsPerPartition = 10UL * 1000 * 1000;
 
     /// Track total bytes of object data written (not including log overhead).
-    uint64_t bytesWritten;
+    std::atomic<uint64_t> bytesWritten;
 
     /**
      * The main in-memory data structure holding all of the data stored
@@ -177,42 +415,216 @@ class MasterService : public Service {
      * objects stored on this server. Before accessing objects via the hash
      * table, you usually need to check that the tablet still lives on this
      * server; objects from deleted tablets are not immediately purged from the
-     * hash table.
+     * hash table. It grows when it fills up; see #objectMapResizer.
      */
     HashTable<LogEntryHandle> objectMap;
 
+    /// #objectMap is grown once its load factor exceeds this.
+    static const double MAX_OBJECT_MAP_LOAD_FACTOR;
+
+    /// Number of objects #multiRead looks up in #objectMap at once.
+    static const uint32_t MULTIREAD_BATCH_SIZE = 16;
+
+    /// Maximum number of objects #multiWrite and #multiRemove append to
+    /// the log at once; see #PendingUpdate.
+    static const uint32_t MULTIWRITE_BATCH_SIZE = 64;
+
     /**
      * Tablets this master owns.
      * The user_data field in each tablet points to a Table object.
+     * Whenever tablets are added or removed, or their key ranges or Tables
+     * change, #indexTablets must be called before the next lookup.
      */
     ProtoBuf::Tablets tablets;
 
+    /**
+     * A tablet as recorded in #tabletIndex.
+     */
+    struct IndexedTablet {
+        IndexedTablet(uint64_t tableId, uint64_t startKeyHash,
+                      uint64_t endKeyHash, Table* table,
+                      const ProtoBuf::Tablets::Tablet* tablet)
+            : tableId(tableId)
+            , startKeyHash(startKeyHash)
+            , endKeyHash(endKeyHash)
+            , table(table)
+            , tablet(tablet)
+        {
+        }
+
+        uint64_t tableId;
+        uint64_t startKeyHash;
+        uint64_t endKeyHash;
+
+        /// The tablet's user_data.
+        Table* table;
+
+        /// The tablet in #tablets.
+        const ProtoBuf::Tablets::Tablet* tablet;
+
+        /// Orders tablets by table and then by first key hash.
+        bool operator<(const IndexedTablet& other) const {
+            return tableId < other.tableId ||
+                   (tableId == other.tableId &&
+                    startKeyHash < other.startKeyHash);
+        }
+    };
+
+    /**
+     * #tablets sorted by table and first key hash, so that the tablet of
+     * an object is found by binary search rather than by a scan through
+     * all of #tablets. Replaced as a whole by #indexTablets.
+     */
+    vector<IndexedTablet> tabletIndex;
+
     /**
      * Used to ensure that init() is invoked before the dispatcher runs.
      */
     bool initCalled;
 
+    /**
+     * The migration of a tablet away from this master that is in progress,
+     * or NULL if there is none. Only one migration runs at a time.
+     * Changed only while holding #allObjectLocks, so holding any one of
+     * #objectLocks is enough to read it.
+     */
+    OutgoingMigration* outgoingMigration;
+
+    /// #migrateTablet freezes writes for the final catch-up round as soon
+    /// as a round sends no more than this many bytes...
+    static const uint64_t MIGRATION_FINAL_ROUND_BYTES = 1024 * 1024;
+
+    /// ...or after this many catch-up rounds, whichever comes first.
+    static const uint32_t MIGRATION_MAX_CATCH_UP_ROUNDS = 8;
+
+    /// Paces the replay of incoming migration data, across all migrations
+    /// to this master; see ServerConfig::Master::migrationBytesPerSecond.
+    TokenBucket migrationReplayThrottle;
+
+
     /**
      * Used to identify the first write request, so that we can initialize
      * connections to all backups at that time (this is a temporary kludge
      * that needs to be replaced with a better solution).  False means this
      * service has not yet processed any write requests.
      */
-    bool anyWrites;
+    std::atomic<bool> anyWrites;
+
+    /// Number of locks in #objectLocks. Must be a power of two.
+    static const uint32_t NUM_OBJECT_LOCKS = 256;
+
+    /**
+     * One of #objectLocks, padded to a cache line so that threads taking
+     * neighbouring locks don't fight over the line.
+     */
+    struct ObjectLock {
+        ObjectLock()
+            : lock()
+            , pad()
+        {
+        }
+
+        SpinLock lock;
+        char pad[CACHE_LINE_SIZE - sizeof(SpinLock)];
+    };
+
+    /**
+     * Locks that serialise the operations on objects (reads, creations,
+     * overwrites, deletions, and cleaning relocations). Each lock covers
+     * the objects that fall into a fixed subset of the buckets of
+     * #objectMap, so operations on different buckets can run in parallel
+     * and the HashTable needs no locking of its own. See #objectLock.
+     * Whoever needs more than one of them at a time takes them in
+     * ascending order.
+     */
+    ObjectLock objectLocks[NUM_OBJECT_LOCKS];
+
+    /**
+     * Takes all of #objectLocks, which excludes every operation on
+     * objects. This is what protects #tablets, the Tables and
+     * #outgoingMigration from being changed while a request or the
+     * cleaner looks at them: those hold one of #objectLocks throughout.
+     * Use it with std::lock_guard.
+     */
+    class AllObjectLocks {
+      public:
+        explicit AllObjectLocks(MasterService& service)
+            : service(service)
+        {
+        }
+        void lock();
+        void unlock();
+
+      PRIVATE:
+        MasterService& service;
+        DISALLOW_COPY_AND_ASSIGN(AllObjectLocks);
+    };
+    AllObjectLocks allObjectLocks;
+
+    /**
+     * Takes the #objectLocks of a group of objects together, each lock just
+     * once and in ascending order, and releases them when destroyed. Call
+     * #add for each object, then #lock.
+     */
+    class ObjectLockGroup {
+      public:
+        ObjectLockGroup()
+            : locks()
+            , held(0)
+        {
+        }
+        ~ObjectLockGroup() { unlock(); }
+        void add(SpinLock& lock) { locks.push_back(&lock); }
+        void lock();
+        void unlock();
+
+      PRIVATE:
+        /// The locks to take; sorted and free of duplicates once taken.
+        vector<SpinLock*> locks;
+
+        /// Number of #locks held at the moment.
+        size_t held;
+
+        DISALLOW_COPY_AND_ASSIGN(ObjectLockGroup);
+    };
 
     /**
-     * Lock that serialises all object updates (creations, overwrites,
-     * deletions, and cleaning relocations). This protects regular RPC
-     * operations from the log cleaner. When we work on multithreaded
-     * writes we'll need to revisit this.
+     * Grows #objectMap in the background once its load factor exceeds
+     * #MAX_OBJECT_MAP_LOAD_FACTOR, moving a few of its buckets to the
+     * larger table whenever the dispatch thread polls. It never waits for
+     * one of #objectLocks, since the worker holding it may itself be
+     * waiting for the dispatch thread to replicate a write.
      */
-    SpinLock objectUpdateLock;
+    class ObjectMapResizer : public Dispatch::Poller {
+      public:
+        explicit ObjectMapResizer(MasterService& service);
+        virtual void poll();
+
+        /// Maximum number of buckets moved by a single #poll.
+        static const uint32_t BUCKETS_PER_POLL = 4;
+
+      PRIVATE:
+        bool lockAll();
+        void unlockAll();
+
+        /// The master whose #objectMap this grows.
+        MasterService& service;
+
+        DISALLOW_COPY_AND_ASSIGN(ObjectMapResizer);
+    };
+    Tub<ObjectMapResizer> objectMapResizer;
+
+    /// Replays the partitions of recovery and migration segments in
+    /// parallel; see #recoverSegment and config.master.numReplayThreads.
+    ReplayThreadPool replayThreads;
+
+    SpinLock& objectLock(uint64_t tableId, const char* key,
+                         uint16_t keyLength);
 
     /* Tombstone cleanup method used after recovery. */
     void removeTombstones();
 
   PRIVATE:
-    void incrementReadAndWriteStatistics(Table* table);
 
     static void
     detectSegmentRecoveryFailure(
@@ -232,6 +644,9 @@ class MasterService : public Service {
                                             void* cookie);
     friend void tombstoneScanCallback(LogEntryHandle handle, void* cookie);
     friend void segmentReplayCallback(Segment* seg, void* cookie);
+    void indexTablets();
+    const IndexedTablet* findIndexedTablet(uint64_t tableId,
+                                           HashType keyHash);
     Table* getTable(uint64_t tableId, const char* key, uint16_t keyLength)
         __attribute__((warn_unused_result));
     Table* getTableForHash(uint64_t tableId, HashType keyHash)
@@ -239,6 +654,116 @@ class MasterService : public Service {
     ProtoBuf::Tablets::Tablet const* getTabletForHash(uint64_t tableId,
                                                       HashType keyHash)
         __attribute__((warn_unused_result));
+    void noteAppend(Table* table, LogEntryHandle handle);
+    void noteAppend(Table* table, uint64_t segmentId);
+
+    /**
+     * An object write or removal of a #multiWrite or #multiRemove. The
+     * updates of a request are checked and appended to the log in groups
+     * of at most #MULTIWRITE_BATCH_SIZE, each with a single multi-append;
+     * see #appendUpdates.
+     */
+    struct PendingUpdate {
+        PendingUpdate(uint64_t tableId, const char* key, uint16_t keyLength,
+                      uint32_t dataLength, const RejectRules& rejectRules)
+            : tableId(tableId)
+            , key(key)
+            , keyLength(keyLength)
+            , keyHash(getKeyHash(key, keyLength))
+            , dataLength(dataLength)
+            , rejectRules(rejectRules)
+            , status(STATUS_OK)
+            , version(VERSION_NONEXISTENT)
+            , table(NULL)
+            , handle(NULL)
+            , object()
+            , keyAndData(NULL)
+            , keyOffset(0)
+            , tombstone()
+        {
+        }
+
+        PendingUpdate(const PendingUpdate& other)
+            : tableId(other.tableId)
+            , key(other.key)
+            , keyLength(other.keyLength)
+            , keyHash(other.keyHash)
+            , dataLength(other.dataLength)
+            , rejectRules(other.rejectRules)
+            , status(other.status)
+            , version(other.version)
+            , table(other.table)
+            , handle(other.handle)
+            , object(other.object)
+            , keyAndData(other.keyAndData)
+            , keyOffset(other.keyOffset)
+            , tombstone(other.tombstone)
+        {
+        }
+
+        PendingUpdate&
+        operator=(const PendingUpdate& other)
+        {
+            tableId = other.tableId;
+            key = other.key;
+            keyLength = other.keyLength;
+            keyHash = other.keyHash;
+            dataLength = other.dataLength;
+            rejectRules = other.rejectRules;
+            status = other.status;
+            version = other.version;
+            table = other.table;
+            handle = other.handle;
+            object = other.object;
+            keyAndData = other.keyAndData;
+            keyOffset = other.keyOffset;
+            tombstone = other.tombstone;
+            return *this;
+        }
+
+        /// Identifies the object. #key points into the request.
+        uint64_t tableId;
+        const char* key;
+        uint16_t keyLength;
+        HashType keyHash;
+
+        /// Size of the new value in bytes; 0 for a removal.
+        uint32_t dataLength;
+
+        /// Conditions under which the update must not be made.
+        RejectRules rejectRules;
+
+        /// The outcome of the update, copied into the reply once its group
+        /// is done.
+        Status status;
+        uint64_t version;
+
+        /// The tablet the object belongs to.
+        Table* table;
+
+        /// The object's current entry in #objectMap, if any.
+        LogEntryHandle handle;
+
+        /// The header of the new Object; empty for a removal, or if the
+        /// update was rejected. 64-bit words keep the Object aligned.
+        vector<uint64_t> object;
+
+        /// The new Object's key and data, which go straight from the
+        /// request into the log behind #object.
+        const Buffer* keyAndData;
+        uint32_t keyOffset;
+
+        /// The tombstone for the object at #handle; empty if that isn't
+        /// to be replaced or removed.
+        vector<uint64_t> tombstone;
+    };
+
+    bool fitsInUpdateGroup(const vector<PendingUpdate>& updates,
+                           uint64_t tableId, const char* key,
+                           uint16_t keyLength, uint32_t dataLength);
+    void lookupUpdates(vector<PendingUpdate>& updates);
+    void appendUpdates(vector<PendingUpdate>& updates);
+    void openBackupSessionsOnFirstWrite();
     Status rejectOperation(const RejectRules& rejectRules, uint64_t version)
         __attribute__((warn_unused_result));
     Status storeData(uint64_t table,
@@ -247,6 +772,8 @@ class MasterService : public Service {
                      uint32_t dataLength,
                      uint64_t* newVersion, bool async)
         __attribute__((warn_unused_result));
+    friend class LogCleanerBenchmark;
+    friend class MasterServiceBenchmark;
     friend class RecoverSegmentBenchmark;
     friend class MasterServiceInternal::RecoveryTask;
     DISALLOW_COPY_AND_ASSIGN(MasterService);
@@ -0,0 +1,255 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * \file
+ * Measures how the throughput of a single master grows with the number of
+ * threads serving requests to it.
+ *
+ * The benchmark fills a master with objects and then has several threads
+ * issue reads and writes of random objects straight to
+ * MasterService::dispatch, the way the ServiceManager's worker threads
+ * would, so that neither the network nor the transports get in the way.
+ */
+
+#include <thread>
+
+#if __GNUC__ >= 4 && __GNUC_MINOR__ >= 5
+#include <atomic>
+#else
+#include <cstdatomic>
+#endif
+
+#include "Cycles.h"
+#include "MasterService.h"
+#include "Tablets.pb.h"
+#include "Tub.h"
+
+namespace RAMCloud {
+
+class MasterServiceBenchmark {
+
+  public:
+    ServerConfig config;
+    ServerList serverList;
+    MasterService* service;
+
+    /// Number of objects in the table, keyed "0" to "numObjects - 1".
+    uint32_t numObjects;
+
+    /// Size of each object's value in bytes.
+    uint32_t objectSize;
+
+    /// Set once all worker threads are ready, to start them at once.
+    std::atomic<bool> go;
+
+    MasterServiceBenchmark(string logSize, string hashTableSize,
+                           uint32_t numObjects, uint32_t objectSize)
+        : config(ServerConfig::forTesting())
+        , serverList()
+        , service(NULL)
+        , numObjects(numObjects)
+        , objectSize(objectSize)
+        , go(false)
+    {
+        config.localLocator = "bogus";
+        config.coordinatorLocator = "bogus";
+        config.setLogAndHashTableSize(logSize, hashTableSize);
+        config.services = {MASTER_SERVICE};
+        config.master.numReplicas = 0;
+        service = new MasterService(config, NULL, serverList);
+        service->init(ServerId(1, 0));
+
+        ProtoBuf::Tablets_Tablet& tablet(*service->tablets.add_tablet());
+        tablet.set_table_id(0);
+        tablet.set_start_key_hash(0);
+        tablet.set_end_key_hash(~0UL);
+        tablet.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
+        tablet.set_server_id(service->serverId.getId());
+        tablet.set_user_data(reinterpret_cast<uint64_t>(
+            new Table(0, 0, ~0UL)));
+        service->indexTablets();
+
+        for (uint32_t i = 0; i < numObjects; i++)
+            write(i);
+    }
+
+    ~MasterServiceBenchmark()
+    {
+        delete service;
+    }
+
+    /**
+     * Read an object through MasterService::dispatch.
+     * \return
+     *      The status of the request.
+     */
+    Status
+    read(uint32_t objectIndex)
+    {
+        string key = format("%u", objectIndex);
+        Buffer request;
+        Buffer reply;
+        ReadRpc::Request& reqHdr(*new(&request, APPEND) ReadRpc::Request);
+        memset(&reqHdr, 0, sizeof(reqHdr));
+        reqHdr.common.opcode = ReadRpc::opcode;
+        reqHdr.tableId = 0;
+        reqHdr.keyLength = downCast<uint16_t>(key.length());
+        Buffer::Chunk::appendToBuffer(&request, key.c_str(),
+                                      reqHdr.keyLength);
+        Service::Rpc rpc(NULL, request, reply);
+        service->dispatch(ReadRpc::opcode, rpc);
+        return reply.getStart<ReadRpc::Response>()->common.status;
+    }
+
+    /**
+     * Overwrite an object through MasterService::dispatch.
+     * \return
+     *      The status of the request.
+     */
+    Status
+    write(uint32_t objectIndex)
+    {
+        string key = format("%u", objectIndex);
+        char value[objectSize];
+        memset(value, 'x', objectSize);
+        Buffer request;
+        Buffer reply;
+        WriteRpc::Request& reqHdr(*new(&request, APPEND) WriteRpc::Request);
+        memset(&reqHdr, 0, sizeof(reqHdr));
+        reqHdr.common.opcode = WriteRpc::opcode;
+        reqHdr.tableId = 0;
+        reqHdr.keyLength = downCast<uint16_t>(key.length());
+        reqHdr.length = objectSize;
+        reqHdr.async = 1;
+        Buffer::Chunk::appendToBuffer(&request, key.c_str(),
+                                      reqHdr.keyLength);
+        Buffer::Chunk::appendToBuffer(&request, value, objectSize);
+        Service::Rpc rpc(NULL, request, reply);
+        service->dispatch(WriteRpc::opcode, rpc);
+        return reply.getStart<WriteRpc::Response>()->common.status;
+    }
+
+    /**
+     * Body of a worker thread: issue \a numOps reads and writes of random
+     * objects as soon as #go is set.
+     *
+     * \param bench
+     *      The benchmark the thread works for.
+     * \param seed
+     *      Seeds the thread's choice of objects.
+     * \param numOps
+     *      Number of requests to issue.
+     * \param writePercent
+     *      Percentage of the requests that are writes.
+     * \param failures
+     *      Number of requests that didn't return STATUS_OK is added here.
+     * \param context
+     *      The context of the benchmark's main thread.
+     */
+    static void
+    workerMain(MasterServiceBenchmark* bench, uint64_t seed, uint32_t numOps,
+               uint32_t writePercent, std::atomic<uint64_t>* failures,
+               Context* context)
+    {
+        Context::Guard _(*context);
+
+        // A private generator keeps the threads from sharing a cache line
+        // just to pick their objects.
+        uint64_t random = seed * 6364136223846793005UL + 1442695040888963407UL;
+        uint64_t failed = 0;
+        while (!bench->go)
+            /* spin */;
+        for (uint32_t i = 0; i < numOps; i++) {
+            random = random * 6364136223846793005UL + 1442695040888963407UL;
+            uint32_t objectIndex =
+                downCast<uint32_t>((random >> 33) % bench->numObjects);
+            Status status;
+            if ((random >> 16) % 100 < writePercent)
+                status = bench->write(objectIndex);
+            else
+                status = bench->read(objectIndex);
+            if (status != STATUS_OK)
+                failed++;
+        }
+        *failures += failed;
+    }
+
+    /**
+     * Run the workload on a number of threads and print the throughput.
+     *
+     * \param numThreads
+     *      Number of threads issuing requests at once.
+     * \param totalOps
+     *      Number of requests issued by all threads together.
+     * \param writePercent
+     *      Percentage of the requests that are writes.
+     */
+    void
+    run(uint32_t numThreads, uint32_t totalOps, uint32_t writePercent)
+    {
+        uint32_t opsPerThread = totalOps / numThreads;
+        std::atomic<uint64_t> failures(0);
+        go = false;
+        Tub<std::thread> threads[numThreads];
+        for (uint32_t t = 0; t < numThreads; t++) {
+            threads[t].construct(workerMain, this, t + 1, opsPerThread,
+                                 writePercent, &failures, &Context::get());
+        }
+
+        uint64_t start = Cycles::rdtsc();
+        go = true;
+        for (uint32_t t = 0; t < numThreads; t++)
+            threads[t]->join();
+        double seconds = Cycles::toSeconds(Cycles::rdtsc() - start);
+
+        printf("%3u%% writes %2u threads: %8.0f ops/s (%.2f us/op per "
+               "thread)", writePercent, numThreads,
+               static_cast<double>(opsPerThread * numThreads) / seconds,
+               seconds * 1e06 / opsPerThread);
+        if (failures > 0)
+            printf(", %lu failed", failures.load());
+        printf("\n");
+    }
+
+    DISALLOW_COPY_AND_ASSIGN(MasterServiceBenchmark);
+};
+
+}  // namespace RAMCloud
+
+int
+main()
+{
+    uint32_t numObjects = 1000000;
+    uint32_t objectSize = 100;
+    uint32_t totalOps = 1000000;
+    uint32_t writePercents[] = { 0, 5, 50 };
+    uint32_t maxThreads = std::thread::hardware_concurrency();
+    if (maxThreads == 0)
+        maxThreads = 8;
+
+    foreach (uint32_t writePercent, writePercents) {
+        printf("==========================\n");
+        // A fresh master for every mix, so that the log never fills up.
+        RAMCloud::MasterServiceBenchmark msb("2048", "10%", numObjects,
+                                             objectSize);
+        for (uint32_t numThreads = 1; numThreads <= maxThreads;
+             numThreads *= 2) {
+            msb.run(numThreads, totalOps, writePercent);
+        }
+    }
+
+    return 0;
+}
@@ -78,6 +78,7 @@ class MasterServiceTest : public ::testing::Test {
         tablet.set_start_key_hash(0);
         tablet.set_end_key_hash(~0UL);
         tablet.set_user_data(reinterpret_cast<uint64_t>(new Table(0, 0, ~0UL)));
+        service->indexTablets();
     }
 
     uint32_t
@@ -200,6 +201,81 @@ TEST_F(MasterServiceTest, read_rejectRules) {
     EXPECT_EQ(1U, version);
 }
 
+TEST_F(MasterServiceTest, read_onlyTakesObjectLock) {
+    client->write(0, "0", 1, "abcdef", 6);
+    SpinLock& objectLock = service->objectLock(0, "0", 1);
+    string otherKey;
+    for (uint32_t i = 1; ; i++) {
+        otherKey = format("%u", i);
+        if (&service->objectLock(0, otherKey.c_str(),
+                                 downCast<uint16_t>(otherKey.length())) !=
+            &objectLock)
+            break;
+    }
+
+    // Reads of an object must go ahead while another object is locked.
+    std::lock_guard<SpinLock> lock(service->objectLock(0, otherKey.c_str(),
+        downCast<uint16_t>(otherKey.length())));
+    Buffer value;
+    client->read(0, "0", 1, &value);
+    EXPECT_EQ("abcdef", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, allObjectLocks) {
+    SpinLock& objectLock = service->objectLock(0, "0", 1);
+    {
+        std::lock_guard<MasterService::AllObjectLocks> lock(
+            service->allObjectLocks);
+        EXPECT_FALSE(objectLock.try_lock());
+    }
+    EXPECT_TRUE(objectLock.try_lock());
+    objectLock.unlock();
+}
+
+TEST_F(MasterServiceTest, objectMapResizer) {
+    client->write(0, "0", 1, "item0", 5);
+    client->write(0, "1", 1, "item1", 5);
+    HashTable<LogEntryHandle>& objectMap = service->objectMap;
+    MasterService::ObjectMapResizer& resizer = *service->objectMapResizer;
+    uint64_t numBuckets = objectMap.getNumBuckets();
+    resizer.poll();
+    EXPECT_FALSE(objectMap.isResizing());
+    objectMap.startResize();
+
+    // A bucket isn't moved while its lock is taken.
+    service->objectLocks[0].lock.lock();
+    resizer.poll();
+    EXPECT_EQ(0UL, objectMap.getNextBucketToMigrate());
+    service->objectLocks[0].lock.unlock();
+    resizer.poll();
+    EXPECT_EQ(MasterService::ObjectMapResizer::BUCKETS_PER_POLL,
+              objectMap.getNextBucketToMigrate());
+    while (objectMap.getNextBucketToMigrate() < numBuckets)
+        resizer.poll();
+
+    // Swapping in the new table waits for every lock, without keeping
+    // those it got hold of meanwhile.
+    service->objectLocks[7].lock.lock();
+    resizer.poll();
+    EXPECT_TRUE(objectMap.isResizing());
+    for (uint32_t i = 0; i < 7; i++) {
+        EXPECT_TRUE(service->objectLocks[i].lock.try_lock());
+        service->objectLocks[i].lock.unlock();
+    }
+    service->objectLocks[7].lock.unlock();
+    resizer.poll();
+    EXPECT_FALSE(objectMap.isResizing());
+    EXPECT_TRUE(service->objectLocks[0].lock.try_lock());
+    service->objectLocks[0].lock.unlock();
+    EXPECT_EQ(2 * numBuckets, objectMap.getNumBuckets());
+
+    Buffer value;
+    client->read(0, "0", 1, &value);
+    EXPECT_EQ("item0", TestUtil::toString(&value));
+    client->read(0, "1", 1, &value);
+    EXPECT_EQ("item1", TestUtil::toString(&value));
+}
+
 TEST_F(MasterServiceTest, multiRead_basics) {
     client->write(0, "0", 1, "firstVal", 8);
     client->write(0, "1", 1, "secondVal", 9);
@@ -251,6 +327,229 @@ TEST_F(MasterServiceTest, multiRead_noSuchObject) {
                  statusToSymbol(requestError.status));
 }
 
+TEST_F(MasterServiceTest, multiRead_severalBatches) {
+    // Enough objects to span more than one batch of lookups, with a key
+    // that's asked for twice, one that's missing and one from a table
+    // that isn't here mixed in.
+    const uint32_t numObjects = MasterService::MULTIREAD_BATCH_SIZE + 4;
+    for (uint32_t i = 0; i < numObjects; i++) {
+        string key = format("%u", i);
+        string value = format("value%u", i);
+        client->write(0, key.c_str(), downCast<uint16_t>(key.length()),
+                      value.c_str(), downCast<uint32_t>(value.length()));
+    }
+
+    const uint32_t numRequests = numObjects + 3;
+    string keys[numRequests];
+    uint64_t tableIds[numRequests];
+    for (uint32_t i = 0; i < numObjects; i++) {
+        keys[i] = format("%u", i);
+        tableIds[i] = 0;
+    }
+    keys[numObjects] = "0";
+    tableIds[numObjects] = 0;
+    keys[numObjects + 1] = "missing";
+    tableIds[numObjects + 1] = 0;
+    keys[numObjects + 2] = "0";
+    tableIds[numObjects + 2] = 10;
+
+    std::vector<MasterClient::ReadObject*> requests;
+    Tub<Buffer> values[numRequests];
+    Tub<MasterClient::ReadObject> objects[numRequests];
+    for (uint32_t i = 0; i < numRequests; i++) {
+        objects[i].construct(tableIds[i], keys[i].c_str(),
+                             downCast<uint16_t>(keys[i].length()),
+                             &values[i]);
+        objects[i]->status = STATUS_RETRY;
+        requests.push_back(objects[i].get());
+    }
+
+    client->multiRead(requests);
+
+    for (uint32_t i = 0; i < numObjects; i++) {
+        EXPECT_STREQ("STATUS_OK", statusToSymbol(objects[i]->status));
+        EXPECT_EQ(i + 1, objects[i]->version);
+        EXPECT_EQ(format("value%u", i), TestUtil::toString(values[i].get()));
+    }
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(objects[numObjects]->status));
+    EXPECT_EQ("value0", TestUtil::toString(values[numObjects].get()));
+    EXPECT_STREQ("STATUS_OBJECT_DOESNT_EXIST",
+                 statusToSymbol(objects[numObjects + 1]->status));
+    EXPECT_STREQ("STATUS_UNKNOWN_TABLE",
+                 statusToSymbol(objects[numObjects + 2]->status));
+}
+
+TEST_F(MasterServiceTest, multiRemove) {
+    client->write(0, "0", 1, "firstVal", 8);
+    client->write(0, "1", 1, "secondVal", 9);
+
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.versionNeGiven = true;
+    rules.givenVersion = 1;
+    std::vector<MasterClient::RemoveObject*> requests;
+    MasterClient::RemoveObject request1(0, "0", 1);
+    requests.push_back(&request1);
+    MasterClient::RemoveObject request2(0, "1", 1, &rules);
+    requests.push_back(&request2);
+    MasterClient::RemoveObject request3(0, "2", 1);
+    requests.push_back(&request3);
+    MasterClient::RemoveObject request4(10, "0", 1);
+    requests.push_back(&request4);
+
+    client->multiRemove(requests);
+
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request1.status));
+    EXPECT_EQ(1U, request1.version);
+    EXPECT_STREQ("STATUS_WRONG_VERSION", statusToSymbol(request2.status));
+    EXPECT_EQ(2U, request2.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request3.status));
+    EXPECT_EQ(VERSION_NONEXISTENT, request3.version);
+    EXPECT_STREQ("STATUS_UNKNOWN_TABLE", statusToSymbol(request4.status));
+
+    Buffer value;
+    EXPECT_THROW(client->read(0, "0", 1, &value),
+                 ObjectDoesntExistException);
+    client->read(0, "1", 1, &value);
+    EXPECT_EQ("secondVal", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, multiWrite_basics) {
+    client->write(0, "1", 1, "oldVal", 6);
+    client->write(0, "2", 1, "oldVal", 6);
+
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.exists = true;
+    std::vector<MasterClient::WriteObject*> requests;
+    MasterClient::WriteObject request1(0, "0", 1, "firstVal", 8);
+    requests.push_back(&request1);
+    MasterClient::WriteObject request2(0, "1", 1, "secondVal", 9);
+    requests.push_back(&request2);
+    MasterClient::WriteObject request3(0, "2", 1, "thirdVal", 8, &rules);
+    requests.push_back(&request3);
+    MasterClient::WriteObject request4(10, "0", 1, "fourthVal", 9);
+    requests.push_back(&request4);
+
+    client->multiWrite(requests);
+
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request1.status));
+    EXPECT_EQ(3U, request1.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request2.status));
+    EXPECT_EQ(2U, request2.version);
+    EXPECT_STREQ("STATUS_OBJECT_EXISTS", statusToSymbol(request3.status));
+    EXPECT_EQ(2U, request3.version);
+    EXPECT_STREQ("STATUS_UNKNOWN_TABLE", statusToSymbol(request4.status));
+
+    Buffer value;
+    client->read(0, "0", 1, &value);
+    EXPECT_EQ("firstVal", TestUtil::toString(&value));
+    client->read(0, "1", 1, &value);
+    EXPECT_EQ("secondVal", TestUtil::toString(&value));
+    client->read(0, "2", 1, &value);
+    EXPECT_EQ("oldVal", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, multiWrite_severalGroups) {
+    // More objects than fit into one group, with a key that's written
+    // twice early on: the second write must start a new group, and see
+    // the first.
+    const uint32_t numObjects = MasterService::MULTIWRITE_BATCH_SIZE + 10;
+    string keys[numObjects];
+    string values[numObjects];
+    Tub<MasterClient::WriteObject> objects[numObjects + 1];
+    std::vector<MasterClient::WriteObject*> requests;
+    for (uint32_t i = 0; i < numObjects; i++) {
+        keys[i] = format("%u", i);
+        values[i] = format("value%u", i);
+        objects[i].construct(0, keys[i].c_str(),
+                             downCast<uint16_t>(keys[i].length()),
+                             values[i].c_str(),
+                             downCast<uint32_t>(values[i].length()));
+        requests.push_back(objects[i].get());
+        if (i == 2) {
+            objects[numObjects].construct(0, "0", 1, "again", 5);
+            requests.push_back(objects[numObjects].get());
+        }
+    }
+
+    client->multiWrite(requests);
+
+    for (uint32_t i = 0; i < numObjects; i++) {
+        EXPECT_STREQ("STATUS_OK", statusToSymbol(objects[i]->status));
+        Buffer value;
+        client->read(0, keys[i].c_str(),
+                     downCast<uint16_t>(keys[i].length()), &value);
+        if (i > 0)
+            EXPECT_EQ(values[i], TestUtil::toString(&value));
+        else
+            EXPECT_EQ("again", TestUtil::toString(&value));
+    }
+    EXPECT_STREQ("STATUS_OK",
+                 statusToSymbol(objects[numObjects]->status));
+    EXPECT_EQ(objects[0]->version + 1, objects[numObjects]->version);
+}
+
+TEST_F(MasterServiceTest, multiWrite_truncated) {
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    Buffer request;
+    MultiWriteRpc::Request* reqHdr =
+        new(&request, APPEND) MultiWriteRpc::Request;
+    reqHdr->count = 3;
+    reqHdr->async = 0;
+    new(&request, APPEND) MultiWriteRpc::Request::Part(0, 1, 3, rules);
+    Buffer::Chunk::appendToBuffer(&request, "0abc", 4);
+    // The second key is cut short, and the third part is missing.
+    new(&request, APPEND) MultiWriteRpc::Request::Part(0, 4, 3, rules);
+    Buffer::Chunk::appendToBuffer(&request, "ke", 2);
+
+    Buffer reply;
+    MultiWriteRpc::Response* respHdr =
+        new(&reply, APPEND) MultiWriteRpc::Response;
+    Service::Rpc rpc(NULL, request, reply);
+    service->multiWrite(*reqHdr, *respHdr, rpc);
+
+    EXPECT_EQ(3U, respHdr->count);
+    EXPECT_EQ(sizeof(MultiWriteRpc::Response) +
+              3 * sizeof(MultiWriteRpc::Response::Part),
+              reply.getTotalLength());
+    Status expected[] = { STATUS_OK,
+                          STATUS_MESSAGE_TOO_SHORT,
+                          STATUS_MESSAGE_TOO_SHORT };
+    for (uint32_t i = 0; i < 3; i++) {
+        const MultiWriteRpc::Response::Part* part =
+            reply.getOffset<MultiWriteRpc::Response::Part>(downCast<uint32_t>(
+                sizeof(MultiWriteRpc::Response) +
+                i * sizeof(MultiWriteRpc::Response::Part)));
+        EXPECT_STREQ(statusToSymbol(expected[i]),
+                     statusToSymbol(part->status));
+    }
+
+    Buffer value;
+    client->read(0, "0", 1, &value);
+    EXPECT_EQ("abc", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, fitsInUpdateGroup) {
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    vector<MasterService::PendingUpdate> updates;
+    EXPECT_TRUE(service->fitsInUpdateGroup(updates, 0, "0", 1, ~0U >> 1));
+
+    updates.push_back(MasterService::PendingUpdate(0, "0", 1, 10, rules));
+    EXPECT_FALSE(service->fitsInUpdateGroup(updates, 0, "0", 1, 10));
+    EXPECT_TRUE(service->fitsInUpdateGroup(updates, 1, "0", 1, 10));
+    EXPECT_TRUE(service->fitsInUpdateGroup(updates, 0, "00", 2, 10));
+    EXPECT_FALSE(service->fitsInUpdateGroup(
+        updates, 0, "1", 1, service->log.getSegmentCapacity() / 4));
+
+    while (updates.size() < MasterService::MULTIWRITE_BATCH_SIZE) {
+        updates.push_back(MasterService::PendingUpdate(1, "0", 1, 0, rules));
+    }
+    EXPECT_FALSE(service->fitsInUpdateGroup(updates, 0, "1", 1, 0));
+}
+
 TEST_F(MasterServiceTest, detectSegmentRecoveryFailure_success) {
     typedef MasterService::Replica::State State;
     vector<MasterService::Replica> replicas {
@@ -710,6 +1009,94 @@ TEST_F(MasterServiceTest, recoverSegment) {
     free(seg);
 }
 
+TEST_F(MasterServiceTest, recoverSegment_parallel) {
+    masterConfig.localLocator = "mock:host=master2";
+    masterConfig.master.numReplayThreads = 4;
+    MasterService* master2 = cluster.addServer(masterConfig)->master.get();
+    ProtoBuf::Tablets_Tablet& tablet(*master2->tablets.add_tablet());
+    tablet.set_table_id(0);
+    tablet.set_start_key_hash(0);
+    tablet.set_end_key_hash(~0UL);
+    Table* table = new Table(0, 0, ~0UL);
+    tablet.set_user_data(reinterpret_cast<uint64_t>(table));
+    master2->indexTablets();
+
+    // Every key gets version 1 and then version 2; every third key is
+    // removed again. Keys spread over all partitions.
+    uint32_t segLen = 64 * 1024;
+    char* seg = static_cast<char*>(Memory::xmemalign(HERE, segLen, segLen));
+    Segment s(0UL, 0, seg, segLen, NULL);
+    const void* last = NULL;
+    for (uint64_t version = 1; version <= 2; version++) {
+        for (int i = 0; i < 200; i++) {
+            string key = format("k%03d", i);
+            DECLARE_OBJECT(o, 4, 0);
+            o->tableId = 0;
+            o->keyLength = 4;
+            o->version = version;
+            memcpy(o->getKeyLocation(), key.c_str(), 4);
+            last = s.append(LOG_ENTRY_TYPE_OBJ, o,
+                            o->objectLength(0))->userData();
+            if (version == 2 && i % 3 == 0) {
+                DECLARE_OBJECTTOMBSTONE(t, 4, 0, o);
+                last = s.append(LOG_ENTRY_TYPE_OBJTOMB, t,
+                                t->tombLength())->userData();
+            }
+        }
+    }
+    s.close(NULL);
+    uint64_t appendsBefore = metrics->master.objectAppendCount;
+    uint64_t tombstonesBefore = metrics->master.tombstoneAppendCount;
+    uint64_t liveBefore = metrics->master.liveObjectCount;
+    master2->recoverSegment(0, seg, downCast<uint32_t>(
+                            static_cast<const char*>(last) - seg));
+    EXPECT_EQ(400U, metrics->master.objectAppendCount - appendsBefore);
+    EXPECT_EQ(67U, metrics->master.tombstoneAppendCount - tombstonesBefore);
+    EXPECT_EQ(133U, metrics->master.liveObjectCount - liveBefore);
+
+    for (int i = 0; i < 200; i++) {
+        string key = format("k%03d", i);
+        LogEntryHandle handle = master2->objectMap.lookup(0, key.c_str(), 4);
+        ASSERT_TRUE(handle != NULL);
+        if (i % 3 == 0) {
+            EXPECT_EQ(LOG_ENTRY_TYPE_OBJTOMB, handle->type());
+            EXPECT_EQ(2U, handle->userData<ObjectTombstone>()->objectVersion);
+        } else {
+            EXPECT_EQ(LOG_ENTRY_TYPE_OBJ, handle->type());
+            EXPECT_EQ(2U, handle->userData<Object>()->version);
+        }
+    }
+    TabletStatistics::Counters counters = table->statistics.collect();
+    EXPECT_EQ(133, counters.liveObjectCount);
+    EXPECT_EQ(1U, table->segmentIds.size());
+    free(seg);
+}
+
+TEST_F(MasterServiceTest, recoverSegment_lockObjects) {
+    uint32_t segLen = 8192;
+    char* seg = static_cast<char*>(Memory::xmemalign(HERE, segLen, segLen));
+    uint32_t len = buildRecoverySegment(seg, segLen, 0, "key0", 4, 1,
+                                        "migrated");
+    Table* table = service->getTable(0, "key0", 4);
+    ASSERT_TRUE(table != NULL);
+    table->segmentIds.clear();
+
+    // Only the object's own lock is taken, and the tablet's segments are
+    // recorded right away since the Table isn't protected afterwards.
+    SpinLock& other = service->objectLocks[
+        (service->objectMap.getBucketIndex(0, "key0", 4) + 1) &
+        (MasterService::NUM_OBJECT_LOCKS - 1)].lock;
+    other.lock();
+    service->recoverSegment(-1, seg, len, true);
+    other.unlock();
+    verifyRecoveryObject(0, "key0", 4, "migrated");
+    EXPECT_TRUE(service->objectLock(0, "key0", 4).try_lock());
+    service->objectLock(0, "key0", 4).unlock();
+    EXPECT_EQ(1U, table->segmentIds.count(
+              service->log.headOfLog().segmentId()));
+    free(seg);
+}
+
 TEST_F(MasterServiceTest, remove_basics) {
     client->write(0, "key0", 4, "item0", 5);
 
@@ -760,7 +1147,7 @@ TEST_F(MasterServiceTest, remove_objectAlreadyDeleted) {
     EXPECT_EQ(VERSION_NONEXISTENT, version);
 }
 
-TEST_F(MasterServiceTest, incrementReadAndWriteStatistics) {
+TEST_F(MasterServiceTest, readAndWriteStatistics) {
     Buffer value;
     uint64_t version;
     int64_t objectValue = 16;
@@ -782,40 +1169,97 @@ TEST_F(MasterServiceTest, incrementReadAndWriteStatistics) {
     requests.push_back(&request2);
 
     client->multiRead(requests);
+    client->remove(0, "key1", 4);
 
     Table* table = reinterpret_cast<Table*>(
                                     service->tablets.tablet(0).user_data());
-    EXPECT_EQ((uint64_t)7, table->statEntry.number_read_and_writes());
+    TabletStatistics::Counters counters = table->statistics.collect();
+    EXPECT_EQ(4, counters.readCount);
+    EXPECT_EQ(32, counters.readBytes);
+    EXPECT_EQ(4, counters.writeCount);
+    EXPECT_EQ(24, counters.writeBytes);
+    EXPECT_EQ(1, counters.liveObjectCount);
+    EXPECT_EQ(8, counters.liveObjectBytes);
 }
 
+TEST_F(MasterServiceTest, readAndWriteStatistics_notCountedByCleaner) {
+    client->write(0, "key0", 4, "item0", 5);
+    LogEntryHandle handle = service->objectMap.lookup(0, "key0", 4);
+    ASSERT_TRUE(handle != NULL);
+    objectLivenessCallback(handle, service);
+
+    Table* table = reinterpret_cast<Table*>(
+                                    service->tablets.tablet(0).user_data());
+    EXPECT_EQ(0, table->statistics.collect().readCount);
+    EXPECT_EQ(1, table->statistics.collect().writeCount);
+}
 
 TEST_F(MasterServiceTest, GetServerStatistics) {
     Buffer value;
     uint64_t version;
     int64_t objectValue = 16;
 
+    Table* table = reinterpret_cast<Table*>(
+                                    service->tablets.tablet(0).user_data());
+    table->statistics.lastSampleTime = 1000;
     client->write(0, "key0", 4, &objectValue, 8, NULL, &version);
     client->read(0, "key0", 4, &value);
     client->read(0, "key0", 4, &value);
     client->read(0, "key0", 4, &value);
+    Cycles::mockTscValue = 1000 + Cycles::fromSeconds(1.0);
 
     ProtoBuf::ServerStatistics serverStats;
     client->getServerStatistics(serverStats);
-    EXPECT_EQ("tabletentry { table_id: 0 start_key_hash: 0 "
-              "end_key_hash: 18446744073709551615 number_read_and_writes: 4 }",
-              serverStats.ShortDebugString());
+    Cycles::mockTscValue = 0;
+    ASSERT_EQ(1, serverStats.tabletentry_size());
+    const ProtoBuf::ServerStatistics::TabletEntry& entry(
+        serverStats.tabletentry(0));
+    EXPECT_EQ(0U, entry.table_id());
+    EXPECT_EQ(0U, entry.start_key_hash());
+    EXPECT_EQ(~0UL, entry.end_key_hash());
+    EXPECT_EQ(4U, entry.number_read_and_writes());
+    EXPECT_EQ(3U, entry.read_count());
+    EXPECT_EQ(1U, entry.write_count());
+    EXPECT_EQ(24U, entry.read_bytes());
+    EXPECT_EQ(8U, entry.write_bytes());
+    EXPECT_EQ(1U, entry.live_object_count());
+    EXPECT_EQ(8U, entry.live_object_bytes());
+    ASSERT_EQ(3, entry.rate_size());
+    EXPECT_EQ(1000U, entry.rate(0).window_ms());
+    EXPECT_EQ(10000U, entry.rate(1).window_ms());
+    EXPECT_EQ(60000U, entry.rate(2).window_ms());
+    // One second into a one second window: 1 - 1/e of the true rate.
+    EXPECT_NEAR(3 * (1 - exp(-1.0)), entry.rate(0).reads_per_second(), 1e-6);
+    EXPECT_NEAR(1 - exp(-1.0), entry.rate(0).writes_per_second(), 1e-6);
+    EXPECT_NEAR(24 * (1 - exp(-1.0)), entry.rate(0).read_bytes_per_second(),
+                1e-6);
+    EXPECT_NEAR(8 * (1 - exp(-1.0)), entry.rate(0).write_bytes_per_second(),
+                1e-6);
+    EXPECT_NEAR(3 * (1 - exp(-0.1)), entry.rate(1).reads_per_second(), 1e-6);
+    ASSERT_EQ(16, entry.bucket_size());
+    uint64_t keyHash = getKeyHash("key0", 4);
+    uint64_t accesses = 0;
+    foreach (const ProtoBuf::ServerStatistics::TabletEntry::Bucket& bucket,
+             entry.bucket()) {
+        accesses += bucket.accesses();
+        if (keyHash >> 60 == bucket.start_key_hash() >> 60) {
+            EXPECT_EQ(4U, bucket.accesses());
+            EXPECT_EQ(8U, bucket.live_bytes());
+        }
+    }
+    EXPECT_EQ(4U, accesses);
 
     client->splitMasterTablet(0, 0, ~0UL, (~0UL/2));
     client->getServerStatistics(serverStats);
-    EXPECT_EQ("tabletentry { table_id: 0 "
-              "start_key_hash: 0 "
-              "end_key_hash: 9223372036854775806 } "
-              "tabletentry { table_id: 0 start_key_hash: 9223372036854775807 "
-              "end_key_hash: 18446744073709551615 }",
-              serverStats.ShortDebugString());
+    ASSERT_EQ(2, serverStats.tabletentry_size());
+    EXPECT_EQ(9223372036854775806UL,
+              serverStats.tabletentry(0).end_key_hash());
+    EXPECT_EQ(9223372036854775807UL,
+              serverStats.tabletentry(1).start_key_hash());
+    EXPECT_EQ(4U, serverStats.tabletentry(0).number_read_and_writes() +
+                  serverStats.tabletentry(1).number_read_and_writes());
 }
 
-
 TEST_F(MasterServiceTest, splitMasterTablet) {
 
     client->splitMasterTablet(0, 0, ~0UL, (~0UL/2));
@@ -880,6 +1324,7 @@ TEST_F(MasterServiceTest, takeTabletOwnership_newTablet) {
         t2.set_end_key_hash(1);
         t2.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
         t2.set_user_data(reinterpret_cast<uint64_t>(table2.release()));
+        service->indexTablets();
 
         EXPECT_EQ(format(
             "tablet { table_id: 1 start_key_hash: 0 end_key_hash: 1 "
@@ -955,6 +1400,7 @@ TEST_F(MasterServiceTest, takeTabletOwnership_migratingTablet) {
     tab.set_end_key_hash(5);
     tab.set_state(ProtoBuf::Tablets_Tablet_State_RECOVERING);
     tab.set_user_data(reinterpret_cast<uint64_t>(new Table(1 , 0 , 5)));
+    service->indexTablets();
 
     client->takeTabletOwnership(1, 0, 5);
 
@@ -977,6 +1423,7 @@ TEST_F(MasterServiceTest, prepForMigration) {
     tablet.set_start_key_hash(27);
     tablet.set_end_key_hash(873);
     tablet.set_user_data(reinterpret_cast<uint64_t>(new Table(0 , 27 , 873)));
+    service->indexTablets();
 
     TestLog::Enable _(prepForMigrationFilter);
 
@@ -1014,6 +1461,7 @@ TEST_F(MasterServiceTest, migrateTablet_simple) {
     tablet.set_start_key_hash(27);
     tablet.set_end_key_hash(873);
     tablet.set_user_data(reinterpret_cast<uint64_t>(new Table(0 , 27 , 873)));
+    service->indexTablets();
 
     TestLog::Enable _(migrateTabletFilter);
 
@@ -1048,11 +1496,158 @@ TEST_F(MasterServiceTest, migrateTablet_movingData) {
     TestLog::Enable _(migrateTabletFilter);
 
     client->migrateTablet(tbl, 0, -1, master2->serverId);
-    EXPECT_EQ("migrateTablet: Migrating tablet (id 0, first 0, last "
-        "18446744073709551615) to ServerId 3 (\"mock:host=master2\") "
-        "| migrateTablet: Sending last migration segment | "
+    EXPECT_TRUE(TestUtil::matchesPosixRegex("^migrateTablet: Migrating "
+        "tablet \\(id 0, first 0, last 18446744073709551615\\) to "
+        "ServerId 3 \\(\"mock:host=master2\"\\) \\| "
+        "migrateTablet: Migration round 0 sent 41 bytes \\| "
         "migrateTablet: Tablet migration succeeded. Sent 1 objects "
-        "and 0 tombstones. 41 bytes in total.", TestLog::get());
+        "and 0 tombstones. 41 bytes in total. Writes were held up for "
+        "[0-9.]+ ms.$", TestLog::get()));
+    EXPECT_TRUE(service->outgoingMigration == NULL);
+
+    Buffer value;
+    cluster.get<MasterClient>(master2)->read(tbl, "hi", 2, &value);
+    EXPECT_EQ("abcdefg", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, migrateTablet_alreadyMigrating) {
+    Tub<MasterService::OutgoingMigration> migration;
+    migration.construct(*service, 5, 0, 10, backup1Id, 0);
+    EXPECT_THROW(client->migrateTablet(0, 0, -1, backup1Id),
+                 RetryException);
+}
+
+TEST_F(MasterServiceTest, migrateLogRange_catchUp) {
+    coordinator->createTable("migrationTable");
+    uint64_t tbl = coordinator->getTableId("migrationTable");
+    client->write(tbl, "a", 1, "first", 5);
+    client->write(tbl, "b", 1, "first", 5);
+
+    ServerConfig master2Config = masterConfig;
+    master2Config.master.numReplicas = 0;
+    master2Config.localLocator = "mock:host=master2";
+    Server* master2 = cluster.addServer(master2Config);
+    auto recipient = cluster.get<MasterClient>(master2);
+    recipient->prepForMigration(tbl, 0, ~0UL, 0, 0);
+
+    Tub<MasterService::OutgoingMigration> migration;
+    migration.construct(*service, tbl, 0, ~0UL, master2->serverId, 0);
+    LogPosition start = service->log.headOfLog();
+    EXPECT_EQ(STATUS_OK, service->migrateLogRange(*migration, LogPosition(),
+                                                  start));
+    EXPECT_EQ(2U, migration->totalObjects);
+
+    // Only what changed since then is sent in the next round.
+    client->write(tbl, "a", 1, "second", 6);
+    client->remove(tbl, "b", 1);
+    client->write(tbl, "c", 1, "first", 5);
+    LogPosition end = service->log.headOfLog();
+    EXPECT_EQ(STATUS_OK, service->migrateLogRange(*migration, start, end));
+    EXPECT_EQ(4U, migration->totalObjects);
+    EXPECT_EQ(1U, migration->totalTombstones);
+
+    // Nothing new: nothing to send.
+    EXPECT_EQ(STATUS_OK, service->migrateLogRange(*migration, end, end));
+    EXPECT_EQ(4U, migration->totalObjects);
+
+    MasterService* newOwner = master2->master.get();
+    LogEntryHandle handle = newOwner->objectMap.lookup(tbl, "a", 1);
+    ASSERT_TRUE(handle != NULL);
+    EXPECT_EQ(LOG_ENTRY_TYPE_OBJ, handle->type());
+    EXPECT_EQ(6U, handle->userData<Object>()->dataLength(handle->length()));
+    handle = newOwner->objectMap.lookup(tbl, "b", 1);
+    ASSERT_TRUE(handle != NULL);
+    EXPECT_EQ(LOG_ENTRY_TYPE_OBJTOMB, handle->type());
+    EXPECT_TRUE(newOwner->objectMap.lookup(tbl, "c", 1) != NULL);
+}
+
+TEST_F(MasterServiceTest, sendMigrationSegment_pipelined) {
+    coordinator->createTable("migrationTable");
+    uint64_t tbl = coordinator->getTableId("migrationTable");
+
+    ServerConfig master2Config = masterConfig;
+    master2Config.master.numReplicas = 0;
+    master2Config.localLocator = "mock:host=master2";
+    Server* master2 = cluster.addServer(master2Config);
+    auto recipient = cluster.get<MasterClient>(master2);
+    recipient->prepForMigration(tbl, 0, ~0UL, 0, 0);
+
+    Tub<MasterService::OutgoingMigration> migration;
+    migration.construct(*service, tbl, 0, ~0UL, master2->serverId, 0);
+    uint64_t segmentsBefore = metrics->master.migrationSegmentCount;
+    LogPosition start;
+    for (uint32_t i = 0; i <= MasterService::MIGRATION_PIPELINE_DEPTH; i++) {
+        string key = format("key%u", i);
+        client->write(tbl, key.c_str(), downCast<uint16_t>(key.length()),
+                      "value", 5);
+        LogPosition end = service->log.headOfLog();
+        EXPECT_EQ(STATUS_OK, service->migrateLogRange(*migration, start, end));
+        start = end;
+    }
+
+    // One segment per round. A segment is only waited for once it is
+    // needed again, so all but the one to be filled next are in flight.
+    EXPECT_EQ(MasterService::MIGRATION_PIPELINE_DEPTH + 1,
+              metrics->master.migrationSegmentCount - segmentsBefore);
+    EXPECT_EQ(1U, migration->current);
+    EXPECT_TRUE(migration->transfers[0].rpc);
+    EXPECT_FALSE(migration->transfers[1].rpc);
+    EXPECT_TRUE(migration->transfers[2].rpc);
+    EXPECT_TRUE(migration->transfers[3].rpc);
+
+    service->drainMigrationSegments(*migration);
+    foreach (MasterService::OutgoingMigration::Transfer& transfer,
+             migration->transfers) {
+        EXPECT_FALSE(transfer.rpc);
+        EXPECT_FALSE(transfer.segment);
+    }
+    EXPECT_TRUE(master2->master->objectMap.lookup(tbl, "key4", 4) != NULL);
+}
+
+TEST_F(MasterServiceTest, sendMigrationSegment_throttled) {
+    coordinator->createTable("migrationTable");
+    uint64_t tbl = coordinator->getTableId("migrationTable");
+
+    ServerConfig master2Config = masterConfig;
+    master2Config.master.numReplicas = 0;
+    master2Config.localLocator = "mock:host=master2";
+    Server* master2 = cluster.addServer(master2Config);
+    auto recipient = cluster.get<MasterClient>(master2);
+    recipient->prepForMigration(tbl, 0, ~0UL, 0, 0);
+
+    Tub<MasterService::OutgoingMigration> migration;
+    migration.construct(*service, tbl, 0, ~0UL, master2->serverId,
+                        1000 * 1000 * 1000);
+    EXPECT_EQ(1000U * 1000 * 1000, migration->throttle.getRate());
+    double tokensBefore = migration->throttle.tokens;
+    client->write(tbl, "key0", 4, "value", 5);
+    EXPECT_EQ(STATUS_OK, service->migrateLogRange(*migration, LogPosition(),
+                                                  service->log.headOfLog()));
+    EXPECT_LT(migration->throttle.tokens, tokensBefore);
+    service->drainMigrationSegments(*migration);
+    EXPECT_TRUE(master2->master->objectMap.lookup(tbl, "key0", 4) != NULL);
+}
+
+TEST_F(MasterServiceTest, migrateTablet_writesFrozen) {
+    uint64_t version;
+    client->write(0, "key0", 4, "item0", 5, NULL, &version);
+
+    Tub<MasterService::OutgoingMigration> migration;
+    migration.construct(*service, 0, 0, ~0UL, backup1Id, 0);
+    client->write(0, "key0", 4, "item1", 5, NULL, &version);
+
+    migration->writesFrozen = true;
+    EXPECT_THROW(client->write(0, "key0", 4, "item2", 5, NULL, &version),
+                 RetryException);
+    EXPECT_THROW(client->remove(0, "key0", 4), RetryException);
+    EXPECT_THROW(client->splitMasterTablet(0, 0, ~0UL, 1000),
+                 RetryException);
+    Buffer value;
+    client->read(0, "key0", 4, &value);
+    EXPECT_EQ("item1", TestUtil::toString(&value));
+
+    migration.destroy();
+    client->write(0, "key0", 4, "item2", 5, NULL, &version);
 }
 
 static bool
@@ -1123,6 +1718,31 @@ TEST_F(MasterServiceTest, write_rejectRules) {
     EXPECT_EQ(VERSION_NONEXISTENT, version);
 }
 
+TEST_F(MasterServiceTest, storeData_keyAndDataFromChunks) {
+    // The key and value are split over chunks, none of them lining up with
+    // where the key ends.
+    Buffer keyAndData;
+    Buffer::Chunk::appendToBuffer(&keyAndData, "xxke", 4);
+    Buffer::Chunk::appendToBuffer(&keyAndData, "y0it", 4);
+    Buffer::Chunk::appendToBuffer(&keyAndData, "em0", 3);
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    uint64_t version;
+    EXPECT_EQ(STATUS_OK, service->storeData(0, &rules, &keyAndData, 2, 4, 5,
+                                            &version, false));
+    Buffer value;
+    client->read(0, "key0", 4, &value);
+    EXPECT_EQ("item0", TestUtil::toString(&value));
+
+    LogEntryHandle handle = service->objectMap.lookup(0, "key0", 4);
+    ASSERT_TRUE(handle != NULL);
+    EXPECT_TRUE(handle->isChecksumValid());
+
+    EXPECT_EQ(STATUS_MESSAGE_TOO_SHORT,
+              service->storeData(0, &rules, &keyAndData, 2, 4, 6,
+                                 &version, false));
+}
+
 TEST_F(MasterServiceTest, increment) {
     Buffer buffer;
     uint64_t version;
@@ -1223,6 +1843,64 @@ TEST_F(MasterServiceTest, getTable) {
     EXPECT_TRUE(service->getTable(1000, "0", 1) == NULL);
 }
 
+TEST_F(MasterServiceTest, getTableForHash_index) {
+    Table* tables[3];
+    uint64_t ranges[3][2] = { { 30, 39 }, { 0, 9 }, { 10, 19 } };
+    for (int i = 0; i < 3; i++) {
+        ProtoBuf::Tablets_Tablet& tablet(*service->tablets.add_tablet());
+        tablet.set_table_id(5);
+        tablet.set_start_key_hash(ranges[i][0]);
+        tablet.set_end_key_hash(ranges[i][1]);
+        tables[i] = new Table(5, ranges[i][0], ranges[i][1]);
+        tablet.set_user_data(reinterpret_cast<uint64_t>(tables[i]));
+    }
+    service->indexTablets();
+
+    EXPECT_EQ(tables[1], service->getTableForHash(5, 0));
+    EXPECT_EQ(tables[1], service->getTableForHash(5, 9));
+    EXPECT_EQ(tables[2], service->getTableForHash(5, 10));
+    EXPECT_EQ(tables[2], service->getTableForHash(5, 19));
+    EXPECT_TRUE(service->getTableForHash(5, 20) == NULL);
+    EXPECT_EQ(tables[0], service->getTableForHash(5, 35));
+    EXPECT_TRUE(service->getTableForHash(5, 40) == NULL);
+    EXPECT_TRUE(service->getTableForHash(4, 5) == NULL);
+    EXPECT_TRUE(service->getTableForHash(6, 5) == NULL);
+    EXPECT_EQ(&service->tablets.tablet(1),
+              service->getTabletForHash(5, 30));
+
+    // Table 0 from the fixture sorts first and covers every key.
+    EXPECT_TRUE(service->getTableForHash(0, ~0UL) != NULL);
+}
+
+TEST_F(MasterServiceTest, noteAppend) {
+    client->write(0, "key0", 4, "item0", 5);
+    Table* table = service->getTable(0, "key0", 4);
+    ASSERT_TRUE(table != NULL);
+    uint64_t head = service->log.headOfLog().segmentId();
+    EXPECT_EQ(1U, table->segmentIds.size());
+    EXPECT_EQ(1U, table->segmentIds.count(head));
+
+    // Both halves of a split tablet may have entries in the same segments.
+    client->splitMasterTablet(0, 0, ~0UL, 1UL << 63);
+    Table* lower = service->getTableForHash(0, 0);
+    Table* upper = service->getTableForHash(0, ~0UL);
+    ASSERT_TRUE(lower != NULL && upper != NULL && lower != upper);
+    EXPECT_EQ(1U, lower->segmentIds.count(head));
+    EXPECT_EQ(1U, upper->segmentIds.count(head));
+
+    // Once there are too many, the IDs of freed segments are dropped.
+    table = service->getTable(0, "key0", 4);
+    table->segmentIds.clear();
+    table->segmentIds.insert(head + 1000);
+    table->segmentIds.insert(head + 1001);
+    table->lastSegmentId = ~0UL;
+    table->segmentIdsPruneSize = 2;
+    client->write(0, "key0", 4, "item1", 5);
+    EXPECT_EQ(1U, table->segmentIds.size());
+    EXPECT_EQ(1U, table->segmentIds.count(head));
+    EXPECT_EQ(64U, table->segmentIdsPruneSize);
+}
+
 TEST_F(MasterServiceTest, rejectOperation) {
     RejectRules empty, rules;
     memset(&empty, 0, sizeof(empty));
@@ -29,7 +29,7 @@ class MockService : public Service {
 
     explicit MockService(int threadLimit = 3) : mutex(), log(),
             gate(0), sendReply(false),
-            threadLimit(threadLimit) { }
+            threadLimit(threadLimit), backgroundOpcode(-1) { }
     virtual ~MockService() {}
     virtual void dispatch(RpcOpcode opcode, Rpc& rpc)
     {
@@ -74,6 +74,9 @@ class MockService : public Service {
     virtual int maxThreads() {
         return threadLimit;
     }
+    virtual bool isBackground(RpcOpcode opcode) {
+        return opcode == backgroundOpcode;
+    }
 
     /// Used to serialize access to #log.
     std::mutex mutex;
@@ -94,6 +97,9 @@ class MockService : public Service {
     /// Return value from maxThreads.
     int threadLimit;
 
+    /// Requests with this opcode are background requests.
+    int backgroundOpcode;
+
     DISALLOW_COPY_AND_ASSIGN(MockService);
 };
 
@@ -19,6 +19,7 @@
 #include "KeyUtil.h"
 
 
+#include <algorithm>
 #include <iostream>
 
 namespace RAMCloud {
@@ -51,6 +52,7 @@ class RealTabletMapFetcher : public ObjectFinder::TabletMapFetcher {
  */
 ObjectFinder::ObjectFinder(CoordinatorClient& coordinator)
     : tabletMap()
+    , tabletIndex()
     , tabletMapFetcher(new RealTabletMapFetcher(coordinator))
 {
 }
@@ -84,30 +86,82 @@ ObjectFinder::lookup(uint64_t table, const char* key, uint16_t keyLength) {
     */
     bool haveRefreshed = false;
     while (true) {
-        foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
-            if (tablet.table_id() == table &&
-                tablet.start_key_hash() <= keyHash &&
-                keyHash <= tablet.end_key_hash()) {
-                if (tablet.state() == ProtoBuf::Tablets_Tablet_State_NORMAL) {
-                    // TODO(ongaro): add cache
-                    return Context::get().transportManager->getSession(
-                            tablet.service_locator().c_str());
-                } else {
-                    // tablet is recovering or something, try again
-                    if (haveRefreshed)
-                        usleep(10000);
-                    goto refresh_and_retry;
-                }
+        IndexedTablet* entry = findTablet(table, keyHash);
+        if (entry != NULL) {
+            if (entry->tablet->state() ==
+                    ProtoBuf::Tablets_Tablet_State_NORMAL) {
+                return getSession(*entry);
             }
-        }
-        // tablet not found in local tablet map cache
-        if (haveRefreshed) {
+            // tablet is recovering or something, try again
+            if (haveRefreshed)
+                usleep(10000);
+        } else if (haveRefreshed) {
+            // tablet not found in local tablet map cache
             throw TableDoesntExistException(HERE);
         }
-        refresh_and_retry:
-            tabletMapFetcher->getTabletMap(tabletMap);
-            haveRefreshed = true;
+        refresh();
+        haveRefreshed = true;
+    }
+}
+
+/**
+ * Fetch a fresh copy of the coordinator's tablet map and rebuild
+ * #tabletIndex from it. Sessions are opened again on demand.
+ */
+void
+ObjectFinder::refresh()
+{
+    tabletIndex.clear();
+    tabletMapFetcher->getTabletMap(tabletMap);
+    tabletIndex.reserve(tabletMap.tablet_size());
+    foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
+        tabletIndex.push_back(IndexedTablet(tablet.table_id(),
+                                            tablet.start_key_hash(),
+                                            tablet.end_key_hash(),
+                                            &tablet));
+    }
+    std::sort(tabletIndex.begin(), tabletIndex.end());
+}
+
+/**
+ * Find the tablet in the local tablet map cache that covers a key hash.
+ *
+ * \param table
+ *      The table containing the desired object.
+ * \param keyHash
+ *      Hash of the object's key.
+ * \return
+ *      The entry of #tabletIndex for the tablet, or NULL if the cache has
+ *      no such tablet.
+ */
+ObjectFinder::IndexedTablet*
+ObjectFinder::findTablet(uint64_t table, HashType keyHash)
+{
+    // Find the first tablet starting after keyHash; the one before it is
+    // the only candidate.
+    IndexedTablet key(table, keyHash, keyHash, NULL);
+    std::vector<IndexedTablet>::iterator it =
+        std::upper_bound(tabletIndex.begin(), tabletIndex.end(), key);
+    if (it == tabletIndex.begin())
+        return NULL;
+    --it;
+    if (it->tableId != table || keyHash > it->endKeyHash)
+        return NULL;
+    return &*it;
+}
+
+/**
+ * Return a session to the master of an entry of #tabletIndex, opening it
+ * if this is the first time the entry is used since the last #refresh.
+ */
+Transport::SessionRef
+ObjectFinder::getSession(IndexedTablet& entry)
+{
+    if (!entry.session) {
+        entry.session = Context::get().transportManager->getSession(
+                entry.tablet->service_locator().c_str());
     }
+    return entry.session;
 }
 
 Transport::SessionRef
@@ -118,20 +172,23 @@ ObjectFinder::getSessionRef(std::string serverConnectionString) {
 
 
 /**
- * Lookup the masters for multiple keys across tables.
+ * Bin the objects of a multi-object operation by the master that owns them.
+ * The status of objects whose table doesn't exist is set to
+ * STATUS_TABLE_DOESNT_EXIST, and they are left out.
+ * \tparam Bin
+ *      MasterRequests or one of its kin, for \a Request.
  * \param requests
- *      Array listing the objects to be read/written
+ *      Array listing the objects to be read/written/removed
  * \param numRequests
  *      Length of requests array
  * \return requestBins
  *      Bins requests according to the master they correspond to.
  */
-
-std::vector<ObjectFinder::MasterRequests>
-ObjectFinder::multiLookup(MasterClient::ReadObject* requests[],
-                          uint32_t numRequests) {
-
-    std::vector<ObjectFinder::MasterRequests> requestBins;
+template<typename Bin, typename Request>
+std::vector<Bin>
+ObjectFinder::binRequests(Request* requests[], uint32_t numRequests)
+{
+    std::vector<Bin> requestBins;
     for (uint32_t i = 0; i < numRequests; i++){
         try {
             Transport::SessionRef currentSessionRef =
@@ -150,7 +207,7 @@ ObjectFinder::multiLookup(MasterClient::ReadObject* requests[],
             }
             // else create a new requestBin corresponding to this master
             if (!masterFound) {
-                requestBins.push_back(ObjectFinder::MasterRequests());
+                requestBins.push_back(Bin());
                 requestBins.back().sessionRef = currentSessionRef;
                 requestBins.back().requests.push_back(requests[i]);
             }
@@ -163,6 +220,54 @@ ObjectFinder::multiLookup(MasterClient::ReadObject* requests[],
     return requestBins;
 }
 
+/**
+ * Lookup the masters for multiple keys across tables.
+ * \param requests
+ *      Array listing the objects to be read
+ * \param numRequests
+ *      Length of requests array
+ * \return requestBins
+ *      Bins requests according to the master they correspond to.
+ */
+std::vector<ObjectFinder::MasterRequests>
+ObjectFinder::multiLookup(MasterClient::ReadObject* requests[],
+                          uint32_t numRequests)
+{
+    return binRequests<MasterRequests>(requests, numRequests);
+}
+
+/**
+ * Lookup the masters for multiple keys across tables.
+ * \param requests
+ *      Array listing the objects to be written
+ * \param numRequests
+ *      Length of requests array
+ * \return requestBins
+ *      Bins requests according to the master they correspond to.
+ */
+std::vector<ObjectFinder::MasterWriteRequests>
+ObjectFinder::multiLookup(MasterClient::WriteObject* requests[],
+                          uint32_t numRequests)
+{
+    return binRequests<MasterWriteRequests>(requests, numRequests);
+}
+
+/**
+ * Lookup the masters for multiple keys across tables.
+ * \param requests
+ *      Array listing the objects to be removed
+ * \param numRequests
+ *      Length of requests array
+ * \return requestBins
+ *      Bins requests according to the master they correspond to.
+ */
+std::vector<ObjectFinder::MasterRemoveRequests>
+ObjectFinder::multiLookup(MasterClient::RemoveObject* requests[],
+                          uint32_t numRequests)
+{
+    return binRequests<MasterRemoveRequests>(requests, numRequests);
+}
+
 std::set<Transport::SessionRef>
 ObjectFinder::tableLookup(uint64_t table)
 {
@@ -170,16 +275,15 @@ ObjectFinder::tableLookup(uint64_t table)
 
     if (sessionRefBins.size() == 0) {
                     // tablet is recovering or something, try again
-                    tabletMapFetcher->getTabletMap(tabletMap);
+                    refresh();
     }
 
 
-    foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
-        if (tablet.table_id() == table) {
-            if (tablet.state() == ProtoBuf::Tablets_Tablet_State_NORMAL) {
-                // TODO(ongaro): add cache
-                sessionRefBins.insert(Context::get().transportManager->getSession(
-                                                                tablet.service_locator().c_str()));
+    foreach (IndexedTablet& entry, tabletIndex) {
+        if (entry.tableId == table) {
+            if (entry.tablet->state() ==
+                    ProtoBuf::Tablets_Tablet_State_NORMAL) {
+                sessionRefBins.insert(getSession(entry));
             }
         }
 
@@ -195,22 +299,18 @@ ObjectFinder::serverLookupWithTabletRange(uint64_t table, uint64_t startKey, uin
 
     if (sessionRefBins.size() == 0) {
                     // tablet is recovering or something, try again
-                    tabletMapFetcher->getTabletMap(tabletMap);
+                    refresh();
     }
 
-    Transport::SessionRef session; 
+    Transport::SessionRef session;
 
 
-    foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
-        if (tablet.table_id() == table) {
-            if (tablet.state() == ProtoBuf::Tablets_Tablet_State_NORMAL &&
-                tablet.start_key_hash() == startKey &&
-                tablet.end_key_hash() == endKey) {
-                // TODO(ongaro): add cache
-                session = Context::get().transportManager->getSession(tablet.service_locator().c_str());
-            }
-        }
-
+    IndexedTablet* entry = findTablet(table, startKey);
+    if (entry != NULL &&
+        entry->tablet->state() == ProtoBuf::Tablets_Tablet_State_NORMAL &&
+        entry->startKeyHash == startKey &&
+        entry->endKeyHash == endKey) {
+        session = getSession(*entry);
     }
 
     return session;
@@ -234,7 +334,7 @@ ObjectFinder::resolveTableDistribution(uint64_t tableId, uint64_t maxKey)
     }
 
     // Iterate over tablets, check for each tablet which keys are included
-    tabletMapFetcher->getTabletMap(tabletMap);
+    refresh();
 
     foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
         if (tablet.table_id() == tableId) {
@@ -304,7 +404,7 @@ ObjectFinder::waitForTabletDown()
             }
         }
         usleep(200);
-        tabletMapFetcher->getTabletMap(tabletMap);
+        refresh();
     }
 }
 
@@ -331,7 +431,7 @@ ObjectFinder::waitForAllTabletsNormal()
         if (allNormal && tabletMap.tablet_size() > 0)
             return;
         usleep(200);
-        tabletMapFetcher->getTabletMap(tabletMap);
+        refresh();
     }
 }
 
@@ -19,6 +19,7 @@
 #include <boost/function.hpp>
 
 #include "Common.h"
+#include "KeyHash.h"
 #include "CoordinatorClient.h"
 #include "Transport.h"
 #include "MasterClient.h"
@@ -44,6 +45,24 @@ class ObjectFinder {
         std::vector<MasterClient::ReadObject*> requests;
     };
 
+    /**
+     * Like #MasterRequests, for a multiWrite.
+     */
+    struct MasterWriteRequests {
+        MasterWriteRequests() : sessionRef(), requests() {}
+        Transport::SessionRef sessionRef;
+        std::vector<MasterClient::WriteObject*> requests;
+    };
+
+    /**
+     * Like #MasterRequests, for a multiRemove.
+     */
+    struct MasterRemoveRequests {
+        MasterRemoveRequests() : sessionRef(), requests() {}
+        Transport::SessionRef sessionRef;
+        std::vector<MasterClient::RemoveObject*> requests;
+    };
+
     struct KeysAtServer {
         KeysAtServer() : serverConnectionString(), keys() {}
         std::string serverConnectionString;
@@ -55,6 +74,12 @@ class ObjectFinder {
     Transport::SessionRef getSessionRef(std::string serverConnectionString);
     std::vector<MasterRequests> multiLookup(MasterClient::ReadObject* input[],
                                             uint32_t numRequests);
+    std::vector<MasterWriteRequests> multiLookup(
+                                    MasterClient::WriteObject* input[],
+                                    uint32_t numRequests);
+    std::vector<MasterRemoveRequests> multiLookup(
+                                    MasterClient::RemoveObject* input[],
+                                    uint32_t numRequests);
 
     std::set<Transport::SessionRef> tableLookup(uint64_t table);
 
@@ -70,17 +95,86 @@ class ObjectFinder {
      */
     void flush() {
         tabletMap.Clear();
+        tabletIndex.clear();
     }
 
     void waitForTabletDown();
     void waitForAllTabletsNormal();
 
   PRIVATE:
+    /**
+     * An entry of #tabletIndex: the hash range of one tablet in #tabletMap
+     * along with a session to the master that owns it.
+     */
+    struct IndexedTablet {
+        IndexedTablet(uint64_t tableId, uint64_t startKeyHash,
+                      uint64_t endKeyHash,
+                      const ProtoBuf::Tablets::Tablet* tablet)
+            : tableId(tableId)
+            , startKeyHash(startKeyHash)
+            , endKeyHash(endKeyHash)
+            , tablet(tablet)
+            , session()
+        {
+        }
+
+        IndexedTablet(const IndexedTablet& other)
+            : tableId(other.tableId)
+            , startKeyHash(other.startKeyHash)
+            , endKeyHash(other.endKeyHash)
+            , tablet(other.tablet)
+            , session(other.session)
+        {
+        }
+
+        IndexedTablet&
+        operator=(const IndexedTablet& other)
+        {
+            tableId = other.tableId;
+            startKeyHash = other.startKeyHash;
+            endKeyHash = other.endKeyHash;
+            tablet = other.tablet;
+            session = other.session;
+            return *this;
+        }
+
+        /// Orders entries by table, then by the start of their range.
+        bool operator<(const IndexedTablet& other) const {
+            return tableId < other.tableId ||
+                (tableId == other.tableId &&
+                 startKeyHash < other.startKeyHash);
+        }
+
+        uint64_t tableId;
+        uint64_t startKeyHash;
+        uint64_t endKeyHash;
+
+        /// The tablet in #tabletMap this entry was built from.
+        const ProtoBuf::Tablets::Tablet* tablet;
+
+        /// Session to the tablet's master, opened by the first lookup
+        /// that needs it so that refreshing the map costs no string work.
+        Transport::SessionRef session;
+    };
+
+    void refresh();
+    IndexedTablet* findTablet(uint64_t table, HashType keyHash);
+    Transport::SessionRef getSession(IndexedTablet& entry);
+    template<typename Bin, typename Request>
+    std::vector<Bin> binRequests(Request* requests[], uint32_t numRequests);
+
     /**
      * A cache of the coordinator's tablet map.
      */
     ProtoBuf::Tablets tabletMap;
 
+    /**
+     * The tablets of #tabletMap sorted by (tableId, startKeyHash), so that
+     * a lookup is a binary search. Rebuilt by #refresh and emptied along
+     * with #tabletMap by #flush.
+     */
+    std::vector<IndexedTablet> tabletIndex;
+
     /**
      * Update the local tablet map cache. Usually, calling
      * tabletMapFetcher.getTabletMap() is the same as calling
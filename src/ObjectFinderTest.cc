@@ -57,6 +57,15 @@ struct Refresher : public ObjectFinder::TabletMapFetcher {
     uint32_t called;
 };
 
+/// Hands out a tablet map set up by the test.
+struct FixedTabletMap : public ObjectFinder::TabletMapFetcher {
+    FixedTabletMap() : tablets() {}
+    void getTabletMap(ProtoBuf::Tablets& tabletMap) {
+        tabletMap = tablets;
+    }
+    ProtoBuf::Tablets tablets;
+};
+
 class ObjectFinderTest : public ::testing::Test {
   public:
     MockCluster cluster;
@@ -100,6 +109,48 @@ TEST_F(ObjectFinderTest, lookup) {
         static_cast<BindTransport::BindSession*>(session.get())->locator);
 }
 
+TEST_F(ObjectFinderTest, lookup_cachesSession) {
+    Transport::SessionRef session(objectFinder->lookup(1, "testKey", 7));
+    Transport::SessionRef again(objectFinder->lookup(1, "otherKey", 8));
+    EXPECT_EQ(3U, refresher->called);
+    EXPECT_EQ(session.get(), again.get());
+
+    // flush drops the cached sessions along with the tablet map.
+    objectFinder->flush();
+    EXPECT_EQ(0U, objectFinder->tabletIndex.size());
+}
+
+TEST_F(ObjectFinderTest, findTablet) {
+    FixedTabletMap* fetcher = new FixedTabletMap();
+    ProtoBuf::Tablets_Tablet& lower(*fetcher->tablets.add_tablet());
+    lower.set_table_id(1);
+    lower.set_start_key_hash(0);
+    lower.set_end_key_hash(99);
+    ProtoBuf::Tablets_Tablet& upper(*fetcher->tablets.add_tablet());
+    upper.set_table_id(1);
+    upper.set_start_key_hash(200);
+    upper.set_end_key_hash(~0UL);
+    ProtoBuf::Tablets_Tablet& other(*fetcher->tablets.add_tablet());
+    other.set_table_id(0);
+    other.set_start_key_hash(0);
+    other.set_end_key_hash(~0UL);
+    // Deliberately out of order: the index must sort them.
+    objectFinder->tabletMapFetcher.reset(fetcher);
+    objectFinder->refresh();
+    EXPECT_EQ(3U, objectFinder->tabletIndex.size());
+    EXPECT_EQ(0U, objectFinder->tabletIndex[0].tableId);
+
+    // The index points into the ObjectFinder's own copy of the map.
+    const ProtoBuf::Tablets& map = objectFinder->tabletMap;
+    EXPECT_EQ(&map.tablet(0), objectFinder->findTablet(1, 0)->tablet);
+    EXPECT_EQ(&map.tablet(0), objectFinder->findTablet(1, 99)->tablet);
+    EXPECT_TRUE(objectFinder->findTablet(1, 100) == NULL);
+    EXPECT_EQ(&map.tablet(1), objectFinder->findTablet(1, 200)->tablet);
+    EXPECT_EQ(&map.tablet(1), objectFinder->findTablet(1, ~0UL)->tablet);
+    EXPECT_EQ(&map.tablet(2), objectFinder->findTablet(0, ~0UL)->tablet);
+    EXPECT_TRUE(objectFinder->findTablet(2, 0) == NULL);
+}
+
 TEST_F(ObjectFinderTest, multiLookup_basics) {
     MasterClient::ReadObject* requests[3];
 
@@ -139,6 +190,35 @@ TEST_F(ObjectFinderTest, multiLookup_basics) {
     EXPECT_STREQ("STATUS_RETRY", statusToSymbol(request3.status));
 }
 
+TEST_F(ObjectFinderTest, multiLookup_writesAndRemoves) {
+    MasterClient::WriteObject write1(1, "0", 1, "value", 5);
+    MasterClient::WriteObject write2(2, "0", 1, "value", 5);
+    MasterClient::WriteObject write3(3, "0", 1, "value", 5);
+    write3.status = STATUS_RETRY;
+    MasterClient::WriteObject* writes[] = { &write1, &write2, &write3 };
+    std::vector<ObjectFinder::MasterWriteRequests> writeBins =
+                                    objectFinder->multiLookup(writes, 3);
+    ASSERT_EQ(2U, writeBins.size());
+    EXPECT_EQ("mock:host=server0",
+        static_cast<BindTransport::BindSession*>(
+        writeBins[0].sessionRef.get())->locator);
+    EXPECT_EQ(&write1, writeBins[0].requests[0]);
+    EXPECT_EQ("mock:host=server1",
+        static_cast<BindTransport::BindSession*>(
+        writeBins[1].sessionRef.get())->locator);
+    EXPECT_EQ(&write2, writeBins[1].requests[0]);
+    EXPECT_STREQ("STATUS_TABLE_DOESNT_EXIST", statusToSymbol(write3.status));
+
+    MasterClient::RemoveObject remove1(1, "0", 1);
+    MasterClient::RemoveObject remove2(1, "1", 1);
+    MasterClient::RemoveObject* removes[] = { &remove1, &remove2 };
+    std::vector<ObjectFinder::MasterRemoveRequests> removeBins =
+                                    objectFinder->multiLookup(removes, 2);
+    ASSERT_EQ(1U, removeBins.size());
+    ASSERT_EQ(2U, removeBins[0].requests.size());
+    EXPECT_EQ(&remove2, removeBins[0].requests[1]);
+}
+
 TEST_F(ObjectFinderTest, multiLookup_badTable) {
     TestLog::Enable _;
 
@@ -51,6 +51,8 @@
 #include "ClientException.h"
 #include "PerfHelper.h"
 #include "KeyUtil.h"
+#include "ServerStatistics.pb.h"
+#include "TabletStatistics.h"
 
 using namespace RAMCloud;
 
@@ -636,6 +638,41 @@ double startStopTimer()
     return Cycles::toSeconds(stop - start)/count;
 }
 
+// Measure the per-operation cost of the way masters used to count tablet
+// accesses: a read-modify-write of a protobuf field under a SpinLock.
+double tabletStatsProtobuf()
+{
+    int count = 1000000;
+    SpinLock lock;
+    ProtoBuf::ServerStatistics_TabletEntry entry;
+    entry.set_table_id(0);
+    entry.set_start_key_hash(0);
+    entry.set_end_key_hash(~0UL);
+    uint64_t start = Cycles::rdtsc();
+    for (int i = 0; i < count; i++) {
+        std::lock_guard<SpinLock> _(lock);
+        entry.set_number_read_and_writes(entry.number_read_and_writes() + 1);
+    }
+    uint64_t stop = Cycles::rdtsc();
+    return Cycles::toSeconds(stop - start)/count;
+}
+
+// Measure the per-operation cost of counting a tablet access in the calling
+// thread's TabletStatistics slot.
+double tabletStatsSlots()
+{
+    int count = 1000000;
+    TabletStatistics stats(0, ~0UL);
+    uint64_t start = Cycles::rdtsc();
+    for (int i = 0; i < count; i++) {
+        stats.recordRead(i, 100);
+    }
+    uint64_t stop = Cycles::rdtsc();
+    if (stats.collect().readCount != count)
+        printf("tabletStatsSlots: lost updates\n");
+    return Cycles::toSeconds(stop - start)/count;
+}
+
 // Measure the cost of throwing and catching an int. This uses an integer as
 // the value thrown, which is presumably as fast as possible.
 double throwInt()
@@ -816,6 +853,10 @@ TestInfo tests[] = {
      "Acquire/release SpinLock"},
     {"startStopTimer", startStopTimer,
      "Start and stop a Dispatch::Timer"},
+    {"tabletStatsProtobuf", tabletStatsProtobuf,
+     "Count a tablet access in a protobuf under a SpinLock"},
+    {"tabletStatsSlots", tabletStatsSlots,
+     "Count a tablet access in a per-thread counter slot"},
     {"throwInt", throwInt,
      "Throw an int"},
     {"throwIntNL", throwIntNL,
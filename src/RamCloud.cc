@@ -13,9 +13,14 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <algorithm>
+
 #include "RamCloud.h"
+#include "Cycles.h"
 #include "MasterClient.h"
+#include "Object.h"
 #include "PingClient.h"
+#include "Segment.h"
 
 namespace RAMCloud {
 
@@ -37,6 +42,8 @@ RamCloud::RamCloud(const char* serviceLocator)
     , status(STATUS_OK)
     , coordinator(serviceLocator)
     , objectFinder(coordinator)
+    , asyncRpcPoller(*Context::get().dispatch)
+    , readCoalescer(*this, *Context::get().dispatch)
 {
     // This should be the last line on all return paths of this constructor.
     constructorContext.leave();
@@ -55,6 +62,8 @@ RamCloud::RamCloud(Context& context, const char* serviceLocator)
     , status(STATUS_OK)
     , coordinator(serviceLocator)
     , objectFinder(coordinator)
+    , asyncRpcPoller(*Context::get().dispatch)
+    , readCoalescer(*this, *Context::get().dispatch)
 {
     // This should be the last line on all return paths of this constructor.
     constructorContext.leave();
@@ -214,6 +223,20 @@ RamCloud::read(uint64_t tableId, const char* key, uint16_t keyLength,
                uint64_t* version)
 {
     Context::Guard _(clientContext);
+    if (readCoalescer.maxReads > 1 && rejectRules == NULL) {
+        // Join any AsyncReads being held back; waiting sends them at once.
+        AsyncRead read(*this, tableId, key, keyLength, value);
+        try {
+            read.wait();
+        } catch (ClientException& e) {
+            if (version != NULL)
+                *version = read.getVersion();
+            throw;
+        }
+        if (version != NULL)
+            *version = read.getVersion();
+        return;
+    }
     while (1) {
         // Keep trying the operation if the server responded with a retry
         // status.
@@ -274,6 +297,81 @@ RamCloud::multiRead(MasterClient::ReadObject* requests[], uint32_t numRequests)
     }
 }
 
+/**
+ * Delete multiple objects, with one request to each of the masters
+ * involved.
+ *
+ * \param requests
+ *      Array (of RemoveObject's) listing the objects to be removed. The
+ *      status and version of each are filled in; see #remove.
+ * \param numRequests
+ *      Number of valid entries in \c requests.
+ */
+void
+RamCloud::multiRemove(MasterClient::RemoveObject* requests[],
+                      uint32_t numRequests)
+{
+    Context::Guard _(clientContext);
+    std::vector<ObjectFinder::MasterRemoveRequests> requestBins =
+                            objectFinder.multiLookup(requests, numRequests);
+
+    uint32_t numBins = downCast<uint32_t>(requestBins.size());
+    // The RPCs refer to their MasterClients until they complete.
+    Tub<MasterClient> masters[numBins];
+    Tub<MasterClient::MultiRemove> multiRemoveInstances[numBins];
+
+    // Send requests to all servers in serial without waiting for
+    // responses for parallelism.
+    for (uint32_t i = 0; i < numBins; i++) {
+        masters[i].construct(requestBins[i].sessionRef);
+        multiRemoveInstances[i].construct(*masters[i], requestBins[i].requests);
+    }
+    // Receive responses from the servers in serial.
+    for (uint32_t i = 0; i < numBins; i++) {
+        multiRemoveInstances[i]->complete();
+    }
+}
+
+/**
+ * Write multiple objects, with one request to each of the masters
+ * involved. Each master appends its objects to its log together and
+ * waits for them to be replicated just once.
+ *
+ * \param requests
+ *      Array (of WriteObject's) listing the objects to be written. The
+ *      status and version of each are filled in; see #write.
+ * \param numRequests
+ *      Number of valid entries in \c requests.
+ * \param async
+ *      If true, the new objects will not be replicated to backups before
+ *      the call returns.
+ */
+void
+RamCloud::multiWrite(MasterClient::WriteObject* requests[],
+                     uint32_t numRequests, bool async)
+{
+    Context::Guard _(clientContext);
+    std::vector<ObjectFinder::MasterWriteRequests> requestBins =
+                            objectFinder.multiLookup(requests, numRequests);
+
+    uint32_t numBins = downCast<uint32_t>(requestBins.size());
+    // The RPCs refer to their MasterClients until they complete.
+    Tub<MasterClient> masters[numBins];
+    Tub<MasterClient::MultiWrite> multiWriteInstances[numBins];
+
+    // Send requests to all servers in serial without waiting for
+    // responses for parallelism.
+    for (uint32_t i = 0; i < numBins; i++) {
+        masters[i].construct(requestBins[i].sessionRef);
+        multiWriteInstances[i].construct(*masters[i], requestBins[i].requests,
+                                         async);
+    }
+    // Receive responses from the servers in serial.
+    for (uint32_t i = 0; i < numBins; i++) {
+        multiWriteInstances[i]->complete();
+    }
+}
+
 /// \copydoc MasterClient::remove
 void
 RamCloud::remove(uint64_t tableId, const char* key, uint16_t keyLength,
@@ -363,4 +461,685 @@ RamCloud::write(uint64_t tableId, const char* key, uint16_t keyLength,
     }
 }
 
+/**
+ * Poll the client's dispatcher once, which moves any AsyncRpcs along and
+ * invokes the callbacks of those that have completed.
+ */
+void
+RamCloud::poll()
+{
+    Context::Guard _(clientContext);
+    Context::get().dispatch->poll();
+}
+
+/**
+ * Turn coalescing of reads on or off. While it's on, AsyncReads without
+ * reject rules are held back until \a maxReads of them have been issued,
+ * until the first of them has been held back for \a windowMicroseconds,
+ * or until the thread waits for one of them, whichever comes first. They
+ * are then sent in a MULTI_READ RPC to each master involved. Blocking
+ * #read calls join the reads being held back. This saves most of the
+ * per-RPC overhead on both the client and the masters, at the cost of
+ * some latency.
+ *
+ * \param windowMicroseconds
+ *      The longest time a read may be held back.
+ * \param maxReads
+ *      The most reads held back at once; 0 or 1 turns coalescing off.
+ */
+void
+RamCloud::setReadCoalescing(uint32_t windowMicroseconds, uint32_t maxReads)
+{
+    Context::Guard _(clientContext);
+    readCoalescer.windowCycles =
+        Cycles::fromNanoseconds(windowMicroseconds * 1000UL);
+    readCoalescer.maxReads = maxReads;
+    if (maxReads <= 1)
+        readCoalescer.flush();
+}
+
+/**
+ * Constructor for AsyncRpc; the subclass sends the operation once it has
+ * built the request.
+ *
+ * \param ramCloud
+ *      The client through which the operation is made.
+ * \param tableId
+ *      The table containing the object.
+ * \param key
+ *      Variable length key that uniquely identifies the object within
+ *      tableId. The caller is responsible for ensuring that this key
+ *      remains valid until the operation has completed or been destroyed.
+ * \param keyLength
+ *      Size in bytes of the key.
+ * \param responseBuffer
+ *      The response to the operation goes here; if NULL, it goes in a
+ *      Buffer of the AsyncRpc's own.
+ * \param callback
+ *      If not NULL, invoked once the operation has completed.
+ * \param cookie
+ *      Passed to \a callback.
+ */
+RamCloud::AsyncRpc::AsyncRpc(RamCloud& ramCloud,
+                             uint64_t tableId, const char* key,
+                             uint16_t keyLength, Buffer* responseBuffer,
+                             AsyncCallback callback, void* cookie)
+    : constructorContext(ramCloud.clientContext)
+    , ramCloud(ramCloud)
+    , tableId(tableId)
+    , key(key)
+    , keyLength(keyLength)
+    , requestBuffer()
+    , response()
+    , responseBuffer(responseBuffer != NULL ? *responseBuffer : response)
+    , status(STATUS_OK)
+    , version(VERSION_NONEXISTENT)
+    , session()
+    , rpc(NULL)
+    , transportError()
+    , finished(false)
+    , callback(callback)
+    , cookie(cookie)
+    , slot(-1)
+    , coalesced(false)
+{
+    assert(Context::get().dispatch->isDispatchThread());
+    // This should be the last line on all return paths of this constructor.
+    constructorContext.leave();
+}
+
+/**
+ * Destructor for AsyncRpc. An operation that hasn't completed yet is
+ * abandoned, without its callback being invoked; it may or may not have
+ * been made by the master.
+ */
+RamCloud::AsyncRpc::~AsyncRpc()
+{
+    Context::Guard _(ramCloud.clientContext);
+    if (rpc != NULL)
+        rpc->cancel();
+    if (slot >= 0)
+        ramCloud.asyncRpcPoller.remove(this);
+}
+
+/**
+ * Abandon the operation if it hasn't completed yet. Once the poller notices
+ * it has, the operation completes and #wait throws TransportException. The
+ * master may or may not have made the operation.
+ */
+void
+RamCloud::AsyncRpc::cancel()
+{
+    Context::Guard _(ramCloud.clientContext);
+    if (rpc != NULL)
+        rpc->cancel();
+}
+
+/**
+ * Return whether the operation has completed, polling the dispatcher once
+ * if it hasn't, so that a loop on this method makes progress.
+ */
+bool
+RamCloud::AsyncRpc::isReady()
+{
+    Context::Guard _(ramCloud.clientContext);
+    if (!finished)
+        Context::get().dispatch->poll();
+    return finished;
+}
+
+/**
+ * Wait for the operation to complete, polling the dispatcher in the
+ * meantime, and report how it went.
+ *
+ * \throw TransportException
+ *      The operation could not be delivered, or was canceled.
+ * \throw ClientException
+ *      The master rejected the operation; see #getStatus.
+ */
+void
+RamCloud::AsyncRpc::wait()
+{
+    Context::Guard _(ramCloud.clientContext);
+    // There's no point holding back reads while the thread blocks.
+    if (!finished && coalesced)
+        ramCloud.readCoalescer.flush();
+    while (!finished)
+        Context::get().dispatch->poll();
+    if (transportError)
+        throw TransportException(HERE, *transportError);
+    if (status != STATUS_OK)
+        ClientException::throwException(HERE, status);
+}
+
+/**
+ * Send the operation to the master that owns its object, as far as the
+ * ObjectFinder knows, and have the poller watch for its completion.
+ */
+void
+RamCloud::AsyncRpc::send()
+{
+    session = ramCloud.objectFinder.lookup(tableId, key, keyLength);
+    rpc = session->clientSend(&requestBuffer, &responseBuffer);
+    if (slot < 0)
+        ramCloud.asyncRpcPoller.add(this);
+}
+
+/**
+ * Invoked by the poller once the transport's RPC has finished: either send
+ * the operation again or complete it.
+ */
+void
+RamCloud::AsyncRpc::complete()
+{
+    Transport::ClientRpc* finishedRpc = rpc;
+    // Looking up the master again below may poll the dispatcher, which
+    // mustn't take this for a finished RPC again.
+    rpc = NULL;
+    try {
+        finishedRpc->wait();
+        const RpcResponseCommon* common =
+            responseBuffer.getStart<RpcResponseCommon>();
+        status = (common != NULL) ? common->status
+                                  : STATUS_RESPONSE_FORMAT_ERROR;
+        if (retry())
+            return;
+        if (common != NULL)
+            handleResponse();
+    } catch (TransportException& e) {
+        transportError.construct(e.message);
+    }
+    finish();
+}
+
+/**
+ * Send the operation again if #status says that the master couldn't make
+ * it for now, or that it doesn't own the object any more.
+ *
+ * \return
+ *      Whether the operation was sent again. If it wasn't since its table
+ *      has disappeared meanwhile, #status says so.
+ * \throw TransportException
+ *      The ObjectFinder couldn't reach the coordinator.
+ */
+bool
+RamCloud::AsyncRpc::retry()
+{
+    if (status != STATUS_RETRY && status != STATUS_UNKNOWN_TABLE)
+        return false;
+    // The Tablet Map pointed to some server, but it's no longer
+    // in charge of the appropriate tablet. We need to refresh.
+    if (status == STATUS_UNKNOWN_TABLE)
+        ramCloud.objectFinder.flush();
+    responseBuffer.reset();
+    try {
+        send();
+    } catch (ClientException& e) {
+        status = e.status;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Mark the operation completed and invoke its callback, which may destroy
+ * it; this must be the last thing done with the operation.
+ */
+void
+RamCloud::AsyncRpc::finish()
+{
+    finished = true;
+    ramCloud.asyncRpcPoller.remove(this);
+    if (callback != NULL)
+        callback(this, cookie);
+}
+
+/**
+ * Start reading an object. See RamCloud::read and AsyncRpc.
+ *
+ * \param ramCloud
+ *      The client through which to read.
+ * \param tableId
+ *      The table containing the desired object.
+ * \param key
+ *      Variable length key that uniquely identifies the object within
+ *      tableId; must remain valid until the read has completed.
+ * \param keyLength
+ *      Size in bytes of the key.
+ * \param[out] value
+ *      After a successful completion, this Buffer will hold the contents
+ *      of the desired object.
+ * \param rejectRules
+ *      If non-NULL, specifies conditions under which the read should be
+ *      aborted with an error.
+ * \param callback
+ *      If not NULL, invoked once the read has completed.
+ * \param cookie
+ *      Passed to \a callback.
+ */
+RamCloud::AsyncRead::AsyncRead(RamCloud& ramCloud,
+                               uint64_t tableId, const char* key,
+                               uint16_t keyLength, Buffer* value,
+                               const RejectRules* rejectRules,
+                               AsyncCallback callback, void* cookie)
+    : AsyncRpc(ramCloud, tableId, key, keyLength, value, callback, cookie)
+{
+    Context::Guard _(ramCloud.clientContext);
+    value->reset();
+    ReadRpc::Request& reqHdr(Client::allocHeader<ReadRpc>(requestBuffer));
+    reqHdr.tableId = tableId;
+    reqHdr.keyLength = keyLength;
+    if (rejectRules != NULL)
+        reqHdr.rejectRules = *rejectRules;
+    Buffer::Chunk::appendToBuffer(&requestBuffer, key, keyLength);
+
+    // MULTI_READ has no reject rules. The request is built all the same,
+    // in case the master asks for the read to be sent again.
+    if (rejectRules == NULL && ramCloud.readCoalescer.add(this))
+        return;
+    send();
+}
+
+RamCloud::AsyncRead::~AsyncRead()
+{
+    Context::Guard _(ramCloud.clientContext);
+    if (coalesced)
+        ramCloud.readCoalescer.remove(this);
+}
+
+void
+RamCloud::AsyncRead::handleResponse()
+{
+    const ReadRpc::Response* respHdr =
+        responseBuffer.getStart<ReadRpc::Response>();
+    if (respHdr == NULL) {
+        status = STATUS_RESPONSE_FORMAT_ERROR;
+        return;
+    }
+    version = respHdr->version;
+
+    // Truncate the response Buffer so that it consists of nothing
+    // but the object data.
+    responseBuffer.truncateFront(sizeof(*respHdr));
+}
+
+/**
+ * Start writing an object. See RamCloud::write and AsyncRpc.
+ *
+ * \param ramCloud
+ *      The client through which to write.
+ * \param tableId
+ *      The table containing the desired object.
+ * \param key
+ *      Variable length key that uniquely identifies the object within
+ *      tableId; must remain valid until the write has completed.
+ * \param keyLength
+ *      Size in bytes of the key.
+ * \param buf
+ *      Address of the first byte of the new contents for the object; must
+ *      remain valid until the write has completed.
+ * \param length
+ *      Size in bytes of the new contents for the object.
+ * \param rejectRules
+ *      If non-NULL, specifies conditions under which the write should be
+ *      aborted with an error.
+ * \param async
+ *      If true, the write completes before the object has been replicated
+ *      to backups.
+ * \param callback
+ *      If not NULL, invoked once the write has completed.
+ * \param cookie
+ *      Passed to \a callback.
+ */
+RamCloud::AsyncWrite::AsyncWrite(RamCloud& ramCloud,
+                                 uint64_t tableId, const char* key,
+                                 uint16_t keyLength,
+                                 const void* buf, uint32_t length,
+                                 const RejectRules* rejectRules, bool async,
+                                 AsyncCallback callback, void* cookie)
+    : AsyncRpc(ramCloud, tableId, key, keyLength, NULL, callback, cookie)
+{
+    Context::Guard _(ramCloud.clientContext);
+    WriteRpc::Request& reqHdr(Client::allocHeader<WriteRpc>(requestBuffer));
+    reqHdr.tableId = tableId;
+    reqHdr.keyLength = keyLength;
+    reqHdr.length = length;
+    if (rejectRules != NULL)
+        reqHdr.rejectRules = *rejectRules;
+    reqHdr.async = async;
+    Buffer::Chunk::appendToBuffer(&requestBuffer, key, keyLength);
+    Buffer::Chunk::appendToBuffer(&requestBuffer, buf, length);
+    send();
+}
+
+void
+RamCloud::AsyncWrite::handleResponse()
+{
+    const WriteRpc::Response* respHdr =
+        responseBuffer.getStart<WriteRpc::Response>();
+    if (respHdr == NULL) {
+        status = STATUS_RESPONSE_FORMAT_ERROR;
+        return;
+    }
+    version = respHdr->version;
+}
+
+/**
+ * Constructor for AsyncRpcPoller.
+ *
+ * \param dispatch
+ *      The client's dispatcher.
+ */
+RamCloud::AsyncRpcPoller::AsyncRpcPoller(Dispatch& dispatch)
+    : Dispatch::Poller(dispatch)
+    , rpcs()
+{
+}
+
+/**
+ * Complete the AsyncRpcs whose RPCs have finished.
+ */
+void
+RamCloud::AsyncRpcPoller::poll()
+{
+    // Completing an operation removes it from #rpcs, and may add or remove
+    // others, either from its callback or by polling the dispatcher again
+    // while the operation is sent anew. Walking #rpcs backwards with a
+    // bounds check copes with both; operations added during the walk wait
+    // for the next one.
+    for (size_t i = rpcs.size(); i > 0; i--) {
+        if (i > rpcs.size())
+            continue;
+        AsyncRpc* asyncRpc = rpcs[i - 1];
+        if (asyncRpc->rpc != NULL && asyncRpc->rpc->isReady())
+            asyncRpc->complete();
+    }
+}
+
+/// Start watching an AsyncRpc.
+void
+RamCloud::AsyncRpcPoller::add(AsyncRpc* rpc)
+{
+    assert(rpc->slot < 0);
+    rpc->slot = downCast<int>(rpcs.size());
+    rpcs.push_back(rpc);
+}
+
+/// Stop watching an AsyncRpc.
+void
+RamCloud::AsyncRpcPoller::remove(AsyncRpc* rpc)
+{
+    if (rpc->slot < 0)
+        return;
+    AsyncRpc* last = rpcs.back();
+    rpcs[rpc->slot] = last;
+    last->slot = rpc->slot;
+    rpcs.pop_back();
+    rpc->slot = -1;
+}
+
+/**
+ * Constructor for ReadCoalescer; reads aren't coalesced until
+ * RamCloud::setReadCoalescing says so.
+ *
+ * \param ramCloud
+ *      The client the reads are made through.
+ * \param dispatch
+ *      The client's dispatcher.
+ */
+RamCloud::ReadCoalescer::ReadCoalescer(RamCloud& ramCloud, Dispatch& dispatch)
+    : Dispatch::Poller(dispatch)
+    , ramCloud(ramCloud)
+    , windowCycles(0)
+    , maxReads(0)
+    , waiting()
+    , firstWaitingTime(0)
+    , flushing()
+    , failed()
+    , inFlight()
+{
+}
+
+RamCloud::ReadCoalescer::~ReadCoalescer()
+{
+    foreach (MultiRead* multiRead, inFlight) {
+        if (multiRead->rpc != NULL)
+            multiRead->rpc->cancel();
+        delete multiRead;
+    }
+}
+
+/**
+ * Complete the reads whose MULTI_READ RPCs have finished, and send the
+ * reads that have been held back long enough.
+ */
+void
+RamCloud::ReadCoalescer::poll()
+{
+    while (!failed.empty()) {
+        AsyncRead* read = failed.back();
+        failed.pop_back();
+        completeRead(read);
+    }
+
+    // Completing reads may add and remove MULTI_READs, or poll the
+    // dispatcher again; see AsyncRpcPoller::poll.
+    for (size_t i = inFlight.size(); i > 0; i--) {
+        if (i > inFlight.size())
+            continue;
+        MultiRead* multiRead = inFlight[i - 1];
+        if (multiRead->rpc == NULL || !multiRead->rpc->isReady())
+            continue;
+        complete(multiRead);
+        inFlight.erase(std::find(inFlight.begin(), inFlight.end(),
+                                 multiRead));
+        delete multiRead;
+    }
+
+    // Not Dispatch::currentTime: that was taken before this pass of the
+    // pollers, and reads issued by the callbacks above are newer.
+    if (!waiting.empty() &&
+        Cycles::rdtsc() - firstWaitingTime >= windowCycles) {
+        flush();
+    }
+}
+
+/**
+ * Hold back a read, or send the reads held back if there are enough of
+ * them now.
+ *
+ * \param read
+ *      The read, which has not been sent.
+ * \return
+ *      False if reads aren't being coalesced, in which case the caller
+ *      sends the read itself.
+ */
+bool
+RamCloud::ReadCoalescer::add(AsyncRead* read)
+{
+    if (maxReads <= 1)
+        return false;
+    if (waiting.empty())
+        firstWaitingTime = Cycles::rdtsc();
+    waiting.push_back(read);
+    read->coalesced = true;
+    if (waiting.size() >= maxReads)
+        flush();
+    return true;
+}
+
+/**
+ * Forget about a read that is being destroyed before it has completed.
+ */
+void
+RamCloud::ReadCoalescer::remove(AsyncRead* read)
+{
+    AsyncRead* none = NULL;
+    waiting.erase(std::remove(waiting.begin(), waiting.end(), read),
+                  waiting.end());
+    failed.erase(std::remove(failed.begin(), failed.end(), read),
+                 failed.end());
+    std::replace(flushing.begin(), flushing.end(), read, none);
+    foreach (MultiRead* multiRead, inFlight) {
+        std::replace(multiRead->reads.begin(), multiRead->reads.end(),
+                     read, none);
+    }
+    read->coalesced = false;
+}
+
+/**
+ * Send the reads held back, binned by master with ObjectFinder::multiLookup,
+ * in a MULTI_READ RPC to each master.
+ */
+void
+RamCloud::ReadCoalescer::flush()
+{
+    // Looking up the masters may poll the dispatcher, which mustn't flush
+    // again meanwhile.
+    if (waiting.empty() || !flushing.empty())
+        return;
+    flushing.swap(waiting);
+
+    uint32_t count = downCast<uint32_t>(flushing.size());
+    vector<MasterClient::ReadObject> objects(count);
+    vector<MasterClient::ReadObject*> objectPointers(count);
+    for (uint32_t i = 0; i < count; i++) {
+        AsyncRead* read = flushing[i];
+        objects[i].tableId = read->tableId;
+        objects[i].key = read->key;
+        objects[i].keyLength = read->keyLength;
+        objects[i].status = STATUS_OK;
+        objectPointers[i] = &objects[i];
+    }
+    vector<ObjectFinder::MasterRequests> bins;
+    try {
+        bins = ramCloud.objectFinder.multiLookup(&objectPointers[0], count);
+    } catch (...) {
+        foreach (AsyncRead* read, flushing) {
+            if (read != NULL)
+                waiting.push_back(read);
+        }
+        flushing.clear();
+        throw;
+    }
+
+    foreach (ObjectFinder::MasterRequests& bin, bins) {
+        MultiRead* multiRead = new MultiRead;
+        multiRead->session = bin.sessionRef;
+        Buffer& request = multiRead->requestBuffer;
+        MultiReadRpc::Request& reqHdr(
+            Client::allocHeader<MultiReadRpc>(request));
+        foreach (MasterClient::ReadObject* object, bin.requests) {
+            AsyncRead* read = flushing[object - &objects[0]];
+            if (read == NULL)
+                continue;
+            new(&request, APPEND)
+                MultiReadRpc::Request::Part(read->tableId, read->keyLength);
+            Buffer::Chunk::appendToBuffer(&request, read->key,
+                                          read->keyLength);
+            multiRead->reads.push_back(read);
+        }
+        reqHdr.count = downCast<uint32_t>(multiRead->reads.size());
+        if (multiRead->reads.empty()) {
+            delete multiRead;
+            continue;
+        }
+        multiRead->rpc = multiRead->session->clientSend(
+            &request, &multiRead->responseBuffer);
+        inFlight.push_back(multiRead);
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (flushing[i] != NULL && objects[i].status != STATUS_OK) {
+            flushing[i]->status = objects[i].status;
+            failed.push_back(flushing[i]);
+        }
+    }
+    flushing.clear();
+}
+
+/**
+ * Hand the reads of a finished MULTI_READ RPC their results, and complete
+ * them.
+ */
+void
+RamCloud::ReadCoalescer::complete(MultiRead* multiRead)
+{
+    Buffer& response = multiRead->responseBuffer;
+    Tub<string> transportError;
+    Status status = STATUS_OK;
+    Transport::ClientRpc* rpc = multiRead->rpc;
+    // Mark the RPC as being completed, for polls from within callbacks.
+    multiRead->rpc = NULL;
+    try {
+        rpc->wait();
+        const MultiReadRpc::Response* respHdr =
+            response.getStart<MultiReadRpc::Response>();
+        status = (respHdr != NULL) ? respHdr->common.status
+                                   : STATUS_RESPONSE_FORMAT_ERROR;
+    } catch (TransportException& e) {
+        transportError.construct(e.message);
+    }
+
+    // Callbacks may destroy reads further down the list, so each read's
+    // part of the response is dealt with before it is completed.
+    uint32_t offset = downCast<uint32_t>(sizeof(MultiReadRpc::Response));
+    for (size_t i = 0; i < multiRead->reads.size(); i++) {
+        Status readStatus = status;
+        uint64_t version = VERSION_NONEXISTENT;
+        if (!transportError && status == STATUS_OK) {
+            const Status* partStatus = response.getOffset<Status>(offset);
+            offset += downCast<uint32_t>(sizeof(Status));
+            readStatus = (partStatus != NULL) ? *partStatus
+                                              : STATUS_RESPONSE_FORMAT_ERROR;
+        }
+        AsyncRead* read = multiRead->reads[i];
+        if (readStatus == STATUS_OK && !transportError) {
+            const SegmentEntry* entry =
+                response.getOffset<SegmentEntry>(offset);
+            offset += downCast<uint32_t>(sizeof(SegmentEntry));
+            const Object* object = response.getOffset<Object>(offset);
+            if (entry == NULL || object == NULL) {
+                // Nothing after this can be trusted either.
+                status = readStatus = STATUS_RESPONSE_FORMAT_ERROR;
+            } else {
+                version = object->version;
+                uint32_t dataLength = object->dataLength(entry->length);
+                uint32_t dataOffset = offset +
+                    downCast<uint32_t>(sizeof(Object)) + object->keyLength;
+                if (read != NULL) {
+                    response.copy(dataOffset, dataLength,
+                                  new(&read->responseBuffer, APPEND)
+                                  char[dataLength]);
+                }
+                offset += entry->length;
+            }
+        }
+        if (read == NULL)
+            continue;
+        if (transportError)
+            read->transportError.construct(*transportError);
+        read->status = readStatus;
+        read->version = version;
+        completeRead(read);
+    }
+}
+
+/**
+ * Complete a read once the ReadCoalescer has set its outcome, unless its
+ * status calls for sending it again, which is then done on its own.
+ */
+void
+RamCloud::ReadCoalescer::completeRead(AsyncRead* read)
+{
+    read->coalesced = false;
+    try {
+        if (!read->transportError && read->retry())
+            return;
+    } catch (TransportException& e) {
+        read->transportError.construct(e.message);
+    }
+    read->finish();
+}
+
 }  // namespace RAMCloud
@@ -18,6 +18,7 @@
 
 #include "Common.h"
 #include "CoordinatorClient.h"
+#include "Dispatch.h"
 #include "MasterClient.h"
 #include "ObjectFinder.h"
 #include "ServerMetrics.h"
@@ -129,6 +130,158 @@ class RamCloud {
         DISALLOW_COPY_AND_ASSIGN(Write);
     };
 
+    class AsyncRpc;
+
+    /**
+     * The type of the function an AsyncRpc invokes once it has completed.
+     * The callback runs from within Dispatch::poll, in the client's thread.
+     *
+     * \param rpc
+     *      The operation that completed. The callback may destroy it, and
+     *      may start new operations.
+     * \param cookie
+     *      The value given when the operation was started.
+     */
+    typedef void (*AsyncCallback)(AsyncRpc* rpc, void* cookie);
+
+    /**
+     * A read or write of a single object that runs in the background, so
+     * that a single thread can keep any number of them in flight, to any
+     * number of masters. See AsyncRead and AsyncWrite.
+     *
+     * The operation is sent to the master that the ObjectFinder says owns
+     * the object. It is sent again whenever the master answers
+     * STATUS_RETRY, and also, once the tablet map has been refreshed, if
+     * the master no longer owns the object. Completions are noticed by a
+     * Dispatch::Poller, so whatever polls the client's dispatcher
+     * (RamCloud::poll, #isReady, #wait, or waiting for any other RPC)
+     * moves all of the operations along. Once an operation has
+     * completed, its callback, if any, is invoked.
+     *
+     * AsyncRpcs may only be used in the thread that polls the client's
+     * dispatcher, which is normally the only thread of a client.
+     */
+    class AsyncRpc {
+      public:
+        virtual ~AsyncRpc();
+        void cancel();
+        bool isReady();
+        void wait();
+
+        /**
+         * Return the status the master returned for the operation; only
+         * meaningful once the operation has completed. #wait throws the
+         * corresponding exception, if any.
+         */
+        Status getStatus() const { return status; }
+
+        /**
+         * Return the version of the object as of the operation; only
+         * meaningful once the operation has completed.
+         */
+        uint64_t getVersion() const { return version; }
+
+      PROTECTED:
+        AsyncRpc(RamCloud& ramCloud, uint64_t tableId, const char* key,
+                 uint16_t keyLength, Buffer* responseBuffer,
+                 AsyncCallback callback, void* cookie);
+        void send();
+
+        /**
+         * Invoked once the master has answered with anything but a status
+         * that calls for the operation to be sent again. Extracts the
+         * results of the operation from #responseBuffer.
+         */
+        virtual void handleResponse() = 0;
+
+        /// Analogous to RamCloud::constructorContext. Must be the first
+        /// member, so that it is set while the others are constructed.
+        Context::Guard constructorContext;
+
+        RamCloud& ramCloud;
+
+        /// Identifies the object; the caller keeps the key valid until the
+        /// operation completes.
+        uint64_t tableId;
+        const char* key;
+        uint16_t keyLength;
+
+        Buffer requestBuffer;
+
+        /// Holds the response, unless the subclass supplies a Buffer.
+        Buffer response;
+        Buffer& responseBuffer;
+
+        /// See #getStatus.
+        Status status;
+
+        /// See #getVersion.
+        uint64_t version;
+
+      PRIVATE:
+        void complete();
+        bool retry();
+        void finish();
+
+        /// The master the operation was last sent to.
+        Transport::SessionRef session;
+
+        /// The transport's RPC while one is in flight; NULL otherwise.
+        Transport::ClientRpc* rpc;
+
+        /// Set if the transport failed to deliver the operation, to the
+        /// message of the exception #wait throws.
+        Tub<string> transportError;
+
+        /// Whether the operation has completed.
+        bool finished;
+
+        AsyncCallback callback;
+        void* cookie;
+
+        /// Index of this operation in AsyncRpcPoller::rpcs, or -1 while
+        /// it's not there.
+        int slot;
+
+        /// Whether the operation is in the hands of the ReadCoalescer,
+        /// rather than sent on its own.
+        bool coalesced;
+
+        friend class RamCloud;
+        DISALLOW_COPY_AND_ASSIGN(AsyncRpc);
+    };
+
+    /**
+     * An AsyncRpc version of #read(). If read coalescing is on (see
+     * #setReadCoalescing), reads without reject rules are sent together
+     * with others in MULTI_READ RPCs.
+     */
+    class AsyncRead : public AsyncRpc {
+      public:
+        AsyncRead(RamCloud& ramCloud,
+                  uint64_t tableId, const char* key, uint16_t keyLength,
+                  Buffer* value, const RejectRules* rejectRules = NULL,
+                  AsyncCallback callback = NULL, void* cookie = NULL);
+        ~AsyncRead();
+      PRIVATE:
+        void handleResponse();
+        DISALLOW_COPY_AND_ASSIGN(AsyncRead);
+    };
+
+    /// An AsyncRpc version of #write(). The new value isn't copied, so it
+    /// must stay intact until the write has completed.
+    class AsyncWrite : public AsyncRpc {
+      public:
+        AsyncWrite(RamCloud& ramCloud,
+                   uint64_t tableId, const char* key, uint16_t keyLength,
+                   const void* buf, uint32_t length,
+                   const RejectRules* rejectRules = NULL, bool async = false,
+                   AsyncCallback callback = NULL, void* cookie = NULL);
+      PRIVATE:
+        void handleResponse();
+        DISALLOW_COPY_AND_ASSIGN(AsyncWrite);
+    };
+
     explicit RamCloud(const char* serviceLocator);
     RamCloud(Context& context, const char* serviceLocator);
     void createTable(const char* name, uint32_t serverSpan = 1);
@@ -155,6 +308,10 @@ class RamCloud {
               int64_t incrementValue, const RejectRules* rejectRules = NULL,
               uint64_t* version = NULL, int64_t* newValue = NULL);
     void multiRead(MasterClient::ReadObject* requests[], uint32_t numRequests);
+    void multiRemove(MasterClient::RemoveObject* requests[],
+                     uint32_t numRequests);
+    void multiWrite(MasterClient::WriteObject* requests[],
+                    uint32_t numRequests, bool async = false);
     void remove(uint64_t tableId, const char* key, uint16_t keyLength,
                 const RejectRules* rejectRules = NULL,
                 uint64_t* version = NULL);
@@ -164,8 +321,99 @@ class RamCloud {
                uint64_t* version = NULL, bool async = false);
     void write(uint64_t tableId, const char* key, uint16_t keyLength,
                const char* s);
+    void poll();
+    void setReadCoalescing(uint32_t windowMicroseconds, uint32_t maxReads);
 
   PRIVATE:
+    /**
+     * Notices the completion of AsyncRpcs while the client's dispatcher
+     * is polled.
+     */
+    class AsyncRpcPoller : public Dispatch::Poller {
+      public:
+        explicit AsyncRpcPoller(Dispatch& dispatch);
+        void poll();
+        void add(AsyncRpc* rpc);
+        void remove(AsyncRpc* rpc);
+
+        /// AsyncRpcs that haven't completed yet, in no particular order.
+        vector<AsyncRpc*> rpcs;
+        DISALLOW_COPY_AND_ASSIGN(AsyncRpcPoller);
+    };
+
+    /**
+     * Holds back the AsyncReads issued within a short window of each
+     * other, up to a given number of them, and then sends them in a
+     * MULTI_READ RPC to each master involved, to save most of the cost of
+     * an RPC per object on both ends. See #setReadCoalescing.
+     */
+    class ReadCoalescer : public Dispatch::Poller {
+      public:
+        ReadCoalescer(RamCloud& ramCloud, Dispatch& dispatch);
+        ~ReadCoalescer();
+        void poll();
+        bool add(AsyncRead* read);
+        void remove(AsyncRead* read);
+        void flush();
+
+        /// A MULTI_READ RPC sent on behalf of some AsyncReads.
+        struct MultiRead {
+            MultiRead()
+                : session()
+                , requestBuffer()
+                , responseBuffer()
+                , rpc(NULL)
+                , reads()
+            {
+            }
+
+            Transport::SessionRef session;
+            Buffer requestBuffer;
+            Buffer responseBuffer;
+            Transport::ClientRpc* rpc;
+
+            /// The reads the RPC is for, in the order of the request. An
+            /// entry is NULL if its read has been destroyed.
+            vector<AsyncRead*> reads;
+
+            DISALLOW_COPY_AND_ASSIGN(MultiRead);
+        };
+
+        void complete(MultiRead* multiRead);
+        void completeRead(AsyncRead* read);
+
+        RamCloud& ramCloud;
+
+        /// Reads are held back for at most this long; see
+        /// #setReadCoalescing.
+        uint64_t windowCycles;
+
+        /// Reads are sent once this many are held back. 0 or 1 means reads
+        /// aren't coalesced.
+        uint32_t maxReads;
+
+        /// Reads held back, in the order they were issued.
+        vector<AsyncRead*> waiting;
+
+        /// Value of Cycles::rdtsc() when the first read in #waiting was
+        /// issued.
+        uint64_t firstWaitingTime;
+
+        /// The reads #flush is sending; NULL entries were destroyed
+        /// meanwhile.
+        vector<AsyncRead*> flushing;
+
+        /// Reads #flush couldn't send, since their table doesn't exist.
+        /// They are completed by the next #poll, rather than from within
+        /// whatever called #flush.
+        vector<AsyncRead*> failed;
+
+        /// MULTI_READ RPCs that haven't been completed yet.
+        vector<MultiRead*> inFlight;
+
+        DISALLOW_COPY_AND_ASSIGN(ReadCoalescer);
+    };
+
     /**
      * Service locator for the cluster coordinator.
      */
@@ -199,6 +447,13 @@ class RamCloud {
     CoordinatorClient coordinator;
     ObjectFinder objectFinder;
 
+  PRIVATE:
+    /// Keeps track of the AsyncRpcs started with this object.
+    AsyncRpcPoller asyncRpcPoller;
+
+    /// Holds back AsyncReads to send them together.
+    ReadCoalescer readCoalescer;
+
   private:
     DISALLOW_COPY_AND_ASSIGN(RamCloud);
 };
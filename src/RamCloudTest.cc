@@ -56,6 +56,36 @@ class RamCloudTest : public ::testing::Test {
         tableId2 = ramcloud->getTableId("table2");
     }
 
+    static void
+    countCompletion(RamCloud::AsyncRpc* rpc, void* cookie)
+    {
+        (*static_cast<int*>(cookie))++;
+    }
+
+    /// Reads object "0" of table1 again; see #readAgain.
+    struct ReadAgain {
+        explicit ReadAgain(RamCloudTest* test)
+            : test(test)
+            , value()
+            , read()
+        {
+        }
+
+        RamCloudTest* test;
+        Buffer value;
+        Tub<RamCloud::AsyncRead> read;
+
+        DISALLOW_COPY_AND_ASSIGN(ReadAgain);
+    };
+
+    static void
+    readAgain(RamCloud::AsyncRpc* rpc, void* cookie)
+    {
+        ReadAgain* again = static_cast<ReadAgain*>(cookie);
+        again->read.construct(*again->test->ramcloud, again->test->tableId1,
+                              "0", 1, &again->value);
+    }
+
     DISALLOW_COPY_AND_ASSIGN(RamCloudTest);
 };
 
@@ -121,6 +151,195 @@ TEST_F(RamCloudTest, multiRead) {
     EXPECT_EQ("thirdVal", TestUtil::toString(readValue3.get()));
 }
 
+TEST_F(RamCloudTest, multiWriteAndRemove) {
+    MasterClient::WriteObject write1(tableId1, "0", 1, "firstVal", 8);
+    MasterClient::WriteObject write2(tableId2, "0", 1, "secondVal", 9);
+    MasterClient::WriteObject write3(tableId2, "1", 1, "thirdVal", 8);
+    MasterClient::WriteObject* writes[] = { &write1, &write2, &write3 };
+    ramcloud->multiWrite(writes, 3);
+
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(write1.status));
+    EXPECT_EQ(1U, write1.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(write2.status));
+    EXPECT_EQ(1U, write2.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(write3.status));
+    EXPECT_EQ(2U, write3.version);
+    Buffer value;
+    ramcloud->read(tableId2, "1", 1, &value);
+    EXPECT_EQ("thirdVal", TestUtil::toString(&value));
+
+    MasterClient::RemoveObject remove1(tableId1, "0", 1);
+    MasterClient::RemoveObject remove2(tableId2, "1", 1);
+    MasterClient::RemoveObject* removes[] = { &remove1, &remove2 };
+    ramcloud->multiRemove(removes, 2);
+
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(remove1.status));
+    EXPECT_EQ(1U, remove1.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(remove2.status));
+    EXPECT_EQ(2U, remove2.version);
+    EXPECT_THROW(ramcloud->read(tableId1, "0", 1, &value),
+                 ObjectDoesntExistException);
+    ramcloud->read(tableId2, "0", 1, &value);
+    EXPECT_EQ("secondVal", TestUtil::toString(&value));
+}
+
+TEST_F(RamCloudTest, asyncReadAndWrite) {
+    int completions = 0;
+    RamCloud::AsyncWrite write1(*ramcloud, tableId1, "0", 1, "abcdef", 6,
+                                NULL, false, countCompletion, &completions);
+    RamCloud::AsyncWrite write2(*ramcloud, tableId2, "1", 1, "xyz", 3,
+                                NULL, false, countCompletion, &completions);
+    EXPECT_EQ(2U, ramcloud->asyncRpcPoller.rpcs.size());
+    EXPECT_EQ(0, completions);
+    ramcloud->poll();
+    EXPECT_EQ(2, completions);
+    EXPECT_EQ(0U, ramcloud->asyncRpcPoller.rpcs.size());
+    EXPECT_TRUE(write1.isReady());
+    write1.wait();
+    EXPECT_EQ(1U, write1.getVersion());
+
+    Buffer value;
+    RamCloud::AsyncRead read1(*ramcloud, tableId1, "0", 1, &value);
+    read1.wait();
+    EXPECT_EQ("abcdef", TestUtil::toString(&value));
+    EXPECT_EQ(1U, read1.getVersion());
+
+    RamCloud::AsyncRead read2(*ramcloud, tableId1, "2", 1, &value);
+    EXPECT_THROW(read2.wait(), ObjectDoesntExistException);
+    EXPECT_EQ(STATUS_OBJECT_DOESNT_EXIST, read2.getStatus());
+}
+
+TEST_F(RamCloudTest, asyncRpc_transportError) {
+    cluster.transport.errorMessage = "I'm sorry, Dave";
+    Buffer value;
+    RamCloud::AsyncRead read(*ramcloud, tableId1, "0", 1, &value);
+    EXPECT_THROW(read.wait(), TransportException);
+}
+
+TEST_F(RamCloudTest, asyncRpcPoller_destroyedWhileOutstanding) {
+    int completions = 0;
+    Tub<RamCloud::AsyncWrite> writes[3];
+    for (int i = 0; i < 3; i++) {
+        writes[i].construct(*ramcloud, tableId1, "0", 1, "abc", 3,
+                            static_cast<RejectRules*>(NULL), false,
+                            countCompletion, &completions);
+    }
+    writes[0].destroy();
+    EXPECT_EQ(2U, ramcloud->asyncRpcPoller.rpcs.size());
+    EXPECT_EQ(0, writes[2]->slot);
+    ramcloud->poll();
+    EXPECT_EQ(2, completions);
+    EXPECT_TRUE(writes[1]->isReady());
+    EXPECT_TRUE(writes[2]->isReady());
+}
+
+TEST_F(RamCloudTest, readCoalescing_maxReads) {
+    ramcloud->write(tableId1, "0", 1, "abcdef", 6);
+    ramcloud->write(tableId2, "1", 1, "xyz", 3);
+    ramcloud->setReadCoalescing(1000000, 3);
+
+    int completions = 0;
+    Buffer value1, value2, value3;
+    RamCloud::AsyncRead read1(*ramcloud, tableId1, "0", 1, &value1, NULL,
+                              countCompletion, &completions);
+    RamCloud::AsyncRead read2(*ramcloud, tableId2, "1", 1, &value2, NULL,
+                              countCompletion, &completions);
+    EXPECT_EQ(2U, ramcloud->readCoalescer.waiting.size());
+    EXPECT_EQ(0U, ramcloud->readCoalescer.inFlight.size());
+    RamCloud::AsyncRead read3(*ramcloud, tableId1, "2", 1, &value3, NULL,
+                              countCompletion, &completions);
+    EXPECT_EQ(0U, ramcloud->readCoalescer.waiting.size());
+    EXPECT_EQ(2U, ramcloud->readCoalescer.inFlight.size());
+    EXPECT_EQ(0, completions);
+
+    ramcloud->poll();
+    EXPECT_EQ(3, completions);
+    EXPECT_EQ(0U, ramcloud->readCoalescer.inFlight.size());
+    read1.wait();
+    EXPECT_EQ("abcdef", TestUtil::toString(&value1));
+    EXPECT_EQ(1U, read1.getVersion());
+    read2.wait();
+    EXPECT_EQ("xyz", TestUtil::toString(&value2));
+    EXPECT_THROW(read3.wait(), ObjectDoesntExistException);
+}
+
+TEST_F(RamCloudTest, readCoalescing_waitFlushes) {
+    ramcloud->write(tableId1, "0", 1, "abcdef", 6);
+    ramcloud->setReadCoalescing(1000000, 10);
+    Buffer value1, value2;
+    RamCloud::AsyncRead read1(*ramcloud, tableId1, "0", 1, &value1);
+    RamCloud::AsyncRead read2(*ramcloud, tableId1, "0", 1, &value2);
+    EXPECT_EQ(2U, ramcloud->readCoalescer.waiting.size());
+    read1.wait();
+    EXPECT_TRUE(read2.isReady());
+    EXPECT_EQ("abcdef", TestUtil::toString(&value1));
+    EXPECT_EQ("abcdef", TestUtil::toString(&value2));
+
+    // Blocking reads go through the coalescer as well.
+    value1.reset();
+    uint64_t version;
+    ramcloud->read(tableId1, "0", 1, &value1, NULL, &version);
+    EXPECT_EQ("abcdef", TestUtil::toString(&value1));
+    EXPECT_EQ(1U, version);
+}
+
+TEST_F(RamCloudTest, readCoalescing_window) {
+    ramcloud->write(tableId1, "0", 1, "abcdef", 6);
+    ramcloud->setReadCoalescing(0, 10);
+    Buffer value;
+    RamCloud::AsyncRead read(*ramcloud, tableId1, "0", 1, &value);
+    EXPECT_EQ(1U, ramcloud->readCoalescer.waiting.size());
+    ramcloud->poll();
+    EXPECT_EQ(0U, ramcloud->readCoalescer.waiting.size());
+    ramcloud->poll();
+    EXPECT_TRUE(read.isReady());
+    EXPECT_EQ("abcdef", TestUtil::toString(&value));
+}
+
+TEST_F(RamCloudTest, readCoalescing_readFromCallback) {
+    ramcloud->write(tableId1, "0", 1, "abcdef", 6);
+    ramcloud->setReadCoalescing(1000000, 10);
+    ReadAgain again(this);
+    Buffer value;
+    RamCloud::AsyncRead read(*ramcloud, tableId1, "0", 1, &value, NULL,
+                             readAgain, &again);
+    ramcloud->readCoalescer.flush();
+    ramcloud->poll();
+    EXPECT_TRUE(read.isReady());
+
+    // The read issued from the callback is held back like any other.
+    ASSERT_TRUE(again.read);
+    EXPECT_EQ(1U, ramcloud->readCoalescer.waiting.size());
+    ramcloud->poll();
+    EXPECT_EQ(1U, ramcloud->readCoalescer.waiting.size());
+    again.read->wait();
+    EXPECT_EQ("abcdef", TestUtil::toString(&again.value));
+}
+
+TEST_F(RamCloudTest, readCoalescing_destroyedWhileOutstanding) {
+    ramcloud->write(tableId1, "0", 1, "abcdef", 6);
+    ramcloud->setReadCoalescing(1000000, 2);
+    int completions = 0;
+    Buffer value1, value2;
+    Tub<RamCloud::AsyncRead> read1;
+    read1.construct(*ramcloud, tableId1, "0", 1, &value1,
+                    static_cast<RejectRules*>(NULL), countCompletion,
+                    &completions);
+    RamCloud::AsyncRead read2(*ramcloud, tableId1, "0", 1, &value2, NULL,
+                              countCompletion, &completions);
+    read1.destroy();
+    ramcloud->poll();
+    EXPECT_EQ(1, completions);
+    EXPECT_EQ("abcdef", TestUtil::toString(&value2));
+}
+
+TEST_F(RamCloudTest, readCoalescing_unknownTable) {
+    ramcloud->setReadCoalescing(1000000, 10);
+    Buffer value;
+    RamCloud::AsyncRead read(*ramcloud, 99, "0", 1, &value);
+    EXPECT_THROW(read.wait(), TableDoesntExistException);
+}
+
 TEST_F(RamCloudTest, writeString) {
     uint64_t tableId1 = ramcloud->getTableId("table1");
     ramcloud->write(tableId1, "99", 2, "abcdef");
@@ -92,6 +92,7 @@ class RecoverSegmentBenchmark {
         tablet.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
         tablet.set_server_id(service->serverId.getId());
         *service->tablets.add_tablet() = tablet;
+        service->indexTablets();
 
         /*
          * Now run a fake recovery.
@@ -15,6 +15,7 @@
 
 #include "BackupClient.h"
 #include "CycleCounter.h"
+#include "Cycles.h"
 #include "Logger.h"
 #include "ShortMacros.h"
 #include "RawMetrics.h"
@@ -40,11 +41,17 @@ namespace RAMCloud {
  *      updated for this server in the case of some failures.  May be
  *      NULL for testing in which case updates will not be sent to the
  *      coordinator.
+ * \param maxWriteDelayMicros
+ *      Longest time, in microseconds, that data written to a segment may be
+ *      held back before it is sent to backups, so that writes arriving
+ *      meanwhile go out in the same write rpc and are acknowledged together.
+ *      0 sends data as soon as possible.
  */
 ReplicaManager::ReplicaManager(ServerList& serverList,
                                const ServerId& masterId,
                                uint32_t numReplicas,
-                               const string* coordinatorLocator)
+                               const string* coordinatorLocator,
+                               uint32_t maxWriteDelayMicros)
     : numReplicas(numReplicas)
     , tracker(serverList)
     , backupSelector(tracker)
@@ -55,6 +62,7 @@ ReplicaManager::ReplicaManager(ServerList& serverList,
     , replicatedSegmentList()
     , taskManager()
     , writeRpcsInFlight(0)
+    , maxWriteDelay(Cycles::fromNanoseconds(maxWriteDelayMicros * 1000UL))
     , minOpenSegmentId()
     , failureMonitor(serverList, this)
 {
@@ -209,7 +217,8 @@ ReplicaManager::openSegment(bool isLogHead, uint64_t segmentId,
                                  writeRpcsInFlight, *minOpenSegmentId,
                                  dataMutex,
                                  isLogHead, masterId, segmentId,
-                                 data, openLen, numReplicas);
+                                 data, openLen, numReplicas,
+                                 1024 * 1024, maxWriteDelay);
     replicatedSegmentList.push_back(*replicatedSegment);
     replicatedSegment->schedule();
     return replicatedSegment;
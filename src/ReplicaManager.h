@@ -63,7 +63,8 @@ class ReplicaManager
     ReplicaManager(ServerList& serverList,
                    const ServerId& masterId,
                    uint32_t numReplicas,
-                   const string* coordinatorLocator);
+                   const string* coordinatorLocator,
+                   uint32_t maxWriteDelayMicros = 0);
     ~ReplicaManager();
 
     bool isIdle();
@@ -132,6 +133,13 @@ class ReplicaManager
      */
     uint32_t writeRpcsInFlight;
 
+    /**
+     * Longest time, in cycles, that a ReplicatedSegment holds back data
+     * queued for a replica so that later writes can share its write rpc.
+     * See ReplicatedSegment::maxWriteDelay.
+     */
+    const uint64_t maxWriteDelay;
+
     /**
      * Provides access to the latest minOpenSegmentId acknowledged by the
      * coordinator for this server and allows easy, asynchronous updates
@@ -13,6 +13,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include "Cycles.h"
 #include "ReplicatedSegment.h"
 #include "ShortMacros.h"
 
@@ -61,6 +62,9 @@ namespace RAMCloud {
  * \param maxBytesPerWriteRpc
  *      Maximum bytes to send in a single write rpc; can help latency of
  *      GetRecoveryDataRequests by unclogging backups a bit.
+ * \param maxWriteDelay
+ *      Longest time, in cycles, that queued data may be held back so that
+ *      later writes can be sent in the same write rpc; see #maxWriteDelay.
  */
 ReplicatedSegment::ReplicatedSegment(TaskManager& taskManager,
                                      BackupTracker& tracker,
@@ -75,7 +79,8 @@ ReplicatedSegment::ReplicatedSegment(TaskManager& taskManager,
                                      const void* data,
                                      uint32_t openLen,
                                      uint32_t numReplicas,
-                                     uint32_t maxBytesPerWriteRpc)
+                                     uint32_t maxBytesPerWriteRpc,
+                                     uint64_t maxWriteDelay)
     : Task(taskManager)
     , tracker(tracker)
     , backupSelector(backupSelector)
@@ -89,8 +94,10 @@ ReplicatedSegment::ReplicatedSegment(TaskManager& taskManager,
     , data(data)
     , openLen(openLen)
     , maxBytesPerWriteRpc(maxBytesPerWriteRpc)
+    , maxWriteDelay(maxWriteDelay)
     , queued(true, openLen, false)
     , freeQueued(false)
+    , dataReleased(false)
     , followingSegment(NULL)
     , precedingSegmentCloseAcked(true)
     , recoveringFromLostOpenReplicas(false)
@@ -152,6 +159,38 @@ ReplicatedSegment::free()
     schedule();
 }
 
+/**
+ * Wait for the segment to be fully replicated and then stop reading the
+ * segment data, so that the log may reuse the memory holding it while
+ * the replicas are kept. If a backup holding one of the replicas fails
+ * afterwards the replica is not recreated; see hasLostReplicas().
+ * Requires that the segment has been closed.
+ */
+void
+ReplicatedSegment::releaseData()
+{
+    while (true) {
+        Lock lock(dataMutex);
+        assert(queued.close);
+        if (isSynced()) {
+            dataReleased = true;
+            break;
+        }
+        taskManager.proceed();
+    }
+}
+
+/**
+ * Return true if a replica of this segment was lost after releaseData()
+ * and so this segment is no longer durably replicated.
+ */
+bool
+ReplicatedSegment::hasLostReplicas()
+{
+    Lock _(dataMutex);
+    return dataReleased && !isSynced();
+}
+
 /**
  * Return true if no further actions are needed to durably replicate this
  * segment.  This can change as this master learns about failures in the
@@ -388,6 +427,13 @@ ReplicatedSegment::write(uint32_t offset)
     assert(!queued.close);
     // offset monotonically increases
     assert(offset >= queued.bytes);
+
+    // Replicas that had been sent everything start waiting anew.
+    uint64_t now = Cycles::rdtsc();
+    foreach (auto& replica, replicas) {
+        if (replica.sent.bytes == queued.bytes)
+            replica.unsentSince = now;
+    }
     queued.bytes = offset;
 
     schedule();
@@ -458,7 +504,7 @@ ReplicatedSegment::performTask()
                 schedule();
             }
         }
-        assert(isSynced() || isScheduled());
+        assert(isSynced() || isScheduled() || dataReleased);
     }
 }
 
@@ -543,6 +589,11 @@ ReplicatedSegment::performWrite(Replica& replica)
         return;
     }
 
+    if (dataReleased && !replica.writeRpc) {
+        // The segment data is gone; the log must rewrite it elsewhere.
+        return;
+    }
+
     if (!replica.isActive) {
         // This replica does not exist yet. Choose a backup.
         // Selection of a backup is separated from the send of the open rpc
@@ -667,6 +718,18 @@ ReplicatedSegment::performWrite(Replica& replica)
                 flags = BackupWriteRpc::NONE;
             }
 
+            if (flags == BackupWriteRpc::NONE &&
+                length < maxBytesPerWriteRpc &&
+                Cycles::rdtsc() - replica.unsentSince < maxWriteDelay) {
+                TEST_LOG("Holding back write of segment %lu for more data",
+                         segmentId);
+                // Group commit: give other writers a moment to queue data
+                // that can go out in the same rpc as this, so that they are
+                // acknowledged by the same round trip.
+                schedule();
+                return;
+            }
+
             if (flags == BackupWriteRpc::CLOSE &&
                 followingSegment &&
                 !followingSegment->getAcked().open) {
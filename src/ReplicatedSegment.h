@@ -198,6 +198,7 @@ class ReplicatedSegment : public Task {
             , sent()
             , freeRpc()
             , writeRpc()
+            , unsentSince(0)
             , replicateAtomically(false)
         {}
 
@@ -284,6 +285,12 @@ class ReplicatedSegment : public Task {
         /// The outstanding write operation to this backup, if any.
         Tub<BackupClient::WriteSegment> writeRpc;
 
+        /**
+         * Cycles::rdtsc() when the oldest data that has been queued but
+         * not yet sent to this replica was queued; see #maxWriteDelay.
+         */
+        uint64_t unsentSince;
+
         // Fields below survive across failed()/start() calls.
 
         /**
@@ -305,6 +312,8 @@ class ReplicatedSegment : public Task {
 // --- ReplicatedSegment ---
   PUBLIC:
     void free();
+    void releaseData();
+    bool hasLostReplicas();
     bool isSynced() const;
     void close(ReplicatedSegment* followingSegment);
     bool handleBackupFailure(ServerId failedId)
@@ -332,7 +341,8 @@ class ReplicatedSegment : public Task {
                       ServerId masterId, uint64_t segmentId,
                       const void* data, uint32_t openLen,
                       uint32_t numReplicas,
-                      uint32_t maxBytesPerWriteRpc = 1024 * 1024);
+                      uint32_t maxBytesPerWriteRpc = 1024 * 1024,
+                      uint64_t maxWriteDelay = 0);
     ~ReplicatedSegment();
 
     void performTask();
@@ -429,6 +439,16 @@ class ReplicatedSegment : public Task {
      */
     const uint32_t maxBytesPerWriteRpc;
 
+    /**
+     * Longest time, in cycles, that data queued for a replica may be held
+     * back before a write rpc is sent for it. While it waits, more writes
+     * may be queued and then go out in the same rpc, so that their writers
+     * are all acknowledged by a single round trip to the backup (group
+     * commit). 0 sends each write as soon as the replica has no rpc
+     * outstanding.
+     */
+    const uint64_t maxWriteDelay;
+
     /**
      * Tracks how much of a segment the log module has made available for
      * replication.
@@ -438,6 +458,12 @@ class ReplicatedSegment : public Task {
     /// True if all known replicas of this segment should be freed on backups.
     bool freeQueued;
 
+    /**
+     * True once #data may no longer be read; see releaseData(). Replicas lost
+     * after this point are not recreated.
+     */
+    bool dataReleased;
+
     /**
      * The segment that logically follows this one in the log; set by close().
      * Needed to make two guarantees.
@@ -17,6 +17,7 @@
 
 #include "TestUtil.h"
 #include "BackupSelector.h"
+#include "Cycles.h"
 #include "Memory.h"
 #include "ReplicatedSegment.h"
 #include "ShortMacros.h"
@@ -127,7 +128,7 @@ struct ReplicatedSegmentTest : public ::testing::Test {
 
 
     std::unique_ptr<ReplicatedSegment>
-    newSegment(uint64_t segmentId) {
+    newSegment(uint64_t segmentId, uint64_t maxWriteDelay = 0) {
         void* segMem = operator new(ReplicatedSegment::sizeOf(numReplicas));
         auto newHead = std::unique_ptr<ReplicatedSegment>(
                 new(segMem) ReplicatedSegment(taskManager, tracker,
@@ -137,7 +138,8 @@ struct ReplicatedSegmentTest : public ::testing::Test {
                                               dataMutex, true,
                                               masterId, segmentId,
                                               data, openLen, numReplicas,
-                                              MAX_BYTES_PER_WRITE));
+                                              MAX_BYTES_PER_WRITE,
+                                              maxWriteDelay));
         return newHead;
     }
 
@@ -277,6 +279,33 @@ TEST_F(ReplicatedSegmentTest, handleBackupFailureWhileHandlingFailure) {
     reset();
 }
 
+TEST_F(ReplicatedSegmentTest, releaseData) {
+    transport.setInput("0 0 0"); // server id check
+    transport.setInput("0 0"); // open
+    transport.setInput("0 1 0"); // server id check
+    transport.setInput("0 0"); // open
+    segment->write(openLen);
+    taskManager.proceed(); // send opens
+    taskManager.proceed(); // reap opens
+
+    transport.setInput("0 0"); // close
+    transport.setInput("0 0"); // close
+    segment->close(NULL);
+    segment->releaseData(); // waits for the closes
+    EXPECT_TRUE(segment->isSynced());
+    EXPECT_TRUE(segment->dataReleased);
+    EXPECT_FALSE(segment->hasLostReplicas());
+
+    // The lost replica isn't recreated from the released data.
+    EXPECT_FALSE(segment->handleBackupFailure({0, 0}));
+    transport.outputLog = "";
+    taskManager.proceed();
+    EXPECT_EQ("", transport.outputLog);
+    EXPECT_FALSE(segment->replicas[0].isActive);
+    EXPECT_FALSE(segment->isScheduled());
+    EXPECT_TRUE(segment->hasLostReplicas());
+}
+
 TEST_F(ReplicatedSegmentTest, sync) {
     transport.setInput("0 0 0"); // server id check
     transport.setInput("0 0"); // write
@@ -925,6 +954,40 @@ TEST_F(ReplicatedSegmentTest, performWriteMoreToSend) {
     reset();
 }
 
+TEST_F(ReplicatedSegmentTest, performWriteGroupCommitDelay) {
+    transport.setInput("0 0 0"); // server id check
+    transport.setInput("0 0"); // write
+    transport.setInput("0 1 0"); // server id check
+    transport.setInput("0 0"); // write
+    transport.setInput("0 0"); // write
+    transport.setInput("0 0"); // write
+
+    reset();
+    segment = newSegment(segmentId, 1000);
+    taskManager.proceed(); // send open
+    taskManager.proceed(); // reap opens
+
+    Cycles::mockTscValue = 5000;
+    segment->write(openLen + 10);
+    Cycles::mockTscValue = 5500;
+    segment->write(openLen + 20);
+    transport.outputLog = "";
+    taskManager.proceed(); // oldest unsent data is too young, hold back
+    EXPECT_EQ("", transport.outputLog);
+    EXPECT_TRUE(segment->isScheduled());
+
+    Cycles::mockTscValue = 6000;
+    taskManager.proceed(); // both writes go out in one rpc per replica
+    EXPECT_STREQ(
+        "clientSend: 0x10020 999 0 888 0 10 20 0 klmnopqrstuvwxyzabce | "
+        "clientSend: 0x10020 999 0 888 0 10 20 0 klmnopqrstuvwxyzabce",
+        transport.outputLog.c_str());
+    EXPECT_TRUE(segment->replicas[0].writeRpc);
+
+    Cycles::mockTscValue = 0;
+    reset();
+}
+
 TEST_F(ReplicatedSegmentTest, performWriteClosedButLongerThanMaxTxLimit) {
     transport.setInput("0 0 0"); // server id check
     transport.setInput("0 0"); // write
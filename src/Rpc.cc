@@ -93,6 +93,10 @@ Rpc::opcodeSymbol(uint32_t opcode)
         case IS_REPLICA_NEEDED:          return "IS_REPLICA_NEEDED";
         case SPLIT_TABLET:               return "SPLIT_TABLET";
         case GET_SERVER_STATISTICS:      return "GET_SERVER_STATISTICS";
+        case SPLIT_TABLET_BY_ID:         return "SPLIT_TABLET_BY_ID";
+        case SPLIT_TABLET_AT_MEDIAN:     return "SPLIT_TABLET_AT_MEDIAN";
+        case MULTI_WRITE:                return "MULTI_WRITE";
+        case MULTI_REMOVE:               return "MULTI_REMOVE";
         case ILLEGAL_RPC_TYPE:           return "ILLEGAL_RPC_TYPE";
     }
 
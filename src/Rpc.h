@@ -106,7 +106,11 @@ enum RpcOpcode {
     IS_REPLICA_NEEDED       = 48,
     SPLIT_TABLET            = 49,
     GET_SERVER_STATISTICS   = 50,
-    ILLEGAL_RPC_TYPE        = 51,  // 1 + the highest legitimate RpcOpcode
+    SPLIT_TABLET_BY_ID      = 51,
+    SPLIT_TABLET_AT_MEDIAN  = 52,
+    MULTI_WRITE             = 53,
+    MULTI_REMOVE            = 54,
+    ILLEGAL_RPC_TYPE        = 55,  // 1 + the highest legitimate RpcOpcode
 };
 
 /**
@@ -229,6 +233,8 @@ struct MigrateTabletRpc {
         uint64_t firstKey;          // First key of the tablet to migrate.
         uint64_t lastKey;           // Last key of the tablet to migrate.
         uint64_t newOwnerMasterId;  // ServerId of the master to migrate to.
+        uint64_t bytesPerSecond;    // Limit on the rate data is sent at, or
+                                    // 0 for the source master's default.
     } __attribute__((packed));
     struct Response {
         RpcResponseCommon common;
@@ -262,6 +268,72 @@ struct MultiReadRpc {
     } __attribute__((packed));
 };
 
+struct MultiRemoveRpc {
+    static const RpcOpcode opcode = MULTI_REMOVE;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t count;
+        struct Part {
+            uint64_t tableId;
+            uint16_t keyLength;
+            RejectRules rejectRules;
+            // In buffer: The actual key for this part
+            // follows immediately after this.
+            Part(uint64_t tableId, uint16_t keyLength,
+                 const RejectRules& rejectRules)
+                : tableId(tableId), keyLength(keyLength),
+                  rejectRules(rejectRules) {}
+        } __attribute__((packed));
+    } __attribute__((packed));
+    struct Response {
+        // RpcResponseCommon contains a status field. But it is not used in
+        // multiRemove since there is a separate status for each object.
+        // Included here to fulfill requirements in common code.
+        RpcResponseCommon common;
+        uint32_t count;
+        struct Part {
+            Status status;
+            uint64_t version;
+        } __attribute__((packed));
+        // In buffer: A Part for each object, in the order of the request.
+    } __attribute__((packed));
+};
+
+struct MultiWriteRpc {
+    static const RpcOpcode opcode = MULTI_WRITE;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t count;
+        uint8_t async;
+        struct Part {
+            uint64_t tableId;
+            uint16_t keyLength;
+            uint32_t length;              // Length of the object's value.
+            RejectRules rejectRules;
+            // In buffer: The actual key for this part follows
+            // immediately after this, and the value after the key.
+            Part(uint64_t tableId, uint16_t keyLength, uint32_t length,
+                 const RejectRules& rejectRules)
+                : tableId(tableId), keyLength(keyLength), length(length),
+                  rejectRules(rejectRules) {}
+        } __attribute__((packed));
+    } __attribute__((packed));
+    struct Response {
+        // RpcResponseCommon contains a status field. But it is not used in
+        // multiWrite since there is a separate status for each object.
+        // Included here to fulfill requirements in common code.
+        RpcResponseCommon common;
+        uint32_t count;
+        struct Part {
+            Status status;
+            uint64_t version;
+        } __attribute__((packed));
+        // In buffer: A Part for each object, in the order of the request.
+    } __attribute__((packed));
+};
+
 struct PrepForMigrationRpc {
     static const RpcOpcode opcode = PREP_FOR_MIGRATION;
     static const ServiceType service = MASTER_SERVICE;
@@ -459,6 +531,45 @@ struct SplitTabletRpc {
 };
 
 
+struct SplitTabletByIdRpc {
+    static const RpcOpcode opcode = SPLIT_TABLET_BY_ID;
+    static const ServiceType service = COORDINATOR_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint64_t tableId;             // Id of the table that contains the to
+                                      // be split tablet.
+        uint64_t startKeyHash;        // Identify the to be split tablet by
+                                      // providing its current start key hash.
+        uint64_t endKeyHash;          // Identify the to be split tablet by
+                                      // providing its current end key hash.
+        uint64_t splitKeyHash;        // Indicate where to split the tablet.
+                                      // This will be the first key of the
+                                      // second tablet after the split.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+    } __attribute__((packed));
+};
+
+struct SplitTabletAtMedianRpc {
+    static const RpcOpcode opcode = SPLIT_TABLET_AT_MEDIAN;
+    static const ServiceType service = COORDINATOR_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint64_t tableId;             // Id of the table that contains the to
+                                      // be split tablet.
+        uint64_t startKeyHash;        // Identify the to be split tablet by
+                                      // providing its current start key hash.
+        uint64_t endKeyHash;          // Identify the to be split tablet by
+                                      // providing its current end key hash.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+        uint64_t splitKeyHash;        // The first key of the second tablet
+                                      // after the split.
+    } __attribute__((packed));
+};
+
 struct SplitMasterTabletRpc {
     static const RpcOpcode opcode = SPLIT_TABLET;
     static const ServiceType service = MASTER_SERVICE;
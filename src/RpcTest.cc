@@ -44,7 +44,7 @@ TEST_F(RpcTest, opcodeSymbol_integer) {
     EXPECT_STREQ("ILLEGAL_RPC_TYPE", Rpc::opcodeSymbol(ILLEGAL_RPC_TYPE));
 
     // Test out-of-range values.
-    EXPECT_STREQ("unknown(52)", Rpc::opcodeSymbol(ILLEGAL_RPC_TYPE+1));
+    EXPECT_STREQ("unknown(56)", Rpc::opcodeSymbol(ILLEGAL_RPC_TYPE+1));
 
     // Make sure the next-to-last value is defined (this will fail if
     // someone adds a new opcode and doesn't update opcodeSymbol).
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "Buffer.h"
 #include "Crc32C.h"
 #include "CycleCounter.h"
 #include "RawMetrics.h"
@@ -31,6 +32,11 @@
 
 namespace RAMCloud {
 
+/// Segment::copyAndChecksum copies and checksums this many bytes at a
+/// time: enough to make the checksum's per-call cost vanish, few enough
+/// to still be in the L1 cache when they're checksummed.
+static const uint32_t COPY_PIECE_BYTES = 4096;
+
 /**
  * Constructor for Segment.
  * \param log
@@ -95,6 +101,9 @@ Segment::Segment(Log *log,
       entryCountsByType(),
       listEntries(),
       cleanedEpoch(-1),
+      inMemoryOnly(false),
+      compacted(false),
+      compactedSegments(),
       replicatedSegment(NULL)
 {
     commonConstructor(isLogHead, type, buffer, length,
@@ -147,6 +156,9 @@ Segment::Segment(uint64_t logId,
       entryCountsByType(),
       listEntries(),
       cleanedEpoch(-1),
+      inMemoryOnly(false),
+      compacted(false),
+      compactedSegments(),
       replicatedSegment(NULL)
 {
     commonConstructor(true, LOG_ENTRY_TYPE_INVALID, NULL, 0,
@@ -260,7 +272,8 @@ SegmentEntryHandleVector
 Segment::multiAppend(SegmentMultiAppendVector& appends, bool sync)
 {
     CycleCounter<RawMetric> _(&metrics->master.segmentAppendTicks);
-    std::lock_guard<SpinLock> lock(mutex);
+    Tub<std::lock_guard<SpinLock>> lock;
+    lock.construct(mutex);
     SegmentEntryHandleVector handles;
 
     if (closed)
@@ -281,18 +294,25 @@ Segment::multiAppend(SegmentMultiAppendVector& appends, bool sync)
                                          appends[i].buffer,
                                          appends[i].length,
                                          false,
-                                         appends[i].expectedChecksum));
+                                         appends[i].expectedChecksum,
+                                         appends[i].source,
+                                         appends[i].sourceOffset,
+                                         appends[i].sourceLength));
 
         // This should never fail. It was up to this method to ensure
         // success before starting the appends.
         assert(handles[i] != NULL);
     }
 
-    // Sync once, if needed, in order to write everything atomically.
+    // Sync once, if needed, in order to write everything atomically. The
+    // lock is released first, so that other threads' appends meanwhile can
+    // go out to backups along with these (group commit).
     if (replicatedSegment) {
         replicatedSegment->write(tail);
+        uint32_t appendedBytes = tail;
+        lock.destroy();
         if (sync)
-            replicatedSegment->sync(tail);
+            replicatedSegment->sync(appendedBytes);
     }
 
     return handles;
@@ -478,6 +498,23 @@ Segment::sync()
         replicatedSegment->sync(tail);
 }
 
+/**
+ * Wait for the first \a offset bytes of the segment to be replicated. Unlike
+ * #sync() this doesn't hold the Segment's lock while waiting, so data that
+ * other threads append meanwhile can be replicated in the same write rpcs.
+ *
+ * \param offset
+ *      Number of bytes from the start of the segment that must be durable,
+ *      such as the end of an entry just appended.
+ */
+void
+Segment::sync(uint32_t offset)
+{
+    ReplicatedSegment* replicas = replicatedSegment;
+    if (replicas)
+        replicas->sync(offset);
+}
+
 /**
  * Request the eventual freeing all known replicas of a segment from its
  * backups.  Requires that the segment has been closed.
@@ -493,6 +530,30 @@ Segment::freeReplicas()
     }
 }
 
+/**
+ * Wait for the segment to be fully replicated and then stop its replicas
+ * from being rewritten from this Segment's memory, so that the memory may be
+ * reused while the replicas are kept. Used by the LogCleaner when it
+ * compacts the segment. Requires that the segment has been closed.
+ */
+void
+Segment::detachReplicas()
+{
+    assert(closed);
+    if (replicatedSegment)
+        replicatedSegment->releaseData();
+}
+
+/**
+ * Return true if some replica of this segment was lost after
+ * #detachReplicas was called and so can no longer be recreated from memory.
+ */
+bool
+Segment::hasLostReplicas()
+{
+    return replicatedSegment != NULL && replicatedSegment->hasLostReplicas();
+}
+
 
 /**
  * Obtain a const pointer to the first byte of backing memory for this Segment.
@@ -635,6 +696,13 @@ Segment::getAverageTimestamp()
  *      The checksum we expect this entry to have once appended. If the
  *      actual calculated checksum does not match, an exception is
  *      thrown and nothing is appended. This parameter is optional.
+ * \param source
+ *      If not NULL, the last \a sourceLength of the \a length bytes are
+ *      copied from this Buffer rather than from \a buffer.
+ * \param sourceOffset
+ *      Offset in \a source of the first byte to copy.
+ * \param sourceLength
+ *      Number of bytes to copy from \a source.
  * \return
  *      On success, a SegmentEntryHandle is returned, which points to the
  *      ``buffer'' written. On failure, the handle is NULL. We avoid using
@@ -642,7 +710,8 @@ Segment::getAverageTimestamp()
  */
 SegmentEntryHandle
 Segment::locklessAppend(LogEntryType type, const void *buffer, uint32_t length,
-    bool sync, Tub<SegmentChecksum::ResultType> expectedChecksum)
+    bool sync, Tub<SegmentChecksum::ResultType> expectedChecksum,
+    const Buffer* source, uint32_t sourceOffset, uint32_t sourceLength)
 {
     CycleCounter<RawMetric> _(&metrics->master.segmentAppendTicks);
 
@@ -651,7 +720,7 @@ Segment::locklessAppend(LogEntryType type, const void *buffer, uint32_t length,
         return NULL;
 
     return forceAppendWithEntry(type, buffer, length,
-        sync, true, expectedChecksum);
+        sync, true, expectedChecksum, source, sourceOffset, sourceLength);
 }
 
 /**
@@ -818,6 +887,38 @@ Segment::forceAppendRepeatedByte(uint8_t byte, uint32_t length)
     return static_cast<void *>(dst);
 }
 
+/**
+ * Copy data into the Segment's backing memory, updating a checksum with it
+ * as it goes. The data is copied and checksummed in pieces small enough to
+ * stay in the cache, so that the checksum reads the bytes just written
+ * rather than making a second trip to memory for them.
+ * \param dst
+ *      Where to copy the data to.
+ * \param src
+ *      The data to copy.
+ * \param length
+ *      Number of bytes to copy.
+ * \param checksum
+ *      Checksum to update with the data, or NULL if none.
+ */
+void
+Segment::copyAndChecksum(uint8_t* dst, const void* src, uint32_t length,
+                         SegmentChecksum* checksum)
+{
+    const uint8_t* from = static_cast<const uint8_t*>(src);
+    while (length > 0) {
+        uint32_t pieceLength = length;
+        if (pieceLength > COPY_PIECE_BYTES)
+            pieceLength = COPY_PIECE_BYTES;
+        memcpy(dst, from, pieceLength);
+        if (checksum != NULL)
+            checksum->update(dst, pieceLength);
+        dst += pieceLength;
+        from += pieceLength;
+        length -= pieceLength;
+    }
+}
+
 /**
  * Append an entry of any type to the Segment. This function will always
  * succeed so long as there is sufficient room left in the tail of the Segment.
@@ -825,13 +926,11 @@ Segment::forceAppendRepeatedByte(uint8_t byte, uint32_t length)
  *      The type of entry to append.
  * \param buffer
  *      Data to be appended to this Segment.  If buffer is NULL then an entry
- *      \a length bytes is inserted but is left uninitialized.  This should
- *      probably only be used with LogEntryType UNINIT or INVALID.  Passing
- *      \a updateChecksum as true with a NULL \a buffer will segfault; this
- *      can only be done for entries which do not require integrity for
- *      correct operation.
+ *      \a length bytes is inserted but is zero-filled.  This should
+ *      probably only be used with LogEntryType UNINIT or INVALID.
  * \param length
- *      Length of the data to be appended in bytes.
+ *      Length of the data to be appended in bytes, including any taken
+ *      from \a source.
  * \param sync
  *      If true then this write to replicated to backups before return,
  *      otherwise the replication will happen on a subsequent append()
@@ -847,15 +946,25 @@ Segment::forceAppendRepeatedByte(uint8_t byte, uint32_t length)
  *      for recovery to avoid calculating the checksum twice (once to check
  *      the recovered object, and again when adding to the log). This
  *      parameter is optional and is not normally used.
+ * \param source
+ *      If not NULL, the last \a sourceLength of the \a length bytes are
+ *      copied straight from this Buffer's chunks rather than from \a buffer.
+ *      The Buffer must hold all of them.
+ * \param sourceOffset
+ *      Offset in \a source of the first byte to copy.
+ * \param sourceLength
+ *      Number of bytes to copy from \a source.
  * \return
  *      A SegmentEntryHandle corresponding to the data just written. 
  */
 SegmentEntryHandle
 Segment::forceAppendWithEntry(LogEntryType type, const void *buffer,
     uint32_t length, bool sync, bool updateChecksum,
-    Tub<SegmentChecksum::ResultType> expectedChecksum)
+    Tub<SegmentChecksum::ResultType> expectedChecksum,
+    const Buffer* source, uint32_t sourceOffset, uint32_t sourceLength)
 {
     assert(!closed);
+    assert(sourceLength <= length);
 
     uint64_t freeBytes = capacity - tail;
     uint64_t needBytes = sizeof(SegmentEntry) + length;
@@ -864,11 +973,42 @@ Segment::forceAppendWithEntry(LogEntryType type, const void *buffer,
 
     SegmentEntry entry(type, length);
 
+    // The contents go in right behind the entry header, which is written
+    // last since it holds their checksum. Nothing is appended until the
+    // tail moves, so an unexpected checksum below leaves no trace.
+    SegmentChecksum entryChecksum;
+    SegmentChecksum* contentsChecksum = NULL;
     if (updateChecksum) {
-        CycleCounter<RawMetric> _(&metrics->master.segmentAppendChecksumTicks);
-        SegmentChecksum entryChecksum;
         entryChecksum.update(&entry, sizeof(entry));
-        entryChecksum.update(buffer, length);
+        contentsChecksum = &entryChecksum;
+    }
+    {
+        CycleCounter<RawMetric> _(&metrics->master.segmentAppendCopyTicks);
+        uint8_t* dst = static_cast<uint8_t*>(baseAddress) + tail +
+                       sizeof(entry);
+        uint32_t bufferLength = length - sourceLength;
+        if (buffer) {
+            copyAndChecksum(dst, buffer, bufferLength, contentsChecksum);
+        } else {
+            memset(dst, 0x0, bufferLength);
+            if (contentsChecksum != NULL)
+                contentsChecksum->update(dst, bufferLength);
+        }
+        dst += bufferLength;
+        if (source != NULL) {
+            Buffer::Iterator it(*source, sourceOffset, sourceLength);
+            for (; !it.isDone(); it.next()) {
+                copyAndChecksum(dst, it.getData(), it.getLength(),
+                                contentsChecksum);
+                dst += it.getLength();
+            }
+        }
+        assert(dst == static_cast<uint8_t*>(baseAddress) + tail +
+                      sizeof(entry) + length);
+    }
+
+    if (updateChecksum) {
+        CycleCounter<RawMetric> _(&metrics->master.segmentAppendChecksumTicks);
 
         // The incoming checksum will have had the mutableFields checksum
         // XORed back out, so compare it now.
@@ -900,16 +1040,8 @@ Segment::forceAppendWithEntry(LogEntryType type, const void *buffer,
                          mutableFieldsChecksum.getResult();
     }
 
-    const void* entryPointer;
-    {
-        CycleCounter<RawMetric> _(&metrics->master.segmentAppendCopyTicks);
-        entryPointer = forceAppendBlob(&entry, sizeof(entry));
-        if (buffer) {
-            forceAppendBlob(buffer, length);
-        } else {
-            forceAppendRepeatedByte(0x0, length);
-        }
-    }
+    const void* entryPointer = forceAppendBlob(&entry, sizeof(entry));
+    tail += length;
 
     if (sync && replicatedSegment) {
         // replicatedSegment can be NULL while initial opening entries for the
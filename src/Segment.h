@@ -119,6 +119,7 @@ struct SegmentException : public Exception {
 };
 
 // forward decls
+class Buffer;
 class Log;
 class Segment;
 class _SegmentEntryHandle;
@@ -130,6 +131,14 @@ typedef const _SegmentEntryHandle* SegmentEntryHandle;
 /// Vector of Segment pointers.
 typedef std::vector<Segment*> SegmentVector;
 
+/**
+ * Describes one entry of a Segment::multiAppend. The entry's contents are
+ * the #length - #sourceLength bytes at #buffer, followed by #sourceLength
+ * bytes taken from #source. The latter are copied straight out of the
+ * Buffer's chunks into the segment, so that callers holding data in a
+ * Buffer, such as the value of a write RPC, needn't make their own copy
+ * first.
+ */
 class SegmentMultiAppendEntry {
   public:
     SegmentMultiAppendEntry(LogEntryType type,
@@ -140,15 +149,38 @@ class SegmentMultiAppendEntry {
         : type(type),
           buffer(buffer),
           length(length),
-          expectedChecksum(expectedChecksum)
+          expectedChecksum(expectedChecksum),
+          source(NULL),
+          sourceOffset(0),
+          sourceLength(0)
+    {
+    }
+
+    SegmentMultiAppendEntry(LogEntryType type,
+                            const void* buffer,
+                            uint32_t length,
+                            const Buffer* source,
+                            uint32_t sourceOffset,
+                            uint32_t sourceLength)
+        : type(type),
+          buffer(buffer),
+          length(length),
+          expectedChecksum(),
+          source(source),
+          sourceOffset(sourceOffset),
+          sourceLength(sourceLength)
     {
+        assert(sourceLength <= length);
     }
 
     SegmentMultiAppendEntry(const SegmentMultiAppendEntry& other)
         : type(other.type),
           buffer(other.buffer),
           length(other.length),
-          expectedChecksum(other.expectedChecksum)
+          expectedChecksum(other.expectedChecksum),
+          source(other.source),
+          sourceOffset(other.sourceOffset),
+          sourceLength(other.sourceLength)
     {
     }
 
@@ -159,13 +191,24 @@ class SegmentMultiAppendEntry {
         buffer = other.buffer;
         length = other.length;
         expectedChecksum = other.expectedChecksum;
+        source = other.source;
+        sourceOffset = other.sourceOffset;
+        sourceLength = other.sourceLength;
         return *this;
     }
 
     LogEntryType type;
     const void* buffer;
+
+    /// Total length of the entry's contents, including #sourceLength.
     uint32_t length;
     Tub<SegmentChecksum::ResultType> expectedChecksum;
+
+    /// If not NULL, the last #sourceLength bytes of the entry are
+    /// the bytes of this Buffer starting at #sourceOffset.
+    const Buffer* source;
+    uint32_t sourceOffset;
+    uint32_t sourceLength;
 };
 
 /// TODO(Rumble)
@@ -214,7 +257,10 @@ class Segment {
                                                 uint64_t freeSpaceTimeSum);
     void               close(Segment* nextHead, bool sync = true);
     void               sync();
+    void               sync(uint32_t offset);
     void               freeReplicas();
+    void               detachReplicas();
+    bool               hasLostReplicas();
     const void        *getBaseAddress() const;
     uint64_t           getId() const;
     uint32_t           getCapacity() const;
@@ -309,7 +355,10 @@ class Segment {
                                          uint64_t headSegmentIdDuringCleaning);
     SegmentEntryHandle locklessAppend(LogEntryType type,
                             const void *buffer, uint32_t length, bool sync,
-                            Tub<SegmentChecksum::ResultType> expectedChecksum);
+                            Tub<SegmentChecksum::ResultType> expectedChecksum,
+                            const Buffer* source = NULL,
+                            uint32_t sourceOffset = 0,
+                            uint32_t sourceLength = 0);
     uint32_t           locklessGetLiveBytes() const;
     uint32_t           locklessAppendableBytes() const;
     bool               locklessCanAppendEntries(size_t numberOfEntries,
@@ -321,13 +370,19 @@ class Segment {
     const void        *forceAppendBlob(const void *buffer,
                                        uint32_t length);
     const void        *forceAppendRepeatedByte(uint8_t byte, uint32_t length);
+    static void        copyAndChecksum(uint8_t* dst, const void* src,
+                                       uint32_t length,
+                                       SegmentChecksum* checksum);
     SegmentEntryHandle forceAppendWithEntry(LogEntryType type,
                              const void *buffer,
                              uint32_t length,
                              bool sync = true,
                              bool updateChecksum = true,
                              Tub<SegmentChecksum::ResultType> expectedChecksum =
-                                 Tub<SegmentChecksum::ResultType>());
+                                 Tub<SegmentChecksum::ResultType>(),
+                             const Buffer* source = NULL,
+                             uint32_t sourceOffset = 0,
+                             uint32_t sourceLength = 0);
 
     /// ReplicaManager used to replicate this Segment. This is responsible for
     /// making operations on this Segment durable.
@@ -409,8 +464,8 @@ class Segment {
     uint32_t          entryCountsByType[256];
 
     /*
-     * The following fields are only used externally by the Log class;
-     * the Segment code does not touch them.
+     * The following fields are only used externally by the Log class
+     * and its LogCleaner; the Segment code does not touch them.
      */
 
     /// List pointer for Log code to track the state of this Segment (e.g. is
@@ -421,10 +476,26 @@ class Segment {
     /// is safe to return the memory backing this Segment to the free list.
     uint64_t          cleanedEpoch;
 
+    /// True if the LogCleaner created this Segment by compacting others in
+    /// memory. It has no replicas of its own: backups instead keep those of
+    /// the Segments listed in #compactedSegments.
+    bool              inMemoryOnly;
+
+    /// True once this Segment's live data has been compacted into a Segment
+    /// that is #inMemoryOnly. Its memory is then returned to the Log, but the
+    /// object and its replicas are kept until that Segment is freed.
+    bool              compacted;
+
+    /// If #inMemoryOnly, the compacted Segments whose replicas hold this
+    /// Segment's data on backups. The Segment owns them and lists them in
+    /// LogDigests in its own place.
+    SegmentVector     compactedSegments;
+
      /// Handle to the open segment on backups, or NULL if the segment is freed.
     ReplicatedSegment* replicatedSegment;
 
     friend class Log;
+    friend class LogCleaner;
     friend class SegmentIterator;
 
     DISALLOW_COPY_AND_ASSIGN(Segment);
@@ -472,6 +472,68 @@ TEST_F(SegmentTest, forceAppendWithEntry) {
     EXPECT_EQ(2U, s.entryCountsByType[LOG_ENTRY_TYPE_OBJ]);
 }
 
+TEST_F(SegmentTest, forceAppendWithEntry_fromBuffer) {
+    char alignedBuf[16384] __attribute__((aligned(16384)));
+    Segment s(112233, 445566, alignedBuf, sizeof(alignedBuf));
+
+    // The header, then bytes 10 through 5009 of a Buffer whose chunks
+    // don't line up with either end, the second one being longer than
+    // what copyAndChecksum takes at once.
+    char header[7] = "header";
+    char chunks[6000];
+    for (uint32_t i = 0; i < sizeof(chunks); i++)
+        chunks[i] = static_cast<char>(i * 7);
+    Buffer source;
+    Buffer::Chunk::appendToBuffer(&source, chunks, 20);
+    Buffer::Chunk::appendToBuffer(&source, chunks + 20, 5000);
+    Buffer::Chunk::appendToBuffer(&source, chunks + 5020, 980);
+    uint32_t length = downCast<uint32_t>(sizeof(header)) + 5000;
+
+    SegmentEntryHandle seh = s.forceAppendWithEntry(LOG_ENTRY_TYPE_OBJ,
+        header, length, false, true, Tub<SegmentChecksum::ResultType>(),
+        &source, 10, 5000);
+    ASSERT_TRUE(seh != NULL);
+    EXPECT_EQ(length, seh->length());
+    EXPECT_EQ(0, memcmp(header, seh->userData(), sizeof(header)));
+    EXPECT_EQ(0, memcmp(chunks + 10,
+                        seh->userData<char>() + sizeof(header), 5000));
+    EXPECT_TRUE(seh->isChecksumValid());
+
+    // The checksum is the same as that of a contiguous copy.
+    char contiguous[length];
+    memcpy(contiguous, header, sizeof(header));
+    memcpy(contiguous + sizeof(header), chunks + 10, 5000);
+    SegmentEntry entry(LOG_ENTRY_TYPE_OBJ, length);
+    SegmentChecksum expectedChecksum;
+    expectedChecksum.update(&entry, sizeof(entry));
+    expectedChecksum.update(contiguous, length);
+    uint32_t tail = s.tail;
+    EXPECT_THROW(s.forceAppendWithEntry(LOG_ENTRY_TYPE_OBJ, header, length,
+        false, true, expectedChecksum.getResult() + 1, &source, 10, 5000),
+        SegmentException);
+    EXPECT_EQ(tail, s.tail);
+    seh = s.forceAppendWithEntry(LOG_ENTRY_TYPE_OBJ, header, length,
+        false, true, expectedChecksum.getResult(), &source, 10, 5000);
+    EXPECT_TRUE(seh != NULL);
+}
+
+TEST_F(SegmentTest, multiAppend_fromBuffer) {
+    char alignedBuf[8192] __attribute__((aligned(8192)));
+    Segment s(1, 2, alignedBuf, sizeof(alignedBuf));
+
+    Buffer source;
+    Buffer::Chunk::appendToBuffer(&source, "0123", 4);
+    Buffer::Chunk::appendToBuffer(&source, "4567", 4);
+    SegmentMultiAppendVector appends;
+    appends.push_back({ LOG_ENTRY_TYPE_OBJ, "ab", 2 });
+    appends.push_back({ LOG_ENTRY_TYPE_OBJ, "cd", 7, &source, 2, 5 });
+    SegmentEntryHandleVector handles = s.multiAppend(appends, false);
+    ASSERT_EQ(2U, handles.size());
+    EXPECT_EQ("ab", string(handles[0]->userData<char>(), 2));
+    EXPECT_EQ("cd23456", string(handles[1]->userData<char>(), 7));
+    EXPECT_TRUE(handles[1]->isChecksumValid());
+}
+
 TEST_F(SegmentTest, syncToBackup) {
     char alignedBuf[8192] __attribute__((aligned(8192)));
     ReplicaManager replicaManager(serverList, serverId, 0, NULL);
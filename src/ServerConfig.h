@@ -169,7 +169,14 @@ struct ServerConfig {
             : logBytes(32 * 1024 * 1024)
             , hashTableBytes(1 * 1024 * 1024)
             , disableLogCleaner(true)
+            , numCleanerThreads(1)
+            , minDiskUtilisation(0)
+            , numLogHeads(1)
+            , groupCommitMicros(0)
             , numReplicas(0)
+            , numReplayThreads(1)
+            , numWorkerThreads(2)
+            , migrationBytesPerSecond(0)
         {}
 
         /**
@@ -181,7 +188,14 @@ struct ServerConfig {
             : logBytes()
             , hashTableBytes()
             , disableLogCleaner()
+            , numCleanerThreads()
+            , minDiskUtilisation()
+            , numLogHeads()
+            , groupCommitMicros()
             , numReplicas()
+            , numReplayThreads()
+            , numWorkerThreads()
+            , migrationBytesPerSecond()
         {}
 
         /// Total number bytes to use for the in-memory Log.
@@ -193,8 +207,47 @@ struct ServerConfig {
         /// If true, disable the log cleaner entirely.
         bool disableLogCleaner;
 
+        /// Number of threads cleaning the log in parallel, unless the
+        /// cleaner is disabled.
+        uint32_t numCleanerThreads;
+
+        /// Percentage of backup space that must hold live data before the
+        /// cleaner rewrites replicas; until then it compacts segments in
+        /// memory only. 0 disables compaction.
+        uint32_t minDiskUtilisation;
+
+        /// Number of head segments the log appends to at once; worker
+        /// threads appending to different heads don't wait for each other.
+        uint32_t numLogHeads;
+
+        /// Longest time, in microseconds, a write RPC to a backup is held
+        /// back so that data from more synchronous writes can join it.
+        /// 0 sends every write as soon as the replica is free.
+        uint32_t groupCommitMicros;
+
         /// Number of replicas to keep per segment stored on backups.
         uint32_t numReplicas;
+
+        /**
+         * Number of threads used to replay each segment this master receives
+         * during recovery or migration. With 1, segments are replayed by the
+         * service thread alone.
+         */
+        uint32_t numReplayThreads;
+
+        /**
+         * Number of threads serving requests to the master in parallel.
+         * At least two are used regardless.
+         */
+        uint32_t numWorkerThreads;
+
+        /**
+         * Limit on the rate at which tablet data is migrated to and from
+         * this master, in bytes per second; 0 means unlimited. Applies to
+         * migrations away from this master that don't set a limit of their
+         * own, and to all incoming migration data together.
+         */
+        uint64_t migrationBytesPerSecond;
     } master;
 
     /**
@@ -53,6 +53,26 @@ main(int argc, char *argv[])
                default_value(RANDOM_REFINE_AVG),
              "0 random refine min, 1 random refine avg, 2 even distribution, "
              "3 uniform random")
+            ("cleanerThreads",
+             ProgramOptions::value<uint32_t>(
+                &config.master.numCleanerThreads)->default_value(1),
+             "Number of threads cleaning the log in parallel")
+            ("minDiskUtilisation",
+             ProgramOptions::value<uint32_t>(
+                &config.master.minDiskUtilisation)->default_value(0),
+             "Percentage of backup space that must hold live data before "
+             "the cleaner rewrites replicas; until then it compacts "
+             "segments in memory only. 0 disables compaction")
+            ("logHeads",
+             ProgramOptions::value<uint32_t>(
+                &config.master.numLogHeads)->default_value(1),
+             "Number of head segments the log appends to at once, so that "
+             "worker threads can write in parallel")
+            ("groupCommitMicros",
+             ProgramOptions::value<uint32_t>(
+                &config.master.groupCommitMicros)->default_value(0),
+             "Longest time in microseconds a write to a backup is held back "
+             "so that other synchronous writes can share its RPC")
             ("disableLogCleaner,d",
              ProgramOptions::bool_switch(&config.master.disableLogCleaner),
              "Disable the log cleaner entirely. You will eventually run out "
@@ -65,7 +85,7 @@ main(int argc, char *argv[])
              ProgramOptions::value<string>(&hashTableMemory)->
                 default_value("10%"),
              "Percentage or megabytes of master memory allocated to "
-             "the hash table")
+             "the hash table at first; it doubles when it fills up")
             ("masterOnly,M",
              ProgramOptions::bool_switch(&masterOnly),
              "The server should run the master service only (no backup)")
@@ -78,6 +98,20 @@ main(int argc, char *argv[])
              ProgramOptions::value<uint32_t>(&config.master.numReplicas)->
                 default_value(0),
              "Number of backup copies to make for each segment")
+            ("replayThreads",
+             ProgramOptions::value<uint32_t>(&config.master.numReplayThreads)->
+                default_value(4),
+             "Number of threads replaying each segment received during "
+             "recovery or migration")
+            ("workerThreads",
+             ProgramOptions::value<uint32_t>(&config.master.numWorkerThreads)->
+                default_value(4),
+             "Number of threads serving requests to the master in parallel")
+            ("migrationBytesPerSecond",
+             ProgramOptions::value<uint64_t>(
+                &config.master.migrationBytesPerSecond)->default_value(0),
+             "Limit on the rate at which tablets are migrated to and from "
+             "this master, in bytes per second; 0 means unlimited")
             ("segmentFrames",
              ProgramOptions::value<uint32_t>(&config.backup.numSegmentFrames)->
                 default_value(512),
@@ -98,6 +98,17 @@ class Service {
         return 1;
     }
 
+    /**
+     * Returns true if requests with the given opcode are background work,
+     * such as moving data between servers. The ServiceManager only starts
+     * them when no regular requests for the service are waiting, and never
+     * lets them occupy all of the service's threads, so they can't hold up
+     * regular requests for long. The default is that no request is.
+     */
+    virtual bool isBackground(RpcOpcode opcode) {
+        return false;
+    }
+
     void ping(const PingRpc::Request& reqHdr,
               PingRpc::Response& respHdr,
               Rpc& rpc);
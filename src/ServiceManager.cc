@@ -162,7 +162,17 @@ ServiceManager::handleRpc(Transport::ServerRpc* rpc)
 #endif
 
     // See if we have exceeded the concurrency limit for the service.
-    if (serviceInfo->requestsRunning >= serviceInfo->maxThreads) {
+    bool background = serviceInfo->service.isBackground(
+            RpcOpcode(header->opcode));
+    if (background) {
+        if (serviceInfo->requestsRunning >= serviceInfo->maxThreads ||
+                serviceInfo->backgroundRunning >=
+                serviceInfo->maxBackgroundThreads ||
+                !serviceInfo->waitingRpcs.empty()) {
+            serviceInfo->waitingBackgroundRpcs.push(rpc);
+            return;
+        }
+    } else if (serviceInfo->requestsRunning >= serviceInfo->maxThreads) {
         serviceInfo->waitingRpcs.push(rpc);
         return;
     }
@@ -178,12 +188,15 @@ ServiceManager::handleRpc(Transport::ServerRpc* rpc)
 #endif
 
     serviceInfo->requestsRunning++;
+    if (background)
+        serviceInfo->backgroundRunning++;
 
     // Hand off the RPC to a worker thread.
     assert(!idleThreads.empty());
     Worker* worker = idleThreads.back();
     idleThreads.pop_back();
     worker->serviceInfo = serviceInfo;
+    worker->background = background;
     worker->handoff(rpc);
     worker->busyIndex = downCast<int>(busyThreads.size());
     busyThreads.push_back(worker);
@@ -236,10 +249,22 @@ ServiceManager::poll()
 
         if (state != Worker::POSTPROCESSING) {
             // If there is work waiting for this service, start the next RPC.
+            // Regular requests go first; a background one may only start
+            // if that doesn't exceed the service's limit for them.
             ServiceInfo* info = worker->serviceInfo;
+            if (worker->background) {
+                info->backgroundRunning--;
+                worker->background = false;
+            }
             if (!info->waitingRpcs.empty()) {
                 worker->handoff(info->waitingRpcs.front());
                 info->waitingRpcs.pop();
+            } else if (!info->waitingBackgroundRpcs.empty() &&
+                       info->backgroundRunning < info->maxBackgroundThreads) {
+                info->backgroundRunning++;
+                worker->background = true;
+                worker->handoff(info->waitingBackgroundRpcs.front());
+                info->waitingBackgroundRpcs.pop();
             } else {
                 // This worker is now idle; remove it from busyThreads (fill
                 // its slot with the worker in the last slot).
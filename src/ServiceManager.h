@@ -76,15 +76,29 @@ class ServiceManager : Dispatch::Poller {
                                        /// executed by the service (each in a
                                        /// separate thread); must never be
                                        /// greater than maxThreads.
+        int maxBackgroundThreads;      /// Concurrency limit for background
+                                       /// requests (see
+                                       /// Service::isBackground); leaves a
+                                       /// thread for regular requests unless
+                                       /// the service has only one.
+        int backgroundRunning;         /// The number of background RPCs
+                                       /// among requestsRunning.
         std::queue<Transport::ServerRpc*> waitingRpcs;
                                        /// Requests that cannot execute until
                                        /// an existing request completes
                                        /// (requestsRunning == maxThreads).
+        std::queue<Transport::ServerRpc*> waitingBackgroundRpcs;
+                                       /// Background requests that cannot
+                                       /// execute yet. They are only started
+                                       /// once waitingRpcs is empty.
         explicit ServiceInfo(Service& service)
             : service(service)
             , maxThreads(service.maxThreads())
             , requestsRunning(0)
+            , maxBackgroundThreads(maxThreads > 1 ? maxThreads - 1 : 1)
+            , backgroundRunning(0)
             , waitingRpcs()
+            , waitingBackgroundRpcs()
         {}
         friend class Worker;
         DISALLOW_COPY_AND_ASSIGN(ServiceInfo);
@@ -140,6 +154,9 @@ class Worker {
     int busyIndex;                     /// Location of this worker in
                                        /// #busyThreads, or -1 if this worker
                                        /// is idle.
+    bool background;                   /// True if #rpc is a background
+                                       /// request (see
+                                       /// Service::isBackground).
     AtomicInt state;                   /// Shared variable used to pass RPCs
                                        /// between the dispatch thread and this
                                        /// worker.
@@ -179,7 +196,8 @@ class Worker {
 
     explicit Worker(Context& context)
         : serviceInfo(NULL), thread(), context(context), rpc(NULL),
-          busyIndex(-1), state(POLLING), exited(false) {}
+          busyIndex(-1), background(false), state(POLLING),
+          exited(false) {}
     void exit();
     void handoff(Transport::ServerRpc* rpc);
 
@@ -175,6 +175,31 @@ TEST_F(ServiceManagerTest, handleRpc_concurrencyLimitExceeded) {
     EXPECT_EQ(1U, manager->services[1]->waitingRpcs.size());
 }
 
+TEST_F(ServiceManagerTest, handleRpc_background) {
+    // Background requests may use 2 of the service's 3 threads.
+    service.backgroundOpcode = 1;
+    service.gate = -1;
+    MockTransport::MockServerRpc* rpc1 = new MockTransport::MockServerRpc(
+            &transport, "0x10001 1");
+    MockTransport::MockServerRpc* rpc2 = new MockTransport::MockServerRpc(
+            &transport, "0x10001 2");
+    MockTransport::MockServerRpc* rpc3 = new MockTransport::MockServerRpc(
+            &transport, "0x10001 3");
+    MockTransport::MockServerRpc* rpc4 = new MockTransport::MockServerRpc(
+            &transport, "0x10000 4");
+    manager->handleRpc(rpc1);
+    manager->handleRpc(rpc2);
+    manager->handleRpc(rpc3);
+    EXPECT_EQ(2U, manager->busyThreads.size());
+    EXPECT_EQ(2, manager->services[1]->backgroundRunning);
+    EXPECT_EQ(1U, manager->services[1]->waitingBackgroundRpcs.size());
+
+    // A regular request still finds a thread.
+    manager->handleRpc(rpc4);
+    EXPECT_EQ(3U, manager->busyThreads.size());
+    EXPECT_EQ(0U, manager->services[1]->waitingRpcs.size());
+}
+
 TEST_F(ServiceManagerTest, handleRpc_handoffToWorker) {
     MockTransport::MockServerRpc* rpc1 = new MockTransport::MockServerRpc(
             &transport, "0x10000 1");
@@ -250,6 +275,44 @@ TEST_F(ServiceManagerTest, poll_basics) {
             transport.outputLog);
 }
 
+TEST_F(ServiceManagerTest, poll_regularBeforeBackground) {
+    service.backgroundOpcode = 1;
+    service.gate = -1;
+    MockTransport::MockServerRpc* rpc1 = new MockTransport::MockServerRpc(
+            &transport, "0x10001 1");
+    MockTransport::MockServerRpc* rpc2 = new MockTransport::MockServerRpc(
+            &transport, "0x10001 2");
+    MockTransport::MockServerRpc* rpc3 = new MockTransport::MockServerRpc(
+            &transport, "0x10000 3");
+    MockTransport::MockServerRpc* rpc4 = new MockTransport::MockServerRpc(
+            &transport, "0x10001 4");
+    MockTransport::MockServerRpc* rpc5 = new MockTransport::MockServerRpc(
+            &transport, "0x10000 5");
+    manager->handleRpc(rpc1);
+    manager->handleRpc(rpc2);
+    manager->handleRpc(rpc3);
+    manager->handleRpc(rpc4);
+    manager->handleRpc(rpc5);
+    EXPECT_EQ(1U, manager->services[1]->waitingRpcs.size());
+    EXPECT_EQ(1U, manager->services[1]->waitingBackgroundRpcs.size());
+
+    // The regular request goes first, although it arrived later.
+    service.gate = 3;
+    waitUntilDone(1);
+    manager->poll();
+    EXPECT_EQ(0U, manager->services[1]->waitingRpcs.size());
+    EXPECT_EQ(1U, manager->services[1]->waitingBackgroundRpcs.size());
+
+    // The background request has to wait for another one to finish.
+    service.gate = 1;
+    waitUntilDone(1);
+    manager->poll();
+    EXPECT_EQ(0U, manager->services[1]->waitingBackgroundRpcs.size());
+    EXPECT_EQ(2, manager->services[1]->backgroundRunning);
+    EXPECT_EQ("serverReply: 0x10001 4 | serverReply: 0x10002 2",
+            transport.outputLog);
+}
+
 TEST_F(ServiceManagerTest, poll_postprocessing) {
     // This test makes sure that the POSTPROCESSING state is handled
     // correctly (along with the subsequent POLLING state).
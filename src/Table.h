@@ -16,10 +16,14 @@
 #ifndef RAMCLOUD_TABLE_H
 #define RAMCLOUD_TABLE_H
 
+#include <mutex>
+#include <unordered_set>
+
 #include "Common.h"
 #include "Object.h"
 #include "HashTable.h"
-#include "ServerStatistics.pb.h"
+#include "SpinLock.h"
+#include "TabletStatistics.h"
 
 namespace RAMCloud {
 
@@ -40,13 +44,14 @@ class Table {
           objectBytes(0),
           tombstoneCount(0),
           tombstoneBytes(0),
-          statEntry(),
+          statistics(start_key_hash, end_key_hash),
+          segmentIds(),
+          lastSegmentId(~0UL),
+          segmentIdsPruneSize(MIN_SEGMENT_IDS_PRUNE_SIZE),
+          mutex(),
           tableId(tableId),
           nextVersion(1)
     {
-        statEntry.set_table_id(tableId);
-        statEntry.set_start_key_hash(start_key_hash);
-        statEntry.set_end_key_hash(end_key_hash);
     }
 
     /**
@@ -56,6 +61,7 @@ class Table {
      * \see #nextVersion
      */
     uint64_t AllocateVersion() {
+        std::lock_guard<SpinLock> lock(mutex);
         return nextVersion++;
     }
 
@@ -67,10 +73,25 @@ class Table {
      * \see #nextVersion
      */
     void RaiseVersion(uint64_t minimum) {
+        std::lock_guard<SpinLock> lock(mutex);
         if (minimum > nextVersion)
             nextVersion = minimum;
     }
 
+    /**
+     * Remember that an object or tombstone of this tablet was appended to
+     * the log segment with ID \a segmentId. The caller must hold #mutex.
+     * \return
+     *      True if the segment wasn't already in #segmentIds.
+     */
+    bool addSegment(uint64_t segmentId) {
+        // Appends mostly go to the head, so this is the common case.
+        if (segmentId == lastSegmentId)
+            return false;
+        lastSegmentId = segmentId;
+        return segmentIds.insert(segmentId).second;
+    }
+
     /**
      * Get the Table's identifier.
      */
@@ -82,7 +103,31 @@ class Table {
     uint64_t objectBytes;
     uint64_t tombstoneCount;
     uint64_t tombstoneBytes;
-    ProtoBuf::ServerStatistics_TabletEntry statEntry;
+
+    /// Access statistics for this tablet; exported through
+    /// GET_SERVER_STATISTICS.
+    TabletStatistics statistics;
+
+    /// IDs of the log segments that may hold objects or tombstones of this
+    /// tablet, so that migrating it needn't scan the whole log. This is a
+    /// superset: segments stay in it until they are found to have been
+    /// freed (see MasterService::noteAppend).
+    std::unordered_set<uint64_t> segmentIds;
+
+    /// The segment given to the last call to #addSegment.
+    uint64_t lastSegmentId;
+
+    /// Freed segments are weeded out of #segmentIds once it has grown
+    /// beyond this many elements.
+    size_t segmentIdsPruneSize;
+
+    /// Smallest value of #segmentIdsPruneSize.
+    static const size_t MIN_SEGMENT_IDS_PRUNE_SIZE = 64;
+
+    /// Requests on different objects of the table may run in parallel, so
+    /// this protects #nextVersion and the #segmentIds bookkeeping. It is
+    /// taken after an object's lock and before any of the Log's locks.
+    SpinLock mutex;
 
   private:
 
@@ -0,0 +1,505 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <map>
+#include <set>
+
+#include "ServerStatistics.pb.h"
+
+#include "Common.h"
+#include "Fence.h"
+#include "MasterClient.h"
+#include "ServerList.h"
+#include "ShortMacros.h"
+#include "TabletBalancer.h"
+#include "TabletStatistics.h"
+
+namespace RAMCloud {
+
+/**
+ * Issues a single MIGRATE_TABLET RPC on behalf of the balancer. Conforms
+ * to AsynchronousTaskConcept so that a plan's migrations can be handed to
+ * parallelRun.
+ */
+struct MigrateTabletTask {
+    MigrateTabletTask(const TabletBalancer::Action& action,
+                      const string& serviceLocator, uint64_t bytesPerSecond)
+        : action(action)
+        , serviceLocator(serviceLocator)
+        , bytesPerSecond(bytesPerSecond)
+        , masterClient()
+        , rpc()
+        , done(false)
+    {}
+    bool isReady() { return rpc && rpc->isReady(); }
+    bool isDone() { return done; }
+    void send() {
+        LOG(NOTICE, "Migrating tablet (id %lu, range [%lu,%lu]) from server "
+            "id %lu to server id %lu", action.tableId, action.startKeyHash,
+            action.endKeyHash, *action.serverId, *action.newOwner);
+        try {
+            masterClient.construct(Context::get().transportManager->
+                                   getSession(serviceLocator.c_str()));
+            rpc.construct(*masterClient, action.tableId, action.startKeyHash,
+                          action.endKeyHash, action.newOwner, bytesPerSecond);
+        } catch (const TransportException& e) {
+            LOG(WARNING, "Couldn't contact %s, skipping migration; "
+                "failure was: %s", serviceLocator.c_str(), e.message.c_str());
+            done = true;
+        }
+    }
+    void wait() {
+        try {
+            (*rpc)();
+        } catch (const TransportException& e) {
+            LOG(WARNING, "Couldn't contact %s, migration of tablet (id %lu, "
+                "range [%lu,%lu]) may not have happened; failure was: %s",
+                serviceLocator.c_str(), action.tableId, action.startKeyHash,
+                action.endKeyHash, e.message.c_str());
+        } catch (const ClientException& e) {
+            LOG(WARNING, "Migration of tablet (id %lu, range [%lu,%lu]) "
+                "failed: %s", action.tableId, action.startKeyHash,
+                action.endKeyHash, e.toString());
+        }
+        done = true;
+    }
+
+    /// The MIGRATE action being carried out.
+    const TabletBalancer::Action action;
+
+    /// Locator of the master that currently owns the tablet.
+    const string serviceLocator;
+
+    /// See TabletBalancer::Config::migrationBytesPerSecond.
+    const uint64_t bytesPerSecond;
+
+    Tub<MasterClient> masterClient;
+    Tub<MasterClient::MigrateTablet> rpc;
+    bool done;
+    DISALLOW_COPY_AND_ASSIGN(MigrateTabletTask);
+};
+
+/**
+ * Create a new TabletBalancer. The balancer thread isn't started until
+ * start() is called.
+ *
+ * \param coordinatorLocator
+ *      The ServiceLocator string of the coordinator whose tablets are
+ *      to be balanced.
+ * \param config
+ *      Tunables controlling how often and how aggressively to rebalance.
+ */
+TabletBalancer::TabletBalancer(const string& coordinatorLocator,
+                               const Config& config)
+    : coordinatorClient(coordinatorLocator.c_str())
+    , config(config)
+    , thread()
+    , threadShouldExit(false)
+{
+}
+
+TabletBalancer::~TabletBalancer()
+{
+    halt();
+}
+
+/**
+ * Start the balancer thread.
+ *
+ * This method starts the balancer thread and returns immediately. Use
+ * the halt method to terminate the thread. A valid context must be
+ * initialized before calling start.
+ */
+void
+TabletBalancer::start()
+{
+    thread.construct(balancerThreadEntry, this, &Context::get());
+}
+
+/**
+ * Halt the balancer thread. Once the function returns the thread will have
+ * terminated; a balancing round in progress is completed first.
+ */
+void
+TabletBalancer::halt()
+{
+    if (thread) {
+        threadShouldExit = true;
+        Fence::sfence();
+        thread->join();
+        threadShouldExit = false;
+        thread.destroy();
+    }
+}
+
+/**
+ * Run a single balancing round: gather statistics from all masters, plan
+ * the splits and migrations needed to bring every master back under the
+ * threshold, and carry them out.
+ *
+ * The first round after construction only records a baseline; loads are
+ * computed from the change in the masters' counters between rounds.
+ *
+ * \throw TransportException
+ *      The coordinator could not be reached.
+ * \throw ClientException
+ *      The coordinator refused one of the requests.
+ */
+void
+TabletBalancer::balance()
+{
+    ProtoBuf::ServerList masterList;
+    coordinatorClient.getMasterList(masterList);
+
+    vector<ServerId> masters;
+    vector<TabletLoad> tablets;
+    collectLoads(masterList, masters, tablets);
+
+    vector<Action> actions;
+    plan(masters, tablets, config.threshold, actions);
+    if (actions.empty())
+        return;
+
+    LOG(NOTICE, "Rebalancing %lu tablets across %lu masters (%lu actions)",
+        tablets.size(), masters.size(), actions.size());
+    execute(masterList, actions);
+}
+
+/**
+ * Compute a list of actions that brings the load of every master down to
+ * at most \a threshold times the mean load of all masters.
+ *
+ * Tablets are taken greedily from the most loaded master and moved to the
+ * least loaded one. A tablet is moved only if the recipient stays under the
+ * threshold and the gap between the two masters actually narrows. If no
+ * tablet on the most loaded master qualifies, its hottest tablet is split
+ * where its master saw half of the load on either side (or in the middle of
+ * its key hash range if that isn't known) and the halves are considered
+ * again.
+ *
+ * \param masters
+ *      The masters that can take part in balancing. Tablets served by any
+ *      other server are ignored.
+ * \param tablets
+ *      The load observed on every tablet.
+ * \param threshold
+ *      Multiple of the mean load that a master may carry before it is
+ *      considered overloaded.
+ * \param[out] actions
+ *      The planned actions are appended here. Splits are always planned
+ *      before any migration of the resulting halves.
+ */
+void
+TabletBalancer::plan(const vector<ServerId>& masters,
+                     const vector<TabletLoad>& tablets,
+                     double threshold,
+                     vector<Action>& actions)
+{
+    if (masters.size() < 2)
+        return;
+
+    std::map<uint64_t, double> serverLoad;
+    foreach (const ServerId& master, masters)
+        serverLoad[*master] = 0;
+
+    // The plan is built against a copy of the tablets so that each decision
+    // sees the effect of the ones before it. Tablets that have already been
+    // moved in this round are marked settled and left alone.
+    vector<TabletLoad> current;
+    vector<bool> settled;
+    double totalLoad = 0;
+    foreach (const TabletLoad& tablet, tablets) {
+        auto it = serverLoad.find(*tablet.serverId);
+        if (it == serverLoad.end())
+            continue;
+        it->second += tablet.load;
+        totalLoad += tablet.load;
+        current.push_back(tablet);
+        settled.push_back(false);
+    }
+
+    double mean = totalLoad / static_cast<double>(masters.size());
+    if (mean <= 0)
+        return;
+    double limit = threshold * mean;
+
+    while (actions.size() < MAX_ACTIONS_PER_ROUND) {
+        auto hottest = serverLoad.begin();
+        auto coolest = serverLoad.begin();
+        for (auto it = serverLoad.begin(); it != serverLoad.end(); ++it) {
+            if (it->second > hottest->second)
+                hottest = it;
+            if (it->second < coolest->second)
+                coolest = it;
+        }
+        if (hottest->second <= limit)
+            break;
+
+        double gap = hottest->second - coolest->second;
+        double room = std::min(limit - coolest->second, gap);
+
+        // Look for the hottest tablet that can be moved as a whole.
+        size_t best = current.size();
+        size_t hottestTablet = current.size();
+        for (size_t i = 0; i < current.size(); i++) {
+            const TabletLoad& tablet = current[i];
+            if (settled[i] || *tablet.serverId != hottest->first)
+                continue;
+            if (hottestTablet == current.size() ||
+                tablet.load > current[hottestTablet].load)
+                hottestTablet = i;
+            if (tablet.load > 0 && tablet.load <= room && tablet.load < gap &&
+                (best == current.size() || tablet.load > current[best].load))
+                best = i;
+        }
+
+        if (best != current.size()) {
+            TabletLoad& tablet = current[best];
+            Action action(Action::MIGRATE, tablet.tableId,
+                          tablet.startKeyHash, tablet.endKeyHash,
+                          tablet.serverId);
+            action.newOwner = ServerId(coolest->first);
+            actions.push_back(action);
+
+            hottest->second -= tablet.load;
+            coolest->second += tablet.load;
+            tablet.serverId = action.newOwner;
+            settled[best] = true;
+            continue;
+        }
+
+        // Nothing fits, so the hottest tablet carries too much load to be
+        // moved on its own: split it and try again with the halves.
+        if (hottestTablet == current.size())
+            break;
+        TabletLoad lower = current[hottestTablet];
+        if (lower.endKeyHash - lower.startKeyHash < MIN_SPLIT_SPAN)
+            break;
+        uint64_t splitKeyHash = lower.startKeyHash +
+                                (lower.endKeyHash - lower.startKeyHash) / 2 + 1;
+        if (lower.loadMedianKeyHash > lower.startKeyHash + 1 &&
+            lower.loadMedianKeyHash < lower.endKeyHash)
+            splitKeyHash = lower.loadMedianKeyHash;
+
+        Action action(Action::SPLIT, lower.tableId, lower.startKeyHash,
+                      lower.endKeyHash, lower.serverId);
+        action.splitKeyHash = splitKeyHash;
+        actions.push_back(action);
+
+        TabletLoad upper(lower.tableId, splitKeyHash, lower.endKeyHash,
+                         lower.serverId, lower.load / 2);
+        lower.endKeyHash = splitKeyHash - 1;
+        lower.load /= 2;
+        lower.loadMedianKeyHash = 0;
+        current[hottestTablet] = lower;
+        current.push_back(upper);
+        settled.push_back(false);
+    }
+}
+
+/**
+ * Poll every master for its statistics and compute the load of each of the
+ * tablets it owns.
+ *
+ * \param masterList
+ *      The masters in the cluster, as returned by the coordinator.
+ * \param[out] masters
+ *      The masters that responded are appended here. Masters that could
+ *      not be reached are left out of this round altogether.
+ * \param[out] tablets
+ *      The load of every tablet of the responding masters is appended
+ *      here. Only tablets the coordinator considers to be in the NORMAL
+ *      state and owned by the reporting master are included; in particular
+ *      a tablet that is in the middle of being migrated is reported only
+ *      once.
+ */
+void
+TabletBalancer::collectLoads(const ProtoBuf::ServerList& masterList,
+                             vector<ServerId>& masters,
+                             vector<TabletLoad>& tablets)
+{
+    ProtoBuf::Tablets tabletMap;
+    coordinatorClient.getTabletMap(tabletMap);
+
+    std::set<TabletKey> owned;
+    foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
+        if (tablet.state() != ProtoBuf::Tablets_Tablet_State_NORMAL)
+            continue;
+        owned.insert(TabletKey(tablet.server_id(), tablet.table_id(),
+                               tablet.start_key_hash(),
+                               tablet.end_key_hash()));
+    }
+
+    foreach (const ProtoBuf::ServerList::Entry& master, masterList.server()) {
+        if (master.status() != static_cast<uint32_t>(ServerStatus::UP))
+            continue;
+
+        const char* locator = master.service_locator().c_str();
+        ProtoBuf::ServerStatistics serverStats;
+        try {
+            MasterClient(Context::get().transportManager->getSession(locator))
+                .getServerStatistics(serverStats);
+        } catch (const TransportException& e) {
+            LOG(WARNING, "Couldn't get statistics from %s, leaving it out of "
+                "this round; failure was: %s", locator, e.message.c_str());
+            continue;
+        } catch (const ClientException& e) {
+            LOG(WARNING, "Couldn't get statistics from %s, leaving it out of "
+                "this round; failure was: %s", locator, e.toString());
+            continue;
+        }
+
+        ServerId serverId(master.server_id());
+        masters.push_back(serverId);
+        foreach (const ProtoBuf::ServerStatistics::TabletEntry& entry,
+                 serverStats.tabletentry()) {
+            TabletKey key(*serverId, entry.table_id(), entry.start_key_hash(),
+                          entry.end_key_hash());
+            if (owned.find(key) == owned.end())
+                continue;
+
+            tablets.push_back(tabletLoad(serverId, entry,
+                                         config.rateWindowMs));
+        }
+    }
+}
+
+/**
+ * Turn the statistics a master reports for one of its tablets into the
+ * input #plan expects.
+ *
+ * \param serverId
+ *      The master that reported the statistics.
+ * \param entry
+ *      The tablet's entry in the master's GET_SERVER_STATISTICS response.
+ * \param rateWindowMs
+ *      Which of the reported rates to use (see Config::rateWindowMs). A
+ *      master that doesn't report a matching window makes the tablet count
+ *      as idle; it'll be picked up once it does.
+ */
+TabletBalancer::TabletLoad
+TabletBalancer::tabletLoad(ServerId serverId,
+                           const ProtoBuf::ServerStatistics::TabletEntry& entry,
+                           uint32_t rateWindowMs)
+{
+    double load = 0;
+    foreach (const ProtoBuf::ServerStatistics::TabletEntry::Rate& rate,
+             entry.rate()) {
+        if (rate.window_ms() == rateWindowMs) {
+            load = rate.reads_per_second() + rate.writes_per_second();
+            break;
+        }
+    }
+    return TabletLoad(entry.table_id(), entry.start_key_hash(),
+                      entry.end_key_hash(), serverId, load,
+                      TabletStatistics::findLoadMedian(entry));
+}
+
+/**
+ * Carry out a plan computed by #plan. Splits are done first, one at a time
+ * and in order, since they only touch metadata and later migrations may
+ * refer to the tablets they create. The migrations are then issued with at
+ * most Config::maxConcurrentMigrations outstanding at once. Failures are
+ * logged and otherwise ignored; the next round will plan around them.
+ *
+ * \param masterList
+ *      The masters in the cluster, used to find the source of each
+ *      migration.
+ * \param actions
+ *      The plan to carry out.
+ */
+void
+TabletBalancer::execute(const ProtoBuf::ServerList& masterList,
+                        const vector<Action>& actions)
+{
+    std::map<uint64_t, string> locators;
+    foreach (const ProtoBuf::ServerList::Entry& master, masterList.server())
+        locators[master.server_id()] = master.service_locator();
+
+    uint32_t numMigrations = 0;
+    foreach (const Action& action, actions) {
+        if (action.type != Action::SPLIT) {
+            numMigrations++;
+            continue;
+        }
+        LOG(NOTICE, "Splitting tablet (id %lu, range [%lu,%lu]) at %lu",
+            action.tableId, action.startKeyHash, action.endKeyHash,
+            action.splitKeyHash);
+        try {
+            coordinatorClient.splitTabletById(action.tableId,
+                                              action.startKeyHash,
+                                              action.endKeyHash,
+                                              action.splitKeyHash);
+        } catch (const ClientException& e) {
+            LOG(WARNING, "Split of tablet (id %lu, range [%lu,%lu]) failed: "
+                "%s", action.tableId, action.startKeyHash, action.endKeyHash,
+                e.toString());
+        }
+    }
+
+    Tub<MigrateTabletTask> tasks[numMigrations];
+    uint32_t taskNum = 0;
+    foreach (const Action& action, actions) {
+        if (action.type == Action::MIGRATE)
+            tasks[taskNum++].construct(action, locators[*action.serverId],
+                                       config.migrationBytesPerSecond);
+    }
+    parallelRun(tasks, numMigrations,
+                std::max(config.maxConcurrentMigrations, 1U));
+}
+
+/**
+ * Main thread entry point for the balancer. Runs a balancing round every
+ * Config::pollIntervalMs milliseconds until halt() is called.
+ *
+ * \param balancer
+ *      TabletBalancer passed in from thread creation.
+ * \param context
+ *      Context object to use for all operations.
+ */
+void
+TabletBalancer::balancerThreadEntry(TabletBalancer* balancer,
+                                    Context* context)
+{
+    Context::Guard _(*context);
+
+    LOG(NOTICE, "Tablet balancer thread started");
+
+    while (1) {
+        Fence::lfence();
+        if (balancer->threadShouldExit)
+            break;
+
+        try {
+            balancer->balance();
+        } catch (const TransportException& e) {
+            LOG(WARNING, "Balancing round failed: %s", e.message.c_str());
+        } catch (const ClientException& e) {
+            LOG(WARNING, "Balancing round failed: %s", e.toString());
+        }
+
+        // Sleep in short slices so halt() doesn't have to wait out a
+        // whole interval.
+        for (uint32_t slept = 0; slept < balancer->config.pollIntervalMs;
+             slept += 10) {
+            Fence::lfence();
+            if (balancer->threadShouldExit)
+                break;
+            usleep(10 * 1000);
+        }
+    }
+}
+
+} // namespace RAMCloud
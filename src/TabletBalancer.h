@@ -0,0 +1,222 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUD_TABLETBALANCER_H
+#define RAMCLOUD_TABLETBALANCER_H
+
+#include <thread>
+#include <tuple>
+
+#include "ServerList.pb.h"
+#include "ServerStatistics.pb.h"
+#include "Tablets.pb.h"
+
+#include "Common.h"
+#include "CoordinatorClient.h"
+#include "ServerId.h"
+#include "Tub.h"
+
+namespace RAMCloud {
+
+/**
+ * Moves tablets between masters so that no master serves a disproportionate
+ * share of the cluster's load.
+ *
+ * Each balancing round fetches the tablet map and the list of masters from
+ * the coordinator and polls every master with GET_SERVER_STATISTICS. The
+ * load of a tablet is the decaying rate of reads plus writes its master
+ * reports over the window selected by Config::rateWindowMs.
+ * Masters whose load exceeds Config::threshold times the cluster mean shed
+ * tablets to the least loaded masters; a tablet that is too hot to be moved
+ * as a whole is split first. The resulting migrations are issued with at
+ * most Config::maxConcurrentMigrations outstanding at any time.
+ *
+ * The balancer runs in its own thread in the coordinator process, but it
+ * talks to the CoordinatorService only through RPCs, just like any other
+ * client. This is deliberate: migrating a tablet makes the source master call
+ * back into the coordinator (REASSIGN_TABLET_OWNERSHIP), so the balancer must
+ * never hold up the coordinator's service thread while a migration is in
+ * progress.
+ *
+ * Deciding what to do (#plan) is a pure function of the observed loads, so
+ * it can be exercised without a cluster; the TabletBalancerSimulator does
+ * just that.
+ *
+ * Once you construct a TabletBalancer you may use start() and halt() to
+ * start and stop the balancer thread, or call balance() directly to run a
+ * single round.
+ */
+class TabletBalancer {
+  public:
+    /**
+     * Tunables for the balancer; CoordinatorMain exposes these as
+     * command-line options.
+     */
+    struct Config {
+        Config()
+            : pollIntervalMs(1000)
+            , threshold(1.25)
+            , maxConcurrentMigrations(2)
+            , rateWindowMs(10000)
+            , migrationBytesPerSecond(0)
+        {
+        }
+
+        /// Number of milliseconds between balancing rounds.
+        uint32_t pollIntervalMs;
+
+        /// A master is considered overloaded once its load is above this
+        /// multiple of the mean load of all masters.
+        double threshold;
+
+        /// Maximum number of MIGRATE_TABLET RPCs outstanding at once.
+        uint32_t maxConcurrentMigrations;
+
+        /// Which of the decaying access rates reported by the masters to
+        /// balance on, identified by its window length in milliseconds
+        /// (see TabletStatistics::WINDOW_MS). Short windows react quickly
+        /// but also chase bursts.
+        uint32_t rateWindowMs;
+
+        /// Limit on the rate at which each migration sends data, so that
+        /// moving tablets doesn't crowd out the masters' regular traffic.
+        /// 0 leaves it to the masters' own default.
+        uint64_t migrationBytesPerSecond;
+    };
+
+    /**
+     * The load observed on a single tablet during the last round.
+     */
+    struct TabletLoad {
+        TabletLoad(uint64_t tableId, uint64_t startKeyHash,
+                   uint64_t endKeyHash, ServerId serverId, double load,
+                   uint64_t loadMedianKeyHash = 0)
+            : tableId(tableId)
+            , startKeyHash(startKeyHash)
+            , endKeyHash(endKeyHash)
+            , serverId(serverId)
+            , load(load)
+            , loadMedianKeyHash(loadMedianKeyHash)
+        {
+        }
+
+        uint64_t tableId;
+        uint64_t startKeyHash;
+        uint64_t endKeyHash;
+
+        /// The master currently serving the tablet.
+        ServerId serverId;
+
+        /// Operations per second directed at the tablet.
+        double load;
+
+        /// Key hash that splits the load on the tablet in half (see
+        /// TabletStatistics::findLoadMedian), or 0 if unknown.
+        uint64_t loadMedianKeyHash;
+    };
+
+    /**
+     * A single step of a rebalancing plan.
+     */
+    struct Action {
+        enum Type {
+            /// Split the tablet at #splitKeyHash.
+            SPLIT,
+            /// Move the tablet from #serverId to #newOwner.
+            MIGRATE,
+        };
+
+        Action(Type type, uint64_t tableId, uint64_t startKeyHash,
+               uint64_t endKeyHash, ServerId serverId)
+            : type(type)
+            , tableId(tableId)
+            , startKeyHash(startKeyHash)
+            , endKeyHash(endKeyHash)
+            , serverId(serverId)
+            , splitKeyHash(0)
+            , newOwner()
+        {
+        }
+
+        Type type;
+        uint64_t tableId;
+        uint64_t startKeyHash;
+        uint64_t endKeyHash;
+
+        /// The master serving the tablet when the action is executed.
+        ServerId serverId;
+
+        /// For SPLIT: the first key hash of the upper half.
+        uint64_t splitKeyHash;
+
+        /// For MIGRATE: the master the tablet is moved to.
+        ServerId newOwner;
+    };
+
+    TabletBalancer(const string& coordinatorLocator, const Config& config);
+    ~TabletBalancer();
+    void start();
+    void halt();
+    void balance();
+    static void plan(const vector<ServerId>& masters,
+                     const vector<TabletLoad>& tablets,
+                     double threshold,
+                     vector<Action>& actions);
+    static TabletLoad tabletLoad(
+                    ServerId serverId,
+                    const ProtoBuf::ServerStatistics::TabletEntry& entry,
+                    uint32_t rateWindowMs);
+
+  PRIVATE:
+    /// Upper bound on the number of actions planned in a single round.
+    /// Anything left over is picked up in the next round, using fresh
+    /// statistics.
+    static const uint32_t MAX_ACTIONS_PER_ROUND = 32;
+
+    /// Tablets covering fewer key hashes than this are never split. If such
+    /// a tablet is still too hot, its load is most likely concentrated on a
+    /// handful of keys and splitting it further wouldn't help.
+    static const uint64_t MIN_SPLIT_SPAN = 1UL << 32;
+
+    /// Identifies a tablet on a particular master:
+    /// (serverId, tableId, startKeyHash, endKeyHash).
+    typedef std::tuple<uint64_t, uint64_t, uint64_t, uint64_t> TabletKey;
+
+    void collectLoads(const ProtoBuf::ServerList& masterList,
+                      vector<ServerId>& masters,
+                      vector<TabletLoad>& tablets);
+    void execute(const ProtoBuf::ServerList& masterList,
+                 const vector<Action>& actions);
+    static void balancerThreadEntry(TabletBalancer* balancer,
+                                    Context* context);
+
+    /// Used to fetch the tablet map and master list and to split tablets.
+    CoordinatorClient coordinatorClient;
+
+    /// Tunables given to the constructor.
+    const Config config;
+
+    /// Balancer thread.
+    Tub<std::thread> thread;
+
+    /// Set by halt() to ask the balancer thread to exit.
+    bool threadShouldExit;
+
+    DISALLOW_COPY_AND_ASSIGN(TabletBalancer);
+};
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUD_TABLETBALANCER_H
@@ -0,0 +1,384 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cmath>
+
+#include "ServerStatistics.pb.h"
+
+#include "Cycles.h"
+#include "ShortMacros.h"
+#include "TabletBalancerSimulator.h"
+
+namespace RAMCloud {
+
+typedef TabletBalancer::Action Action;
+typedef TabletBalancer::TabletLoad TabletLoad;
+
+const double TabletBalancerSimulator::MAX_UTILIZATION = 0.99;
+
+/**
+ * Return the statistics the simulator keeps for \a tablet.
+ */
+static TabletStatistics*
+statisticsOf(const ProtoBuf::Tablets::Tablet& tablet)
+{
+    return reinterpret_cast<TabletStatistics*>(tablet.user_data());
+}
+
+/**
+ * Construct a simulator with an empty cluster; tables appear as the trace
+ * accesses them.
+ *
+ * \param config
+ *      Parameters of the simulation.
+ */
+TabletBalancerSimulator::TabletBalancerSimulator(const Config& config)
+    : config(config)
+    , tabletMap()
+    , objectBytes()
+    , nextTableMasterIdx(0)
+    , intervalEnd(0)
+    , started(false)
+    , masterOps(config.numMasters)
+    , pendingMigrationBytes(config.numMasters)
+    , intervals()
+{
+}
+
+TabletBalancerSimulator::~TabletBalancerSimulator()
+{
+    foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet())
+        delete statisticsOf(tablet);
+}
+
+/**
+ * Apply one access from the trace to the simulated cluster, first running
+ * the balancer for every interval that ended before it.
+ *
+ * \param access
+ *      The access. Its time must not be earlier than that of the previous
+ *      access.
+ */
+void
+TabletBalancerSimulator::replay(const Access& access)
+{
+    double intervalSeconds = config.intervalMs / 1000.0;
+    if (!started) {
+        intervalEnd = (std::floor(access.time / intervalSeconds) + 1) *
+                      intervalSeconds;
+        started = true;
+    }
+    while (access.time >= intervalEnd)
+        endInterval();
+
+    ProtoBuf::Tablets::Tablet& tablet =
+        getTablet(access.tableId, access.keyHash, access.time);
+    TabletStatistics* statistics = statisticsOf(tablet);
+    masterOps[tablet.server_id() - 1] += access.reads + access.writes;
+
+    ObjectKey key(access.tableId, access.keyHash);
+    auto it = objectBytes.find(key);
+    uint32_t bytes = (it == objectBytes.end()) ? 0 : it->second;
+    for (uint32_t i = 0; i < access.reads; i++)
+        statistics->recordRead(access.keyHash, bytes);
+    if (access.writes == 0)
+        return;
+    for (uint32_t i = 0; i < access.writes; i++)
+        statistics->recordWrite(access.keyHash, access.objectBytes);
+    if (it != objectBytes.end())
+        statistics->objectRemoved(access.keyHash, bytes);
+    statistics->objectAdded(access.keyHash, access.objectBytes);
+    objectBytes[key] = access.objectBytes;
+}
+
+/**
+ * Close the interval the last access fell into. Call this once at the end
+ * of the trace.
+ */
+void
+TabletBalancerSimulator::finish()
+{
+    if (started)
+        endInterval();
+    started = false;
+}
+
+/**
+ * Parse a line of a trace file. Each line holds the time in seconds since
+ * the start of the trace, the table id, the key hash, the number of reads,
+ * the number of writes and the size of the object after the writes,
+ * separated by white space. Blank lines and lines starting with '#' are
+ * ignored.
+ *
+ * \param line
+ *      The line to parse.
+ * \param[out] access
+ *      Filled in with the contents of the line.
+ * \return
+ *      True if the line held an access, false if it should be skipped.
+ * \throw FatalError
+ *      The line is malformed.
+ */
+bool
+TabletBalancerSimulator::parseAccess(const string& line, Access& access)
+{
+    size_t start = line.find_first_not_of(" \t");
+    if (start == string::npos || line[start] == '#')
+        return false;
+    if (sscanf(line.c_str(), "%lf %lu %lu %u %u %u", &access.time,
+               &access.tableId, &access.keyHash, &access.reads,
+               &access.writes, &access.objectBytes) != 6) {
+        DIE("Malformed trace line: '%s'", line.c_str());
+    }
+    return true;
+}
+
+/**
+ * Render an interval as a line of the simulator's report; the columns are
+ * the end time, the mean and maximum load per master, the imbalance (their
+ * ratio), the mean and maximum latency, the number of splits and
+ * migrations, and the number of bytes moved.
+ */
+string
+TabletBalancerSimulator::toString(const Interval& interval)
+{
+    double imbalance = interval.meanLoad > 0
+                       ? interval.maxLoad / interval.meanLoad
+                       : 1.0;
+    return format("%9.1f %11.0f %11.0f %6.2f %9.1f %9.1f %5u %5u %12lu",
+                  interval.endTime, interval.meanLoad, interval.maxLoad,
+                  imbalance, interval.meanLatencyUs, interval.maxLatencyUs,
+                  interval.splits, interval.migrations, interval.bytesMoved);
+}
+
+/**
+ * Return the tablet that holds a key hash, placing the table on the next
+ * master if it hasn't been seen before.
+ *
+ * \param tableId
+ *      Table the key belongs to.
+ * \param keyHash
+ *      The key hash.
+ * \param time
+ *      Current trace time in seconds, used to start the statistics of a new
+ *      table.
+ */
+ProtoBuf::Tablets::Tablet&
+TabletBalancerSimulator::getTablet(uint64_t tableId, HashType keyHash,
+                                   double time)
+{
+    for (int i = 0; i < tabletMap.tablet_size(); i++) {
+        ProtoBuf::Tablets::Tablet& tablet = *tabletMap.mutable_tablet(i);
+        if (tablet.table_id() == tableId &&
+            tablet.start_key_hash() <= keyHash &&
+            tablet.end_key_hash() >= keyHash) {
+            return tablet;
+        }
+    }
+
+    // Tablets always cover the whole key hash range of their table, so
+    // this must be a new table.
+    ProtoBuf::Tablets::Tablet& tablet = *tabletMap.add_tablet();
+    tablet.set_table_id(tableId);
+    tablet.set_start_key_hash(0);
+    tablet.set_end_key_hash(~0UL);
+    tablet.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
+    tablet.set_server_id(nextTableMasterIdx++ % config.numMasters + 1);
+    tablet.set_user_data(reinterpret_cast<uint64_t>(
+        new TabletStatistics(0, ~0UL, Cycles::fromSeconds(time))));
+    tablet.set_ctime_log_head_id(0);
+    tablet.set_ctime_log_head_offset(0);
+    return tablet;
+}
+
+/**
+ * Record what happened during the current interval, run a balancing round
+ * if enabled, and move on to the next interval.
+ */
+void
+TabletBalancerSimulator::endInterval()
+{
+    double intervalSeconds = config.intervalMs / 1000.0;
+    uint64_t migrationBytes = static_cast<uint64_t>(
+        static_cast<double>(config.migrationBytesPerSecond) * intervalSeconds);
+
+    Interval interval;
+    interval.endTime = intervalEnd;
+    uint64_t totalOps = 0;
+    double totalLoad = 0;
+    double weightedLatency = 0;
+    for (uint32_t i = 0; i < config.numMasters; i++) {
+        double load = static_cast<double>(masterOps[i]) / intervalSeconds;
+        double utilization = load * config.serviceTimeUs / 1e06;
+        if (pendingMigrationBytes[i] > 0) {
+            uint64_t moved = std::min(pendingMigrationBytes[i],
+                                      migrationBytes);
+            if (migrationBytes > 0) {
+                utilization += config.migrationCost *
+                               static_cast<double>(moved) /
+                               static_cast<double>(migrationBytes);
+            }
+            pendingMigrationBytes[i] = (migrationBytes > 0)
+                                       ? pendingMigrationBytes[i] - moved
+                                       : 0;
+        }
+        utilization = std::min(utilization, MAX_UTILIZATION);
+        double latency = config.serviceTimeUs / (1 - utilization);
+
+        totalOps += masterOps[i];
+        totalLoad += load;
+        weightedLatency += latency * static_cast<double>(masterOps[i]);
+        interval.maxLoad = std::max(interval.maxLoad, load);
+        interval.maxLatencyUs = std::max(interval.maxLatencyUs, latency);
+        masterOps[i] = 0;
+    }
+    interval.meanLoad = totalLoad / config.numMasters;
+    interval.meanLatencyUs = (totalOps > 0)
+                             ? weightedLatency / static_cast<double>(totalOps)
+                             : config.serviceTimeUs;
+
+    if (config.balance)
+        rebalance(interval);
+    intervals.push_back(interval);
+    intervalEnd += intervalSeconds;
+}
+
+/**
+ * Run a balancing round at the end of the current interval and apply its
+ * plan to the tablet map.
+ *
+ * \param interval
+ *      Record of the current interval; the balancer's actions are counted
+ *      here.
+ */
+void
+TabletBalancerSimulator::rebalance(Interval& interval)
+{
+    uint64_t now = Cycles::fromSeconds(intervalEnd);
+    vector<ServerId> masters;
+    for (uint32_t i = 0; i < config.numMasters; i++)
+        masters.push_back(ServerId(i + 1));
+
+    // Gather the loads the same way the real balancer does, from the
+    // statistics the masters would report.
+    vector<TabletLoad> tablets;
+    foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
+        TabletStatistics* statistics = statisticsOf(tablet);
+        statistics->sample(now);
+        ProtoBuf::ServerStatistics::TabletEntry entry;
+        entry.set_table_id(tablet.table_id());
+        entry.set_start_key_hash(tablet.start_key_hash());
+        entry.set_end_key_hash(tablet.end_key_hash());
+        statistics->serialize(entry);
+        tablets.push_back(TabletBalancer::tabletLoad(
+            ServerId(tablet.server_id()), entry, config.rateWindowMs));
+    }
+
+    vector<Action> actions;
+    TabletBalancer::plan(masters, tablets, config.threshold, actions);
+    foreach (const Action& action, actions) {
+        if (action.type == Action::SPLIT)
+            split(action, interval);
+        else
+            migrate(action, interval);
+    }
+}
+
+/**
+ * Return the tablet an action refers to, or NULL if there is no such tablet
+ * on the server the action expects it on.
+ */
+ProtoBuf::Tablets::Tablet*
+TabletBalancerSimulator::findTablet(const Action& action)
+{
+    for (int i = 0; i < tabletMap.tablet_size(); i++) {
+        ProtoBuf::Tablets::Tablet& tablet = *tabletMap.mutable_tablet(i);
+        if (tablet.table_id() == action.tableId &&
+            tablet.start_key_hash() == action.startKeyHash &&
+            tablet.end_key_hash() == action.endKeyHash &&
+            tablet.server_id() == *action.serverId) {
+            return &tablet;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Carry out a SPLIT planned by the balancer, the way SPLIT_TABLET does on
+ * the coordinator and the master.
+ */
+void
+TabletBalancerSimulator::split(const Action& action, Interval& interval)
+{
+    ProtoBuf::Tablets::Tablet* tablet = findTablet(action);
+    if (tablet == NULL) {
+        LOG(WARNING, "Planned split of unknown tablet (id %lu, range "
+            "[%lu,%lu])", action.tableId, action.startKeyHash,
+            action.endKeyHash);
+        return;
+    }
+
+    uint64_t now = Cycles::fromSeconds(intervalEnd);
+    TabletStatistics* upper = new TabletStatistics(action.splitKeyHash,
+                                                   action.endKeyHash, now);
+    statisticsOf(*tablet)->split(action.splitKeyHash, *upper, now);
+
+    ProtoBuf::Tablets::Tablet newTablet = *tablet;
+    tablet->set_end_key_hash(action.splitKeyHash - 1);
+    newTablet.set_start_key_hash(action.splitKeyHash);
+    newTablet.set_user_data(reinterpret_cast<uint64_t>(upper));
+    *tabletMap.add_tablet() = newTablet;
+    interval.splits++;
+}
+
+/**
+ * Carry out a MIGRATE planned by the balancer. The tablet's live objects
+ * have to be sent to the new owner, which keeps both masters busy for a
+ * while (see #endInterval); the new owner starts out knowing nothing but
+ * those objects.
+ */
+void
+TabletBalancerSimulator::migrate(const Action& action, Interval& interval)
+{
+    ProtoBuf::Tablets::Tablet* tablet = findTablet(action);
+    if (tablet == NULL) {
+        LOG(WARNING, "Planned migration of unknown tablet (id %lu, range "
+            "[%lu,%lu])", action.tableId, action.startKeyHash,
+            action.endKeyHash);
+        return;
+    }
+
+    uint64_t now = Cycles::fromSeconds(intervalEnd);
+    TabletStatistics* statistics = new TabletStatistics(
+        action.startKeyHash, action.endKeyHash, now);
+    uint64_t bytes = 0;
+    for (auto it = objectBytes.lower_bound(ObjectKey(action.tableId,
+                                                     action.startKeyHash));
+         it != objectBytes.end() && it->first.first == action.tableId &&
+         it->first.second <= action.endKeyHash; ++it) {
+        statistics->objectAdded(it->first.second, it->second);
+        bytes += it->second;
+    }
+    delete statisticsOf(*tablet);
+    tablet->set_user_data(reinterpret_cast<uint64_t>(statistics));
+    tablet->set_server_id(*action.newOwner);
+
+    pendingMigrationBytes[*action.serverId - 1] += bytes;
+    pendingMigrationBytes[*action.newOwner - 1] += bytes;
+    interval.migrations++;
+    interval.bytesMoved += bytes;
+}
+
+} // namespace RAMCloud
@@ -0,0 +1,230 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUD_TABLETBALANCERSIMULATOR_H
+#define RAMCLOUD_TABLETBALANCERSIMULATOR_H
+
+#include <map>
+
+#include "Tablets.pb.h"
+
+#include "Common.h"
+#include "TabletBalancer.h"
+#include "TabletStatistics.h"
+
+namespace RAMCloud {
+
+/**
+ * Replays a recorded access trace against a simulated cluster, so that
+ * balancing policies can be compared on a single machine.
+ *
+ * The simulated cluster consists of nothing but a tablet map, in the same
+ * form the coordinator keeps it, and a TabletStatistics for every tablet,
+ * fed just like a master would feed it. Tables are placed on the masters
+ * round-robin when they are first accessed, the way CREATE_TABLE does.
+ * Time is taken from the trace rather than from the clock, and advances in
+ * intervals of Config::intervalMs. At the end of each interval the
+ * simulator samples the statistics, hands them to TabletBalancer::plan
+ * and applies the resulting splits and migrations to the tablet map
+ * immediately. As on a real recipient, a tablet that has been moved starts
+ * out with fresh statistics that only know about its live objects.
+ *
+ * For every interval the simulator records how evenly the operations were
+ * spread over the masters, what the balancer did, and an estimate of the
+ * resulting latency: each master is treated as an M/M/1 queue whose
+ * utilization is its operation rate times Config::serviceTimeUs, plus
+ * Config::migrationCost while it is busy sending or receiving a migration.
+ */
+class TabletBalancerSimulator {
+  public:
+    /**
+     * Parameters of a simulation; TabletBalancerSimulatorMain exposes these
+     * as command-line options.
+     */
+    struct Config {
+        Config()
+            : numMasters(4)
+            , intervalMs(1000)
+            , balance(true)
+            , threshold(1.25)
+            , rateWindowMs(10000)
+            , serviceTimeUs(2.0)
+            , migrationBytesPerSecond(100 * 1024 * 1024)
+            , migrationCost(0.25)
+        {
+        }
+
+        /// Number of masters in the simulated cluster.
+        uint32_t numMasters;
+
+        /// Length of a balancing round, in milliseconds of trace time.
+        uint32_t intervalMs;
+
+        /// If false, the simulator only reports how the trace would behave
+        /// without a balancer.
+        bool balance;
+
+        /// See TabletBalancer::Config::threshold.
+        double threshold;
+
+        /// See TabletBalancer::Config::rateWindowMs.
+        uint32_t rateWindowMs;
+
+        /// Time a master takes to serve a single read or write, in
+        /// microseconds.
+        double serviceTimeUs;
+
+        /// Rate at which a migration moves data.
+        uint64_t migrationBytesPerSecond;
+
+        /// Fraction of a master's capacity taken up while it sends or
+        /// receives a migration at #migrationBytesPerSecond.
+        double migrationCost;
+    };
+
+    /**
+     * A line of the trace: some number of reads and writes of a single
+     * object at a given time.
+     */
+    struct Access {
+        Access()
+            : time(0)
+            , tableId(0)
+            , keyHash(0)
+            , reads(0)
+            , writes(0)
+            , objectBytes(0)
+        {
+        }
+
+        /// Seconds since the start of the trace. Accesses must be given to
+        /// #replay in order of time.
+        double time;
+        uint64_t tableId;
+        HashType keyHash;
+        uint32_t reads;
+        uint32_t writes;
+
+        /// Size of the object after the writes. The reads are taken to
+        /// happen before the writes.
+        uint32_t objectBytes;
+    };
+
+    /**
+     * What happened during one interval.
+     */
+    struct Interval {
+        Interval()
+            : endTime(0)
+            , meanLoad(0)
+            , maxLoad(0)
+            , meanLatencyUs(0)
+            , maxLatencyUs(0)
+            , splits(0)
+            , migrations(0)
+            , bytesMoved(0)
+        {
+        }
+
+        /// Trace time at the end of the interval, in seconds.
+        double endTime;
+
+        /// Operations per second served by the average master.
+        double meanLoad;
+
+        /// Operations per second served by the busiest master.
+        double maxLoad;
+
+        /// Estimated latency of an operation, averaged over all operations.
+        double meanLatencyUs;
+
+        /// Estimated latency of an operation on the slowest master.
+        double maxLatencyUs;
+
+        /// Number of tablets the balancer split at the end of the interval.
+        uint32_t splits;
+
+        /// Number of tablets the balancer moved at the end of the interval.
+        uint32_t migrations;
+
+        /// Live object data in the tablets that were moved.
+        uint64_t bytesMoved;
+    };
+
+    explicit TabletBalancerSimulator(const Config& config);
+    ~TabletBalancerSimulator();
+    void replay(const Access& access);
+    void finish();
+    static bool parseAccess(const string& line, Access& access);
+    static string toString(const Interval& interval);
+
+    /// Return the intervals completed so far, oldest first.
+    const vector<Interval>& getIntervals() const { return intervals; }
+
+  PRIVATE:
+    /// Estimates of the utilization of a master are capped here, so that
+    /// an overloaded master shows up as very slow rather than infinitely
+    /// slow.
+    static const double MAX_UTILIZATION;
+
+    /// Identifies an object: (tableId, keyHash).
+    typedef std::pair<uint64_t, HashType> ObjectKey;
+
+    ProtoBuf::Tablets::Tablet& getTablet(uint64_t tableId, HashType keyHash,
+                                         double time);
+    void endInterval();
+    void rebalance(Interval& interval);
+    ProtoBuf::Tablets::Tablet* findTablet(
+                    const TabletBalancer::Action& action);
+    void split(const TabletBalancer::Action& action, Interval& interval);
+    void migrate(const TabletBalancer::Action& action, Interval& interval);
+
+    /// Parameters given to the constructor.
+    const Config config;
+
+    /// The simulated coordinator's tablet map. The user_data of every
+    /// tablet points to its TabletStatistics, which are owned by the
+    /// simulator.
+    ProtoBuf::Tablets tabletMap;
+
+    /// Current size of every object that has been written.
+    std::map<ObjectKey, uint32_t> objectBytes;
+
+    /// Index of the master the next new table is placed on.
+    uint32_t nextTableMasterIdx;
+
+    /// Trace time at which the current interval ends, in seconds.
+    double intervalEnd;
+
+    /// Whether #intervalEnd has been set by the first access.
+    bool started;
+
+    /// Operations served by each master during the current interval,
+    /// indexed by ServerId - 1.
+    vector<uint64_t> masterOps;
+
+    /// Migration data each master still has to send or receive, indexed
+    /// by ServerId - 1.
+    vector<uint64_t> pendingMigrationBytes;
+
+    /// Intervals completed so far.
+    vector<Interval> intervals;
+
+    DISALLOW_COPY_AND_ASSIGN(TabletBalancerSimulator);
+};
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUD_TABLETBALANCERSIMULATOR_H
@@ -0,0 +1,163 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * \file
+ * Replays an access trace against a simulated cluster to show how the
+ * tablet balancer would spread its load; see TabletBalancerSimulator.
+ *
+ * The report has one line per balancing interval, followed by totals.
+ */
+
+#include <boost/program_options.hpp>
+#include <fstream>
+#include <iostream>
+
+#include "Common.h"
+#include "Context.h"
+#include "TabletBalancerSimulator.h"
+
+using namespace RAMCloud;
+namespace po = boost::program_options;
+
+int
+main(int argc, char* argv[])
+try
+{
+    Context context(true);
+    Context::Guard _(context);
+
+    TabletBalancerSimulator::Config config;
+    string traceFile;
+    bool noBalance = false;
+    po::options_description desc(
+            "Usage: BalancerSimulator [options] --trace <file>\n\n"
+            "Replays an access trace against a simulated cluster and\n"
+            "reports the load imbalance, the balancer's actions and the\n"
+            "estimated latency over time.\n\n"
+            "Each line of the trace holds: <seconds> <tableId> <keyHash>\n"
+            "<reads> <writes> <objectBytes>.\n\n"
+            "Allowed options:");
+    desc.add_options()
+        ("trace,t", po::value<string>(&traceFile),
+                "File to read the trace from, or - for stdin (required)")
+        ("masters,n",
+                po::value<uint32_t>(&config.numMasters)->default_value(
+                    config.numMasters),
+                "Number of masters in the simulated cluster")
+        ("interval",
+                po::value<uint32_t>(&config.intervalMs)->default_value(
+                    config.intervalMs),
+                "Milliseconds of trace time between balancing rounds")
+        ("noBalance", po::bool_switch(&noBalance),
+                "Don't run the balancer; only report the trace's own "
+                "imbalance")
+        ("threshold",
+                po::value<double>(&config.threshold)->default_value(
+                    config.threshold),
+                "A master is overloaded once its load is above this "
+                "multiple of the mean load")
+        ("rateWindow",
+                po::value<uint32_t>(&config.rateWindowMs)->default_value(
+                    config.rateWindowMs),
+                "Averaging window of the access rates to balance on, in "
+                "milliseconds")
+        ("serviceTime",
+                po::value<double>(&config.serviceTimeUs)->default_value(
+                    config.serviceTimeUs),
+                "Microseconds a master spends on each read or write")
+        ("migrationBytesPerSecond",
+                po::value<uint64_t>(
+                    &config.migrationBytesPerSecond)->default_value(
+                    config.migrationBytesPerSecond),
+                "Rate at which migrations move data")
+        ("migrationCost",
+                po::value<double>(&config.migrationCost)->default_value(
+                    config.migrationCost),
+                "Fraction of a master's capacity taken up by a migration")
+        ("help,h", "Print this help message");
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+        std::cout << desc << '\n';
+        return 0;
+    }
+    if (traceFile.empty()) {
+        std::cerr << "missing required option --trace\n";
+        return 1;
+    }
+    if (config.numMasters == 0 || config.intervalMs == 0) {
+        std::cerr << "--masters and --interval must be positive\n";
+        return 1;
+    }
+    config.balance = !noBalance;
+
+    std::ifstream file;
+    if (traceFile != "-") {
+        file.open(traceFile.c_str());
+        if (!file) {
+            std::cerr << "couldn't open " << traceFile << '\n';
+            return 1;
+        }
+    }
+    std::istream& trace = (traceFile == "-") ? std::cin : file;
+
+    TabletBalancerSimulator simulator(config);
+    std::cout << "# time(s)  mean(op/s)   max(op/s)  ratio  mean(us)   "
+                 "max(us) split  move        bytes\n";
+    size_t reported = 0;
+    string line;
+    TabletBalancerSimulator::Access access;
+    while (std::getline(trace, line)) {
+        if (!TabletBalancerSimulator::parseAccess(line, access))
+            continue;
+        simulator.replay(access);
+        const vector<TabletBalancerSimulator::Interval>& intervals =
+            simulator.getIntervals();
+        for (; reported < intervals.size(); reported++)
+            std::cout << TabletBalancerSimulator::toString(
+                intervals[reported]) << '\n';
+    }
+    simulator.finish();
+
+    const vector<TabletBalancerSimulator::Interval>& intervals =
+        simulator.getIntervals();
+    for (; reported < intervals.size(); reported++)
+        std::cout << TabletBalancerSimulator::toString(
+            intervals[reported]) << '\n';
+
+    uint32_t splits = 0;
+    uint32_t migrations = 0;
+    uint64_t bytesMoved = 0;
+    double worstImbalance = 1.0;
+    foreach (const TabletBalancerSimulator::Interval& interval, intervals) {
+        splits += interval.splits;
+        migrations += interval.migrations;
+        bytesMoved += interval.bytesMoved;
+        if (interval.meanLoad > 0) {
+            worstImbalance = std::max(worstImbalance,
+                                      interval.maxLoad / interval.meanLoad);
+        }
+    }
+    std::cout << format("# %lu intervals, %u splits, %u migrations, "
+                        "%lu bytes moved, worst imbalance %.2f\n",
+                        intervals.size(), splits, migrations, bytesMoved,
+                        worstImbalance);
+    return 0;
+} catch (Exception& e) {
+    fprintf(stderr, "RAMCloud exception: %s\n", e.str().c_str());
+    return 1;
+}
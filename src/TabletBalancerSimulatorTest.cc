@@ -0,0 +1,195 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "TestUtil.h"
+#include "TabletBalancerSimulator.h"
+
+namespace RAMCloud {
+
+typedef TabletBalancerSimulator::Access Access;
+typedef TabletBalancerSimulator::Interval Interval;
+
+class TabletBalancerSimulatorTest : public ::testing::Test {
+  public:
+    TabletBalancerSimulator::Config config;
+
+    TabletBalancerSimulatorTest()
+        : config()
+    {
+        Context::get().logger->setLogLevels(RAMCloud::SILENT_LOG_LEVEL);
+        config.numMasters = 2;
+    }
+
+    static Access
+    access(double time, uint64_t tableId, HashType keyHash,
+           uint32_t reads, uint32_t writes, uint32_t objectBytes = 100)
+    {
+        Access result;
+        result.time = time;
+        result.tableId = tableId;
+        result.keyHash = keyHash;
+        result.reads = reads;
+        result.writes = writes;
+        result.objectBytes = objectBytes;
+        return result;
+    }
+
+    static TabletStatistics*
+    statistics(TabletBalancerSimulator& simulator, int tablet)
+    {
+        return reinterpret_cast<TabletStatistics*>(
+            simulator.tabletMap.tablet(tablet).user_data());
+    }
+
+    DISALLOW_COPY_AND_ASSIGN(TabletBalancerSimulatorTest);
+};
+
+TEST_F(TabletBalancerSimulatorTest, parseAccess) {
+    Access access;
+    EXPECT_TRUE(TabletBalancerSimulator::parseAccess(
+        "1.5 7 12345 3 1 200", access));
+    EXPECT_EQ(1.5, access.time);
+    EXPECT_EQ(7UL, access.tableId);
+    EXPECT_EQ(12345UL, access.keyHash);
+    EXPECT_EQ(3U, access.reads);
+    EXPECT_EQ(1U, access.writes);
+    EXPECT_EQ(200U, access.objectBytes);
+
+    EXPECT_FALSE(TabletBalancerSimulator::parseAccess("", access));
+    EXPECT_FALSE(TabletBalancerSimulator::parseAccess("  # comment", access));
+    EXPECT_THROW(TabletBalancerSimulator::parseAccess("1.5 7 oops", access),
+                 FatalError);
+}
+
+TEST_F(TabletBalancerSimulatorTest, replay_placesTablesRoundRobin) {
+    TabletBalancerSimulator simulator(config);
+    simulator.replay(access(0.1, 10, 5, 1, 0));
+    simulator.replay(access(0.2, 11, 5, 1, 0));
+    simulator.replay(access(0.3, 12, 5, 1, 0));
+    simulator.replay(access(0.4, 10, ~0UL, 1, 0));
+    ASSERT_EQ(3, simulator.tabletMap.tablet_size());
+    EXPECT_EQ(1UL, simulator.tabletMap.tablet(0).server_id());
+    EXPECT_EQ(2UL, simulator.tabletMap.tablet(1).server_id());
+    EXPECT_EQ(1UL, simulator.tabletMap.tablet(2).server_id());
+    EXPECT_EQ(3U, simulator.masterOps[0]);
+    EXPECT_EQ(1U, simulator.masterOps[1]);
+}
+
+TEST_F(TabletBalancerSimulatorTest, replay_tracksObjects) {
+    TabletBalancerSimulator simulator(config);
+    simulator.replay(access(0.1, 10, 5, 0, 1, 100));
+    simulator.replay(access(0.2, 10, 5, 2, 1, 300));
+    simulator.replay(access(0.3, 10, 6, 1, 0));
+    TabletStatistics::Counters counters =
+        statistics(simulator, 0)->collect();
+    EXPECT_EQ(3, counters.readCount);
+    EXPECT_EQ(200, counters.readBytes);
+    EXPECT_EQ(2, counters.writeCount);
+    EXPECT_EQ(400, counters.writeBytes);
+    EXPECT_EQ(1, counters.liveObjectCount);
+    EXPECT_EQ(300, counters.liveObjectBytes);
+}
+
+TEST_F(TabletBalancerSimulatorTest, replay_endsIntervals) {
+    config.balance = false;
+    TabletBalancerSimulator simulator(config);
+    simulator.replay(access(1.5, 10, 5, 600, 0));
+    simulator.replay(access(1.7, 11, 5, 200, 0));
+    EXPECT_EQ(0U, simulator.getIntervals().size());
+
+    // An empty interval in between is reported as such.
+    simulator.replay(access(3.2, 10, 5, 2, 0));
+    ASSERT_EQ(2U, simulator.getIntervals().size());
+    const Interval& busy = simulator.getIntervals()[0];
+    EXPECT_EQ(2.0, busy.endTime);
+    EXPECT_DOUBLE_EQ(400, busy.meanLoad);
+    EXPECT_DOUBLE_EQ(600, busy.maxLoad);
+    EXPECT_DOUBLE_EQ(2.0 / (1 - 600 * 2e-06), busy.maxLatencyUs);
+    EXPECT_DOUBLE_EQ((600 * 2.0 / (1 - 600 * 2e-06) +
+                      200 * 2.0 / (1 - 200 * 2e-06)) / 800,
+                     busy.meanLatencyUs);
+    const Interval& idle = simulator.getIntervals()[1];
+    EXPECT_EQ(3.0, idle.endTime);
+    EXPECT_EQ(0, idle.meanLoad);
+    EXPECT_EQ(2.0, idle.meanLatencyUs);
+
+    simulator.finish();
+    EXPECT_EQ(3U, simulator.getIntervals().size());
+    EXPECT_EQ("      4.0           1           2   2.00       2.0       2.0"
+              "     0     0            0",
+              TabletBalancerSimulator::toString(simulator.getIntervals()[2]));
+}
+
+TEST_F(TabletBalancerSimulatorTest, endInterval_overloadedMaster) {
+    config.balance = false;
+    TabletBalancerSimulator simulator(config);
+    simulator.replay(access(0.5, 10, 5, 1000000, 0));
+    simulator.finish();
+    EXPECT_DOUBLE_EQ(2.0 / (1 - TabletBalancerSimulator::MAX_UTILIZATION),
+                     simulator.getIntervals()[0].maxLatencyUs);
+}
+
+TEST_F(TabletBalancerSimulatorTest, rebalance_splitAndMigrate) {
+    config.migrationBytesPerSecond = 1000;
+    TabletBalancerSimulator simulator(config);
+    for (uint64_t i = 0; i < 16; i++)
+        simulator.replay(access(0.5, 10, (i << 60) + (1UL << 59), 100, 1));
+    simulator.finish();
+
+    const Interval& interval = simulator.getIntervals()[0];
+    EXPECT_EQ(1U, interval.splits);
+    EXPECT_EQ(1U, interval.migrations);
+    EXPECT_EQ(800U, interval.bytesMoved);
+    ASSERT_EQ(2, simulator.tabletMap.tablet_size());
+    const ProtoBuf::Tablets::Tablet& lower = simulator.tabletMap.tablet(0);
+    const ProtoBuf::Tablets::Tablet& upper = simulator.tabletMap.tablet(1);
+    EXPECT_EQ(0UL, lower.start_key_hash());
+    EXPECT_EQ(lower.end_key_hash() + 1, upper.start_key_hash());
+    EXPECT_EQ(~0UL, upper.end_key_hash());
+    EXPECT_EQ(2UL, lower.server_id());
+    EXPECT_EQ(1UL, upper.server_id());
+    EXPECT_LT((7UL << 60) + (1UL << 59), lower.end_key_hash());
+    EXPECT_GT((8UL << 60) + (1UL << 59), lower.end_key_hash());
+
+    // The migrated tablet starts over with nothing but its live objects.
+    TabletStatistics::Counters counters =
+        statistics(simulator, 0)->collect();
+    EXPECT_EQ(0, counters.readCount);
+    EXPECT_EQ(8, counters.liveObjectCount);
+    EXPECT_EQ(800, counters.liveObjectBytes);
+    EXPECT_EQ(800U, simulator.pendingMigrationBytes[0]);
+    EXPECT_EQ(800U, simulator.pendingMigrationBytes[1]);
+}
+
+TEST_F(TabletBalancerSimulatorTest, endInterval_migrationCost) {
+    config.balance = false;
+    config.migrationBytesPerSecond = 1000;
+    TabletBalancerSimulator simulator(config);
+    simulator.pendingMigrationBytes[0] = 1500;
+    simulator.pendingMigrationBytes[1] = 500;
+    simulator.replay(access(0.5, 10, 5, 0, 0));
+    simulator.replay(access(1.5, 10, 5, 0, 0));
+    simulator.finish();
+
+    EXPECT_EQ(0U, simulator.pendingMigrationBytes[0]);
+    EXPECT_EQ(0U, simulator.pendingMigrationBytes[1]);
+    ASSERT_EQ(2U, simulator.getIntervals().size());
+    EXPECT_DOUBLE_EQ(2.0 / (1 - 0.25),
+                     simulator.getIntervals()[0].maxLatencyUs);
+    EXPECT_DOUBLE_EQ(2.0 / (1 - 0.125),
+                     simulator.getIntervals()[1].maxLatencyUs);
+}
+
+}  // namespace RAMCloud
@@ -0,0 +1,261 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "TestUtil.h"
+#include "CoordinatorClient.h"
+#include "Cycles.h"
+#include "MasterClient.h"
+#include "MasterService.h"
+#include "MockCluster.h"
+#include "TabletBalancer.h"
+#include "TabletStatistics.h"
+
+namespace RAMCloud {
+
+typedef TabletBalancer::Action Action;
+typedef TabletBalancer::TabletLoad TabletLoad;
+
+class TabletBalancerTest : public ::testing::Test {
+  public:
+    MockCluster cluster;
+    ServerConfig masterConfig;
+    Server* master1;
+    Server* master2;
+    CoordinatorClient* coordinator;
+    TabletBalancer::Config config;
+
+    TabletBalancerTest()
+        : cluster()
+        , masterConfig(ServerConfig::forTesting())
+        , master1()
+        , master2()
+        , coordinator()
+        , config()
+    {
+        Context::get().logger->setLogLevels(RAMCloud::SILENT_LOG_LEVEL);
+
+        masterConfig.services = {MASTER_SERVICE, PING_SERVICE,
+                                 MEMBERSHIP_SERVICE};
+        masterConfig.localLocator = "mock:host=master1";
+        master1 = cluster.addServer(masterConfig);
+        masterConfig.localLocator = "mock:host=master2";
+        master2 = cluster.addServer(masterConfig);
+
+        coordinator = cluster.getCoordinatorClient();
+    }
+
+    ~TabletBalancerTest()
+    {
+        Cycles::mockTscValue = 0;
+    }
+
+    /// Render a plan as a string, so tests can check it in one go.
+    static string
+    toString(const vector<Action>& actions)
+    {
+        string result;
+        foreach (const Action& action, actions) {
+            if (result.size() != 0)
+                result += " | ";
+            if (action.type == Action::SPLIT) {
+                result += format("split %lu [%lu,%lu] at %lu",
+                                 action.tableId, action.startKeyHash,
+                                 action.endKeyHash, action.splitKeyHash);
+            } else {
+                result += format("migrate %lu [%lu,%lu] from %lu to %lu",
+                                 action.tableId, action.startKeyHash,
+                                 action.endKeyHash, *action.serverId,
+                                 *action.newOwner);
+            }
+        }
+        return result;
+    }
+
+    DISALLOW_COPY_AND_ASSIGN(TabletBalancerTest);
+};
+
+TEST_F(TabletBalancerTest, plan_alreadyBalanced) {
+    vector<ServerId> masters = { ServerId(1), ServerId(2) };
+    vector<TabletLoad> tablets;
+    tablets.push_back(TabletLoad(0, 0, 99, ServerId(1), 50));
+    tablets.push_back(TabletLoad(1, 0, 99, ServerId(2), 60));
+    vector<Action> actions;
+    TabletBalancer::plan(masters, tablets, 1.25, actions);
+    EXPECT_EQ("", toString(actions));
+}
+
+TEST_F(TabletBalancerTest, plan_idleCluster) {
+    vector<ServerId> masters = { ServerId(1), ServerId(2) };
+    vector<TabletLoad> tablets;
+    tablets.push_back(TabletLoad(0, 0, ~0UL, ServerId(1), 0));
+    vector<Action> actions;
+    TabletBalancer::plan(masters, tablets, 1.25, actions);
+    EXPECT_EQ("", toString(actions));
+}
+
+TEST_F(TabletBalancerTest, plan_singleMaster) {
+    vector<ServerId> masters = { ServerId(1) };
+    vector<TabletLoad> tablets;
+    tablets.push_back(TabletLoad(0, 0, ~0UL, ServerId(1), 100));
+    vector<Action> actions;
+    TabletBalancer::plan(masters, tablets, 1.25, actions);
+    EXPECT_EQ("", toString(actions));
+}
+
+TEST_F(TabletBalancerTest, plan_migrate) {
+    vector<ServerId> masters = { ServerId(1), ServerId(2) };
+    vector<TabletLoad> tablets;
+    tablets.push_back(TabletLoad(0, 0, 99, ServerId(1), 30));
+    tablets.push_back(TabletLoad(1, 0, 99, ServerId(1), 60));
+    tablets.push_back(TabletLoad(2, 0, 99, ServerId(1), 10));
+    vector<Action> actions;
+    TabletBalancer::plan(masters, tablets, 1.25, actions);
+    EXPECT_EQ("migrate 1 [0,99] from 1 to 2", toString(actions));
+}
+
+TEST_F(TabletBalancerTest, plan_migrateSeveral) {
+    vector<ServerId> masters = { ServerId(1), ServerId(2), ServerId(3) };
+    vector<TabletLoad> tablets;
+    for (uint64_t i = 0; i < 6; i++)
+        tablets.push_back(TabletLoad(i, 0, 99, ServerId(1), 10));
+    vector<Action> actions;
+    TabletBalancer::plan(masters, tablets, 1.0, actions);
+    EXPECT_EQ("migrate 0 [0,99] from 1 to 2 | "
+              "migrate 1 [0,99] from 1 to 3 | "
+              "migrate 2 [0,99] from 1 to 2 | "
+              "migrate 3 [0,99] from 1 to 3", toString(actions));
+}
+
+TEST_F(TabletBalancerTest, plan_splitHotTablet) {
+    vector<ServerId> masters = { ServerId(1), ServerId(2) };
+    vector<TabletLoad> tablets;
+    tablets.push_back(TabletLoad(0, 0, ~0UL, ServerId(1), 100));
+    vector<Action> actions;
+    TabletBalancer::plan(masters, tablets, 1.25, actions);
+    EXPECT_EQ("split 0 [0,18446744073709551615] at 9223372036854775808 | "
+              "migrate 0 [0,9223372036854775807] from 1 to 2",
+              toString(actions));
+}
+
+TEST_F(TabletBalancerTest, plan_splitAtLoadMedian) {
+    vector<ServerId> masters = { ServerId(1), ServerId(2) };
+    vector<TabletLoad> tablets;
+    tablets.push_back(TabletLoad(0, 0, ~0UL, ServerId(1), 100, 1UL << 40));
+    vector<Action> actions;
+    TabletBalancer::plan(masters, tablets, 1.25, actions);
+    EXPECT_EQ("split 0 [0,18446744073709551615] at 1099511627776 | "
+              "migrate 0 [0,1099511627775] from 1 to 2",
+              toString(actions));
+
+    // A median that isn't strictly inside the tablet is ignored.
+    tablets[0].loadMedianKeyHash = 1;
+    actions.clear();
+    TabletBalancer::plan(masters, tablets, 1.25, actions);
+    EXPECT_EQ("split 0 [0,18446744073709551615] at 9223372036854775808 | "
+              "migrate 0 [0,9223372036854775807] from 1 to 2",
+              toString(actions));
+}
+
+TEST_F(TabletBalancerTest, plan_tabletTooSmallToSplit) {
+    vector<ServerId> masters = { ServerId(1), ServerId(2) };
+    vector<TabletLoad> tablets;
+    tablets.push_back(TabletLoad(0, 0, 1000, ServerId(1), 100));
+    vector<Action> actions;
+    TabletBalancer::plan(masters, tablets, 1.25, actions);
+    EXPECT_EQ("", toString(actions));
+}
+
+TEST_F(TabletBalancerTest, plan_ignoreUnknownMasters) {
+    vector<ServerId> masters = { ServerId(1), ServerId(2) };
+    vector<TabletLoad> tablets;
+    tablets.push_back(TabletLoad(0, 0, 99, ServerId(1), 10));
+    tablets.push_back(TabletLoad(1, 0, 99, ServerId(1), 10));
+    tablets.push_back(TabletLoad(2, 0, 99, ServerId(3), 1000));
+    vector<Action> actions;
+    TabletBalancer::plan(masters, tablets, 1.25, actions);
+    EXPECT_EQ("migrate 0 [0,99] from 1 to 2", toString(actions));
+}
+
+TEST_F(TabletBalancerTest, balance_idleCluster) {
+    Cycles::mockTscValue = 1000;
+    coordinator->createTable("cold");
+    Cycles::mockTscValue = 1000 + Cycles::fromSeconds(1.0);
+
+    TabletBalancer balancer(cluster.coordinatorLocator, config);
+    balancer.balance();
+
+    ProtoBuf::Tablets tabletMap;
+    coordinator->getTabletMap(tabletMap);
+    EXPECT_EQ(1, tabletMap.tablet_size());
+}
+
+TEST_F(TabletBalancerTest, balance_splitAndMigrate) {
+    Cycles::mockTscValue = 1000;
+    coordinator->createTable("hot");
+    uint64_t table = coordinator->getTableId("hot");
+
+    auto client = cluster.get<MasterClient>(master1);
+    for (int i = 0; i < 10; i++) {
+        string key = format("key%d", i);
+        client->write(table, key.c_str(), downCast<uint16_t>(key.length()),
+                      "value", 5);
+    }
+    Cycles::mockTscValue = 1000 + Cycles::fromSeconds(1.0);
+
+    // The tablet should be split where the master saw half of the writes
+    // on either side. Asking for the statistics at the same (mocked) time
+    // as the balancer will gives the same answer.
+    ProtoBuf::ServerStatistics serverStats;
+    client->getServerStatistics(serverStats);
+    ASSERT_EQ(1, serverStats.tabletentry_size());
+    uint64_t median =
+        TabletStatistics::findLoadMedian(serverStats.tabletentry(0));
+    ASSERT_NE(0UL, median);
+
+    TabletBalancer balancer(cluster.coordinatorLocator, config);
+    balancer.balance();
+
+    ProtoBuf::Tablets tabletMap;
+    coordinator->getTabletMap(tabletMap);
+    ASSERT_EQ(2, tabletMap.tablet_size());
+    EXPECT_EQ(0UL, tabletMap.tablet(0).start_key_hash());
+    EXPECT_EQ(median - 1, tabletMap.tablet(0).end_key_hash());
+    EXPECT_EQ(master2->serverId.getId(), tabletMap.tablet(0).server_id());
+    EXPECT_EQ(median, tabletMap.tablet(1).start_key_hash());
+    EXPECT_EQ(~0UL, tabletMap.tablet(1).end_key_hash());
+    EXPECT_EQ(master1->serverId.getId(), tabletMap.tablet(1).server_id());
+    EXPECT_EQ(1, master1->master->tablets.tablet_size());
+    EXPECT_EQ(1, master2->master->tablets.tablet_size());
+}
+
+TEST_F(TabletBalancerTest, balance_unknownRateWindow) {
+    Cycles::mockTscValue = 1000;
+    coordinator->createTable("hot");
+    uint64_t table = coordinator->getTableId("hot");
+    auto client = cluster.get<MasterClient>(master1);
+    for (int i = 0; i < 10; i++)
+        client->write(table, "key", 3, "value", 5);
+    Cycles::mockTscValue = 1000 + Cycles::fromSeconds(1.0);
+
+    config.rateWindowMs = 1234;
+    TabletBalancer balancer(cluster.coordinatorLocator, config);
+    balancer.balance();
+
+    ProtoBuf::Tablets tabletMap;
+    coordinator->getTabletMap(tabletMap);
+    EXPECT_EQ(1, tabletMap.tablet_size());
+}
+
+}  // namespace RAMCloud
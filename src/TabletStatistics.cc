@@ -0,0 +1,480 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cmath>
+
+#include "Cycles.h"
+#include "Memory.h"
+#include "ShortMacros.h"
+#include "TabletStatistics.h"
+
+namespace RAMCloud {
+
+/**
+ * Fold the events of one interval into the average.
+ *
+ * The events are assumed to have been spread evenly over the interval,
+ * which makes the result independent of how often this is called: feeding
+ * in one interval of 2 seconds gives the same estimate as two back-to-back
+ * intervals of 1 second each with half the events.
+ *
+ * \param events
+ *      Number of events that happened during the interval.
+ * \param elapsedSeconds
+ *      Length of the interval. Nothing happens if this isn't positive.
+ */
+void
+DecayingRate::update(double events, double elapsedSeconds)
+{
+    if (elapsedSeconds <= 0)
+        return;
+    double weight = 1 - exp(-elapsedSeconds / windowSeconds);
+    rate += weight * (events / elapsedSeconds - rate);
+}
+
+const uint32_t TabletStatistics::WINDOW_MS[TabletStatistics::NUM_WINDOWS] =
+    { 1000, 10000, 60000 };
+
+TabletStatistics::Counters::Counters()
+    : readCount(0)
+    , writeCount(0)
+    , readBytes(0)
+    , writeBytes(0)
+    , liveObjectCount(0)
+    , liveObjectBytes(0)
+    , bucketAccesses()
+    , bucketLiveBytes()
+{
+}
+
+/**
+ * Add all of the counts in \a other to this.
+ */
+void
+TabletStatistics::Counters::add(const Counters& other)
+{
+    readCount += other.readCount;
+    writeCount += other.writeCount;
+    readBytes += other.readBytes;
+    writeBytes += other.writeBytes;
+    liveObjectCount += other.liveObjectCount;
+    liveObjectBytes += other.liveObjectBytes;
+    for (uint32_t i = 0; i < NUM_BUCKETS; i++) {
+        bucketAccesses[i] += other.bucketAccesses[i];
+        bucketLiveBytes[i] += other.bucketLiveBytes[i];
+    }
+}
+
+/**
+ * Construct statistics for a tablet that has just been created; all counts
+ * and rates start at zero.
+ *
+ * \param startKeyHash
+ *      First key hash of the tablet.
+ * \param endKeyHash
+ *      Last key hash of the tablet.
+ * \param now
+ *      Cycles::rdtsc() at the time of the call. Only something that keeps
+ *      its own clock, such as the TabletBalancerSimulator, needs to pass
+ *      anything else; it must then do the same for #sample and #split.
+ */
+TabletStatistics::TabletStatistics(uint64_t startKeyHash, uint64_t endKeyHash,
+                                   uint64_t now)
+    : startKeyHash()
+    , endKeyHash()
+    , bucketShift()
+    , slots(static_cast<Slot*>(Memory::xmemalign(HERE, CACHE_LINE_SIZE,
+                                                 NUM_SLOTS * sizeof(Slot))))
+    , base()
+    , lastSampleTime(now)
+    , last()
+    , windows()
+    , bucketRates(NUM_BUCKETS, DecayingRate(BUCKET_WINDOW_MS / 1000.0))
+{
+    setRange(startKeyHash, endKeyHash);
+    for (uint32_t i = 0; i < NUM_SLOTS; i++)
+        new(&slots[i]) Slot();
+    for (uint32_t i = 0; i < NUM_WINDOWS; i++)
+        windows.push_back(Window(WINDOW_MS[i] / 1000.0));
+}
+
+TabletStatistics::~TabletStatistics()
+{
+    free(slots);
+}
+
+/**
+ * Merge the per-thread counters.
+ *
+ * This may run concurrently with threads recording accesses; the result is
+ * then merely a little out of date.
+ */
+TabletStatistics::Counters
+TabletStatistics::collect() const
+{
+    Counters total = base;
+    for (uint32_t i = 0; i < NUM_SLOTS; i++)
+        total.add(slots[i].counters);
+    return total;
+}
+
+/**
+ * Fold the accesses recorded since the previous call into the rates.
+ *
+ * \param now
+ *      Cycles::rdtsc() at the time of the call.
+ */
+void
+TabletStatistics::sample(uint64_t now)
+{
+    if (now <= lastSampleTime)
+        return;
+    Counters current = collect();
+    double elapsed = Cycles::toSeconds(now - lastSampleTime);
+    double reads = static_cast<double>(current.readCount - last.readCount);
+    double writes = static_cast<double>(current.writeCount - last.writeCount);
+    double bytesRead = static_cast<double>(current.readBytes -
+                                           last.readBytes);
+    double bytesWritten = static_cast<double>(current.writeBytes -
+                                              last.writeBytes);
+    foreach (Window& window, windows) {
+        window.reads.update(reads, elapsed);
+        window.writes.update(writes, elapsed);
+        window.readBytes.update(bytesRead, elapsed);
+        window.writeBytes.update(bytesWritten, elapsed);
+    }
+    for (uint32_t i = 0; i < NUM_BUCKETS; i++) {
+        bucketRates[i].update(static_cast<double>(
+            current.bucketAccesses[i] - last.bucketAccesses[i]), elapsed);
+    }
+    lastSampleTime = now;
+    last = current;
+}
+
+/**
+ * Fill in the statistics fields of a TabletEntry. The identity of the tablet
+ * (table id and key hash range) is left to the caller. The counts are
+ * current; the rates are those computed by the last call to #sample.
+ */
+void
+TabletStatistics::serialize(ProtoBuf::ServerStatistics_TabletEntry& entry)
+    const
+{
+    Counters current = collect();
+    entry.set_number_read_and_writes(current.readCount + current.writeCount);
+    entry.set_read_count(current.readCount);
+    entry.set_write_count(current.writeCount);
+    entry.set_read_bytes(current.readBytes);
+    entry.set_write_bytes(current.writeBytes);
+    entry.set_live_object_count(std::max<int64_t>(current.liveObjectCount, 0));
+    entry.set_live_object_bytes(std::max<int64_t>(current.liveObjectBytes, 0));
+    for (uint32_t i = 0; i < NUM_WINDOWS; i++) {
+        ProtoBuf::ServerStatistics_TabletEntry_Rate& rate(*entry.add_rate());
+        rate.set_window_ms(WINDOW_MS[i]);
+        rate.set_reads_per_second(windows[i].reads.get());
+        rate.set_writes_per_second(windows[i].writes.get());
+        rate.set_read_bytes_per_second(windows[i].readBytes.get());
+        rate.set_write_bytes_per_second(windows[i].writeBytes.get());
+    }
+    for (uint32_t i = 0; i < NUM_BUCKETS; i++) {
+        uint64_t bucketStart = startKeyHash + (uint64_t(i) << bucketShift);
+        ProtoBuf::ServerStatistics_TabletEntry_Bucket& bucket(
+            *entry.add_bucket());
+        bucket.set_start_key_hash(bucketStart);
+        bucket.set_accesses(std::max<int64_t>(current.bucketAccesses[i], 0));
+        bucket.set_accesses_per_second(bucketRates[i].get());
+        bucket.set_live_bytes(std::max<int64_t>(current.bucketLiveBytes[i],
+                                                0));
+        // The last bucket may extend past the end of the tablet, but
+        // beyond that there are no more keys to count.
+        if (endKeyHash - bucketStart < (1UL << bucketShift))
+            break;
+    }
+}
+
+/**
+ * Move \a fraction of \a mine into \a theirs; helper for
+ * TabletStatistics::split.
+ */
+static void
+divide(double fraction, int64_t& mine, int64_t& theirs)
+{
+    theirs = static_cast<int64_t>(static_cast<double>(mine) * fraction);
+    mine -= theirs;
+}
+
+/**
+ * Return the last key hash of the histogram bucket that starts at \a first
+ * and is 2^shift key hashes wide, but no more than \a end. Helper for
+ * TabletStatistics::split.
+ */
+static uint64_t
+bucketEnd(uint64_t first, uint32_t shift, uint64_t end)
+{
+    uint64_t widthMinusOne = (1UL << shift) - 1;
+    if (end - first <= widthMinusOne)
+        return end;
+    return first + widthMinusOne;
+}
+
+/**
+ * Spread values kept per bucket of one histogram over the buckets of
+ * another one, in proportion to how many key hashes the buckets share.
+ * Helper for TabletStatistics::split.
+ *
+ * \param from
+ *      Values in the source histogram, which has NUM_BUCKETS buckets of
+ *      2^fromShift key hashes, starting at fromStart and ending at
+ *      fromEnd.
+ * \param[out] to
+ *      The values are added to this histogram, which starts at toStart,
+ *      ends at toEnd and has buckets of 2^toShift key hashes. Keys that
+ *      fall outside of it are dropped.
+ */
+static void
+rebin(const double* from, uint64_t fromStart, uint64_t fromEnd,
+      uint32_t fromShift, double* to, uint64_t toStart, uint64_t toEnd,
+      uint32_t toShift)
+{
+    const uint32_t numBuckets = TabletStatistics::NUM_BUCKETS;
+    for (uint32_t i = 0; i < numBuckets; i++) {
+        uint64_t first = fromStart + (uint64_t(i) << fromShift);
+        if (first < fromStart || first > fromEnd)
+            break;
+        uint64_t last = bucketEnd(first, fromShift, fromEnd);
+        double width = static_cast<double>(last - first) + 1;
+        for (uint32_t j = 0; j < numBuckets; j++) {
+            uint64_t toFirst = toStart + (uint64_t(j) << toShift);
+            if (toFirst < toStart || toFirst > toEnd)
+                break;
+            uint64_t toLast = bucketEnd(toFirst, toShift, toEnd);
+            uint64_t overlapFirst = std::max(first, toFirst);
+            uint64_t overlapLast = std::min(last, toLast);
+            if (overlapFirst > overlapLast)
+                continue;
+            double overlap = static_cast<double>(overlapLast -
+                                                 overlapFirst) + 1;
+            to[j] += from[i] * overlap / width;
+        }
+    }
+}
+
+/**
+ * Divide the statistics between the two halves of a tablet that is being
+ * split. Accesses and live data are divided as the histogram suggests; the
+ * split within a bucket is assumed to be proportional to the key hashes
+ * on either side.
+ *
+ * This must not run concurrently with anything recording accesses to
+ * either tablet.
+ *
+ * \param splitKeyHash
+ *      First key hash of the upper half. This object keeps the lower half.
+ * \param[out] other
+ *      Statistics of the upper half of the tablet, which must cover
+ *      exactly the upper half and must not have recorded anything yet.
+ * \param now
+ *      Cycles::rdtsc() at the time of the call.
+ */
+void
+TabletStatistics::split(uint64_t splitKeyHash, TabletStatistics& other,
+                        uint64_t now)
+{
+    // Sampling first means there are no unaccounted accesses left over that
+    // would need to be divided up.
+    sample(now);
+    Counters total = collect();
+
+    uint64_t oldStart = startKeyHash;
+    uint64_t oldEnd = endKeyHash;
+    uint32_t oldShift = bucketShift;
+    setRange(oldStart, splitKeyHash - 1);
+
+    // Re-bucket the histograms (and the per-bucket rates) to the new ranges.
+    double accesses[NUM_BUCKETS], liveBytes[NUM_BUCKETS], rates[NUM_BUCKETS];
+    for (uint32_t i = 0; i < NUM_BUCKETS; i++) {
+        accesses[i] = static_cast<double>(total.bucketAccesses[i]);
+        liveBytes[i] = static_cast<double>(total.bucketLiveBytes[i]);
+        rates[i] = bucketRates[i].get();
+    }
+    double myAccesses[NUM_BUCKETS] = {}, theirAccesses[NUM_BUCKETS] = {};
+    double myBytes[NUM_BUCKETS] = {}, theirBytes[NUM_BUCKETS] = {};
+    double myRates[NUM_BUCKETS] = {}, theirRates[NUM_BUCKETS] = {};
+    rebin(accesses, oldStart, oldEnd, oldShift,
+          myAccesses, startKeyHash, endKeyHash, bucketShift);
+    rebin(accesses, oldStart, oldEnd, oldShift,
+          theirAccesses, other.startKeyHash, other.endKeyHash,
+          other.bucketShift);
+    rebin(liveBytes, oldStart, oldEnd, oldShift,
+          myBytes, startKeyHash, endKeyHash, bucketShift);
+    rebin(liveBytes, oldStart, oldEnd, oldShift,
+          theirBytes, other.startKeyHash, other.endKeyHash,
+          other.bucketShift);
+    rebin(rates, oldStart, oldEnd, oldShift,
+          myRates, startKeyHash, endKeyHash, bucketShift);
+    rebin(rates, oldStart, oldEnd, oldShift,
+          theirRates, other.startKeyHash, other.endKeyHash,
+          other.bucketShift);
+
+    // Use the histograms to decide what share of the totals goes where.
+    double accessShare = 0, bytesShare = 0, myTotal = 0, theirTotal = 0;
+    for (uint32_t i = 0; i < NUM_BUCKETS; i++) {
+        myTotal += myAccesses[i];
+        theirTotal += theirAccesses[i];
+    }
+    accessShare = (myTotal + theirTotal > 0)
+                  ? theirTotal / (myTotal + theirTotal)
+                  : static_cast<double>(other.endKeyHash -
+                                        other.startKeyHash) /
+                    static_cast<double>(oldEnd - oldStart);
+    myTotal = theirTotal = 0;
+    for (uint32_t i = 0; i < NUM_BUCKETS; i++) {
+        myTotal += myBytes[i];
+        theirTotal += theirBytes[i];
+    }
+    bytesShare = (myTotal + theirTotal > 0)
+                 ? theirTotal / (myTotal + theirTotal)
+                 : accessShare;
+
+    Counters mine;
+    Counters theirs;
+    mine.readCount = total.readCount;
+    mine.writeCount = total.writeCount;
+    mine.readBytes = total.readBytes;
+    mine.writeBytes = total.writeBytes;
+    mine.liveObjectCount = total.liveObjectCount;
+    mine.liveObjectBytes = total.liveObjectBytes;
+    divide(accessShare, mine.readCount, theirs.readCount);
+    divide(accessShare, mine.writeCount, theirs.writeCount);
+    divide(accessShare, mine.readBytes, theirs.readBytes);
+    divide(accessShare, mine.writeBytes, theirs.writeBytes);
+    divide(bytesShare, mine.liveObjectCount, theirs.liveObjectCount);
+    divide(bytesShare, mine.liveObjectBytes, theirs.liveObjectBytes);
+    for (uint32_t i = 0; i < NUM_BUCKETS; i++) {
+        mine.bucketAccesses[i] = static_cast<int64_t>(myAccesses[i] + 0.5);
+        mine.bucketLiveBytes[i] = static_cast<int64_t>(myBytes[i] + 0.5);
+        theirs.bucketAccesses[i] = static_cast<int64_t>(theirAccesses[i] + 0.5);
+        theirs.bucketLiveBytes[i] = static_cast<int64_t>(theirBytes[i] + 0.5);
+        bucketRates[i].set(myRates[i]);
+        other.bucketRates[i].set(theirRates[i]);
+    }
+
+    // The slots' histograms refer to the old bucket boundaries, so
+    // everything moves into #base.
+    for (uint32_t i = 0; i < NUM_SLOTS; i++)
+        new(&slots[i]) Slot();
+    base = mine;
+    last = mine;
+    other.base = theirs;
+    other.last = theirs;
+    other.lastSampleTime = lastSampleTime;
+
+    for (uint32_t i = 0; i < NUM_WINDOWS; i++) {
+        Window& myWindow = windows[i];
+        Window& theirWindow = other.windows[i];
+        theirWindow = myWindow;
+        theirWindow.reads.scale(accessShare);
+        theirWindow.writes.scale(accessShare);
+        theirWindow.readBytes.scale(accessShare);
+        theirWindow.writeBytes.scale(accessShare);
+        myWindow.reads.scale(1 - accessShare);
+        myWindow.writes.scale(1 - accessShare);
+        myWindow.readBytes.scale(1 - accessShare);
+        myWindow.writeBytes.scale(1 - accessShare);
+    }
+}
+
+/**
+ * Find the key hash that divides the load on a tablet into two equal
+ * halves, based on the histogram a master reported for it. Recent load
+ * (accesses_per_second) is preferred; if there was none, the lifetime
+ * access counts are used.
+ *
+ * \param entry
+ *      Statistics for the tablet, as returned by GET_SERVER_STATISTICS.
+ * \return
+ *      A key hash suitable as the first key of the upper half when
+ *      splitting the tablet, or 0 if the statistics don't say where the
+ *      load is (no histogram, no accesses, or a tablet too small to be
+ *      split).
+ */
+uint64_t
+TabletStatistics::findLoadMedian(
+                    const ProtoBuf::ServerStatistics_TabletEntry& entry)
+{
+    uint64_t start = entry.start_key_hash();
+    uint64_t end = entry.end_key_hash();
+    int numBuckets = entry.bucket_size();
+    if (numBuckets == 0 || end - start < 3)
+        return 0;
+
+    bool useRates = false;
+    double total = 0;
+    foreach (const ProtoBuf::ServerStatistics_TabletEntry_Bucket& bucket,
+             entry.bucket())
+        total += bucket.accesses_per_second();
+    if (total > 0) {
+        useRates = true;
+    } else {
+        foreach (const ProtoBuf::ServerStatistics_TabletEntry_Bucket& bucket,
+                 entry.bucket())
+            total += static_cast<double>(bucket.accesses());
+    }
+    if (total <= 0)
+        return 0;
+
+    double half = total / 2;
+    double seen = 0;
+    uint64_t median = 0;
+    for (int i = 0; i < numBuckets; i++) {
+        const ProtoBuf::ServerStatistics_TabletEntry_Bucket&
+            bucket(entry.bucket(i));
+        double load = useRates ? bucket.accesses_per_second()
+                               : static_cast<double>(bucket.accesses());
+        if (seen + load < half) {
+            seen += load;
+            continue;
+        }
+        uint64_t first = bucket.start_key_hash();
+        uint64_t last = (i + 1 < numBuckets)
+                        ? entry.bucket(i + 1).start_key_hash() - 1
+                        : end;
+        double width = static_cast<double>(last - first) + 1;
+        median = first + static_cast<uint64_t>(width * (half - seen) / load);
+        break;
+    }
+
+    // Both halves need to keep at least a couple of key hashes; see
+    // CoordinatorService::splitTablet.
+    return std::min(std::max(median, start + 2), end - 1);
+}
+
+/**
+ * Change the key hash range covered by the histogram and choose its bucket
+ * width: the smallest power of two such that #NUM_BUCKETS buckets cover
+ * the whole range. Existing histogram counts are not adjusted.
+ */
+void
+TabletStatistics::setRange(uint64_t startKeyHash, uint64_t endKeyHash)
+{
+    this->startKeyHash = startKeyHash;
+    this->endKeyHash = endKeyHash;
+    uint64_t span = endKeyHash - startKeyHash;
+    bucketShift = 0;
+    while ((span >> bucketShift) >= NUM_BUCKETS)
+        bucketShift++;
+}
+
+} // namespace RAMCloud
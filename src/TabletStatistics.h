@@ -0,0 +1,300 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUD_TABLETSTATISTICS_H
+#define RAMCLOUD_TABLETSTATISTICS_H
+
+#include "ServerStatistics.pb.h"
+
+#include "Common.h"
+#include "Cycles.h"
+#include "KeyHash.h"
+#include "ThreadId.h"
+
+namespace RAMCloud {
+
+/**
+ * An exponentially decaying average of an event rate.
+ *
+ * The average is fed with the number of events seen during an interval of
+ * arbitrary length; intervals don't need to be regular. Events older than
+ * the window contribute less and less to the average: after one window
+ * their weight has dropped to 1/e, after three windows to about 5%.
+ */
+class DecayingRate {
+  public:
+    explicit DecayingRate(double windowSeconds)
+        : windowSeconds(windowSeconds)
+        , rate(0)
+    {
+    }
+
+    void update(double events, double elapsedSeconds);
+
+    /// Return the current estimate, in events per second.
+    double get() const { return rate; }
+
+    /// Multiply the current estimate by \a fraction.
+    void scale(double fraction) { rate *= fraction; }
+
+    /// Replace the current estimate.
+    void set(double rate) { this->rate = rate; }
+
+  PRIVATE:
+    /// Time constant of the decay.
+    double windowSeconds;
+
+    /// Current estimate, in events per second.
+    double rate;
+};
+
+/**
+ * Access statistics for a single tablet on a master.
+ *
+ * The master bumps plain counters on every read and write (#recordRead,
+ * #recordWrite) and for every object that appears or disappears
+ * (#objectAdded, #objectRemoved). Rates are only derived from the counters
+ * when someone asks for them (#sample), which happens on
+ * GET_SERVER_STATISTICS.
+ *
+ * Besides the totals, accesses and live bytes are also counted in a
+ * histogram of #NUM_BUCKETS sub-ranges of the tablet's key hash range, so
+ * that a tablet can be split where its load actually is (see
+ * #findLoadMedian) rather than at the middle of its hash range. The
+ * buckets are all the same power-of-two width, chosen so that at least
+ * half of them fall into the tablet.
+ *
+ * The counters sit on the RPC fast path, so they are split into one slot
+ * per worker thread, each in cache lines of its own: recording an access
+ * is a few unsynchronized adds to lines no other thread writes to. The
+ * slots are only summed up by #collect. Threads are mapped to slots by
+ * their ThreadId, so worker, replay and cleaner threads do end up sharing
+ * slots. An access count that loses an occasional update merely skews a
+ * rate a little, but the live object counts are running totals that would
+ * drift for good, so those are updated with atomic adds.
+ *
+ * Rates are kept over several windows (see #WINDOW_MS) so that consumers
+ * can tell a burst from a sustained load.
+ */
+class TabletStatistics {
+  public:
+    /// Number of averaging windows kept for every rate.
+    static const uint32_t NUM_WINDOWS = 3;
+
+    /// Length of the averaging windows in milliseconds, shortest first.
+    static const uint32_t WINDOW_MS[NUM_WINDOWS];
+
+    /// Number of per-thread counter slots.
+    static const uint32_t NUM_SLOTS = 16;
+
+    /// Number of key hash sub-ranges in the access histogram.
+    static const uint32_t NUM_BUCKETS = 16;
+
+    /// Averaging window, in milliseconds, of the per-bucket access rates.
+    static const uint32_t BUCKET_WINDOW_MS = 10000;
+
+    /**
+     * The raw counters of a tablet. Counts are signed so that slots can
+     * hold negative deltas (for instance, a thread that removes more
+     * objects than it created).
+     */
+    struct Counters {
+        Counters();
+        void add(const Counters& other);
+
+        /// Number of reads since the tablet was created on this master.
+        int64_t readCount;
+
+        /// Number of writes since the tablet was created on this master.
+        int64_t writeCount;
+
+        /// Bytes of object data returned by the reads in #readCount.
+        /// Reads of objects that don't exist count with 0 bytes.
+        int64_t readBytes;
+
+        /// Bytes of object data stored by the writes in #writeCount.
+        int64_t writeBytes;
+
+        /// Number of objects currently stored in the tablet.
+        int64_t liveObjectCount;
+
+        /// Bytes of object data currently stored in the tablet.
+        int64_t liveObjectBytes;
+
+        /// Reads plus writes, per key hash bucket.
+        int64_t bucketAccesses[NUM_BUCKETS];
+
+        /// Bytes of object data currently stored, per key hash bucket.
+        int64_t bucketLiveBytes[NUM_BUCKETS];
+    };
+
+    TabletStatistics(uint64_t startKeyHash, uint64_t endKeyHash,
+                     uint64_t now = Cycles::rdtsc());
+    ~TabletStatistics();
+
+    /**
+     * Account for a read of \a bytes bytes of object data. Reads of
+     * objects that don't exist count with 0 bytes.
+     */
+    void
+    recordRead(HashType keyHash, uint32_t bytes)
+    {
+        Counters& counters = slot();
+        counters.readCount++;
+        counters.readBytes += bytes;
+        counters.bucketAccesses[bucket(keyHash)]++;
+    }
+
+    /**
+     * Account for a write of \a bytes bytes of object data.
+     */
+    void
+    recordWrite(HashType keyHash, uint32_t bytes)
+    {
+        Counters& counters = slot();
+        counters.writeCount++;
+        counters.writeBytes += bytes;
+        counters.bucketAccesses[bucket(keyHash)]++;
+    }
+
+    /**
+     * Account for a new live object of \a bytes bytes of data.
+     */
+    void
+    objectAdded(HashType keyHash, uint32_t bytes)
+    {
+        Counters& counters = slot();
+        __sync_fetch_and_add(&counters.liveObjectCount, 1);
+        __sync_fetch_and_add(&counters.liveObjectBytes, bytes);
+        __sync_fetch_and_add(&counters.bucketLiveBytes[bucket(keyHash)],
+                             bytes);
+    }
+
+    /**
+     * Account for a live object of \a bytes bytes of data that was
+     * removed or overwritten.
+     */
+    void
+    objectRemoved(HashType keyHash, uint32_t bytes)
+    {
+        Counters& counters = slot();
+        __sync_fetch_and_sub(&counters.liveObjectCount, 1);
+        __sync_fetch_and_sub(&counters.liveObjectBytes, bytes);
+        __sync_fetch_and_sub(&counters.bucketLiveBytes[bucket(keyHash)],
+                             bytes);
+    }
+
+    Counters collect() const;
+    void sample(uint64_t now);
+    void serialize(ProtoBuf::ServerStatistics_TabletEntry& entry) const;
+    void split(uint64_t splitKeyHash, TabletStatistics& other,
+               uint64_t now = Cycles::rdtsc());
+    static uint64_t findLoadMedian(
+                    const ProtoBuf::ServerStatistics_TabletEntry& entry);
+
+  PRIVATE:
+    /**
+     * The decaying rates over a single window.
+     */
+    struct Window {
+        explicit Window(double windowSeconds)
+            : reads(windowSeconds)
+            , writes(windowSeconds)
+            , readBytes(windowSeconds)
+            , writeBytes(windowSeconds)
+        {
+        }
+
+        DecayingRate reads;
+        DecayingRate writes;
+        DecayingRate readBytes;
+        DecayingRate writeBytes;
+    };
+
+    /**
+     * The counters of the threads mapped to one slot, padded out to whole
+     * cache lines.
+     */
+    struct Slot {
+        Slot()
+            : counters()
+            , pad()
+        {
+        }
+
+        Counters counters;
+        char pad[CACHE_LINE_SIZE - sizeof(Counters) % CACHE_LINE_SIZE];
+    };
+    static_assert(sizeof(Slot) % CACHE_LINE_SIZE == 0,
+                  "TabletStatistics::Slot must fill whole cache lines");
+
+    /**
+     * Return the counters the calling thread should update.
+     */
+    Counters&
+    slot()
+    {
+        return slots[ThreadId::get() % NUM_SLOTS].counters;
+    }
+
+    /**
+     * Return the histogram bucket that counts \a keyHash.
+     */
+    uint32_t
+    bucket(HashType keyHash) const
+    {
+        uint64_t index = (keyHash - startKeyHash) >> bucketShift;
+        return index < NUM_BUCKETS ? static_cast<uint32_t>(index)
+                                   : NUM_BUCKETS - 1;
+    }
+
+    void setRange(uint64_t startKeyHash, uint64_t endKeyHash);
+
+    /// First key hash of the tablet.
+    uint64_t startKeyHash;
+
+    /// Last key hash of the tablet.
+    uint64_t endKeyHash;
+
+    /// Histogram buckets are 2^bucketShift key hashes wide.
+    uint32_t bucketShift;
+
+    /// #NUM_SLOTS cache-aligned slots, one per worker thread.
+    Slot* slots;
+
+    /// Added to the sum of the #slots by #collect; #split uses this to
+    /// hand part of the counts to the other half of the tablet.
+    Counters base;
+
+    /// Time of the last call to #sample (or of construction), in the
+    /// same units as the \a now argument of #sample.
+    uint64_t lastSampleTime;
+
+    /// Result of #collect at the last call to #sample.
+    Counters last;
+
+    /// One entry per averaging window, in the order of #WINDOW_MS.
+    vector<Window> windows;
+
+    /// Decaying rate of accesses in each histogram bucket, over
+    /// #BUCKET_WINDOW_MS.
+    vector<DecayingRate> bucketRates;
+
+    DISALLOW_COPY_AND_ASSIGN(TabletStatistics);
+};
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUD_TABLETSTATISTICS_H
@@ -0,0 +1,314 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cmath>
+#include <thread>
+
+#include "TestUtil.h"
+#include "Cycles.h"
+#include "TabletStatistics.h"
+
+namespace RAMCloud {
+
+TEST(DecayingRateTest, update) {
+    DecayingRate rate(1.0);
+    EXPECT_EQ(0, rate.get());
+    rate.update(100, 1.0);
+    EXPECT_NEAR(100 * (1 - exp(-1.0)), rate.get(), 1e-9);
+
+    // A steady load converges on the true rate.
+    for (int i = 0; i < 20; i++)
+        rate.update(100, 1.0);
+    EXPECT_NEAR(100, rate.get(), 1e-6);
+
+    // And an idle tablet decays towards zero.
+    rate.update(0, 3.0);
+    EXPECT_NEAR(100 * exp(-3.0), rate.get(), 1e-6);
+}
+
+TEST(DecayingRateTest, update_independentOfSamplingInterval) {
+    DecayingRate once(10.0);
+    DecayingRate often(10.0);
+    once.update(200, 2.0);
+    often.update(100, 1.0);
+    often.update(100, 1.0);
+    EXPECT_NEAR(once.get(), often.get(), 1e-9);
+}
+
+TEST(DecayingRateTest, update_noElapsedTime) {
+    DecayingRate rate(1.0);
+    rate.update(100, 0);
+    EXPECT_EQ(0, rate.get());
+}
+
+TEST(TabletStatisticsTest, sample) {
+    TabletStatistics stats(0, ~0UL);
+    stats.lastSampleTime = 1000;
+    for (int i = 0; i < 10; i++)
+        stats.recordRead(0, 100);
+    stats.recordWrite(0, 50);
+    stats.sample(1000 + Cycles::fromSeconds(1.0));
+
+    EXPECT_NEAR(10 * (1 - exp(-1.0)), stats.windows[0].reads.get(), 1e-6);
+    EXPECT_NEAR(1000 * (1 - exp(-1.0)), stats.windows[0].readBytes.get(),
+                1e-3);
+    EXPECT_NEAR(1 - exp(-0.1), stats.windows[1].writes.get(), 1e-6);
+    EXPECT_NEAR(50 * (1 - exp(-1.0 / 60)), stats.windows[2].writeBytes.get(),
+                1e-6);
+
+    // Nothing happened since the last sample: rates decay.
+    double before = stats.windows[0].reads.get();
+    stats.sample(1000 + Cycles::fromSeconds(2.0));
+    EXPECT_NEAR(before * exp(-1.0), stats.windows[0].reads.get(), 1e-6);
+
+    // Time going backwards is ignored.
+    before = stats.windows[0].reads.get();
+    stats.sample(500);
+    EXPECT_EQ(before, stats.windows[0].reads.get());
+}
+
+TEST(TabletStatisticsTest, objectAddedAndRemoved) {
+    TabletStatistics stats(0, ~0UL);
+    stats.objectAdded(0, 10);
+    stats.objectAdded(0, 20);
+    stats.objectRemoved(0, 10);
+    EXPECT_EQ(1, stats.collect().liveObjectCount);
+    EXPECT_EQ(20, stats.collect().liveObjectBytes);
+
+    // Never reported as negative, even if we missed an addition.
+    stats.objectRemoved(0, 20);
+    stats.objectRemoved(0, 20);
+    ProtoBuf::ServerStatistics::TabletEntry entry;
+    entry.set_table_id(0);
+    entry.set_start_key_hash(0);
+    entry.set_end_key_hash(0);
+    stats.serialize(entry);
+    EXPECT_EQ(0U, entry.live_object_count());
+    EXPECT_EQ(0U, entry.live_object_bytes());
+}
+
+static void
+recordReads(TabletStatistics* stats, int count)
+{
+    for (int i = 0; i < count; i++)
+        stats->recordRead(0, 1);
+}
+
+TEST(TabletStatisticsTest, collect_perThreadSlots) {
+    TabletStatistics stats(0, ~0UL);
+    recordReads(&stats, 3);
+    std::thread thread(recordReads, &stats, 5);
+    thread.join();
+
+    uint32_t slotsUsed = 0;
+    for (uint32_t i = 0; i < TabletStatistics::NUM_SLOTS; i++) {
+        if (stats.slots[i].counters.readCount != 0)
+            slotsUsed++;
+    }
+    EXPECT_EQ(2U, slotsUsed);
+    EXPECT_EQ(8, stats.collect().readCount);
+    EXPECT_EQ(8, stats.collect().readBytes);
+    EXPECT_EQ(0U, reinterpret_cast<uint64_t>(stats.slots) % CACHE_LINE_SIZE);
+}
+
+TEST(TabletStatisticsTest, serialize) {
+    TabletStatistics stats(2, 3);
+    stats.recordRead(2, 5);
+    stats.recordWrite(3, 7);
+    stats.objectAdded(3, 7);
+    ProtoBuf::ServerStatistics::TabletEntry entry;
+    entry.set_table_id(1);
+    entry.set_start_key_hash(2);
+    entry.set_end_key_hash(3);
+    stats.serialize(entry);
+    EXPECT_EQ("table_id: 1 start_key_hash: 2 end_key_hash: 3 "
+              "number_read_and_writes: 2 "
+              "rate { window_ms: 1000 reads_per_second: 0 "
+                "writes_per_second: 0 read_bytes_per_second: 0 "
+                "write_bytes_per_second: 0 } "
+              "rate { window_ms: 10000 reads_per_second: 0 "
+                "writes_per_second: 0 read_bytes_per_second: 0 "
+                "write_bytes_per_second: 0 } "
+              "rate { window_ms: 60000 reads_per_second: 0 "
+                "writes_per_second: 0 read_bytes_per_second: 0 "
+                "write_bytes_per_second: 0 } "
+              "read_count: 1 write_count: 1 read_bytes: 5 write_bytes: 7 "
+              "live_object_count: 1 live_object_bytes: 7 "
+              "bucket { start_key_hash: 2 accesses: 1 "
+                "accesses_per_second: 0 live_bytes: 0 } "
+              "bucket { start_key_hash: 3 accesses: 1 "
+                "accesses_per_second: 0 live_bytes: 7 }",
+              entry.ShortDebugString());
+}
+
+TEST(TabletStatisticsTest, setRange) {
+    TabletStatistics stats(0, ~0UL);
+    EXPECT_EQ(60U, stats.bucketShift);
+    stats.setRange(100, 115);
+    EXPECT_EQ(0U, stats.bucketShift);
+    stats.setRange(100, 116);
+    EXPECT_EQ(1U, stats.bucketShift);
+    stats.setRange(5, 5);
+    EXPECT_EQ(0U, stats.bucketShift);
+}
+
+TEST(TabletStatisticsTest, bucket) {
+    TabletStatistics stats(1000, 1099);
+    EXPECT_EQ(3U, stats.bucketShift);
+    EXPECT_EQ(0U, stats.bucket(1000));
+    EXPECT_EQ(0U, stats.bucket(1007));
+    EXPECT_EQ(1U, stats.bucket(1008));
+    EXPECT_EQ(12U, stats.bucket(1099));
+    // Keys outside of the tablet shouldn't show up, but mustn't hurt.
+    EXPECT_EQ(15U, stats.bucket(999));
+    EXPECT_EQ(15U, stats.bucket(5000));
+}
+
+TEST(TabletStatisticsTest, split) {
+    TabletStatistics stats(0, 2047);
+    stats.lastSampleTime = 1000;
+    // 80 reads in the lower quarter of the tablet, 20 in the rest.
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t keyHash = (i < 80) ? i : 1024 + i;
+        stats.recordRead(keyHash, 10);
+        stats.objectAdded(keyHash, 10);
+    }
+    Cycles::mockTscValue = 1000 + Cycles::fromSeconds(1.0);
+    stats.sample(Cycles::mockTscValue);
+    double rate = stats.windows[0].reads.get();
+
+    TabletStatistics other(512, 2047);
+    stats.split(512, other);
+    Cycles::mockTscValue = 0;
+    EXPECT_EQ(0U, stats.startKeyHash);
+    EXPECT_EQ(511U, stats.endKeyHash);
+    EXPECT_EQ(80, stats.collect().readCount);
+    EXPECT_EQ(20, other.collect().readCount);
+    EXPECT_EQ(800, stats.collect().liveObjectBytes);
+    EXPECT_EQ(200, other.collect().liveObjectBytes);
+    EXPECT_NEAR(0.8 * rate, stats.windows[0].reads.get(), 1e-6);
+    EXPECT_NEAR(0.2 * rate, other.windows[0].reads.get(), 1e-6);
+    EXPECT_EQ(stats.collect().readCount, stats.last.readCount);
+    EXPECT_EQ(other.collect().readCount, other.last.readCount);
+
+    // The histograms were redistributed over the new, narrower buckets:
+    // the old ones were 128 key hashes wide, so the 80 accesses in the
+    // first one are spread evenly over the first 4 buckets of 32.
+    EXPECT_EQ(20, stats.collect().bucketAccesses[0]);
+    EXPECT_EQ(20, stats.collect().bucketAccesses[3]);
+    EXPECT_EQ(0, stats.collect().bucketAccesses[4]);
+    EXPECT_EQ(20, other.collect().bucketAccesses[4]);
+
+    // Both halves keep counting from where the split left them.
+    stats.recordRead(0, 10);
+    other.recordRead(2047, 10);
+    EXPECT_EQ(81, stats.collect().readCount);
+    EXPECT_EQ(21, other.collect().readCount);
+    EXPECT_EQ(21, stats.collect().bucketAccesses[0]);
+}
+
+TEST(TabletStatisticsTest, split_noAccesses) {
+    TabletStatistics stats(0, 999);
+    TabletStatistics other(250, 999);
+    stats.split(250, other);
+    EXPECT_EQ(0, stats.collect().readCount);
+    EXPECT_EQ(0, other.collect().readCount);
+    EXPECT_EQ(249U, stats.endKeyHash);
+}
+
+/// Build a TabletEntry for [start, end] whose buckets are \a width key
+/// hashes wide and have the given accesses_per_second.
+static ProtoBuf::ServerStatistics::TabletEntry
+makeEntry(uint64_t start, uint64_t end, uint64_t width,
+          const vector<double>& rates)
+{
+    ProtoBuf::ServerStatistics::TabletEntry entry;
+    entry.set_table_id(0);
+    entry.set_start_key_hash(start);
+    entry.set_end_key_hash(end);
+    for (uint32_t i = 0; i < rates.size(); i++) {
+        ProtoBuf::ServerStatistics_TabletEntry_Bucket& bucket(
+            *entry.add_bucket());
+        bucket.set_start_key_hash(start + i * width);
+        bucket.set_accesses(0);
+        bucket.set_accesses_per_second(rates[i]);
+        bucket.set_live_bytes(0);
+    }
+    return entry;
+}
+
+TEST(TabletStatisticsTest, findLoadMedian) {
+    // Uniform load: the middle of the tablet.
+    EXPECT_EQ(800U, TabletStatistics::findLoadMedian(
+        makeEntry(0, 1599, 100, vector<double>(16, 1.0))));
+
+    // Skewed load: half of it is in the first bucket.
+    vector<double> rates(16, 1.0);
+    rates[0] = 15;
+    EXPECT_EQ(100U, TabletStatistics::findLoadMedian(
+        makeEntry(0, 1599, 100, rates)));
+
+    // Interpolated within the bucket holding the median.
+    rates.assign(16, 0);
+    rates[2] = 4;
+    EXPECT_EQ(250U, TabletStatistics::findLoadMedian(
+        makeEntry(0, 1599, 100, rates)));
+
+    // Never so close to the edges that a half would be empty.
+    rates.assign(16, 0);
+    rates[15] = 1;
+    EXPECT_EQ(14U, TabletStatistics::findLoadMedian(
+        makeEntry(0, 15, 1, rates)));
+    rates.assign(16, 0);
+    rates[0] = 1;
+    EXPECT_EQ(2U, TabletStatistics::findLoadMedian(
+        makeEntry(0, 15, 1, rates)));
+}
+
+TEST(TabletStatisticsTest, findLoadMedian_lifetimeCounts) {
+    ProtoBuf::ServerStatistics::TabletEntry entry =
+        makeEntry(0, 1599, 100, vector<double>(16, 0));
+    entry.mutable_bucket(12)->set_accesses(10);
+    EXPECT_EQ(1250U, TabletStatistics::findLoadMedian(entry));
+}
+
+TEST(TabletStatisticsTest, findLoadMedian_unknown) {
+    // No histogram.
+    EXPECT_EQ(0U, TabletStatistics::findLoadMedian(
+        makeEntry(0, 1599, 100, vector<double>())));
+    // No load.
+    EXPECT_EQ(0U, TabletStatistics::findLoadMedian(
+        makeEntry(0, 1599, 100, vector<double>(16, 0))));
+    // Too small to split.
+    EXPECT_EQ(0U, TabletStatistics::findLoadMedian(
+        makeEntry(10, 12, 1, vector<double>(3, 1))));
+}
+
+TEST(TabletStatisticsTest, findLoadMedian_endToEnd) {
+    TabletStatistics stats(0, ~0UL);
+    for (int i = 0; i < 100; i++)
+        stats.recordRead(1UL << 40, 0);
+    stats.recordRead(~0UL, 0);
+    ProtoBuf::ServerStatistics::TabletEntry entry;
+    entry.set_table_id(0);
+    entry.set_start_key_hash(0);
+    entry.set_end_key_hash(~0UL);
+    stats.serialize(entry);
+    EXPECT_EQ(16, entry.bucket_size());
+    uint64_t median = TabletStatistics::findLoadMedian(entry);
+    EXPECT_LT(median, 1UL << 60);
+}
+
+}  // namespace RAMCloud
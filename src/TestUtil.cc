@@ -14,6 +14,7 @@
  */
 
 #include <string.h>
+#include <thread>
 #include "TestUtil.h"
 #include "Dispatch.h"
 #include "Rpc.h"
@@ -472,5 +473,31 @@ TestUtil::readFile(const char* path)
     return result;
 }
 
+/**
+ * Helper for #isLocked: try to acquire \a mutex and release it again.
+ */
+static void
+tryLock(std::mutex* mutex, bool* locked)
+{
+    *locked = !mutex->try_lock();
+    if (!*locked)
+        mutex->unlock();
+}
+
+/**
+ * Return whether some thread holds a mutex. The check is made from a
+ * thread of its own, since a std::mutex may not be tried by its owner.
+ *
+ * \param mutex
+ *      The mutex to check.
+ */
+bool
+TestUtil::isLocked(std::mutex& mutex)
+{
+    bool locked = false;
+    std::thread thread(tryLock, &mutex, &locked);
+    thread.join();
+    return locked;
+}
 
 } // namespace RAMCloud
@@ -23,6 +23,7 @@
 
 #include <gtest/gtest.h>
 #include <regex.h>
+#include <mutex>
 
 // Arrange for private and protected structure members to be public so they
 // can easily be accessed by gtest tests (see Common.h for details).
@@ -54,6 +55,7 @@ class TestUtil {
     static void fillRandom(void* buf, uint32_t size);
     static void fillLargeBuffer(Buffer* buffer, int size);
     static const char *getStatus(Buffer* buffer);
+    static bool isLocked(std::mutex& mutex);
     static ::testing::AssertionResult matchesPosixRegex(
             const string& pattern, const string& subject);
     static string readFile(const char* fileName);
@@ -47,20 +47,4 @@ ThreadId::assign()
     return id;
 }
 
-/**
- * Return a unique identifier associated with this thread.  The
- * return value has two properties:
- * - It will never be zero.
- * - It will be unique for this thread (i.e., no other thread has ever
- *   been returned this value or ever will be returned this value)
- */
-uint64_t
-ThreadId::get()
-{
-    if (id != 0) {
-        return id;
-    }
-    return assign();
-}
-
 } // namespace RAMCloud
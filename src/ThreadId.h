@@ -35,7 +35,24 @@ namespace RAMCloud {
  */
 class ThreadId {
   public:
-    static uint64_t get();
+    /**
+     * Return a unique identifier associated with this thread.  The
+     * return value has two properties:
+     * - It will never be zero.
+     * - It will be unique for this thread (i.e., no other thread has ever
+     *   been returned this value or ever will be returned this value)
+     *
+     * This is inline because it sits on fast paths such as the per-thread
+     * counters in TabletStatistics.
+     */
+    static uint64_t
+    get()
+    {
+        if (id != 0) {
+            return id;
+        }
+        return assign();
+    }
 
   PRIVATE:
     explicit ThreadId();
@@ -0,0 +1,100 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "Cycles.h"
+#include "TokenBucket.h"
+
+namespace RAMCloud {
+
+/**
+ * Construct a full bucket.
+ *
+ * \param rate
+ *      Tokens added per second. 0 means the rate is unlimited.
+ * \param burst
+ *      Maximum number of tokens that may accumulate while the bucket isn't
+ *      used.
+ */
+TokenBucket::TokenBucket(uint64_t rate, uint64_t burst)
+    : mutex()
+    , rate(rate)
+    , burst(burst)
+    , tokens(static_cast<double>(burst))
+    , lastRefill(Cycles::rdtsc())
+{
+}
+
+/**
+ * Change the number of tokens added per second. Any debt the bucket is
+ * in is forgiven, so that lifting a limit takes effect immediately.
+ *
+ * \param rate
+ *      Tokens added per second. 0 means the rate is unlimited.
+ */
+void
+TokenBucket::setRate(uint64_t rate)
+{
+    std::lock_guard<SpinLock> lock(mutex);
+    this->rate = rate;
+    if (tokens < 0)
+        tokens = 0;
+    lastRefill = Cycles::rdtsc();
+}
+
+/**
+ * Take tokens from the bucket, going into debt if there aren't enough.
+ *
+ * \param count
+ *      Number of tokens to take.
+ * \return
+ *      The number of cycles the caller should wait before going ahead:
+ *      0 if there were enough tokens, otherwise however long it takes to
+ *      pay off the debt.
+ */
+uint64_t
+TokenBucket::take(uint64_t count)
+{
+    std::lock_guard<SpinLock> lock(mutex);
+    if (rate == 0)
+        return 0;
+
+    uint64_t now = Cycles::rdtsc();
+    tokens += Cycles::toSeconds(now - lastRefill) * static_cast<double>(rate);
+    if (tokens > static_cast<double>(burst))
+        tokens = static_cast<double>(burst);
+    lastRefill = now;
+
+    tokens -= static_cast<double>(count);
+    if (tokens >= 0)
+        return 0;
+    return Cycles::fromSeconds(-tokens / static_cast<double>(rate));
+}
+
+/**
+ * Take tokens from the bucket and sleep until the caller may go ahead;
+ * see #take.
+ *
+ * \param count
+ *      Number of tokens to take.
+ */
+void
+TokenBucket::wait(uint64_t count)
+{
+    uint64_t delay = take(count);
+    if (delay != 0)
+        usleep(downCast<uint32_t>(Cycles::toNanoseconds(delay) / 1000));
+}
+
+} // namespace RAMCloud
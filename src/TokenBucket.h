@@ -0,0 +1,69 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUD_TOKENBUCKET_H
+#define RAMCLOUD_TOKENBUCKET_H
+
+#include "Common.h"
+#include "SpinLock.h"
+
+namespace RAMCloud {
+
+/**
+ * Limits the average rate of some activity, such as sending bytes, while
+ * letting it go ahead in bursts.
+ *
+ * Tokens accrue at #rate per second, up to #burst of them. Taking more
+ * tokens than are available puts the bucket into debt, and the caller is
+ * told how long it has to wait for the debt to be paid off. Requests larger
+ * than the burst size (a whole migration segment, say) thus still proceed
+ * at the configured average rate.
+ *
+ * This class is thread-safe.
+ */
+class TokenBucket {
+  public:
+    TokenBucket(uint64_t rate, uint64_t burst);
+    void setRate(uint64_t rate);
+
+    /// Return the number of tokens added per second; 0 means unlimited.
+    uint64_t getRate() const { return rate; }
+
+    uint64_t take(uint64_t count);
+    void wait(uint64_t count);
+
+  PRIVATE:
+    /// Serializes #take.
+    SpinLock mutex;
+
+    /// Tokens added per second. 0 means the rate is unlimited and the
+    /// bucket never makes anyone wait.
+    uint64_t rate;
+
+    /// Tokens never accumulate beyond this.
+    uint64_t burst;
+
+    /// Tokens currently available; negative while the bucket is in debt.
+    double tokens;
+
+    /// Cycles::rdtsc() when #tokens was last brought up to date.
+    uint64_t lastRefill;
+
+    DISALLOW_COPY_AND_ASSIGN(TokenBucket);
+};
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUD_TOKENBUCKET_H
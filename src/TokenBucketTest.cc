@@ -0,0 +1,86 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "TestUtil.h"
+#include "Cycles.h"
+#include "TokenBucket.h"
+
+namespace RAMCloud {
+
+class TokenBucketTest : public ::testing::Test {
+  public:
+    TokenBucketTest()
+    {
+        Cycles::mockTscValue = 1000;
+    }
+
+    ~TokenBucketTest()
+    {
+        Cycles::mockTscValue = 0;
+    }
+
+    DISALLOW_COPY_AND_ASSIGN(TokenBucketTest);
+};
+
+TEST_F(TokenBucketTest, take_unlimited) {
+    TokenBucket bucket(0, 100);
+    EXPECT_EQ(0U, bucket.take(1000000));
+    EXPECT_EQ(0U, bucket.take(1000000));
+}
+
+TEST_F(TokenBucketTest, take_burst) {
+    TokenBucket bucket(1000, 100);
+    EXPECT_EQ(0U, bucket.take(60));
+    EXPECT_EQ(0U, bucket.take(40));
+
+    // The bucket is empty now; 50 tokens take 50 ms to come in.
+    EXPECT_NEAR(0.050, Cycles::toSeconds(bucket.take(50)), 1e-6);
+}
+
+TEST_F(TokenBucketTest, take_refill) {
+    TokenBucket bucket(1000, 100);
+    EXPECT_EQ(0U, bucket.take(100));
+    Cycles::mockTscValue += Cycles::fromSeconds(0.020);
+    EXPECT_EQ(0U, bucket.take(20));
+    EXPECT_NEAR(0.010, Cycles::toSeconds(bucket.take(10)), 1e-6);
+
+    // Idle time doesn't accumulate beyond the burst size.
+    Cycles::mockTscValue += Cycles::fromSeconds(10.0);
+    EXPECT_EQ(0U, bucket.take(100));
+    EXPECT_NE(0U, bucket.take(1));
+}
+
+TEST_F(TokenBucketTest, take_largerThanBurst) {
+    TokenBucket bucket(1000, 100);
+    EXPECT_NEAR(0.900, Cycles::toSeconds(bucket.take(1000)), 1e-6);
+
+    // The debt has to be paid off before anything else goes ahead.
+    Cycles::mockTscValue += Cycles::fromSeconds(0.500);
+    EXPECT_NEAR(0.410, Cycles::toSeconds(bucket.take(10)), 1e-6);
+}
+
+TEST_F(TokenBucketTest, setRate) {
+    TokenBucket bucket(1000, 100);
+    EXPECT_NE(0U, bucket.take(1000));
+    bucket.setRate(0);
+    EXPECT_EQ(0U, bucket.getRate());
+    EXPECT_EQ(0U, bucket.take(1000));
+
+    // Setting a limit again doesn't resurrect the old debt.
+    bucket.setRate(2000);
+    EXPECT_NEAR(0.005, Cycles::toSeconds(bucket.take(10)), 1e-6);
+}
+
+}  // namespace RAMCloud